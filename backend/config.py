@@ -13,6 +13,8 @@ class Settings(BaseSettings):
     host: str = "127.0.0.1"
     port: int = 8009
     voice_grpc_addr: str = "127.0.0.1:50051"
+    # Shared-memory status page of a voice service on the same host; empty = status over gRPC.
+    voice_status_page: str = ""
     
     cookie_key: str = "dev-cookie-key"
     netease_api_base: str = "http://47.113.188.213:3000/"
@@ -2,6 +2,7 @@ from __future__ import annotations
 
 import asyncio
 from collections import deque
+import dataclasses
 import hashlib
 import os
 import time
@@ -113,6 +114,10 @@ class TSClientDescriptionRequest(BaseModel):
     description: str
 
 
+class RecordingStartRequest(BaseModel):
+    name: str = ""
+
+
 @app.on_event("startup")
 async def _startup() -> None:
     global _chat_task
@@ -349,10 +354,12 @@ async def _play_queue_item_internal(item_id: int, *, requested_by: str) -> bool:
         album = str(item.album or "")
         artwork_url = str(item.cover_url or "")
         source_url = str(item.source_url or "")
+        # Only full tracks may be cached by the voice service; a trial clip must not stand in for the song.
+        cache_key = ""
         if item.track_id.startswith("netease:"):
             cookie = _get_admin_cookie(session)
             song_id = item.track_id.split(":", 1)[1]
-            source_url, _trial, notice, duration_ms, artist, album, artwork_url = await _resolve_netease_playback_payload(
+            source_url, trial, notice, duration_ms, artist, album, artwork_url = await _resolve_netease_playback_payload(
                 song_id=song_id,
                 cookie=cookie,
                 artist=artist,
@@ -360,6 +367,8 @@ async def _play_queue_item_internal(item_id: int, *, requested_by: str) -> bool:
                 artwork_url=artwork_url,
                 duration_ms=duration_ms,
             )
+            if not trial:
+                cache_key = item.track_id
 
             item.source_url = source_url
             item.album = album
@@ -381,7 +390,9 @@ async def _play_queue_item_internal(item_id: int, *, requested_by: str) -> bool:
             album=album,
             artwork_url=artwork_url,
         )
-        await voice.play(source_url=item.source_url, title=item.title, requested_by=requested_by, notice=notice)
+        await voice.play(
+            source_url=item.source_url, title=item.title, requested_by=requested_by, notice=notice, cache_key=cache_key
+        )
 
         hist = HistoryItem(
             track_id=item.track_id,
@@ -488,7 +499,7 @@ async def _auto_play_next_from_queue(*, start_after_id: int | None = None) -> No
 
 @app.get("/voice/status")
 async def voice_status() -> dict:
-    st = await voice.get_status()
+    st = await voice.get_live_status()
 
     state_map = {
         "STATE_IDLE": "idle",
@@ -502,6 +513,7 @@ async def voice_status() -> dict:
 
     async with _playback_lock:
         qid = _current_queue_item_id
+        source_url = _current_source_url
         started_at = _play_started_at
         paused_at = _paused_at
         paused_total_s = _paused_total_s
@@ -543,7 +555,7 @@ async def voice_status() -> dict:
     return {
         "state": state,
         "now_playing_title": st.now_playing_title,
-        "now_playing_source_url": st.now_playing_source_url,
+        "now_playing_source_url": st.now_playing_source_url or source_url,
         "now_playing_artist": now_playing_artist,
         "now_playing_album": now_playing_album,
         "artwork_url": artwork_url,
@@ -551,6 +563,7 @@ async def voice_status() -> dict:
         "current_time": current_time_s,
         "duration": (duration_ms / 1000.0) if duration_ms > 0 else 0.0,
         "volume_percent": st.volume_percent,
+        "voice_online": st.online,
         "is_shuffled": _shuffle_enabled,
         "repeat_mode": _repeat_mode,
     }
@@ -593,14 +606,13 @@ async def get_voice_fx() -> dict:
 
 @app.put("/voice/fx")
 async def set_voice_fx(req: AudioFxUpdateRequest) -> dict:
-    await voice.set_audio_fx(
+    fx = await voice.update_audio_fx(
         pan=req.pan,
         width=req.width,
         swap_lr=req.swap_lr,
         bass_db=req.bass_db,
         reverb_mix=req.reverb_mix,
     )
-    fx = await voice.get_audio_fx()
     return {
         "ok": True,
         "pan": fx.pan,
@@ -1891,6 +1903,22 @@ async def admin_ts_description(req: TSClientDescriptionRequest, request: Request
     return {"ok": True}
 
 
+@app.post("/admin/voice/recording/start")
+async def admin_voice_recording_start(req: RecordingStartRequest, request: Request) -> dict:
+    _require_admin_token(request)
+    rec = await voice.start_recording((req.name or "").strip())
+    if not rec.ok:
+        raise HTTPException(status_code=409, detail=rec.message)
+    return dataclasses.asdict(rec)
+
+
+@app.post("/admin/voice/recording/stop")
+async def admin_voice_recording_stop(request: Request) -> dict:
+    _require_admin_token(request)
+    rec = await voice.stop_recording()
+    return dataclasses.asdict(rec)
+
+
 @app.get("/admin/debug/cookie")
 async def admin_debug_cookie(request: Request, session: Session = Depends(get_session)) -> dict:
     _require_admin_token(request)
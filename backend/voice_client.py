@@ -10,6 +10,7 @@ import grpc
 
 from .config import settings
 from .grpc_codegen import ensure_voice_stubs
+from .voice_status_page import StatusPage
 
 
 @dataclass
@@ -18,6 +19,8 @@ class VoiceStatus:
     now_playing_title: str
     now_playing_source_url: str
     volume_percent: int
+    # False while the bot is not connected to the TS3 server.
+    online: bool = True
 
 
 @dataclass
@@ -29,12 +32,36 @@ class VoiceAudioFx:
     reverb_mix: float
 
 
+@dataclass
+class VoiceSnapshot:
+    status: VoiceStatus
+    fx: VoiceAudioFx
+    position_ms: int
+    duration_ms: int
+
+
+@dataclass
+class VoiceRecording:
+    ok: bool
+    message: str
+    recording: bool
+    path: str
+    frames_written: int
+    frames_dropped: int
+    files: int
+
+
 class VoiceClient:
     def __init__(self) -> None:
         self._channel: grpc.aio.Channel | None = None
         self._stub = None
         self._pb2 = None
         self._pb2_grpc = None
+        self._status_page = StatusPage(settings.voice_status_page) if settings.voice_status_page else None
+        # Set once GetSnapshot or Batch came back UNIMPLEMENTED (the Rust service); the unary calls
+        # stand in for them from then on.
+        self._no_snapshot = False
+        self._no_batch = False
 
     def _get_stub(self):
         if self._stub is not None:
@@ -54,12 +81,16 @@ class VoiceClient:
         return self._stub
 
     async def close(self) -> None:
+        if self._status_page is not None:
+            self._status_page.close()
         if self._channel is not None:
             await self._channel.close()
             self._channel = None
             self._stub = None
             self._pb2 = None
             self._pb2_grpc = None
+            self._no_snapshot = False
+            self._no_batch = False
 
     async def ping(self) -> str:
         stub = self._get_stub()
@@ -67,13 +98,33 @@ class VoiceClient:
         resp = await stub.Ping(self._pb2.Empty())
         return resp.version
 
-    async def play(self, source_url: str, title: str, requested_by: str, notice: str = "") -> None:
+    async def play(
+        self, source_url: str, title: str, requested_by: str, notice: str = "", *, cache_key: str = ""
+    ) -> None:
         stub = self._get_stub()
         assert self._pb2 is not None
         await stub.Play(
-            self._pb2.PlayRequest(source_url=source_url, title=title, requested_by=requested_by, notice=notice)
+            self._pb2.PlayRequest(
+                source_url=source_url, title=title, requested_by=requested_by, notice=notice, cache_key=cache_key
+            )
         )
 
+    async def play_next(
+        self, source_url: str, title: str, requested_by: str, *, crossfade_ms: int = 0, cache_key: str = ""
+    ) -> bool:
+        stub = self._get_stub()
+        assert self._pb2 is not None
+        resp = await stub.PlayNext(
+            self._pb2.PlayNextRequest(
+                source_url=source_url,
+                title=title,
+                requested_by=requested_by,
+                crossfade_ms=max(0, int(crossfade_ms)),
+                cache_key=cache_key,
+            )
+        )
+        return resp.message == "queued"
+
     async def pause(self) -> None:
         stub = self._get_stub()
         assert self._pb2 is not None
@@ -94,6 +145,12 @@ class VoiceClient:
         assert self._pb2 is not None
         await stub.Skip(self._pb2.Empty())
 
+    async def seek(self, position_ms: int) -> bool:
+        stub = self._get_stub()
+        assert self._pb2 is not None
+        resp = await stub.Seek(self._pb2.SeekRequest(position_ms=max(0, int(position_ms))))
+        return bool(resp.ok)
+
     async def send_notice(self, message: str, *, target_mode: int = 2) -> None:
         stub = self._get_stub()
         assert self._pb2 is not None
@@ -131,6 +188,35 @@ class VoiceClient:
     ) -> None:
         stub = self._get_stub()
         assert self._pb2 is not None
+        await stub.SetAudioFx(
+            self._audio_fx_request(pan=pan, width=width, swap_lr=swap_lr, bass_db=bass_db, reverb_mix=reverb_mix)
+        )
+
+    async def update_audio_fx(
+        self,
+        *,
+        pan: float | None = None,
+        width: float | None = None,
+        swap_lr: bool | None = None,
+        bass_db: float | None = None,
+        reverb_mix: float | None = None,
+    ) -> VoiceAudioFx:
+        """set_audio_fx and get_audio_fx in one round-trip."""
+        req = self._audio_fx_request(pan=pan, width=width, swap_lr=swap_lr, bass_db=bass_db, reverb_mix=reverb_mix)
+        snap = await self.batch([self._pb2.BatchCommand(set_audio_fx=req)])
+        return snap.fx
+
+    def _audio_fx_request(
+        self,
+        *,
+        pan: float | None,
+        width: float | None,
+        swap_lr: bool | None,
+        bass_db: float | None,
+        reverb_mix: float | None,
+    ):
+        self._get_stub()
+        assert self._pb2 is not None
         req = self._pb2.SetAudioFxRequest()
         if pan is not None:
             req.pan = float(pan)
@@ -142,12 +228,143 @@ class VoiceClient:
             req.bass_db = float(bass_db)
         if reverb_mix is not None:
             req.reverb_mix = float(reverb_mix)
-        await stub.SetAudioFx(req)
+        return req
+
+    async def set_encoder(
+        self,
+        *,
+        adaptive: bool | None = None,
+        max_bitrate_kbps: int | None = None,
+        min_bitrate_kbps: int | None = None,
+        max_complexity: int | None = None,
+        min_complexity: int | None = None,
+        fec: bool | None = None,
+    ) -> None:
+        stub = self._get_stub()
+        assert self._pb2 is not None
+        req = self._pb2.SetEncoderRequest()
+        if adaptive is not None:
+            req.adaptive = bool(adaptive)
+        if max_bitrate_kbps is not None:
+            req.max_bitrate_kbps = max(0, int(max_bitrate_kbps))
+        if min_bitrate_kbps is not None:
+            req.min_bitrate_kbps = max(0, int(min_bitrate_kbps))
+        if max_complexity is not None:
+            req.max_complexity = max(0, int(max_complexity))
+        if min_complexity is not None:
+            req.min_complexity = max(0, int(min_complexity))
+        if fec is not None:
+            req.fec = bool(fec)
+        await stub.SetEncoder(req)
 
     async def get_audio_fx(self) -> VoiceAudioFx:
         stub = self._get_stub()
         assert self._pb2 is not None
         resp = await stub.GetAudioFx(self._pb2.Empty())
+        return self._audio_fx(resp)
+
+    async def get_live_status(self) -> VoiceStatus:
+        """Status for frequent polling: from the shared-memory page when one is set up, else get_snapshot()."""
+        if self._status_page is not None:
+            page = self._status_page.read()
+            if page is not None:
+                return VoiceStatus(
+                    state=page["state"],
+                    now_playing_title=page["now_playing_title"],
+                    # Not on the page; the caller knows what it asked to play.
+                    now_playing_source_url="",
+                    volume_percent=page["volume_percent"],
+                    online=page["online"],
+                )
+        return (await self.get_snapshot()).status
+
+    async def get_snapshot(self) -> VoiceSnapshot:
+        """Status, FX and connection state in one call.
+
+        Services without GetSnapshot get GetStatus and GetAudioFx instead; they report no
+        connection state or position, so the bot counts as online and position and duration as 0.
+        """
+        stub = self._get_stub()
+        assert self._pb2 is not None
+        if not self._no_snapshot:
+            try:
+                resp = await stub.GetSnapshot(self._pb2.SnapshotRequest())
+                return self._snapshot(resp)
+            except grpc.aio.AioRpcError as e:
+                if e.code() != grpc.StatusCode.UNIMPLEMENTED:
+                    raise
+                self._no_snapshot = True
+        status = await self.get_status()
+        fx = await self.get_audio_fx()
+        return VoiceSnapshot(status=status, fx=fx, position_ms=0, duration_ms=0)
+
+    async def batch(self, commands: list) -> VoiceSnapshot:
+        """Runs BatchCommand messages in order, with no other command in between; returns the state after them.
+
+        Services without Batch get the commands one unary call each, so other commands may run in
+        between there.
+        """
+        stub = self._get_stub()
+        assert self._pb2 is not None
+        if not self._no_batch:
+            try:
+                resp = await stub.Batch(self._pb2.BatchRequest(commands=commands))
+                return self._snapshot(resp.snapshot)
+            except grpc.aio.AioRpcError as e:
+                if e.code() != grpc.StatusCode.UNIMPLEMENTED:
+                    raise
+                self._no_batch = True
+        for command in commands:
+            await self._unary_command(stub, command)
+        return await self.get_snapshot()
+
+    # BatchCommand oneof field -> the unary RPC that does the same.
+    _BATCH_RPCS = {
+        "play": "Play",
+        "play_next": "PlayNext",
+        "pause": "Pause",
+        "resume": "Resume",
+        "stop": "Stop",
+        "skip": "Skip",
+        "seek": "Seek",
+        "set_volume": "SetVolume",
+        "set_audio_fx": "SetAudioFx",
+        "set_encoder": "SetEncoder",
+    }
+
+    async def _unary_command(self, stub, command) -> None:
+        field = command.WhichOneof("command")
+        if field is None:
+            return
+        await getattr(stub, self._BATCH_RPCS[field])(getattr(command, field))
+
+    async def start_recording(self, name: str = "") -> VoiceRecording:
+        """Records what the bot sends into Ogg Opus files on the voice service's host."""
+        stub = self._get_stub()
+        assert self._pb2 is not None
+        resp = await stub.StartRecording(self._pb2.StartRecordingRequest(name=name))
+        return self._recording(resp)
+
+    async def stop_recording(self) -> VoiceRecording:
+        stub = self._get_stub()
+        assert self._pb2 is not None
+        resp = await stub.StopRecording(self._pb2.Empty())
+        return self._recording(resp)
+
+    @staticmethod
+    def _recording(resp) -> VoiceRecording:
+        return VoiceRecording(
+            ok=bool(resp.ok),
+            message=resp.message,
+            recording=bool(resp.recording),
+            path=resp.path,
+            frames_written=int(resp.frames_written),
+            frames_dropped=int(resp.frames_dropped),
+            files=int(resp.files),
+        )
+
+    @staticmethod
+    def _audio_fx(resp) -> VoiceAudioFx:
         return VoiceAudioFx(
             pan=float(getattr(resp, "pan", 0.0) or 0.0),
             width=float(getattr(resp, "width", 1.0) or 1.0),
@@ -156,12 +373,29 @@ class VoiceClient:
             reverb_mix=float(getattr(resp, "reverb_mix", 0.0) or 0.0),
         )
 
+    @classmethod
+    def _snapshot(cls, resp) -> VoiceSnapshot:
+        st = resp.status
+        return VoiceSnapshot(
+            status=VoiceStatus(
+                state=st.State.Name(st.state),
+                now_playing_title=st.now_playing_title,
+                now_playing_source_url=st.now_playing_source_url,
+                volume_percent=st.volume_percent,
+                online=bool(resp.connection.online),
+            ),
+            fx=cls._audio_fx(resp.fx),
+            position_ms=int(st.position_ms),
+            duration_ms=int(st.duration_ms),
+        )
+
     async def subscribe_events(
         self,
         *,
         include_chat: bool = True,
         include_playback: bool = False,
         include_log: bool = False,
+        include_talk: bool = False,
     ) -> AsyncIterator[object]:
         stub = self._get_stub()
         assert self._pb2 is not None
@@ -169,6 +403,7 @@ class VoiceClient:
             include_chat=include_chat,
             include_playback=include_playback,
             include_log=include_log,
+            include_talk=include_talk,
         )
         async for ev in stub.SubscribeEvents(req):
             yield ev
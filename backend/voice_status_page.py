@@ -0,0 +1,91 @@
+from __future__ import annotations
+
+import mmap
+import os
+import struct
+import time
+
+# Layout written by voice-service/src/status_page.h.
+_MAGIC = b"TSBSTAT1"
+_HEADER = struct.Struct("<8sIIII")
+_ENTRY = struct.Struct("<32sqIiIIII128s")
+_SEQ = struct.Struct("<I")
+_ENTRY_OFFSET = 8
+_STALE_MS = 2000
+_MAX_RETRIES = 100
+
+_STATES = {1: "STATE_IDLE", 2: "STATE_PLAYING", 3: "STATE_PAUSED"}
+
+
+class StatusPage:
+    """Reads the voice service's shared-memory status page (TSBOT_VOICE_STATUS_PAGE) without an RPC.
+
+    read() returns None whenever the page cannot be trusted (missing, not written for a while, or
+    replaced by a restarted service), and the caller falls back to GetSnapshot.
+    """
+
+    def __init__(self, path: str) -> None:
+        self._path = path
+        self._map: mmap.mmap | None = None
+
+    def close(self) -> None:
+        if self._map is not None:
+            self._map.close()
+            self._map = None
+
+    def read(self, bot_index: int = 0) -> dict | None:
+        m = self._mapping()
+        if m is None:
+            return None
+        _, bots, slot_bytes, header_bytes, _ = _HEADER.unpack_from(m, 0)
+        if bot_index >= bots:
+            return None
+        off = header_bytes + bot_index * slot_bytes
+        for _ in range(_MAX_RETRIES):
+            (before,) = _SEQ.unpack_from(m, off)
+            if before & 1:
+                continue
+            raw = m[off + _ENTRY_OFFSET : off + _ENTRY_OFFSET + _ENTRY.size]
+            (after,) = _SEQ.unpack_from(m, off)
+            if after == before:
+                break
+        else:
+            return None
+
+        bot, updated_ms, state, volume, position_ms, duration_ms, online, track_changes, title = _ENTRY.unpack(raw)
+        if time.time() * 1000 - updated_ms > _STALE_MS:
+            # A restarted service renames a fresh page over the path; map that one next time.
+            self.close()
+            return None
+        return {
+            "bot": bot.rstrip(b"\0").decode("utf-8", "replace"),
+            "state": _STATES.get(state, "STATE_UNSPECIFIED"),
+            "volume_percent": volume,
+            "position_ms": position_ms,
+            "duration_ms": duration_ms,
+            "online": bool(online),
+            "track_changes": track_changes,
+            "now_playing_title": title.rstrip(b"\0").decode("utf-8", "replace"),
+        }
+
+    def _mapping(self) -> mmap.mmap | None:
+        if self._map is not None:
+            return self._map
+        try:
+            fd = os.open(self._path, os.O_RDONLY)
+        except OSError:
+            return None
+        try:
+            size = os.fstat(fd).st_size
+            if size < _HEADER.size:
+                return None
+            m = mmap.mmap(fd, size, access=mmap.ACCESS_READ)
+        except (OSError, ValueError):
+            return None
+        finally:
+            os.close(fd)
+        if _HEADER.unpack_from(m, 0)[0] != _MAGIC:
+            m.close()
+            return None
+        self._map = m
+        return m
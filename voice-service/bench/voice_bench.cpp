@@ -0,0 +1,403 @@
+// Offline benchmark of the voice pipeline: decode -> DSP -> Opus encode -> packetize, driven from
+// files as fast as the CPU allows, with no TS3 server, gRPC or send clock involved.
+//
+//   voice-bench [--frames N] [--threads N] [--fx off|bass|reverb|all] [--pcm]
+//               [--bitrate KBPS] [--complexity 0..10] [FILE...]
+//
+// Each thread runs its own pipeline (one bot with its own decoder) on FILE number (thread % count);
+// a file that ends is reopened, so any length of input works. Without files a generated tone feeds
+// the DSP and the decode stage is skipped. --pcm stops after the DSP, like the TS3 SDK sink, which
+// encodes with the channel codec itself. TSBOT_VOICE_DSP picks the DSP kernels as in the service.
+//
+// Reports per stage ns/frame (mean, p50, p99, max) and operator new calls per frame (see
+// alloc_counter.h; libav allocates through av_malloc and is not counted), then frames/sec on one
+// core and how many bots one core fits in the 20 ms frame budget, with a decoder each and with one
+// decoder shared by every bot (the engine's shared decode). Lines are key=value like the service's
+// own log, for scripts that compare runs.
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <numbers>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "alloc_counter.h"
+#include "audio_format.h"
+#include "dsp.h"
+#include "histogram.h"
+#include "opus_encoder.h"
+#include "pcm_decoder.h"
+#include "voice_sink.h"
+
+namespace voice = tsbot::voice;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr int kWarmupFrames = 50;  // fade-in, encoder start-up and first-touch page faults
+constexpr double kFrameBudgetNs = voice::kFrameMs * 1e6;
+
+enum Stage { kDecode, kDsp, kEncode, kPacketize, kStages };
+constexpr const char* kStageNames[kStages] = {"decode", "dsp", "encode", "packetize"};
+
+struct Options {
+  int frames = 3000;  // one minute of audio per thread
+  int threads = 1;
+  std::string fx = "all";
+  bool encode = true;
+  int bitrate_kbps = 0;
+  int complexity = 10;
+  std::vector<std::string> files;
+};
+
+// What the transport does with each frame. For Opus: the body of a TS3 client voice packet, packet
+// id (u16, big-endian), codec id, then the payload, built in one reusable buffer. For PCM: the copy
+// the SDK's custom capture device makes.
+class PacketSink final : public voice::VoiceSink {
+ public:
+  explicit PacketSink(bool opus) : opus_(opus) {}
+
+  bool wants_opus() const override { return opus_; }
+  void send_frame(const voice::OutFrame& f) override {
+    if (opus_) {
+      packet_[0] = static_cast<uint8_t>(id_ >> 8);
+      packet_[1] = static_cast<uint8_t>(id_);
+      packet_[2] = kCodecOpusMusic;
+      std::memcpy(packet_.data() + kHeader, f.opus, f.opus_len);
+      bytes_ += kHeader + f.opus_len;
+    } else {
+      std::memcpy(pcm_.data(), f.pcm, voice::kFrameBytes);
+      bytes_ += voice::kFrameBytes;
+    }
+    ++id_;
+  }
+  void end_of_stream() override {}
+
+  uint64_t bytes() const { return bytes_; }
+
+ private:
+  static constexpr std::size_t kHeader = 3;
+  static constexpr uint8_t kCodecOpusMusic = 5;
+
+  const bool opus_;
+  uint16_t id_ = 0;
+  uint64_t bytes_ = 0;
+  std::array<uint8_t, kHeader + voice::kMaxOpusPacket> packet_{};
+  voice::PcmFrame pcm_{};
+};
+
+struct StageStats {
+  voice::Histogram ns;
+  uint64_t allocs = 0;
+};
+
+struct RunResult {
+  std::string error;
+  int frames = 0;
+  uint64_t opens = 0;
+  uint64_t open_ns = 0;
+  uint64_t payload_bytes = 0;
+  double wall_s = 0.0;
+  StageStats stages[kStages];
+  voice::Histogram total_ns;
+};
+
+voice::FxSettings fx_preset(const std::string& name, bool* ok) {
+  voice::FxSettings fx;
+  *ok = true;
+  if (name == "off") {
+    // Defaults; the engine would bypass the chain here, the benchmark still runs it.
+  } else if (name == "bass") {
+    fx.bass_db = 6.0f;
+  } else if (name == "reverb") {
+    fx.reverb_mix = 0.3f;
+  } else if (name == "all") {
+    fx.volume_percent = 80;
+    fx.pan = 0.2f;
+    fx.width = 1.5f;
+    fx.bass_db = 6.0f;
+    fx.reverb_mix = 0.3f;
+  } else {
+    *ok = false;
+  }
+  return fx;
+}
+
+// One second of a two-tone test signal, for runs without input files.
+std::vector<int16_t> make_tone() {
+  std::vector<int16_t> tone(static_cast<std::size_t>(voice::kSampleRate) * voice::kChannels);
+  constexpr double kTwoPi = 2 * std::numbers::pi;
+  for (int i = 0; i < voice::kSampleRate; ++i) {
+    const double t = kTwoPi * i / voice::kSampleRate;
+    const double l = 0.4 * std::sin(440.0 * t) + 0.1 * std::sin(3000.0 * t);
+    const double r = 0.4 * std::sin(660.0 * t) + 0.1 * std::sin(5000.0 * t);
+    tone[2 * i] = static_cast<int16_t>(l * 32767.0);
+    tone[2 * i + 1] = static_cast<int16_t>(r * 32767.0);
+  }
+  return tone;
+}
+
+uint64_t ns_between(Clock::time_point a, Clock::time_point b) {
+  return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(b - a).count());
+}
+
+bool open_source(voice::PcmDecoder& dec, const std::string& file, RunResult& r) {
+  const auto t0 = Clock::now();
+  dec.close();
+  std::string err;
+  if (!dec.open(file, nullptr, false, &err)) {
+    r.error = file + ": " + err;
+    return false;
+  }
+  r.open_ns += ns_between(t0, Clock::now());
+  ++r.opens;
+  return true;
+}
+
+void run_pipeline(const Options& opt, const std::string* file, const voice::FxSettings& fx, RunResult& r) {
+  voice::PcmDecoder dec;
+  if (file && !open_source(dec, *file, r)) return;
+  const std::vector<int16_t> tone = file ? std::vector<int16_t>{} : make_tone();
+  std::size_t tone_pos = 0;
+
+  voice::DspChain dsp;
+  dsp.set_settings(fx);
+  voice::OpusFrameEncoder enc;
+  if (opt.encode) {
+    voice::OpusEncoderSettings es;
+    es.bitrate_bps = opt.bitrate_kbps * 1000;
+    es.complexity = opt.complexity;
+    enc.apply(es);
+    if (std::string err; !enc.init(&err)) {
+      r.error = "opus encoder: " + err;
+      return;
+    }
+  }
+  PacketSink sink(opt.encode);
+
+  voice::PcmFrame in{};
+  voice::PcmFrame out{};
+  alignas(32) std::array<float, voice::kFrameSamples> f32{};
+  std::array<uint8_t, voice::kMaxOpusPacket> opus{};
+
+  const auto started = Clock::now();
+  for (int i = 0; i < kWarmupFrames + opt.frames; ++i) {
+    const bool measured = i >= kWarmupFrames;
+    Clock::time_point t[kStages + 1];
+    uint64_t a[kStages + 1];
+    a[kDecode] = voice::thread_allocations();
+    t[kDecode] = Clock::now();
+
+    if (file) {
+      auto res = dec.read_frame(in.data());
+      if (res == voice::PcmDecoder::ReadResult::kEof) {
+        // Reopening is not decode work; it is reported on its own line.
+        if (!open_source(dec, *file, r)) return;
+        a[kDecode] = voice::thread_allocations();
+        t[kDecode] = Clock::now();
+        res = dec.read_frame(in.data());
+      }
+      if (res != voice::PcmDecoder::ReadResult::kOk) {
+        r.error = *file + ": " + (dec.last_error().empty() ? "decoder produced no audio" : dec.last_error());
+        return;
+      }
+    } else {
+      std::memcpy(in.data(), tone.data() + tone_pos, voice::kFrameBytes);
+      tone_pos = (tone_pos + voice::kFrameSamples) % tone.size();
+    }
+    a[kDsp] = voice::thread_allocations();
+    t[kDsp] = Clock::now();
+
+    dsp.process(in.data(), out.data(), opt.encode ? f32.data() : nullptr, true);
+    a[kEncode] = voice::thread_allocations();
+    t[kEncode] = Clock::now();
+
+    voice::OutFrame frame;
+    frame.pcm = out.data();
+    if (opt.encode) {
+      const int len = enc.encode(f32.data(), opus.data());
+      if (len < 0) {
+        r.error = "opus encode failed";
+        return;
+      }
+      frame.opus = opus.data();
+      frame.opus_len = static_cast<std::size_t>(len);
+    }
+    a[kPacketize] = voice::thread_allocations();
+    t[kPacketize] = Clock::now();
+
+    sink.send_frame(frame);
+    a[kStages] = voice::thread_allocations();
+    t[kStages] = Clock::now();
+
+    if (!measured) continue;
+    for (int s = 0; s < kStages; ++s) {
+      if ((s == kDecode && !file) || (s == kEncode && !opt.encode)) continue;
+      r.stages[s].ns.record(ns_between(t[s], t[s + 1]));
+      r.stages[s].allocs += a[s + 1] - a[s];
+    }
+    r.total_ns.record(ns_between(file ? t[kDecode] : t[kDsp], t[kStages]));
+    ++r.frames;
+  }
+  r.wall_s = std::chrono::duration<double>(Clock::now() - started).count();
+  r.payload_bytes = sink.bytes();
+}
+
+// Histograms of every thread added up.
+voice::Histogram::Snapshot merged(const std::vector<RunResult>& runs, const voice::Histogram RunResult::*total,
+                                  int stage) {
+  voice::Histogram::Snapshot m;
+  for (const RunResult& r : runs) {
+    const voice::Histogram::Snapshot s = stage < 0 ? (r.*total).snapshot() : r.stages[stage].ns.snapshot();
+    m.count += s.count;
+    m.sum += s.sum;
+    m.max = std::max(m.max, s.max);
+    for (std::size_t i = 0; i < s.buckets.size(); ++i) m.buckets[i] += s.buckets[i];
+  }
+  return m;
+}
+
+double mean(const voice::Histogram::Snapshot& s) {
+  return s.count ? static_cast<double>(s.sum) / static_cast<double>(s.count) : 0.0;
+}
+
+void print_stage(const char* name, const voice::Histogram::Snapshot& s, double allocs_per_frame) {
+  std::printf("stage=%-9s mean_ns=%.0f p50_ns=%llu p99_ns=%llu max_ns=%llu allocs_per_frame=%.3f\n", name, mean(s),
+              static_cast<unsigned long long>(s.percentile(0.5)), static_cast<unsigned long long>(s.percentile(0.99)),
+              static_cast<unsigned long long>(s.max), allocs_per_frame);
+}
+
+bool parse_int(std::string_view arg, const char* value, int lo, int hi, int* out) {
+  if (!value) {
+    std::cerr << "voice-bench: " << arg << " needs a value\n";
+    return false;
+  }
+  char* end = nullptr;
+  const long v = std::strtol(value, &end, 10);
+  if (*value == '\0' || *end != '\0' || v < lo || v > hi) {
+    std::cerr << "voice-bench: " << arg << " must be " << lo << " .. " << hi << "\n";
+    return false;
+  }
+  *out = static_cast<int>(v);
+  return true;
+}
+
+int usage() {
+  std::cerr << "usage: voice-bench [--frames N] [--threads N] [--fx off|bass|reverb|all] [--pcm]\n"
+               "                   [--bitrate KBPS] [--complexity 0..10] [FILE...]\n";
+  return 2;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  Options opt;
+  for (int i = 1; i < argc; ++i) {
+    const std::string_view arg = argv[i];
+    const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+    bool ok = true;
+    if (arg == "--frames") {
+      ok = parse_int(arg, value, 1, 10'000'000, &opt.frames);
+      ++i;
+    } else if (arg == "--threads") {
+      ok = parse_int(arg, value, 1, 1024, &opt.threads);
+      ++i;
+    } else if (arg == "--bitrate") {
+      ok = parse_int(arg, value, 6, 510, &opt.bitrate_kbps);
+      ++i;
+    } else if (arg == "--complexity") {
+      ok = parse_int(arg, value, 0, 10, &opt.complexity);
+      ++i;
+    } else if (arg == "--fx") {
+      if (!value) return usage();
+      opt.fx = value;
+      ++i;
+    } else if (arg == "--pcm") {
+      opt.encode = false;
+    } else if (arg == "-h" || arg == "--help" || (arg.size() > 1 && arg[0] == '-')) {
+      return usage();
+    } else {
+      opt.files.emplace_back(arg);
+    }
+    if (!ok) return 2;
+  }
+  bool fx_ok = false;
+  const voice::FxSettings fx = fx_preset(opt.fx, &fx_ok);
+  if (!fx_ok) {
+    std::cerr << "voice-bench: unknown --fx preset " << opt.fx << "\n";
+    return 2;
+  }
+
+  std::vector<RunResult> runs(static_cast<std::size_t>(opt.threads));
+  {
+    std::vector<std::thread> threads;
+    for (std::size_t t = 0; t < runs.size(); ++t) {
+      const std::string* file = opt.files.empty() ? nullptr : &opt.files[t % opt.files.size()];
+      threads.emplace_back(run_pipeline, std::cref(opt), file, std::cref(fx), std::ref(runs[t]));
+    }
+    for (std::thread& th : threads) th.join();
+  }
+  for (const RunResult& r : runs) {
+    if (!r.error.empty()) {
+      std::cerr << "voice-bench: " << r.error << "\n";
+      return 1;
+    }
+  }
+
+  uint64_t frames = 0, opens = 0, open_ns = 0, bytes = 0;
+  uint64_t allocs[kStages] = {};
+  double wall_s = 0.0;
+  for (const RunResult& r : runs) {
+    frames += static_cast<uint64_t>(r.frames);
+    opens += r.opens;
+    open_ns += r.open_ns;
+    bytes += r.payload_bytes;
+    wall_s = std::max(wall_s, r.wall_s);
+    for (int s = 0; s < kStages; ++s) allocs[s] += r.stages[s].allocs;
+  }
+
+  const bool decoding = !opt.files.empty();
+  std::printf("voice-bench source=%s threads=%d frames_per_thread=%d fx=%s output=%s dsp_kernels=%s\n",
+              decoding ? (opt.files.size() == 1 ? opt.files[0].c_str() : "files") : "tone", opt.threads, opt.frames,
+              opt.fx.c_str(), opt.encode ? "opus" : "pcm", voice::DspChain().kernel_name());
+
+  double stage_mean[kStages] = {};
+  uint64_t total_allocs = 0;
+  for (int s = 0; s < kStages; ++s) {
+    if ((s == kDecode && !decoding) || (s == kEncode && !opt.encode)) continue;
+    const voice::Histogram::Snapshot snap = merged(runs, nullptr, s);
+    stage_mean[s] = mean(snap);
+    total_allocs += allocs[s];
+    print_stage(kStageNames[s], snap, static_cast<double>(allocs[s]) / static_cast<double>(frames));
+  }
+  const voice::Histogram::Snapshot total = merged(runs, &RunResult::total_ns, -1);
+  print_stage("total", total, static_cast<double>(total_allocs) / static_cast<double>(frames));
+  if (decoding) {
+    std::printf("source_opens=%llu open_mean_ms=%.2f\n", static_cast<unsigned long long>(opens),
+                opens ? static_cast<double>(open_ns) / static_cast<double>(opens) / 1e6 : 0.0);
+  }
+
+  // One core runs one pipeline thread flat out, so the mean frame cost is the cost per core. Bots
+  // playing the same track share one decoder, so each of them only adds its DSP, encode and
+  // packetizing to the one decode.
+  const double per_frame_ns = mean(total);
+  const double per_bot_shared_ns = per_frame_ns - stage_mean[kDecode];
+  const double shared_bots = std::floor((kFrameBudgetNs - stage_mean[kDecode]) / per_bot_shared_ns);
+  std::printf("frames_per_sec_per_core=%.0f realtime_factor=%.1f aggregate_frames_per_sec=%.0f payload_kbps=%.1f\n",
+              1e9 / per_frame_ns, kFrameBudgetNs / per_frame_ns, static_cast<double>(frames) / wall_s,
+              static_cast<double>(bytes) * 8.0 / (static_cast<double>(frames + kWarmupFrames * runs.size()) *
+                                                  voice::kFrameMs));
+  std::printf("bots_per_core own_decoder=%.0f shared_decoder=%.0f\n", std::floor(kFrameBudgetNs / per_frame_ns),
+              shared_bots);
+  return 0;
+}
@@ -0,0 +1,555 @@
+// Soak and latency test of the voice service: many bots wired as in main() (engine, VoiceServiceImpl,
+// shared decoders, the real GrpcServer), each sending into a mock TS3 sink, with a load generator
+// calling Play, PlayNext, Skip, SetAudioFx, SetVolume, GetStatus and GetSnapshot at random bots
+// over gRPC for as long as asked. No TS3 server or network needed.
+//
+//   voice-soak [--bots N] [--clients N] [--rate CALLS_PER_SEC] [--duration SECONDS]
+//              [--report SECONDS] [--opus] [--max-p99-ms MS] [--max-underrun-pct PCT]
+//              [--max-rss-growth-mb MB] [FILE...]
+//
+// Bots play the FILEs at random, or a generated 44.1 kHz tone (so every decode also resamples).
+// Each client thread has its own channel to the server's unix socket and issues calls open-loop at
+// exponentially distributed intervals; a call's latency is counted from when it was due, so a call
+// held up behind a slow one reports its wait too. The sink measures the spacing of the frames it
+// is handed: send-tick jitter is how far that is from 20 ms. --opus makes the sinks take Opus, so
+// the engines encode as well. The TSBOT_VOICE_* variables configure the service as usual.
+//
+// Every --report seconds one key=value line for the interval: calls, failed calls, command latency,
+// jitter, engine tick lateness, underruns (which include the prebuffering of every track start) and
+// RSS. At the end, totals per call and the gates: the run fails (exit 1) on any failed call or
+// malformed frame, command p99 above --max-p99-ms, underruns above --max-underrun-pct of the frames
+// sent, or RSS grown by more than --max-rss-growth-mb after the first interval.
+//
+// Under -DTSBOT_VOICE_SANITIZE=thread, run it with TSAN_OPTIONS=suppressions=bench/tsan.supp (ctest
+// does): the distro gRPC is not instrumented.
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <numbers>
+#include <random>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <grpcpp/grpcpp.h>
+#include <unistd.h>
+
+#include "audio_cache.h"
+#include "audio_format.h"
+#include "bot_registry.h"
+#include "client_commands.h"
+#include "decode_pool.h"
+#include "grpc_server.h"
+#include "histogram.h"
+#include "http_reader.h"
+#include "log.h"
+#include "playback_engine.h"
+#include "send_clock.h"
+#include "shared_source.h"
+#include "voice.grpc.pb.h"
+#include "voice_service.h"
+#include "voice_sink.h"
+
+namespace voice = tsbot::voice;
+namespace v1 = tsbot::voice::v1;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr int kTrackSeconds = 30;
+constexpr int kTrackRate = 44100;
+constexpr auto kCallTimeout = std::chrono::seconds(10);
+// Spacing above this is the sink idling between tracks, not jitter.
+constexpr int64_t kGapUs = 500'000;
+
+enum Op { kPlay, kPlayNext, kSkip, kSetAudioFx, kSetVolume, kGetStatus, kGetSnapshot, kOps };
+constexpr const char* kOpNames[kOps] = {"play",       "play_next",  "skip",        "set_fx",
+                                        "set_volume", "get_status", "get_snapshot"};
+// Mostly what a web UI polls with, and a track change every few seconds per bot.
+constexpr double kOpWeights[kOps] = {8, 6, 8, 20, 6, 40, 12};
+
+struct Options {
+  int bots = 16;
+  int clients = 8;
+  int rate = 200;
+  int duration_s = 60;
+  int report_s = 10;
+  bool opus = false;
+  int max_p99_ms = 250;
+  double max_underrun_pct = 5.0;
+  int max_rss_growth_mb = 64;
+  std::vector<std::string> files;
+};
+
+// Shared by the client threads and the sinks; all lock-free.
+struct Metrics {
+  voice::Histogram call_us[kOps];
+  std::atomic<uint64_t> call_errors[kOps] = {};
+  voice::Histogram jitter_us;
+  std::atomic<uint64_t> gaps{0};
+  std::atomic<uint64_t> bad_frames{0};
+};
+
+// What the TS3 client would do with a frame, minus the network: the SDK copies the PCM (or the
+// transport the Opus packet) and returns.
+class SoakSink final : public voice::VoiceSink {
+ public:
+  SoakSink(bool opus, Metrics* m) : opus_(opus), m_(m) {}
+
+  bool wants_opus() const override { return opus_; }
+  void send_frame(const voice::OutFrame& f) override {
+    const auto now = Clock::now();
+    if (!f.pcm || (opus_ && (!f.opus || f.opus_len == 0 || f.opus_len > voice::kMaxOpusPacket))) {
+      m_->bad_frames.fetch_add(1, std::memory_order_relaxed);
+    } else if (opus_) {
+      std::memcpy(packet_.data(), f.opus, f.opus_len);
+    } else {
+      std::memcpy(pcm_.data(), f.pcm, voice::kFrameBytes);
+    }
+    if (has_last_) {
+      const int64_t us = std::chrono::duration_cast<std::chrono::microseconds>(now - last_).count();
+      if (us > kGapUs) {
+        m_->gaps.fetch_add(1, std::memory_order_relaxed);
+      } else {
+        m_->jitter_us.record(static_cast<uint64_t>(std::abs(us - voice::kFrameMs * 1000)));
+      }
+    }
+    last_ = now;
+    has_last_ = true;
+  }
+  void end_of_stream() override { has_last_ = false; }
+
+ private:
+  const bool opus_;
+  Metrics* const m_;
+  // Send thread only.
+  Clock::time_point last_{};
+  bool has_last_ = false;
+  std::array<uint8_t, voice::kMaxOpusPacket> packet_{};
+  voice::PcmFrame pcm_{};
+};
+
+void put_le(std::ofstream& out, uint32_t v, int bytes) {
+  for (int i = 0; i < bytes; ++i) out.put(static_cast<char>((v >> (8 * i)) & 0xff));
+}
+
+// Two tones under a slow swell, so the loudness meter and the limiter have something to do.
+bool write_test_track(const std::string& path, std::string* err) {
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  if (!out) {
+    *err = "cannot write " + path;
+    return false;
+  }
+  const uint32_t frames = static_cast<uint32_t>(kTrackRate) * kTrackSeconds;
+  const uint32_t data_bytes = frames * 4;
+  out.write("RIFF", 4);
+  put_le(out, 36 + data_bytes, 4);
+  out.write("WAVEfmt ", 8);
+  put_le(out, 16, 4);
+  put_le(out, 1, 2);  // PCM
+  put_le(out, 2, 2);
+  put_le(out, kTrackRate, 4);
+  put_le(out, kTrackRate * 4, 4);
+  put_le(out, 4, 2);
+  put_le(out, 16, 2);
+  out.write("data", 4);
+  put_le(out, data_bytes, 4);
+  constexpr double kTwoPi = 2 * std::numbers::pi;
+  for (uint32_t i = 0; i < frames; ++i) {
+    const double t = static_cast<double>(i) / kTrackRate;
+    const double swell = 0.55 + 0.45 * std::sin(kTwoPi * 0.2 * t);
+    const double l = swell * (0.4 * std::sin(kTwoPi * 440.0 * t) + 0.1 * std::sin(kTwoPi * 3000.0 * t));
+    const double r = swell * (0.4 * std::sin(kTwoPi * 660.0 * t) + 0.1 * std::sin(kTwoPi * 5000.0 * t));
+    put_le(out, static_cast<uint16_t>(static_cast<int16_t>(l * 32767.0)), 2);
+    put_le(out, static_cast<uint16_t>(static_cast<int16_t>(r * 32767.0)), 2);
+  }
+  out.close();
+  if (!out) {
+    *err = "cannot write " + path;
+    return false;
+  }
+  return true;
+}
+
+// Resident set size, from /proc; 0 where there is none.
+uint64_t rss_bytes() {
+  std::ifstream statm("/proc/self/statm");
+  uint64_t size = 0, resident = 0;
+  if (!(statm >> size >> resident)) return 0;
+  return resident * static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+}
+
+double mb(uint64_t bytes) { return static_cast<double>(bytes) / (1024.0 * 1024.0); }
+
+voice::Histogram::Snapshot merged(const std::vector<voice::Histogram::Snapshot>& parts) {
+  voice::Histogram::Snapshot m;
+  for (const auto& s : parts) {
+    m.count += s.count;
+    m.sum += s.sum;
+    m.max = std::max(m.max, s.max);
+    for (std::size_t i = 0; i < s.buckets.size(); ++i) m.buckets[i] += s.buckets[i];
+  }
+  return m;
+}
+
+// What was recorded between `before` and `now`. Histograms keep no per-interval maximum; the
+// maximum so far stands in for it.
+voice::Histogram::Snapshot since(const voice::Histogram::Snapshot& now, const voice::Histogram::Snapshot& before) {
+  voice::Histogram::Snapshot d = now;
+  d.count -= before.count;
+  d.sum -= before.sum;
+  for (std::size_t i = 0; i < d.buckets.size(); ++i) d.buckets[i] -= before.buckets[i];
+  return d;
+}
+
+double ms(uint64_t us) { return static_cast<double>(us) / 1000.0; }
+
+// Runs one call of `op` against `bot`; false if it failed or the service refused it.
+bool call(v1::VoiceService::Stub& stub, Op op, const std::string& bot, const std::string& track, std::mt19937& rng) {
+  grpc::ClientContext ctx;
+  ctx.AddMetadata(voice::kBotMetadataKey, bot);
+  ctx.set_deadline(std::chrono::system_clock::now() + kCallTimeout);
+  std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+  v1::CommandResponse cmd;
+  grpc::Status s;
+  switch (op) {
+    case kPlay: {
+      v1::PlayRequest req;
+      req.set_source_url(track);
+      req.set_title("soak");
+      s = stub.Play(&ctx, req, &cmd);
+      break;
+    }
+    case kPlayNext: {
+      v1::PlayNextRequest req;
+      req.set_source_url(track);
+      req.set_title("soak next");
+      req.set_crossfade_ms(static_cast<uint32_t>(unit(rng) * 3000.0f));
+      s = stub.PlayNext(&ctx, req, &cmd);
+      break;
+    }
+    case kSkip:
+      s = stub.Skip(&ctx, v1::Empty(), &cmd);
+      break;
+    case kSetAudioFx: {
+      v1::SetAudioFxRequest req;
+      req.set_pan(unit(rng) * 2.0f - 1.0f);
+      req.set_width(unit(rng) * 2.0f);
+      req.set_swap_lr(unit(rng) < 0.1f);
+      req.set_bass_db(unit(rng) * 12.0f);
+      req.set_reverb_mix(unit(rng) < 0.5f ? 0.0f : unit(rng) * 0.5f);
+      s = stub.SetAudioFx(&ctx, req, &cmd);
+      break;
+    }
+    case kSetVolume: {
+      v1::SetVolumeRequest req;
+      req.set_volume_percent(20 + static_cast<int>(unit(rng) * 80.0f));
+      s = stub.SetVolume(&ctx, req, &cmd);
+      break;
+    }
+    case kGetStatus: {
+      v1::StatusResponse resp;
+      return stub.GetStatus(&ctx, v1::Empty(), &resp).ok();
+    }
+    case kGetSnapshot: {
+      v1::SnapshotRequest req;
+      req.set_include_stats(unit(rng) < 0.25f);
+      v1::SnapshotResponse resp;
+      return stub.GetSnapshot(&ctx, req, &resp).ok();
+    }
+    case kOps:
+      break;
+  }
+  return s.ok() && cmd.ok();
+}
+
+void run_client(int index, const Options& opt, const std::string& addr, const std::vector<std::string>& bot_ids,
+                const std::vector<std::string>& tracks, Clock::time_point end, Metrics& m) {
+  grpc::ChannelArguments args;
+  // A connection of its own, like a separate client process.
+  args.SetInt(GRPC_ARG_USE_LOCAL_SUBCHANNEL_POOL, 1);
+  const auto channel = grpc::CreateCustomChannel(addr, grpc::InsecureChannelCredentials(), args);
+  channel->WaitForConnected(std::chrono::system_clock::now() + kCallTimeout);
+  const auto stub = v1::VoiceService::NewStub(channel);
+
+  std::mt19937 rng(static_cast<std::mt19937::result_type>(index) * 7919u + 1u);
+  std::discrete_distribution<int> pick_op(std::begin(kOpWeights), std::end(kOpWeights));
+  std::uniform_int_distribution<std::size_t> pick_bot(0, bot_ids.size() - 1);
+  std::uniform_int_distribution<std::size_t> pick_track(0, tracks.size() - 1);
+  std::exponential_distribution<double> interval(static_cast<double>(opt.rate) / opt.clients);
+
+  auto due = Clock::now();
+  for (;;) {
+    due += std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(interval(rng)));
+    if (due >= end) break;
+    std::this_thread::sleep_until(due);
+    const Op op = static_cast<Op>(pick_op(rng));
+    const bool ok = call(*stub, op, bot_ids[pick_bot(rng)], tracks[pick_track(rng)], rng);
+    const auto us = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - due).count();
+    m.call_us[op].record(static_cast<uint64_t>(std::max<int64_t>(us, 0)));
+    if (!ok) m.call_errors[op].fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+// Everything the reports are computed from, at one point in time.
+struct Sample {
+  std::vector<voice::Histogram::Snapshot> calls;
+  uint64_t errors = 0;
+  voice::Histogram::Snapshot jitter;
+  voice::Histogram::Snapshot tick_late;
+  uint64_t frames_sent = 0;
+  uint64_t underruns = 0;
+};
+
+Sample take_sample(const Metrics& m, const voice::BotRegistry& bots) {
+  Sample s;
+  for (int op = 0; op < kOps; ++op) {
+    s.calls.push_back(m.call_us[op].snapshot());
+    s.errors += m.call_errors[op].load(std::memory_order_relaxed);
+  }
+  s.jitter = m.jitter_us.snapshot();
+  std::vector<voice::Histogram::Snapshot> late;
+  for (const auto& bot : bots.bots()) {
+    const voice::EngineStats& st = bot->engine->stats();
+    late.push_back(st.tick_late_us.snapshot());
+    s.frames_sent += st.frames_sent.load(std::memory_order_relaxed);
+    s.underruns += st.underrun_frames.load(std::memory_order_relaxed);
+  }
+  s.tick_late = merged(late);
+  return s;
+}
+
+double pct(uint64_t part, uint64_t whole) {
+  return whole ? 100.0 * static_cast<double>(part) / static_cast<double>(whole) : 0.0;
+}
+
+void print_interval(int t, const Sample& now, const Sample& before) {
+  std::vector<voice::Histogram::Snapshot> calls;
+  for (int op = 0; op < kOps; ++op) calls.push_back(since(now.calls[op], before.calls[op]));
+  const voice::Histogram::Snapshot c = merged(calls);
+  const voice::Histogram::Snapshot j = since(now.jitter, before.jitter);
+  const voice::Histogram::Snapshot l = since(now.tick_late, before.tick_late);
+  const uint64_t frames = now.frames_sent - before.frames_sent;
+  std::printf("t=%d calls=%llu errors=%llu call_p50_ms=%.2f call_p99_ms=%.2f jitter_p50_us=%llu jitter_p99_us=%llu "
+              "tick_late_p99_us=%llu frames=%llu underrun_pct=%.2f rss_mb=%.1f\n",
+              t, static_cast<unsigned long long>(c.count), static_cast<unsigned long long>(now.errors - before.errors),
+              ms(c.percentile(0.5)), ms(c.percentile(0.99)), static_cast<unsigned long long>(j.percentile(0.5)),
+              static_cast<unsigned long long>(j.percentile(0.99)), static_cast<unsigned long long>(l.percentile(0.99)),
+              static_cast<unsigned long long>(frames), pct(now.underruns - before.underruns, frames), mb(rss_bytes()));
+  std::fflush(stdout);
+}
+
+bool parse_int(std::string_view arg, const char* value, int lo, int hi, int* out) {
+  if (!value) {
+    std::cerr << "voice-soak: " << arg << " needs a value\n";
+    return false;
+  }
+  char* end = nullptr;
+  const long v = std::strtol(value, &end, 10);
+  if (*value == '\0' || *end != '\0' || v < lo || v > hi) {
+    std::cerr << "voice-soak: " << arg << " must be " << lo << " .. " << hi << "\n";
+    return false;
+  }
+  *out = static_cast<int>(v);
+  return true;
+}
+
+bool parse_pct(std::string_view arg, const char* value, double* out) {
+  char* end = nullptr;
+  const double v = value ? std::strtod(value, &end) : -1.0;
+  if (!value || *value == '\0' || *end != '\0' || !(v >= 0.0 && v <= 100.0)) {
+    std::cerr << "voice-soak: " << arg << " must be 0 .. 100\n";
+    return false;
+  }
+  *out = v;
+  return true;
+}
+
+int usage() {
+  std::cerr << "usage: voice-soak [--bots N] [--clients N] [--rate CALLS_PER_SEC] [--duration SECONDS]\n"
+               "                  [--report SECONDS] [--opus] [--max-p99-ms MS] [--max-underrun-pct PCT]\n"
+               "                  [--max-rss-growth-mb MB] [FILE...]\n";
+  return 2;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  Options opt;
+  for (int i = 1; i < argc; ++i) {
+    const std::string_view arg = argv[i];
+    const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+    bool ok = true;
+    if (arg == "--bots") {
+      ok = parse_int(arg, value, 1, 1024, &opt.bots);
+      ++i;
+    } else if (arg == "--clients") {
+      ok = parse_int(arg, value, 1, 1024, &opt.clients);
+      ++i;
+    } else if (arg == "--rate") {
+      ok = parse_int(arg, value, 1, 100'000, &opt.rate);
+      ++i;
+    } else if (arg == "--duration") {
+      ok = parse_int(arg, value, 1, 7 * 24 * 3600, &opt.duration_s);
+      ++i;
+    } else if (arg == "--report") {
+      ok = parse_int(arg, value, 1, 3600, &opt.report_s);
+      ++i;
+    } else if (arg == "--max-p99-ms") {
+      ok = parse_int(arg, value, 1, 600'000, &opt.max_p99_ms);
+      ++i;
+    } else if (arg == "--max-underrun-pct") {
+      ok = parse_pct(arg, value, &opt.max_underrun_pct);
+      ++i;
+    } else if (arg == "--max-rss-growth-mb") {
+      ok = parse_int(arg, value, 0, 1'000'000, &opt.max_rss_growth_mb);
+      ++i;
+    } else if (arg == "--opus") {
+      opt.opus = true;
+    } else if (arg == "-h" || arg == "--help" || (arg.size() > 1 && arg[0] == '-')) {
+      return usage();
+    } else {
+      opt.files.emplace_back(arg);
+    }
+    if (!ok) return 2;
+  }
+
+  // Every track start logs a line; at soak rates only warnings are worth reading.
+  setenv("TSBOT_LOG_LEVEL", "WARN", /*overwrite=*/0);
+  const voice::EngineConfig engine_cfg = voice::EngineConfig::from_env();
+  voice::keep_off_audio_cpu(nullptr, engine_cfg.send_thread.cpu);
+  voice::AsyncLogger logger;
+
+  const std::filesystem::path scratch =
+      std::filesystem::temp_directory_path() / ("voice-soak-" + std::to_string(getpid()));
+  std::error_code ec;
+  std::filesystem::create_directories(scratch, ec);
+  std::vector<std::string> tracks = opt.files;
+  if (tracks.empty()) {
+    const std::string path = (scratch / "tone.wav").string();
+    if (std::string err; !write_test_track(path, &err)) {
+      std::cerr << "voice-soak: " << err << "\n";
+      return 1;
+    }
+    tracks.push_back(path);
+  }
+  const std::string addr = "unix:" + (scratch / "grpc.sock").string();
+
+  int failed = 0;
+  {
+    voice::AudioCache audio_cache(voice::AudioCacheConfig::from_env());
+    voice::HttpSession http(voice::HttpReaderConfig::from_env());
+    voice::DecodePoolConfig pool_cfg = voice::DecodePoolConfig::from_env();
+    pool_cfg.audio_cpu = engine_cfg.send_thread.cpu;
+    voice::DecodePool decode_pool(pool_cfg);
+    voice::SourceRegistry sources(engine_cfg.pcm_ring_capacity, engine_cfg.prebuffer_target, &audio_cache, &http,
+                                  &decode_pool);
+
+    Metrics m;
+    std::vector<std::string> bot_ids;
+    for (int b = 0; b < opt.bots; ++b) bot_ids.push_back("soak-" + std::to_string(b));
+    // Declared before the registry: the engines' send threads use the sinks until they are destroyed.
+    std::vector<std::unique_ptr<SoakSink>> sinks;
+    voice::NullClientCommands null_commands;
+    voice::BotRegistry bots;
+    for (const auto& id : bot_ids) {
+      voice::Bot& bot = bots.add(id);
+      sinks.push_back(std::make_unique<SoakSink>(opt.opus, &m));
+      bot.engine = std::make_unique<voice::PlaybackEngine>(sinks.back().get(), &bot.events, engine_cfg, &sources);
+      bot.service = std::make_unique<voice::VoiceServiceImpl>(*bot.engine, null_commands, bot_ids, &http.stats());
+    }
+
+    voice::GrpcServerConfig grpc_cfg = voice::GrpcServerConfig::from_env();
+    grpc_cfg.audio_cpu = engine_cfg.send_thread.cpu;
+    grpc_cfg.unix_socket.clear();
+    voice::GrpcServer server(bots, grpc_cfg);
+    if (!server.start(addr)) {
+      std::cerr << "voice-soak: cannot serve on " << addr << "\n";
+      return 1;
+    }
+
+    std::printf("voice-soak bots=%d clients=%d rate=%d duration_s=%d output=%s tracks=%zu\n", opt.bots, opt.clients,
+                opt.rate, opt.duration_s, opt.opus ? "opus" : "pcm", tracks.size());
+    std::fflush(stdout);
+    for (std::size_t b = 0; b < bot_ids.size(); ++b) {
+      bots.bots()[b]->engine->play(voice::TrackInfo{tracks[b % tracks.size()], "soak", ""});
+    }
+
+    const auto started = Clock::now();
+    const auto end = started + std::chrono::seconds(opt.duration_s);
+    std::vector<std::thread> clients;
+    for (int c = 0; c < opt.clients; ++c) {
+      clients.emplace_back(run_client, c, std::cref(opt), std::cref(addr), std::cref(bot_ids), std::cref(tracks),
+                           end, std::ref(m));
+    }
+
+    const Sample first = take_sample(m, bots);
+    Sample prev = first;
+    uint64_t rss_baseline = 0;
+    for (int t = opt.report_s; t <= opt.duration_s; t += opt.report_s) {
+      std::this_thread::sleep_until(started + std::chrono::seconds(t));
+      const Sample now = take_sample(m, bots);
+      print_interval(t, now, prev);
+      // The first interval fills the rings, pools and caches; growth after it is what counts.
+      if (rss_baseline == 0) rss_baseline = rss_bytes();
+      prev = now;
+    }
+    for (std::thread& th : clients) th.join();
+    const Sample last = take_sample(m, bots);
+    const uint64_t rss_end = rss_bytes();
+    if (rss_baseline == 0) rss_baseline = rss_end;
+    server.shutdown();
+
+    for (int op = 0; op < kOps; ++op) {
+      const voice::Histogram::Snapshot& s = last.calls[op];
+      std::printf("call=%-12s count=%llu errors=%llu p50_ms=%.2f p99_ms=%.2f p999_ms=%.2f max_ms=%.2f\n", kOpNames[op],
+                  static_cast<unsigned long long>(s.count),
+                  static_cast<unsigned long long>(m.call_errors[op].load(std::memory_order_relaxed)),
+                  ms(s.percentile(0.5)), ms(s.percentile(0.99)), ms(s.percentile(0.999)), ms(s.max));
+    }
+    const voice::Histogram::Snapshot all_calls = merged(last.calls);
+    const voice::Histogram::Snapshot& j = last.jitter;
+    std::printf("jitter_us p50=%llu p99=%llu p999=%llu max=%llu tick_late_us p99=%llu max=%llu\n",
+                static_cast<unsigned long long>(j.percentile(0.5)), static_cast<unsigned long long>(j.percentile(0.99)),
+                static_cast<unsigned long long>(j.percentile(0.999)), static_cast<unsigned long long>(j.max),
+                static_cast<unsigned long long>(last.tick_late.percentile(0.99)),
+                static_cast<unsigned long long>(last.tick_late.max));
+    const double underrun_pct = pct(last.underruns, last.frames_sent);
+    const double rss_growth_mb = rss_end > rss_baseline ? mb(rss_end - rss_baseline) : 0.0;
+    const uint64_t bad_frames = m.bad_frames.load(std::memory_order_relaxed);
+    std::printf("frames_sent=%llu underrun_frames=%llu underrun_pct=%.2f gaps=%llu bad_frames=%llu\n",
+                static_cast<unsigned long long>(last.frames_sent), static_cast<unsigned long long>(last.underruns),
+                underrun_pct, static_cast<unsigned long long>(m.gaps.load(std::memory_order_relaxed)),
+                static_cast<unsigned long long>(bad_frames));
+    std::printf("rss_baseline_mb=%.1f rss_end_mb=%.1f rss_growth_mb=%.1f\n", mb(rss_baseline), mb(rss_end),
+                rss_growth_mb);
+
+    const auto gate = [&](bool bad, const char* what) {
+      if (!bad) return;
+      std::printf("gate=%s failed\n", what);
+      ++failed;
+    };
+    gate(last.errors > 0, "errors");
+    gate(bad_frames > 0, "bad_frames");
+    gate(last.frames_sent == 0, "frames_sent");
+    gate(ms(all_calls.percentile(0.99)) > opt.max_p99_ms, "call_p99");
+    gate(underrun_pct > opt.max_underrun_pct, "underrun_pct");
+    gate(rss_growth_mb > opt.max_rss_growth_mb, "rss_growth");
+    std::printf("result=%s\n", failed ? "fail" : "pass");
+  }
+  std::filesystem::remove_all(scratch, ec);
+  return failed ? 1 : 0;
+}
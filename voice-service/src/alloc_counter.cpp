@@ -0,0 +1,74 @@
+#include "alloc_counter.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+
+namespace tsbot::voice {
+
+namespace {
+
+// Constant-initialized, so touching it from operator new never runs a TLS constructor.
+constinit thread_local uint64_t t_allocations = 0;
+
+void* allocate(std::size_t n) {
+  ++t_allocations;
+  if (n == 0) n = 1;
+  for (;;) {
+    if (void* p = std::malloc(n)) return p;
+    std::new_handler h = std::get_new_handler();
+    if (!h) throw std::bad_alloc();
+    h();
+  }
+}
+
+void* allocate_aligned(std::size_t n, std::align_val_t al) {
+  ++t_allocations;
+  const auto align = std::max(static_cast<std::size_t>(al), sizeof(void*));
+  if (n == 0) n = 1;
+  for (;;) {
+    void* p = nullptr;
+    if (posix_memalign(&p, align, n) == 0) return p;
+    std::new_handler h = std::get_new_handler();
+    if (!h) throw std::bad_alloc();
+    h();
+  }
+}
+
+}  // namespace
+
+uint64_t thread_allocations() { return t_allocations; }
+
+}  // namespace tsbot::voice
+
+using tsbot::voice::allocate;
+using tsbot::voice::allocate_aligned;
+
+void* operator new(std::size_t n) { return allocate(n); }
+void* operator new[](std::size_t n) { return allocate(n); }
+void* operator new(std::size_t n, std::align_val_t al) { return allocate_aligned(n, al); }
+void* operator new[](std::size_t n, std::align_val_t al) { return allocate_aligned(n, al); }
+
+void* operator new(std::size_t n, const std::nothrow_t&) noexcept {
+  try {
+    return allocate(n);
+  } catch (...) {
+    return nullptr;
+  }
+}
+void* operator new[](std::size_t n, const std::nothrow_t&) noexcept {
+  try {
+    return allocate(n);
+  } catch (...) {
+    return nullptr;
+  }
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t) noexcept { std::free(p); }
+void operator delete(void* p, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t, std::align_val_t) noexcept { std::free(p); }
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <cstdint>
+
+namespace tsbot::voice {
+
+// Heap allocations made through operator new by the calling thread since it started, counted by
+// the replacement operators in alloc_counter.cpp (one thread-local increment each). The engine
+// samples it around the per-frame work on the send thread and in decoder steps to show that the
+// steady state does not allocate. libavformat/libavcodec (av_malloc) and the TS3 SDK allocate
+// through malloc directly and are not seen.
+uint64_t thread_allocations();
+
+}  // namespace tsbot::voice
@@ -0,0 +1,259 @@
+#include "audio_cache.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <system_error>
+#include <utility>
+
+#include "env.h"
+#include "log.h"
+
+namespace tsbot::voice {
+
+namespace {
+
+namespace fs = std::filesystem;
+
+// File layout, integers little-endian:
+//   magic[8] | frames u32 | key_len u32 | loudness i32 | key | packet end offsets u32[frames] | packet data
+// The key is stored so a hash collision reads as a miss instead of the wrong song. The offset table
+// has a fixed stride, so the packet of any frame (a seek target) is found without a scan. Loudness
+// is in hundredths of a LUFS, kNoLoudness if unknown. Version 01 files lack the loudness field and
+// are still read.
+constexpr char kMagic[8] = {'T', 'S', 'B', 'O', 'P', 'C', '0', '2'};
+constexpr char kMagicV1[8] = {'T', 'S', 'B', 'O', 'P', 'C', '0', '1'};
+constexpr std::size_t kHeaderBytes = sizeof(kMagic) + 12;
+constexpr std::size_t kHeaderBytesV1 = sizeof(kMagic) + 8;
+constexpr int32_t kNoLoudness = INT32_MIN;
+constexpr const char* kSuffix = ".opc";
+
+uint32_t get_u32(const uint8_t* p) {
+  return uint32_t{p[0]} | uint32_t{p[1]} << 8 | uint32_t{p[2]} << 16 | uint32_t{p[3]} << 24;
+}
+
+void put_u32(std::string* out, uint32_t v) {
+  for (int i = 0; i < 4; ++i) out->push_back(static_cast<char>((v >> (8 * i)) & 0xff));
+}
+
+uint64_t fnv1a64(const std::string& s) {
+  uint64_t h = 14695981039346656037ull;
+  for (const char ch : s) {
+    h ^= static_cast<uint8_t>(ch);
+    h *= 1099511628211ull;
+  }
+  return h;
+}
+
+bool write_all(int fd, const void* data, std::size_t len) {
+  const auto* p = static_cast<const uint8_t*>(data);
+  while (len > 0) {
+    const ssize_t n = ::write(fd, p, len);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    p += n;
+    len -= static_cast<std::size_t>(n);
+  }
+  return true;
+}
+
+}  // namespace
+
+AudioCacheConfig AudioCacheConfig::from_env() {
+  AudioCacheConfig c;
+  c.dir = get_env("TSBOT_VOICE_CACHE_DIR");
+  if (auto v = env_int("TSBOT_VOICE_CACHE_MB"); v && *v > 0) c.max_bytes = static_cast<uint64_t>(*v) << 20;
+  return c;
+}
+
+CachedTrack::~CachedTrack() { ::munmap(const_cast<uint8_t*>(base_), size_); }
+
+CachedTrack::Parse CachedTrack::parse(const std::string& key) {
+  std::size_t header = 0;
+  if (size_ >= kHeaderBytes && std::memcmp(base_, kMagic, sizeof(kMagic)) == 0) {
+    header = kHeaderBytes;
+    if (const auto centi = static_cast<int32_t>(get_u32(base_ + sizeof(kMagic) + 8)); centi != kNoLoudness) {
+      loudness_lufs_ = static_cast<float>(centi) / 100.0f;
+    }
+  } else if (size_ >= kHeaderBytesV1 && std::memcmp(base_, kMagicV1, sizeof(kMagicV1)) == 0) {
+    header = kHeaderBytesV1;
+  } else {
+    return Parse::kCorrupt;
+  }
+  frames_ = get_u32(base_ + sizeof(kMagic));
+  const uint32_t key_len = get_u32(base_ + sizeof(kMagic) + 4);
+  const uint64_t index_end = header + uint64_t{key_len} + uint64_t{frames_} * 4;
+  if (index_end > size_ || frames_ == 0) return Parse::kCorrupt;
+  // The rest belongs to the other track; whether it is sound is for that track's open() to find.
+  if (key.size() != key_len || std::memcmp(base_ + header, key.data(), key_len) != 0) return Parse::kOtherKey;
+  ends_ = base_ + header + key_len;
+  data_ = base_ + index_end;
+  // Offsets must rise and the last one must end exactly at the end of the file.
+  uint32_t prev = 0;
+  for (uint32_t i = 0; i < frames_; ++i) {
+    const uint32_t end = get_u32(ends_ + 4 * std::size_t{i});
+    if (end < prev) return Parse::kCorrupt;
+    prev = end;
+  }
+  return index_end + prev == size_ ? Parse::kOk : Parse::kCorrupt;
+}
+
+const uint8_t* CachedTrack::packet(uint32_t i, std::size_t* len) const {
+  const uint32_t begin = i == 0 ? 0 : get_u32(ends_ + 4 * std::size_t{i - 1});
+  *len = get_u32(ends_ + 4 * std::size_t{i}) - begin;
+  return data_ + begin;
+}
+
+AudioCache::AudioCache(AudioCacheConfig cfg) : cfg_(std::move(cfg)) {
+  if (!enabled()) return;
+  std::error_code ec;
+  fs::create_directories(cfg_.dir, ec);
+  if (ec) {
+    log_print("WARN audio cache: cannot create ", cfg_.dir, ": ", ec.message());
+    return;
+  }
+
+  // Rebuild the LRU order from mtimes; leftovers of an interrupted store are removed.
+  std::vector<std::pair<fs::file_time_type, fs::directory_entry>> files;
+  for (const auto& e : fs::directory_iterator(cfg_.dir, ec)) {
+    const std::string name = e.path().filename().string();
+    if (name.find(".tmp") != std::string::npos) {
+      fs::remove(e.path(), ec);
+    } else if (e.is_regular_file(ec) && e.path().extension() == kSuffix) {
+      files.emplace_back(e.last_write_time(ec), e);
+    }
+  }
+  std::sort(files.begin(), files.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+  std::lock_guard<std::mutex> lk(mu_);
+  for (const auto& [mtime, e] : files) {
+    const std::string name = e.path().filename().string();
+    lru_.push_front(name);
+    const uint64_t bytes = e.file_size(ec);
+    entries_[name] = Entry{bytes, lru_.begin()};
+    total_bytes_ += bytes;
+  }
+  evict_locked();
+  log_print("audio cache dir=", cfg_.dir, " tracks=", entries_.size(), " bytes=", total_bytes_,
+            " max_bytes=", cfg_.max_bytes);
+}
+
+std::string AudioCache::file_name(const std::string& key) const {
+  char buf[17];
+  std::snprintf(buf, sizeof(buf), "%016llx", static_cast<unsigned long long>(fnv1a64(key)));
+  return std::string(buf) + kSuffix;
+}
+
+std::shared_ptr<const CachedTrack> AudioCache::open(const std::string& key) {
+  if (!enabled() || key.empty()) return nullptr;
+  const std::string name = file_name(key);
+  const std::string path = cfg_.dir + "/" + name;
+  {
+    std::lock_guard<std::mutex> lk(mu_);
+    const auto it = entries_.find(name);
+    if (it == entries_.end()) return nullptr;
+    lru_.splice(lru_.begin(), lru_, it->second.lru);
+  }
+  ::utimensat(AT_FDCWD, path.c_str(), nullptr, 0);
+
+  const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  struct stat st {};
+  void* base = MAP_FAILED;
+  if (fd >= 0) {
+    if (::fstat(fd, &st) == 0 && st.st_size > 0) {
+      base = ::mmap(nullptr, static_cast<std::size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+      // Played front to back from wherever it starts: read ahead, drop pages behind.
+      if (base != MAP_FAILED) ::madvise(base, static_cast<std::size_t>(st.st_size), MADV_SEQUENTIAL);
+    }
+    ::close(fd);
+  }
+  if (base != MAP_FAILED) {
+    std::shared_ptr<CachedTrack> track(
+        new CachedTrack(static_cast<const uint8_t*>(base), static_cast<std::size_t>(st.st_size)));
+    switch (track->parse(key)) {
+      case CachedTrack::Parse::kOk:
+        return track;
+      case CachedTrack::Parse::kOtherKey:
+        // A hash collision: a miss for this key, and the other track keeps its entry.
+        return nullptr;
+      case CachedTrack::Parse::kCorrupt:
+        break;
+    }
+  }
+
+  log_print("WARN audio cache: dropping unreadable entry key=", key, " file=", name);
+  std::lock_guard<std::mutex> lk(mu_);
+  drop_locked(name);
+  return nullptr;
+}
+
+void AudioCache::store(const std::string& key, const PacketLog& packets) {
+  if (!enabled() || key.empty() || packets.ends.empty()) return;
+  const std::string name = file_name(key);
+  const std::string path = cfg_.dir + "/" + name;
+  const std::string tmp = path + ".tmp" + std::to_string(::getpid());
+
+  std::string head(kMagic, sizeof(kMagic));
+  put_u32(&head, static_cast<uint32_t>(packets.ends.size()));
+  put_u32(&head, static_cast<uint32_t>(key.size()));
+  const int32_t centi =
+      std::isnan(packets.loudness_lufs) ? kNoLoudness : static_cast<int32_t>(std::lround(packets.loudness_lufs * 100.0f));
+  put_u32(&head, static_cast<uint32_t>(centi));
+  head += key;
+  for (const uint32_t end : packets.ends) put_u32(&head, end);
+
+  const int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  bool ok = fd >= 0;
+  if (ok) {
+    ok = write_all(fd, head.data(), head.size()) && write_all(fd, packets.data.data(), packets.data.size());
+    ok = ::close(fd) == 0 && ok;
+  }
+  if (ok) ok = ::rename(tmp.c_str(), path.c_str()) == 0;
+  if (!ok) {
+    log_print("WARN audio cache: store failed key=", key, ": ", std::strerror(errno));
+    ::unlink(tmp.c_str());
+    return;
+  }
+
+  const uint64_t bytes = head.size() + packets.data.size();
+  std::lock_guard<std::mutex> lk(mu_);
+  if (const auto it = entries_.find(name); it != entries_.end()) {
+    total_bytes_ -= it->second.bytes;
+    lru_.erase(it->second.lru);
+  }
+  lru_.push_front(name);
+  entries_[name] = Entry{bytes, lru_.begin()};
+  total_bytes_ += bytes;
+  log_print("audio cache stored key=", key, " frames=", packets.ends.size(), " bytes=", bytes,
+            " loudness_lufs=", packets.loudness_lufs);
+  evict_locked();
+}
+
+// Forgets `name` and deletes its file; mappings of it stay valid.
+void AudioCache::drop_locked(const std::string& name) {
+  const auto it = entries_.find(name);
+  if (it == entries_.end()) return;
+  total_bytes_ -= it->second.bytes;
+  lru_.erase(it->second.lru);
+  entries_.erase(it);
+  ::unlink((cfg_.dir + "/" + name).c_str());
+}
+
+void AudioCache::evict_locked() {
+  while (total_bytes_ > cfg_.max_bytes && !lru_.empty()) {
+    const std::string victim = lru_.back();
+    drop_locked(victim);
+  }
+}
+
+}  // namespace tsbot::voice
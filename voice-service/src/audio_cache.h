@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace tsbot::voice {
+
+struct AudioCacheConfig {
+  // TSBOT_VOICE_CACHE_DIR; empty disables the cache.
+  std::string dir;
+  // TSBOT_VOICE_CACHE_MB: total size of the cache files before the least recently played go.
+  uint64_t max_bytes = uint64_t{1024} << 20;
+
+  static AudioCacheConfig from_env();
+};
+
+// Opus packets of one track in play order, as collected on its first play.
+struct PacketLog {
+  std::vector<uint8_t> data;
+  std::vector<uint32_t> ends;  // packet i is data[ends[i - 1], ends[i])
+  // Integrated loudness of the whole track in LUFS; NaN if unknown.
+  float loudness_lufs = std::numeric_limits<float>::quiet_NaN();
+
+  void add(const uint8_t* packet, std::size_t len) {
+    data.insert(data.end(), packet, packet + len);
+    ends.push_back(static_cast<uint32_t>(data.size()));
+  }
+};
+
+// A cached track mapped read-only. Stays valid if the file is evicted meanwhile.
+class CachedTrack {
+ public:
+  ~CachedTrack();
+  CachedTrack(const CachedTrack&) = delete;
+  CachedTrack& operator=(const CachedTrack&) = delete;
+
+  uint32_t frames() const { return frames_; }
+  // Packet of frame `i` (< frames()).
+  const uint8_t* packet(uint32_t i, std::size_t* len) const;
+  // As measured when the track was recorded; NaN for entries written before it was stored.
+  float loudness_lufs() const { return loudness_lufs_; }
+
+ private:
+  friend class AudioCache;
+  // kOtherKey: a well-formed entry of another track whose key hashes to the same file name.
+  enum class Parse { kOk, kOtherKey, kCorrupt };
+
+  CachedTrack(const uint8_t* base, std::size_t size) : base_(base), size_(size) {}
+  Parse parse(const std::string& key);
+
+  const uint8_t* base_;
+  std::size_t size_;
+  uint32_t frames_ = 0;
+  float loudness_lufs_ = std::numeric_limits<float>::quiet_NaN();
+  const uint8_t* ends_ = nullptr;  // frames_ little-endian uint32, possibly unaligned
+  const uint8_t* data_ = nullptr;
+};
+
+// Encoded tracks on disk, one frame-indexed file per track, keyed by a stable track id (the
+// backend's "netease:<id>") rather than the signed CDN URL that changes on every play. A repeat
+// play maps the file and streams its packets with no fetch, demux, resample or encode.
+//
+// Files are evicted least recently played first once the directory exceeds its byte budget; the
+// order survives restarts through the files' mtime. Thread-safe.
+class AudioCache {
+ public:
+  explicit AudioCache(AudioCacheConfig cfg);
+  AudioCache(const AudioCache&) = delete;
+  AudioCache& operator=(const AudioCache&) = delete;
+
+  bool enabled() const { return !cfg_.dir.empty(); }
+  // Tracks bigger than this are not recorded.
+  uint64_t max_track_bytes() const { return cfg_.max_bytes / 4; }
+
+  // Null on a miss. A hit counts as a use for eviction.
+  std::shared_ptr<const CachedTrack> open(const std::string& key);
+  // Writes a track that played to its end, then evicts down to the budget. Blocking file I/O.
+  void store(const std::string& key, const PacketLog& packets);
+
+ private:
+  struct Entry {
+    uint64_t bytes = 0;
+    std::list<std::string>::iterator lru;
+  };
+
+  std::string file_name(const std::string& key) const;
+  void drop_locked(const std::string& name);
+  void evict_locked();
+
+  const AudioCacheConfig cfg_;
+  std::mutex mu_;
+  std::list<std::string> lru_;  // file names, most recently played first
+  std::unordered_map<std::string, Entry> entries_;
+  uint64_t total_bytes_ = 0;
+};
+
+}  // namespace tsbot::voice
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace tsbot::voice {
+
+// Fixed output format of the playback engine: 48 kHz interleaved stereo, 20 ms per frame.
+inline constexpr int kSampleRate = 48000;
+inline constexpr int kChannels = 2;
+inline constexpr int kFrameMs = 20;
+inline constexpr int kFrameSamplesPerChannel = kSampleRate / 1000 * kFrameMs;
+inline constexpr int kFrameSamples = kFrameSamplesPerChannel * kChannels;
+inline constexpr std::size_t kFrameBytes = kFrameSamples * sizeof(int16_t);
+
+// Largest packet a single Opus frame can produce (RFC 6716).
+inline constexpr std::size_t kMaxOpusPacket = 1275;
+
+using PcmFrame = std::array<int16_t, kFrameSamples>;
+
+}  // namespace tsbot::voice
@@ -0,0 +1,62 @@
+#include "bot_registry.h"
+
+#include <algorithm>
+
+#include "env.h"
+#include "log.h"
+
+namespace tsbot::voice {
+
+Bot& BotRegistry::add(std::string id) {
+  bots_.push_back(std::make_unique<Bot>(std::move(id)));
+  return *bots_.back();
+}
+
+Bot* BotRegistry::find(std::string_view id) const {
+  if (bots_.empty()) return nullptr;
+  if (id.empty()) return bots_.front().get();
+  for (const auto& b : bots_) {
+    if (b->id == id) return b.get();
+  }
+  return nullptr;
+}
+
+Bot* BotRegistry::resolve(const grpc::ServerContext& ctx) const {
+  const auto& md = ctx.client_metadata();
+  const auto it = md.find(kBotMetadataKey);
+  if (it == md.end()) return find({});
+  return find(std::string_view(it->second.data(), it->second.size()));
+}
+
+namespace {
+
+// Ids end up in env var names, metric labels and TS3 device names.
+bool valid_bot_id(const std::string& id) {
+  return std::all_of(id.begin(), id.end(), [](char ch) {
+    return (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') || (ch >= '0' && ch <= '9') || ch == '_' || ch == '-';
+  });
+}
+
+}  // namespace
+
+std::vector<std::string> bot_ids_from_env() {
+  std::vector<std::string> ids;
+  const std::string raw = get_env("TSBOT_VOICE_BOTS");
+  std::size_t pos = 0;
+  while (pos <= raw.size()) {
+    const std::size_t end = std::min(raw.find(',', pos), raw.size());
+    std::string id = raw.substr(pos, end - pos);
+    id.erase(0, id.find_first_not_of(" \t"));
+    id.erase(id.find_last_not_of(" \t") + 1);
+    if (!valid_bot_id(id)) {
+      log_print("WARN TSBOT_VOICE_BOTS: ignoring bot id '", id, "' (use letters, digits, '_' or '-')");
+    } else if (!id.empty() && std::find(ids.begin(), ids.end(), id) == ids.end()) {
+      ids.push_back(std::move(id));
+    }
+    pos = end + 1;
+  }
+  if (ids.empty()) ids.emplace_back("default");
+  return ids;
+}
+
+}  // namespace tsbot::voice
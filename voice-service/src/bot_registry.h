@@ -0,0 +1,50 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <grpcpp/server_context.h>
+
+#include "event_bus.h"
+#include "playback_engine.h"
+#include "voice_service.h"
+
+namespace tsbot::voice {
+
+// gRPC metadata key selecting which bot a call is for. Absent or empty means the first bot, so
+// single-bot clients need no changes.
+inline constexpr const char* kBotMetadataKey = "x-tsbot-bot";
+
+// One hosted TS3 connection with its own engine and event stream. The sink and command target
+// (the connection itself) are owned by whoever builds the bot.
+struct Bot {
+  explicit Bot(std::string bot_id) : id(std::move(bot_id)) {}
+
+  const std::string id;
+  EventBus events;
+  std::unique_ptr<PlaybackEngine> engine;
+  std::unique_ptr<VoiceServiceImpl> service;
+};
+
+// The bots this process serves. Filled before the gRPC server starts and immutable afterwards, so
+// lookups need no locking.
+class BotRegistry {
+ public:
+  Bot& add(std::string id);
+  // Empty `id` is the first bot. Null if there is no such bot.
+  Bot* find(std::string_view id) const;
+  // The bot selected by the call's kBotMetadataKey header.
+  Bot* resolve(const grpc::ServerContext& ctx) const;
+
+  const std::vector<std::unique_ptr<Bot>>& bots() const { return bots_; }
+
+ private:
+  std::vector<std::unique_ptr<Bot>> bots_;
+};
+
+// Bot ids from TSBOT_VOICE_BOTS (comma-separated, duplicates dropped); {"default"} when unset.
+std::vector<std::string> bot_ids_from_env();
+
+}  // namespace tsbot::voice
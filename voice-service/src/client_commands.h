@@ -0,0 +1,27 @@
+#pragma once
+
+#include <string>
+
+namespace tsbot::voice {
+
+// Text-side commands for the voice connection. Implementations only queue: the actual server
+// round-trip happens on the connection's own command thread, never on a gRPC worker or the
+// send thread. Both return false when the command was dropped (queue full, not running).
+class ClientCommands {
+ public:
+  virtual ~ClientCommands() = default;
+
+  // `target_mode` 3 = server, anything else = the bot's current channel.
+  virtual bool send_notice(int target_mode, std::string text) = 0;
+  // `description` is already whitespace-compacted; escaping is up to the transport.
+  virtual bool set_description(std::string description) = 0;
+};
+
+// Accepts and drops everything; used when the service runs without a TS3 connection.
+class NullClientCommands final : public ClientCommands {
+ public:
+  bool send_notice(int, std::string) override { return true; }
+  bool set_description(std::string) override { return true; }
+};
+
+}  // namespace tsbot::voice
@@ -0,0 +1,151 @@
+#include "decode_pool.h"
+
+#include <algorithm>
+#include <chrono>
+
+#include "env.h"
+#include "send_clock.h"
+
+namespace tsbot::voice {
+
+namespace {
+
+// How often waiting tasks are polled: a small fraction of the ring, so a source whose readers
+// drained it below the refill mark resumes well before they run dry.
+constexpr auto kScanInterval = std::chrono::milliseconds(5);
+
+int64_t now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+}  // namespace
+
+DecodePoolConfig DecodePoolConfig::from_env() {
+  DecodePoolConfig c;
+  if (auto v = env_int("TSBOT_VOICE_DECODE_THREADS"); v && *v > 0) c.threads = static_cast<int>(*v);
+  return c;
+}
+
+DecodePool::DecodePool(DecodePoolConfig cfg) : audio_cpu_(cfg.audio_cpu) {
+  int n = cfg.threads;
+  // Two at least, so one source stuck opening a slow URL leaves a worker for the others.
+  if (n <= 0) n = std::max(2, static_cast<int>(std::thread::hardware_concurrency()));
+  workers_.reserve(static_cast<std::size_t>(n));
+  for (int i = 0; i < n; ++i) workers_.push_back(std::make_unique<Worker>());
+  for (std::size_t i = 0; i < workers_.size(); ++i) workers_[i]->thread = std::thread([this, i] { run(i); });
+}
+
+DecodePool::~DecodePool() {
+  {
+    std::lock_guard<std::mutex> lk(mu_);
+    stop_.store(true, std::memory_order_release);
+  }
+  cv_.notify_all();
+  for (auto& w : workers_) {
+    if (w->thread.joinable()) w->thread.join();
+  }
+}
+
+void DecodePool::submit(std::shared_ptr<DecodeTask> task) {
+  push(next_.fetch_add(1, std::memory_order_relaxed) % workers_.size(), std::move(task));
+}
+
+void DecodePool::push(std::size_t worker, std::shared_ptr<DecodeTask> task) {
+  {
+    std::lock_guard<std::mutex> lk(workers_[worker]->mu);
+    workers_[worker]->queue.push_back(std::move(task));
+  }
+  queued_.fetch_add(1, std::memory_order_release);
+  // An idle worker checks queued_ under mu_, so taking it here cannot miss that worker's wait.
+  { std::lock_guard<std::mutex> lk(mu_); }
+  cv_.notify_one();
+}
+
+std::shared_ptr<DecodeTask> DecodePool::take(std::size_t self) {
+  std::shared_ptr<DecodeTask> task;
+  {
+    Worker& w = *workers_[self];
+    std::lock_guard<std::mutex> lk(w.mu);
+    if (!w.queue.empty()) {
+      task = std::move(w.queue.front());
+      w.queue.pop_front();
+    }
+  }
+  for (std::size_t k = 1; !task && k < workers_.size(); ++k) {
+    Worker& victim = *workers_[(self + k) % workers_.size()];
+    std::lock_guard<std::mutex> lk(victim.mu);
+    if (!victim.queue.empty()) {
+      task = std::move(victim.queue.back());
+      victim.queue.pop_back();
+      steals_.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+  if (task) queued_.fetch_sub(1, std::memory_order_relaxed);
+  return task;
+}
+
+std::size_t DecodePool::scan_locked(std::size_t self) {
+  last_scan_ns_.store(now_ns(), std::memory_order_relaxed);
+  std::size_t moved = 0;
+  for (std::size_t i = 0; i < waiting_.size();) {
+    if (!waiting_[i]->ready()) {
+      ++i;
+      continue;
+    }
+    {
+      std::lock_guard<std::mutex> lk(workers_[self]->mu);
+      workers_[self]->queue.push_back(std::move(waiting_[i]));
+    }
+    queued_.fetch_add(1, std::memory_order_release);
+    waiting_[i] = std::move(waiting_.back());
+    waiting_.pop_back();
+    ++moved;
+  }
+  // This worker takes the first; the rest are up for grabs.
+  for (std::size_t i = 1; i < moved; ++i) cv_.notify_one();
+  return moved;
+}
+
+void DecodePool::run(std::size_t self) {
+  keep_off_audio_cpu("tsbot-decode", audio_cpu_);
+  const int64_t scan_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(kScanInterval).count();
+  while (!stop_.load(std::memory_order_acquire)) {
+    std::shared_ptr<DecodeTask> task = take(self);
+    if (!task) {
+      std::unique_lock<std::mutex> lk(mu_);
+      if (stop_.load(std::memory_order_relaxed)) break;
+      if (scan_locked(self) > 0 || queued_.load(std::memory_order_acquire) > 0) continue;
+      // One idle worker polls the waiting tasks on a timer; the others sleep until there is work.
+      if (!waiting_.empty() && !scanner_) {
+        scanner_ = true;
+        cv_.wait_for(lk, kScanInterval);
+        scanner_ = false;
+      } else {
+        cv_.wait(lk);
+      }
+      continue;
+    }
+
+    const DecodeTask::Step r = task->step();
+    steps_.fetch_add(1, std::memory_order_relaxed);
+    if (r == DecodeTask::Step::kAgain) {
+      push(self, std::move(task));
+    } else if (r == DecodeTask::Step::kWait) {
+      std::lock_guard<std::mutex> lk(mu_);
+      waiting_.push_back(std::move(task));
+      // Wake a sleeper to take up polling if nobody is.
+      if (!scanner_) cv_.notify_one();
+    }
+    // A kDone task is released here, on the worker, along with its decoder.
+    task.reset();
+
+    // Busy workers poll too, so waiting tasks come back even when no worker is idle.
+    if (now_ns() - last_scan_ns_.load(std::memory_order_relaxed) >= scan_ns) {
+      std::unique_lock<std::mutex> lk(mu_, std::try_to_lock);
+      if (lk.owns_lock()) scan_locked(self);
+    }
+  }
+}
+
+}  // namespace tsbot::voice
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace tsbot::voice {
+
+// A unit of decode work the pool runs a bounded step of at a time (see SharedSource).
+class DecodeTask {
+ public:
+  enum class Step {
+    kAgain,  // more to do right away
+    kWait,   // nothing to do until ready(): the ring is full or the input has nothing buffered
+    kDone,   // finished; the pool drops its reference
+  };
+
+  virtual ~DecodeTask() = default;
+  // Does a few frames' worth of work. Never runs on two workers at once.
+  virtual Step step() = 0;
+  // Whether a task that returned kWait has work again. Cheap and non-blocking; a pool worker polls
+  // it every few milliseconds, never concurrently with step().
+  virtual bool ready() = 0;
+};
+
+struct DecodePoolConfig {
+  // TSBOT_VOICE_DECODE_THREADS; 0 means one per CPU (at least two).
+  int threads = 0;
+  // Kept off this CPU like the other control-side threads; -1 for none.
+  int audio_cpu = -1;
+
+  static DecodePoolConfig from_env();
+};
+
+// Decode threads shared by every source of every bot, so a host runs as many decoders as it has
+// cores instead of one thread per playing track. Each worker has a queue of runnable tasks; it
+// runs the oldest of its own and, when it has none, steals the newest from another worker. A task
+// that returns kWait leaves the queues until ready() says otherwise, so a source waiting on the
+// network or on its readers holds no worker, and one slow source only ever costs the step it is
+// in. Steps are short, so a busy worker's backlog drains to idle ones within a frame or two.
+//
+// submit() is thread-safe. The send threads never touch the pool.
+class DecodePool {
+ public:
+  explicit DecodePool(DecodePoolConfig cfg);
+  // Stops the workers after their current step and drops the tasks still queued.
+  ~DecodePool();
+  DecodePool(const DecodePool&) = delete;
+  DecodePool& operator=(const DecodePool&) = delete;
+
+  void submit(std::shared_ptr<DecodeTask> task);
+
+  std::size_t threads() const { return workers_.size(); }
+  uint64_t steps() const { return steps_.load(std::memory_order_relaxed); }
+  // Tasks a worker took from another worker's queue.
+  uint64_t steals() const { return steals_.load(std::memory_order_relaxed); }
+
+ private:
+  struct Worker {
+    std::mutex mu;
+    std::deque<std::shared_ptr<DecodeTask>> queue;
+    std::thread thread;
+  };
+
+  void run(std::size_t self);
+  std::shared_ptr<DecodeTask> take(std::size_t self);
+  void push(std::size_t worker, std::shared_ptr<DecodeTask> task);
+  // Caller holds mu_. Moves waiting tasks that are ready onto `self`'s queue; returns how many.
+  std::size_t scan_locked(std::size_t self);
+
+  const int audio_cpu_;
+  std::vector<std::unique_ptr<Worker>> workers_;
+  std::atomic<std::size_t> next_{0};    // round-robin target for submit()
+  std::atomic<std::size_t> queued_{0};  // tasks in any worker's queue
+
+  std::mutex mu_;
+  std::condition_variable cv_;  // idle workers
+  std::vector<std::shared_ptr<DecodeTask>> waiting_;
+  bool scanner_ = false;  // an idle worker is polling waiting_ on a timer
+  std::atomic<bool> stop_{false};  // set under mu_
+  std::atomic<int64_t> last_scan_ns_{0};
+
+  std::atomic<uint64_t> steps_{0};
+  std::atomic<uint64_t> steals_{0};
+};
+
+}  // namespace tsbot::voice
@@ -0,0 +1,336 @@
+#include "dsp.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <string>
+
+#include "env.h"
+#include "log.h"
+
+namespace tsbot::voice {
+
+namespace {
+
+constexpr int kFadeInSamplesPerChannel = kSampleRate / 1000 * 80;
+constexpr float kBassCutoffHz = 150.0f;
+constexpr float kPi = 3.14159265358979f;
+constexpr float kBassAlpha = (2.0f * kPi * kBassCutoffHz) / (kSampleRate + 2.0f * kPi * kBassCutoffHz);
+constexpr float kEpsilon = 0.0001f;
+
+void scalar_s16_to_f32(const int16_t* in, float* out, int n, float gain) {
+  const float k = gain / 32768.0f;
+  for (int i = 0; i < n; ++i) out[i] = static_cast<float>(in[i]) * k;
+}
+
+void scalar_ramp_stereo(float* buf, int frames, float start, float step) {
+  for (int i = 0; i < frames; ++i) {
+    const float g = start + step * static_cast<float>(i);
+    buf[i * 2] *= g;
+    buf[i * 2 + 1] *= g;
+  }
+}
+
+void scalar_matrix_stereo(float* buf, int frames, float ll, float lr, float rl, float rr) {
+  for (int i = 0; i < frames; ++i) {
+    const float l = buf[i * 2];
+    const float r = buf[i * 2 + 1];
+    buf[i * 2] = ll * l + lr * r;
+    buf[i * 2 + 1] = rl * l + rr * r;
+  }
+}
+
+float limit_sample(float x) {
+  constexpr float kRange = 1.0f - kLimiterKnee;
+  const float a = std::fabs(x);
+  if (a <= kLimiterKnee) return x;
+  const float over = a - kLimiterKnee;
+  return std::copysign(kLimiterKnee + over * kRange / (kRange + over), x);
+}
+
+void scalar_limit_to_s16(float* buf, int16_t* out, int n, uint64_t* limited, float* peak) {
+  uint64_t c = 0;
+  float p = *peak;
+  for (int i = 0; i < n; ++i) {
+    const float a = std::fabs(buf[i]);
+    p = std::max(p, a);
+    if (a > kLimiterKnee) {
+      ++c;
+      buf[i] = limit_sample(buf[i]);
+    }
+    out[i] = static_cast<int16_t>(std::lrint(buf[i] * 32767.0f));
+  }
+  *limited += c;
+  *peak = p;
+}
+
+float scalar_deinterleave(const float* in, float* l, float* r, int frames) {
+  float p = 0.0f;
+  for (int i = 0; i < frames; ++i) {
+    l[i] = in[i * 2];
+    r[i] = in[i * 2 + 1];
+    p = std::max({p, std::fabs(l[i]), std::fabs(r[i])});
+  }
+  return p;
+}
+
+void scalar_comb_pair(const float* in, const float* tap0, float* line0, const float* tap1, float* line1, float* out,
+                      int n, float feedback) {
+  for (int i = 0; i < n; ++i) {
+    const float y0 = tap0[i];
+    const float y1 = tap1[i];
+    line0[i] = in[i] + y0 * feedback;
+    line1[i] = in[i] + y1 * feedback;
+    out[i] = (y0 + y1) * 0.5f;
+  }
+}
+
+void scalar_allpass(float* buf, const float* tap, float* line, int n, float feedback) {
+  for (int i = 0; i < n; ++i) {
+    const float x = buf[i];
+    const float b = tap[i];
+    line[i] = x + b * feedback;
+    buf[i] = b - x;
+  }
+}
+
+float scalar_wet_mix(float* buf, const float* wet_l, const float* wet_r, int frames, float mix, float mix_step,
+                     float gain) {
+  float p = 0.0f;
+  for (int i = 0; i < frames; ++i) {
+    const float m = mix + mix_step * static_cast<float>(i);
+    const float dry = 1.0f - m;
+    const float wet = m * gain;
+    buf[i * 2] = buf[i * 2] * dry + wet_l[i] * wet;
+    buf[i * 2 + 1] = buf[i * 2 + 1] * dry + wet_r[i] * wet;
+    p = std::max({p, std::fabs(wet_l[i]), std::fabs(wet_r[i])});
+  }
+  return p;
+}
+
+const DspKernels kScalarKernels = {
+    "scalar", &scalar_s16_to_f32, &scalar_ramp_stereo, &scalar_matrix_stereo, &scalar_limit_to_s16,
+    &scalar_deinterleave, &scalar_comb_pair, &scalar_allpass, &scalar_wet_mix,
+};
+
+const DspKernels* detect_best_kernels() {
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64)
+#if defined(__GNUC__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    if (const DspKernels* k = avx2_dsp_kernels()) return k;
+  }
+#endif
+  if (const DspKernels* k = sse2_dsp_kernels()) return k;
+#endif
+  if (const DspKernels* k = neon_dsp_kernels()) return k;
+  return &kScalarKernels;
+}
+
+}  // namespace
+
+#if !defined(TSBOT_DSP_X86)
+const DspKernels* sse2_dsp_kernels() { return nullptr; }
+const DspKernels* avx2_dsp_kernels() { return nullptr; }
+#endif
+#if !defined(TSBOT_DSP_NEON)
+const DspKernels* neon_dsp_kernels() { return nullptr; }
+#endif
+
+const DspKernels& scalar_dsp_kernels() { return kScalarKernels; }
+
+const DspKernels& select_dsp_kernels() {
+  static const DspKernels* const selected = [] {
+    const DspKernels* k = detect_best_kernels();
+    const std::string forced = get_env("TSBOT_VOICE_DSP");
+    if (!forced.empty()) {
+      const DspKernels* candidates[] = {&kScalarKernels, sse2_dsp_kernels(), avx2_dsp_kernels(), neon_dsp_kernels()};
+      const DspKernels* match = nullptr;
+      for (const DspKernels* c : candidates) {
+        if (c && forced == c->name) match = c;
+      }
+      if (match) {
+        k = match;
+      } else {
+        log_print("WARN TSBOT_VOICE_DSP=", forced, " not available, using ", k->name);
+      }
+    }
+    log_print("dsp kernels: ", k->name);
+    return k;
+  }();
+  return *selected;
+}
+
+FxSettings FxSettings::clamped() const {
+  FxSettings c = *this;
+  c.volume_percent = std::clamp(volume_percent, 0, 200);
+  c.pan = std::clamp(pan, -1.0f, 1.0f);
+  c.width = std::clamp(width, 0.0f, 3.0f);
+  c.bass_db = std::clamp(bass_db, 0.0f, 18.0f);
+  c.reverb_mix = std::clamp(reverb_mix, 0.0f, 1.0f);
+  return c;
+}
+
+DspParams DspParams::from(const FxSettings& in) {
+  const FxSettings fx = in.clamped();
+  DspParams p;
+
+  const float r = static_cast<float>(fx.volume_percent) / 100.0f;
+  p.volume = r <= 1.0f ? std::pow(r, 1.6f) : r;
+  p.gain = p.volume;
+
+  const float bass_gain = std::pow(10.0f, fx.bass_db / 20.0f);
+  p.bass = std::fabs(bass_gain - 1.0f) > kEpsilon;
+  p.bass_boost = bass_gain - 1.0f;
+
+  p.reverb_mix = fx.reverb_mix > kEpsilon ? fx.reverb_mix : 0.0f;
+
+  // Swap, then mid/side width, then balance pan, folded into one 2x2 matrix.
+  const bool width = std::fabs(fx.width - 1.0f) > kEpsilon;
+  const bool pan = std::fabs(fx.pan) > kEpsilon;
+  p.stereo = fx.swap_lr || width || pan;
+  if (p.stereo) {
+    const float w = width ? fx.width : 1.0f;
+    const float a = 0.5f * (1.0f + w);  // same-side weight
+    const float b = 0.5f * (1.0f - w);  // cross weight
+    const float lg = fx.pan >= 0.0f ? std::clamp(1.0f - fx.pan, 0.0f, 1.0f) : 1.0f;
+    const float rg = fx.pan >= 0.0f ? 1.0f : std::clamp(1.0f + fx.pan, 0.0f, 1.0f);
+    // Width matrix applied to (L, R) or, when swapped, to (R, L).
+    const float wl_l = fx.swap_lr ? b : a;
+    const float wl_r = fx.swap_lr ? a : b;
+    const float wr_l = fx.swap_lr ? a : b;
+    const float wr_r = fx.swap_lr ? b : a;
+    p.ll = lg * wl_l;
+    p.lr = lg * wl_r;
+    p.rl = rg * wr_l;
+    p.rr = rg * wr_r;
+  }
+  return p;
+}
+
+DspChain::DspChain() : k_(select_dsp_kernels()), reverb_(k_) { p_ = DspParams::from(settings_); }
+
+void DspChain::set_settings(const FxSettings& fx) {
+  if (fx == settings_ && !snap_) return;
+  settings_ = fx;
+  // A second change before the ramp ran simply retargets it from the same starting point.
+  if (!ramping_) from_ = p_;
+  p_ = DspParams::from(fx);
+  p_.gain = p_.volume * norm_gain_;
+  ramping_ = !snap_;
+  snap_ = false;
+}
+
+void DspChain::set_normalization(float gain) {
+  if (gain == norm_gain_) return;
+  norm_gain_ = gain;
+  if (!ramping_) from_ = p_;
+  p_.gain = p_.volume * gain;
+  ramping_ = !snap_;
+}
+
+void DspChain::reset() {
+  bass_lp_l_ = 0.0f;
+  bass_lp_r_ = 0.0f;
+  fade_pos_ = 0;
+  reverb_.reset();
+  ramping_ = false;
+  snap_ = true;
+}
+
+bool DspChain::transparent() const {
+  return settings_ == FxSettings{} && norm_gain_ == 1.0f && !ramping_ && !snap_ && fade_pos_ >= kFadeInSamplesPerChannel;
+}
+
+void DspChain::process(const int16_t* in, int16_t* out, float* f32_out, bool real_frame) {
+  if (ramping_) {
+    convert_ramped(in);
+  } else {
+    k_.s16_to_f32(in, buf_, kFrameSamples, p_.gain);
+  }
+
+  if (real_frame && fade_pos_ < kFadeInSamplesPerChannel) {
+    const float denom = static_cast<float>(kFadeInSamplesPerChannel);
+    k_.ramp_stereo(buf_, kFrameSamplesPerChannel, static_cast<float>(fade_pos_) / denom, 1.0f / denom);
+    fade_pos_ = std::min(fade_pos_ + kFrameSamplesPerChannel, kFadeInSamplesPerChannel);
+  }
+
+  if (ramping_) {
+    ramp_fx();
+    ramping_ = false;
+  } else {
+    apply_fx();
+  }
+
+  k_.limit_to_s16(buf_, out, kFrameSamples, &limited_, &peak_);
+  if (f32_out) std::memcpy(f32_out, buf_, sizeof(buf_));
+}
+
+void DspChain::convert_ramped(const int16_t* in) {
+  const float inv = 1.0f / static_cast<float>(kFrameSamplesPerChannel);
+  k_.s16_to_f32(in, buf_, kFrameSamples, 1.0f);
+  k_.ramp_stereo(buf_, kFrameSamplesPerChannel, from_.gain, (p_.gain - from_.gain) * inv);
+}
+
+// Interpolates every FX coefficient from from_ to p_ across the frame. Runs for one frame per
+// change, so the scalar matrix here costs nothing in steady state.
+void DspChain::ramp_fx() {
+  const float inv = 1.0f / static_cast<float>(kFrameSamplesPerChannel);
+
+  if (from_.bass || p_.bass) bass_shelf(from_.bass_boost, (p_.bass_boost - from_.bass_boost) * inv);
+
+  if (from_.reverb_mix > 0.0f || p_.reverb_mix > 0.0f) {
+    reverb_.process(buf_, kFrameSamplesPerChannel, from_.reverb_mix, (p_.reverb_mix - from_.reverb_mix) * inv);
+    // Switched off: the tail would otherwise come back the next time reverb is turned on.
+    if (p_.reverb_mix == 0.0f) reverb_.reset();
+  }
+
+  if (from_.stereo || p_.stereo) {
+    const float dll = (p_.ll - from_.ll) * inv;
+    const float dlr = (p_.lr - from_.lr) * inv;
+    const float drl = (p_.rl - from_.rl) * inv;
+    const float drr = (p_.rr - from_.rr) * inv;
+    for (int i = 0; i < kFrameSamplesPerChannel; ++i) {
+      const float t = static_cast<float>(i);
+      const float l = buf_[i * 2];
+      const float r = buf_[i * 2 + 1];
+      buf_[i * 2] = (from_.ll + dll * t) * l + (from_.lr + dlr * t) * r;
+      buf_[i * 2 + 1] = (from_.rl + drl * t) * l + (from_.rr + drr * t) * r;
+    }
+  }
+}
+
+void DspChain::apply_fx() {
+  if (p_.bass) bass_shelf(p_.bass_boost, 0.0f);
+
+  if (p_.reverb_mix > 0.0f) reverb_.process(buf_, kFrameSamplesPerChannel, p_.reverb_mix);
+
+  if (p_.stereo) k_.matrix_stereo(buf_, kFrameSamplesPerChannel, p_.ll, p_.lr, p_.rl, p_.rr);
+}
+
+// One-pole low shelf; the boost moves by `boost_step` per L/R pair. The recurrence is serial per
+// channel, so it stays scalar; L and R are independent chains the CPU overlaps.
+void DspChain::bass_shelf(float boost, float boost_step) {
+  float lp_l = bass_lp_l_;
+  float lp_r = bass_lp_r_;
+  for (int i = 0; i < kFrameSamplesPerChannel; ++i) {
+    const float b = boost + boost_step * static_cast<float>(i);
+    const float l = buf_[i * 2];
+    const float r = buf_[i * 2 + 1];
+    lp_l += kBassAlpha * (l - lp_l);
+    lp_r += kBassAlpha * (r - lp_r);
+    buf_[i * 2] = l + lp_l * b;
+    buf_[i * 2 + 1] = r + lp_r * b;
+  }
+  bass_lp_l_ = lp_l;
+  bass_lp_r_ = lp_r;
+}
+
+void DspChain::take_limit_stats(uint64_t* limited, float* peak) {
+  *limited = limited_;
+  *peak = peak_;
+  limited_ = 0;
+  peak_ = 0.0f;
+}
+
+}  // namespace tsbot::voice
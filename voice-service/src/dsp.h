@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstdint>
+
+#include "audio_format.h"
+#include "dsp_kernels.h"
+#include "reverb.h"
+
+namespace tsbot::voice {
+
+// User-facing FX controls, as set through SetVolume / SetAudioFx.
+struct FxSettings {
+  int volume_percent = 100;
+  float pan = 0.0f;         // -1 (left) .. 0 .. +1 (right), balance
+  float width = 1.0f;       // 0 (mono) .. 1 (normal) .. 3
+  bool swap_lr = false;
+  float bass_db = 0.0f;     // 0 .. 18
+  float reverb_mix = 0.0f;  // 0 .. 1
+
+  // Clamps every field to the range SetVolume / SetAudioFx accept.
+  FxSettings clamped() const;
+  bool operator==(const FxSettings&) const = default;
+};
+
+// Per-frame coefficients derived from FxSettings. Rebuilt only when the settings change, so the
+// frame loop never evaluates pow()/exp().
+struct DspParams {
+  float volume = 1.0f;  // the SetVolume curve
+  float gain = 1.0f;    // volume times the loudness normalization gain, applied in one multiply
+  bool bass = false;
+  float bass_boost = 0.0f;  // linear bass gain - 1
+  bool stereo = false;      // any of swap/width/pan active
+  float ll = 1.0f, lr = 0.0f, rl = 0.0f, rr = 1.0f;
+  float reverb_mix = 0.0f;
+
+  static DspParams from(const FxSettings& fx);
+};
+
+// The engine's FX chain for one track: s16 -> f32 with volume, fade-in, bass shelf, reverb,
+// swap/width/pan, soft limiter back to s16. Processes one whole 960x2 frame per call.
+//
+// A settings change takes effect at the next frame boundary and is ramped linearly, per sample,
+// across that frame so volume and FX moves do not click.
+class DspChain {
+ public:
+  DspChain();
+
+  void set_settings(const FxSettings& fx);
+  const FxSettings& settings() const { return settings_; }
+  // Engine-side gain on top of the volume: loudness normalization for the track (see
+  // LoudnessConfig) times ducking. Merged into the volume gain and ramped across the next frame
+  // like a settings change; reset() leaves it as it is. A no-op when unchanged.
+  void set_normalization(float gain);
+  // Start of a new track: clears filter/reverb state and restarts the fade-in. The next
+  // set_settings() applies without a ramp.
+  void reset();
+  // True when process() would hand a real frame back unchanged up to requantization: default
+  // settings, unity normalization, no ramp pending and the fade-in done. The engine then skips
+  // the chain.
+  bool transparent() const;
+
+  // `real_frame` is false for underrun silence, which does not advance the fade-in.
+  // `f32_out`, if non-null, receives the limited float frame (for the Opus encoder).
+  void process(const int16_t* in, int16_t* out, float* f32_out, bool real_frame);
+
+  const char* kernel_name() const { return k_.name; }
+
+  // Samples the output limiter bent, and the largest absolute sample before it, since the last
+  // take_limit_stats().
+  void take_limit_stats(uint64_t* limited, float* peak);
+
+ private:
+  void convert_ramped(const int16_t* in);
+  void ramp_fx();
+  void apply_fx();
+  void bass_shelf(float boost, float boost_step);
+
+  const DspKernels& k_;
+  FxSettings settings_;
+  DspParams p_;
+  DspParams from_;  // params in effect before the pending ramp
+  bool ramping_ = false;
+  bool snap_ = true;
+  float norm_gain_ = 1.0f;
+
+  alignas(32) float buf_[kFrameSamples] = {};
+  float bass_lp_l_ = 0.0f;
+  float bass_lp_r_ = 0.0f;
+  int fade_pos_ = 0;
+  SimpleReverb reverb_;
+
+  uint64_t limited_ = 0;
+  float peak_ = 0.0f;
+};
+
+}  // namespace tsbot::voice
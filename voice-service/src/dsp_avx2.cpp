@@ -0,0 +1,240 @@
+// AVX2 kernels. Built with -mavx2 and only reached after a runtime CPU check, so this file must
+// not pull in inline library code that could be shared with non-AVX translation units.
+#include <immintrin.h>
+
+#include "dsp_kernels.h"
+
+namespace tsbot::voice {
+
+namespace {
+
+float hmax(__m256 v) {
+  alignas(32) float t[8];
+  _mm256_store_ps(t, v);
+  float m = t[0];
+  for (int i = 1; i < 8; ++i) m = t[i] > m ? t[i] : m;
+  return m;
+}
+
+int16_t to_s16(float x) {
+  const float v = x < -1.0f ? -1.0f : (x > 1.0f ? 1.0f : x);
+  return static_cast<int16_t>(_mm_cvtss_si32(_mm_set_ss(v * 32767.0f)));
+}
+
+void s16_to_f32(const int16_t* in, float* out, int n, float gain) {
+  const float k = gain / 32768.0f;
+  const __m256 kv = _mm256_set1_ps(k);
+  int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    const __m128i x0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+    const __m128i x1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i + 8));
+    _mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(x0)), kv));
+    _mm256_storeu_ps(out + i + 8, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(x1)), kv));
+  }
+  for (; i < n; ++i) out[i] = static_cast<float>(in[i]) * k;
+}
+
+void ramp_stereo(float* buf, int frames, float start, float step) {
+  __m256 g = _mm256_add_ps(_mm256_set1_ps(start),
+                           _mm256_mul_ps(_mm256_set1_ps(step), _mm256_setr_ps(0, 0, 1, 1, 2, 2, 3, 3)));
+  const __m256 inc = _mm256_set1_ps(4.0f * step);
+  int i = 0;
+  for (; i + 4 <= frames; i += 4) {
+    float* p = buf + i * 2;
+    _mm256_storeu_ps(p, _mm256_mul_ps(_mm256_loadu_ps(p), g));
+    g = _mm256_add_ps(g, inc);
+  }
+  for (; i < frames; ++i) {
+    const float gs = start + step * static_cast<float>(i);
+    buf[i * 2] *= gs;
+    buf[i * 2 + 1] *= gs;
+  }
+}
+
+void matrix_stereo(float* buf, int frames, float ll, float lr, float rl, float rr) {
+  const __m256 a = _mm256_setr_ps(ll, rl, ll, rl, ll, rl, ll, rl);
+  const __m256 b = _mm256_setr_ps(lr, rr, lr, rr, lr, rr, lr, rr);
+  int i = 0;
+  for (; i + 4 <= frames; i += 4) {
+    float* p = buf + i * 2;
+    const __m256 v = _mm256_loadu_ps(p);
+    const __m256 l = _mm256_shuffle_ps(v, v, _MM_SHUFFLE(2, 2, 0, 0));
+    const __m256 r = _mm256_shuffle_ps(v, v, _MM_SHUFFLE(3, 3, 1, 1));
+    _mm256_storeu_ps(p, _mm256_add_ps(_mm256_mul_ps(l, a), _mm256_mul_ps(r, b)));
+  }
+  for (; i < frames; ++i) {
+    const float l = buf[i * 2];
+    const float r = buf[i * 2 + 1];
+    buf[i * 2] = ll * l + lr * r;
+    buf[i * 2 + 1] = rl * l + rr * r;
+  }
+}
+
+// Eight samples through the limiter; `a` is their absolute value. See DspKernels::limit_to_s16.
+__m256 limit8(__m256 v, __m256 a) {
+  const __m256 knee = _mm256_set1_ps(kLimiterKnee);
+  const __m256 range = _mm256_set1_ps(1.0f - kLimiterKnee);
+  const __m256 over = _mm256_max_ps(_mm256_sub_ps(a, knee), _mm256_setzero_ps());
+  // Below the knee `bent` is the knee itself, so the min keeps those samples as they are.
+  const __m256 bent = _mm256_add_ps(knee, _mm256_div_ps(_mm256_mul_ps(over, range), _mm256_add_ps(range, over)));
+  return _mm256_or_ps(_mm256_min_ps(a, bent), _mm256_and_ps(_mm256_set1_ps(-0.0f), v));
+}
+
+void limit_to_s16(float* buf, int16_t* out, int n, uint64_t* limited, float* peak) {
+  const __m256 sign = _mm256_set1_ps(-0.0f);
+  const __m256 knee = _mm256_set1_ps(kLimiterKnee);
+  const __m256 scale = _mm256_set1_ps(32767.0f);
+  __m256 pk = _mm256_set1_ps(*peak);
+  uint64_t c = 0;
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256 v = _mm256_loadu_ps(buf + i);
+    const __m256 a = _mm256_andnot_ps(sign, v);
+    pk = _mm256_max_ps(pk, a);
+    // Nearly all of a normal frame is below the knee; only vectors with a sample over it pay the divide.
+    if (const int over = _mm256_movemask_ps(_mm256_cmp_ps(a, knee, _CMP_GT_OQ))) {
+      c += static_cast<uint64_t>(__builtin_popcount(over));
+      v = limit8(v, a);
+      _mm256_storeu_ps(buf + i, v);
+    }
+    const __m256i q = _mm256_cvtps_epi32(_mm256_mul_ps(v, scale));
+    const __m128i packed = _mm_packs_epi32(_mm256_castsi256_si128(q), _mm256_extracti128_si256(q, 1));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), packed);
+  }
+  float p = hmax(pk);
+  for (; i < n; ++i) {
+    const float a = buf[i] < 0.0f ? -buf[i] : buf[i];
+    if (a > p) p = a;
+    if (a > kLimiterKnee) {
+      ++c;
+      const float over = a - kLimiterKnee;
+      const float y = kLimiterKnee + over * (1.0f - kLimiterKnee) / (1.0f - kLimiterKnee + over);
+      buf[i] = buf[i] < 0.0f ? -y : y;
+    }
+    out[i] = to_s16(buf[i]);
+  }
+  *limited += c;
+  *peak = p;
+}
+
+// [a0 a1 a2 a3 | a4 a5 a6 a7] with 64-bit pairs reordered 0, 2, 1, 3: undoes the in-lane split
+// of _mm256_shuffle_ps / _mm256_unpack*_ps across the two 128-bit halves.
+__m256 cross_lanes(__m256 v) {
+  return _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(v), _MM_SHUFFLE(3, 1, 2, 0)));
+}
+
+float deinterleave(const float* in, float* l, float* r, int frames) {
+  const __m256 sign = _mm256_set1_ps(-0.0f);
+  __m256 pk = _mm256_setzero_ps();
+  int i = 0;
+  for (; i + 8 <= frames; i += 8) {
+    const __m256 v0 = _mm256_loadu_ps(in + i * 2);
+    const __m256 v1 = _mm256_loadu_ps(in + i * 2 + 8);
+    pk = _mm256_max_ps(pk, _mm256_max_ps(_mm256_andnot_ps(sign, v0), _mm256_andnot_ps(sign, v1)));
+    _mm256_storeu_ps(l + i, cross_lanes(_mm256_shuffle_ps(v0, v1, _MM_SHUFFLE(2, 0, 2, 0))));
+    _mm256_storeu_ps(r + i, cross_lanes(_mm256_shuffle_ps(v0, v1, _MM_SHUFFLE(3, 1, 3, 1))));
+  }
+  float p = hmax(pk);
+  for (; i < frames; ++i) {
+    l[i] = in[i * 2];
+    r[i] = in[i * 2 + 1];
+    const float al = l[i] < 0.0f ? -l[i] : l[i];
+    const float ar = r[i] < 0.0f ? -r[i] : r[i];
+    if (al > p) p = al;
+    if (ar > p) p = ar;
+  }
+  return p;
+}
+
+void comb_pair(const float* in, const float* tap0, float* line0, const float* tap1, float* line1, float* out, int n,
+               float feedback) {
+  const __m256 fb = _mm256_set1_ps(feedback);
+  const __m256 half = _mm256_set1_ps(0.5f);
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const __m256 x = _mm256_loadu_ps(in + i);
+    const __m256 y0 = _mm256_loadu_ps(tap0 + i);
+    const __m256 y1 = _mm256_loadu_ps(tap1 + i);
+    _mm256_storeu_ps(line0 + i, _mm256_add_ps(x, _mm256_mul_ps(y0, fb)));
+    _mm256_storeu_ps(line1 + i, _mm256_add_ps(x, _mm256_mul_ps(y1, fb)));
+    _mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_add_ps(y0, y1), half));
+  }
+  for (; i < n; ++i) {
+    const float y0 = tap0[i];
+    const float y1 = tap1[i];
+    line0[i] = in[i] + y0 * feedback;
+    line1[i] = in[i] + y1 * feedback;
+    out[i] = (y0 + y1) * 0.5f;
+  }
+}
+
+void allpass(float* buf, const float* tap, float* line, int n, float feedback) {
+  const __m256 fb = _mm256_set1_ps(feedback);
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const __m256 x = _mm256_loadu_ps(buf + i);
+    const __m256 b = _mm256_loadu_ps(tap + i);
+    _mm256_storeu_ps(line + i, _mm256_add_ps(x, _mm256_mul_ps(b, fb)));
+    _mm256_storeu_ps(buf + i, _mm256_sub_ps(b, x));
+  }
+  for (; i < n; ++i) {
+    const float x = buf[i];
+    const float b = tap[i];
+    line[i] = x + b * feedback;
+    buf[i] = b - x;
+  }
+}
+
+float wet_mix(float* buf, const float* wet_l, const float* wet_r, int frames, float mix, float mix_step, float gain) {
+  const __m256 sign = _mm256_set1_ps(-0.0f);
+  const __m256 one = _mm256_set1_ps(1.0f);
+  const __m256 g = _mm256_set1_ps(gain);
+  __m256 m = _mm256_add_ps(_mm256_set1_ps(mix),
+                           _mm256_mul_ps(_mm256_set1_ps(mix_step), _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7)));
+  const __m256 inc = _mm256_set1_ps(8.0f * mix_step);
+  __m256 pk = _mm256_setzero_ps();
+  int i = 0;
+  for (; i + 8 <= frames; i += 8) {
+    const __m256 wl = _mm256_loadu_ps(wet_l + i);
+    const __m256 wr = _mm256_loadu_ps(wet_r + i);
+    pk = _mm256_max_ps(pk, _mm256_max_ps(_mm256_andnot_ps(sign, wl), _mm256_andnot_ps(sign, wr)));
+    const __m256 dry = _mm256_sub_ps(one, m);
+    const __m256 wet = _mm256_mul_ps(m, g);
+    const __m256 yl = _mm256_mul_ps(wl, wet);
+    const __m256 yr = _mm256_mul_ps(wr, wet);
+    // unpack interleaves within each 128-bit half; the permutes put pairs 0-3 and 4-7 together.
+    const __m256 d_lo = _mm256_unpacklo_ps(dry, dry);
+    const __m256 d_hi = _mm256_unpackhi_ps(dry, dry);
+    const __m256 y_lo = _mm256_unpacklo_ps(yl, yr);
+    const __m256 y_hi = _mm256_unpackhi_ps(yl, yr);
+    float* p = buf + i * 2;
+    _mm256_storeu_ps(p, _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(p), _mm256_permute2f128_ps(d_lo, d_hi, 0x20)),
+                                      _mm256_permute2f128_ps(y_lo, y_hi, 0x20)));
+    _mm256_storeu_ps(p + 8,
+                     _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(p + 8), _mm256_permute2f128_ps(d_lo, d_hi, 0x31)),
+                                   _mm256_permute2f128_ps(y_lo, y_hi, 0x31)));
+    m = _mm256_add_ps(m, inc);
+  }
+  float p = hmax(pk);
+  for (; i < frames; ++i) {
+    const float mi = mix + mix_step * static_cast<float>(i);
+    const float dry = 1.0f - mi;
+    const float wet = mi * gain;
+    buf[i * 2] = buf[i * 2] * dry + wet_l[i] * wet;
+    buf[i * 2 + 1] = buf[i * 2 + 1] * dry + wet_r[i] * wet;
+    const float al = wet_l[i] < 0.0f ? -wet_l[i] : wet_l[i];
+    const float ar = wet_r[i] < 0.0f ? -wet_r[i] : wet_r[i];
+    if (al > p) p = al;
+    if (ar > p) p = ar;
+  }
+  return p;
+}
+
+const DspKernels kKernels = {"avx2", &s16_to_f32, &ramp_stereo, &matrix_stereo, &limit_to_s16,
+                             &deinterleave, &comb_pair, &allpass, &wet_mix};
+
+}  // namespace
+
+const DspKernels* avx2_dsp_kernels() { return &kKernels; }
+
+}  // namespace tsbot::voice
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstdint>
+
+namespace tsbot::voice {
+
+// -1 dBFS. Where the output limiter starts to bend the signal.
+inline constexpr float kLimiterKnee = 0.891f;
+
+// Per-ISA inner loops of the FX chain. Every kernel works on whole interleaved stereo frames;
+// `n` counts samples (both channels), `frames` counts L/R pairs.
+struct DspKernels {
+  const char* name;
+  // out[i] = in[i] / 32768 * gain
+  void (*s16_to_f32)(const int16_t* in, float* out, int n, float gain);
+  // Scales pair i by (start + i * step); used for the fade-in ramp.
+  void (*ramp_stereo)(float* buf, int frames, float start, float step);
+  // L' = ll * L + lr * R, R' = rl * L + rr * R. Swap, width and pan folded into one matrix.
+  void (*matrix_stereo)(float* buf, int frames, float ll, float lr, float rl, float rr);
+  // Output limiter: soft-limits `buf` in place and converts it to s16. Samples up to kLimiterKnee
+  // pass unchanged; above it, x becomes knee + over * r / (r + over), with over = |x| - knee and
+  // r = 1 - knee, which meets the identity with the same slope and never reaches full scale. Adds
+  // the number of samples over the knee to `limited` and raises `peak` to the largest absolute
+  // input value.
+  void (*limit_to_s16)(float* buf, int16_t* out, int n, uint64_t* limited, float* peak);
+
+  // Reverb building blocks (see SimpleReverb). These work on planar runs of one channel, `n`
+  // samples long. A delay line's `tap` (what was written `delay` samples ago) never overlaps the
+  // `line` span the same call writes.
+  // Splits L/R pairs into two planar runs; returns the largest absolute input.
+  float (*deinterleave)(const float* in, float* l, float* r, int frames);
+  // Two feedback combs on the same input: line_k[i] = in[i] + tap_k[i] * feedback,
+  // out[i] = (tap0[i] + tap1[i]) / 2.
+  void (*comb_pair)(const float* in, const float* tap0, float* line0, const float* tap1, float* line1, float* out,
+                    int n, float feedback);
+  // Schroeder allpass, in place: line[i] = buf[i] + tap[i] * feedback, buf[i] = tap[i] - buf[i].
+  void (*allpass)(float* buf, const float* tap, float* line, int n, float feedback);
+  // Pair i of `buf` becomes dry * (1 - m) + wet * m * gain, with m = mix + mix_step * i. Returns the
+  // largest absolute wet input.
+  float (*wet_mix)(float* buf, const float* wet_l, const float* wet_r, int frames, float mix, float mix_step,
+                   float gain);
+};
+
+const DspKernels& scalar_dsp_kernels();
+// Null when the build does not include that path.
+const DspKernels* sse2_dsp_kernels();
+const DspKernels* avx2_dsp_kernels();
+const DspKernels* neon_dsp_kernels();
+
+// Best path the running CPU supports. TSBOT_VOICE_DSP=scalar|sse2|avx2|neon forces one.
+const DspKernels& select_dsp_kernels();
+
+}  // namespace tsbot::voice
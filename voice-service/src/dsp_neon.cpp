@@ -0,0 +1,200 @@
+// NEON kernels (AArch64).
+#include <arm_neon.h>
+
+#include <cmath>
+
+#include "dsp_kernels.h"
+
+namespace tsbot::voice {
+
+namespace {
+
+void s16_to_f32(const int16_t* in, float* out, int n, float gain) {
+  const float k = gain / 32768.0f;
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const int16x8_t x = vld1q_s16(in + i);
+    vst1q_f32(out + i, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(x))), k));
+    vst1q_f32(out + i + 4, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(x))), k));
+  }
+  for (; i < n; ++i) out[i] = static_cast<float>(in[i]) * k;
+}
+
+void ramp_stereo(float* buf, int frames, float start, float step) {
+  const float init[4] = {0.0f, 1.0f, 2.0f, 3.0f};
+  float32x4_t g = vmlaq_n_f32(vdupq_n_f32(start), vld1q_f32(init), step);
+  const float32x4_t inc = vdupq_n_f32(4.0f * step);
+  int i = 0;
+  for (; i + 4 <= frames; i += 4) {
+    float32x4x2_t v = vld2q_f32(buf + i * 2);
+    v.val[0] = vmulq_f32(v.val[0], g);
+    v.val[1] = vmulq_f32(v.val[1], g);
+    vst2q_f32(buf + i * 2, v);
+    g = vaddq_f32(g, inc);
+  }
+  for (; i < frames; ++i) {
+    const float gs = start + step * static_cast<float>(i);
+    buf[i * 2] *= gs;
+    buf[i * 2 + 1] *= gs;
+  }
+}
+
+void matrix_stereo(float* buf, int frames, float ll, float lr, float rl, float rr) {
+  int i = 0;
+  for (; i + 4 <= frames; i += 4) {
+    const float32x4x2_t v = vld2q_f32(buf + i * 2);
+    float32x4x2_t o;
+    o.val[0] = vmlaq_n_f32(vmulq_n_f32(v.val[0], ll), v.val[1], lr);
+    o.val[1] = vmlaq_n_f32(vmulq_n_f32(v.val[0], rl), v.val[1], rr);
+    vst2q_f32(buf + i * 2, o);
+  }
+  for (; i < frames; ++i) {
+    const float l = buf[i * 2];
+    const float r = buf[i * 2 + 1];
+    buf[i * 2] = ll * l + lr * r;
+    buf[i * 2 + 1] = rl * l + rr * r;
+  }
+}
+
+// Four samples through the limiter; `a` is their absolute value. See DspKernels::limit_to_s16.
+float32x4_t limit4(float32x4_t v, float32x4_t a) {
+  const float32x4_t knee = vdupq_n_f32(kLimiterKnee);
+  const float32x4_t range = vdupq_n_f32(1.0f - kLimiterKnee);
+  const float32x4_t over = vmaxq_f32(vsubq_f32(a, knee), vdupq_n_f32(0.0f));
+  // Below the knee `bent` is the knee itself, so the min keeps those samples as they are.
+  const float32x4_t bent = vaddq_f32(knee, vdivq_f32(vmulq_f32(over, range), vaddq_f32(range, over)));
+  return vbslq_f32(vdupq_n_u32(0x80000000u), v, vminq_f32(a, bent));
+}
+
+void limit_to_s16(float* buf, int16_t* out, int n, uint64_t* limited, float* peak) {
+  const float32x4_t knee = vdupq_n_f32(kLimiterKnee);
+  float32x4_t pk = vdupq_n_f32(*peak);
+  uint64_t c = 0;
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    float32x4_t v0 = vld1q_f32(buf + i);
+    float32x4_t v1 = vld1q_f32(buf + i + 4);
+    const float32x4_t a0 = vabsq_f32(v0);
+    const float32x4_t a1 = vabsq_f32(v1);
+    pk = vmaxq_f32(pk, vmaxq_f32(a0, a1));
+    const uint32_t over = vaddvq_u32(vshrq_n_u32(vcgtq_f32(a0, knee), 31)) +
+                          vaddvq_u32(vshrq_n_u32(vcgtq_f32(a1, knee), 31));
+    // Nearly all of a normal frame is below the knee; only vectors with a sample over it pay the divide.
+    if (over) {
+      c += over;
+      v0 = limit4(v0, a0);
+      v1 = limit4(v1, a1);
+      vst1q_f32(buf + i, v0);
+      vst1q_f32(buf + i + 4, v1);
+    }
+    const int32x4_t q0 = vcvtnq_s32_f32(vmulq_n_f32(v0, 32767.0f));
+    const int32x4_t q1 = vcvtnq_s32_f32(vmulq_n_f32(v1, 32767.0f));
+    vst1q_s16(out + i, vcombine_s16(vqmovn_s32(q0), vqmovn_s32(q1)));
+  }
+  float p = vmaxvq_f32(pk);
+  for (; i < n; ++i) {
+    const float a = std::fabs(buf[i]);
+    if (a > p) p = a;
+    if (a > kLimiterKnee) {
+      ++c;
+      buf[i] = vgetq_lane_f32(limit4(vdupq_n_f32(buf[i]), vdupq_n_f32(a)), 0);
+    }
+    out[i] = static_cast<int16_t>(std::lrint(buf[i] * 32767.0f));
+  }
+  *limited += c;
+  *peak = p;
+}
+
+float deinterleave(const float* in, float* l, float* r, int frames) {
+  float32x4_t pk = vdupq_n_f32(0.0f);
+  int i = 0;
+  for (; i + 4 <= frames; i += 4) {
+    const float32x4x2_t v = vld2q_f32(in + i * 2);
+    pk = vmaxq_f32(pk, vmaxq_f32(vabsq_f32(v.val[0]), vabsq_f32(v.val[1])));
+    vst1q_f32(l + i, v.val[0]);
+    vst1q_f32(r + i, v.val[1]);
+  }
+  float p = vmaxvq_f32(pk);
+  for (; i < frames; ++i) {
+    l[i] = in[i * 2];
+    r[i] = in[i * 2 + 1];
+    p = std::fmax(p, std::fmax(std::fabs(l[i]), std::fabs(r[i])));
+  }
+  return p;
+}
+
+void comb_pair(const float* in, const float* tap0, float* line0, const float* tap1, float* line1, float* out, int n,
+               float feedback) {
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    const float32x4_t x = vld1q_f32(in + i);
+    const float32x4_t y0 = vld1q_f32(tap0 + i);
+    const float32x4_t y1 = vld1q_f32(tap1 + i);
+    vst1q_f32(line0 + i, vmlaq_n_f32(x, y0, feedback));
+    vst1q_f32(line1 + i, vmlaq_n_f32(x, y1, feedback));
+    vst1q_f32(out + i, vmulq_n_f32(vaddq_f32(y0, y1), 0.5f));
+  }
+  for (; i < n; ++i) {
+    const float y0 = tap0[i];
+    const float y1 = tap1[i];
+    line0[i] = in[i] + y0 * feedback;
+    line1[i] = in[i] + y1 * feedback;
+    out[i] = (y0 + y1) * 0.5f;
+  }
+}
+
+void allpass(float* buf, const float* tap, float* line, int n, float feedback) {
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    const float32x4_t x = vld1q_f32(buf + i);
+    const float32x4_t b = vld1q_f32(tap + i);
+    vst1q_f32(line + i, vmlaq_n_f32(x, b, feedback));
+    vst1q_f32(buf + i, vsubq_f32(b, x));
+  }
+  for (; i < n; ++i) {
+    const float x = buf[i];
+    const float b = tap[i];
+    line[i] = x + b * feedback;
+    buf[i] = b - x;
+  }
+}
+
+float wet_mix(float* buf, const float* wet_l, const float* wet_r, int frames, float mix, float mix_step, float gain) {
+  const float init[4] = {0.0f, 1.0f, 2.0f, 3.0f};
+  float32x4_t m = vmlaq_n_f32(vdupq_n_f32(mix), vld1q_f32(init), mix_step);
+  const float32x4_t inc = vdupq_n_f32(4.0f * mix_step);
+  const float32x4_t one = vdupq_n_f32(1.0f);
+  float32x4_t pk = vdupq_n_f32(0.0f);
+  int i = 0;
+  for (; i + 4 <= frames; i += 4) {
+    const float32x4_t wl = vld1q_f32(wet_l + i);
+    const float32x4_t wr = vld1q_f32(wet_r + i);
+    pk = vmaxq_f32(pk, vmaxq_f32(vabsq_f32(wl), vabsq_f32(wr)));
+    const float32x4_t dry = vsubq_f32(one, m);
+    const float32x4_t wet = vmulq_n_f32(m, gain);
+    float32x4x2_t v = vld2q_f32(buf + i * 2);
+    v.val[0] = vmlaq_f32(vmulq_f32(v.val[0], dry), wl, wet);
+    v.val[1] = vmlaq_f32(vmulq_f32(v.val[1], dry), wr, wet);
+    vst2q_f32(buf + i * 2, v);
+    m = vaddq_f32(m, inc);
+  }
+  float p = vmaxvq_f32(pk);
+  for (; i < frames; ++i) {
+    const float mi = mix + mix_step * static_cast<float>(i);
+    const float dry = 1.0f - mi;
+    const float wet = mi * gain;
+    buf[i * 2] = buf[i * 2] * dry + wet_l[i] * wet;
+    buf[i * 2 + 1] = buf[i * 2 + 1] * dry + wet_r[i] * wet;
+    p = std::fmax(p, std::fmax(std::fabs(wet_l[i]), std::fabs(wet_r[i])));
+  }
+  return p;
+}
+
+const DspKernels kKernels = {"neon", &s16_to_f32, &ramp_stereo, &matrix_stereo, &limit_to_s16,
+                             &deinterleave, &comb_pair, &allpass, &wet_mix};
+
+}  // namespace
+
+const DspKernels* neon_dsp_kernels() { return &kKernels; }
+
+}  // namespace tsbot::voice
@@ -0,0 +1,224 @@
+// SSE2 kernels. Baseline on every x86-64 CPU.
+#include <emmintrin.h>
+
+#include <cmath>
+
+#include "dsp_kernels.h"
+
+namespace tsbot::voice {
+
+namespace {
+
+float hmax(__m128 v) {
+  alignas(16) float t[4];
+  _mm_store_ps(t, v);
+  float m = t[0];
+  for (int i = 1; i < 4; ++i) m = t[i] > m ? t[i] : m;
+  return m;
+}
+
+void s16_to_f32(const int16_t* in, float* out, int n, float gain) {
+  const float k = gain / 32768.0f;
+  const __m128 kv = _mm_set1_ps(k);
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+    const __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16);
+    const __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16);
+    _mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), kv));
+    _mm_storeu_ps(out + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), kv));
+  }
+  for (; i < n; ++i) out[i] = static_cast<float>(in[i]) * k;
+}
+
+void ramp_stereo(float* buf, int frames, float start, float step) {
+  __m128 g = _mm_add_ps(_mm_set1_ps(start), _mm_mul_ps(_mm_set1_ps(step), _mm_setr_ps(0, 0, 1, 1)));
+  const __m128 inc = _mm_set1_ps(2.0f * step);
+  int i = 0;
+  for (; i + 2 <= frames; i += 2) {
+    float* p = buf + i * 2;
+    _mm_storeu_ps(p, _mm_mul_ps(_mm_loadu_ps(p), g));
+    g = _mm_add_ps(g, inc);
+  }
+  for (; i < frames; ++i) {
+    const float gs = start + step * static_cast<float>(i);
+    buf[i * 2] *= gs;
+    buf[i * 2 + 1] *= gs;
+  }
+}
+
+void matrix_stereo(float* buf, int frames, float ll, float lr, float rl, float rr) {
+  const __m128 a = _mm_setr_ps(ll, rl, ll, rl);
+  const __m128 b = _mm_setr_ps(lr, rr, lr, rr);
+  int i = 0;
+  for (; i + 2 <= frames; i += 2) {
+    float* p = buf + i * 2;
+    const __m128 v = _mm_loadu_ps(p);
+    const __m128 l = _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 2, 0, 0));
+    const __m128 r = _mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 3, 1, 1));
+    _mm_storeu_ps(p, _mm_add_ps(_mm_mul_ps(l, a), _mm_mul_ps(r, b)));
+  }
+  for (; i < frames; ++i) {
+    const float l = buf[i * 2];
+    const float r = buf[i * 2 + 1];
+    buf[i * 2] = ll * l + lr * r;
+    buf[i * 2 + 1] = rl * l + rr * r;
+  }
+}
+
+// Four samples through the limiter; `a` is their absolute value. See DspKernels::limit_to_s16.
+__m128 limit4(__m128 v, __m128 a) {
+  const __m128 knee = _mm_set1_ps(kLimiterKnee);
+  const __m128 range = _mm_set1_ps(1.0f - kLimiterKnee);
+  const __m128 over = _mm_max_ps(_mm_sub_ps(a, knee), _mm_setzero_ps());
+  // Below the knee `bent` is the knee itself, so the min keeps those samples as they are.
+  const __m128 bent = _mm_add_ps(knee, _mm_div_ps(_mm_mul_ps(over, range), _mm_add_ps(range, over)));
+  return _mm_or_ps(_mm_min_ps(a, bent), _mm_and_ps(_mm_set1_ps(-0.0f), v));
+}
+
+void limit_to_s16(float* buf, int16_t* out, int n, uint64_t* limited, float* peak) {
+  const __m128 sign = _mm_set1_ps(-0.0f);
+  const __m128 knee = _mm_set1_ps(kLimiterKnee);
+  const __m128 scale = _mm_set1_ps(32767.0f);
+  __m128 pk = _mm_set1_ps(*peak);
+  uint64_t c = 0;
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m128 v0 = _mm_loadu_ps(buf + i);
+    __m128 v1 = _mm_loadu_ps(buf + i + 4);
+    const __m128 a0 = _mm_andnot_ps(sign, v0);
+    const __m128 a1 = _mm_andnot_ps(sign, v1);
+    pk = _mm_max_ps(pk, _mm_max_ps(a0, a1));
+    const int over0 = _mm_movemask_ps(_mm_cmpgt_ps(a0, knee));
+    const int over1 = _mm_movemask_ps(_mm_cmpgt_ps(a1, knee));
+    // Nearly all of a normal frame is below the knee; only vectors with a sample over it pay the divide.
+    if (over0 | over1) {
+      c += static_cast<uint64_t>(__builtin_popcount(over0) + __builtin_popcount(over1));
+      v0 = limit4(v0, a0);
+      v1 = limit4(v1, a1);
+      _mm_storeu_ps(buf + i, v0);
+      _mm_storeu_ps(buf + i + 4, v1);
+    }
+    const __m128i i0 = _mm_cvtps_epi32(_mm_mul_ps(v0, scale));
+    const __m128i i1 = _mm_cvtps_epi32(_mm_mul_ps(v1, scale));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_packs_epi32(i0, i1));
+  }
+  float p = hmax(pk);
+  for (; i < n; ++i) {
+    const __m128 v = _mm_set_ss(buf[i]);
+    const __m128 a = _mm_andnot_ps(sign, v);
+    const float af = _mm_cvtss_f32(a);
+    if (af > p) p = af;
+    if (af > kLimiterKnee) {
+      ++c;
+      buf[i] = _mm_cvtss_f32(limit4(v, a));
+    }
+    out[i] = static_cast<int16_t>(std::lrint(buf[i] * 32767.0f));
+  }
+  *limited += c;
+  *peak = p;
+}
+
+float deinterleave(const float* in, float* l, float* r, int frames) {
+  const __m128 sign = _mm_set1_ps(-0.0f);
+  __m128 pk = _mm_setzero_ps();
+  int i = 0;
+  for (; i + 4 <= frames; i += 4) {
+    const __m128 v0 = _mm_loadu_ps(in + i * 2);
+    const __m128 v1 = _mm_loadu_ps(in + i * 2 + 4);
+    pk = _mm_max_ps(pk, _mm_max_ps(_mm_andnot_ps(sign, v0), _mm_andnot_ps(sign, v1)));
+    _mm_storeu_ps(l + i, _mm_shuffle_ps(v0, v1, _MM_SHUFFLE(2, 0, 2, 0)));
+    _mm_storeu_ps(r + i, _mm_shuffle_ps(v0, v1, _MM_SHUFFLE(3, 1, 3, 1)));
+  }
+  float p = hmax(pk);
+  for (; i < frames; ++i) {
+    l[i] = in[i * 2];
+    r[i] = in[i * 2 + 1];
+    const float a = std::fabs(l[i]) > std::fabs(r[i]) ? std::fabs(l[i]) : std::fabs(r[i]);
+    if (a > p) p = a;
+  }
+  return p;
+}
+
+void comb_pair(const float* in, const float* tap0, float* line0, const float* tap1, float* line1, float* out, int n,
+               float feedback) {
+  const __m128 fb = _mm_set1_ps(feedback);
+  const __m128 half = _mm_set1_ps(0.5f);
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    const __m128 x = _mm_loadu_ps(in + i);
+    const __m128 y0 = _mm_loadu_ps(tap0 + i);
+    const __m128 y1 = _mm_loadu_ps(tap1 + i);
+    _mm_storeu_ps(line0 + i, _mm_add_ps(x, _mm_mul_ps(y0, fb)));
+    _mm_storeu_ps(line1 + i, _mm_add_ps(x, _mm_mul_ps(y1, fb)));
+    _mm_storeu_ps(out + i, _mm_mul_ps(_mm_add_ps(y0, y1), half));
+  }
+  for (; i < n; ++i) {
+    const float y0 = tap0[i];
+    const float y1 = tap1[i];
+    line0[i] = in[i] + y0 * feedback;
+    line1[i] = in[i] + y1 * feedback;
+    out[i] = (y0 + y1) * 0.5f;
+  }
+}
+
+void allpass(float* buf, const float* tap, float* line, int n, float feedback) {
+  const __m128 fb = _mm_set1_ps(feedback);
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    const __m128 x = _mm_loadu_ps(buf + i);
+    const __m128 b = _mm_loadu_ps(tap + i);
+    _mm_storeu_ps(line + i, _mm_add_ps(x, _mm_mul_ps(b, fb)));
+    _mm_storeu_ps(buf + i, _mm_sub_ps(b, x));
+  }
+  for (; i < n; ++i) {
+    const float x = buf[i];
+    const float b = tap[i];
+    line[i] = x + b * feedback;
+    buf[i] = b - x;
+  }
+}
+
+float wet_mix(float* buf, const float* wet_l, const float* wet_r, int frames, float mix, float mix_step, float gain) {
+  const __m128 sign = _mm_set1_ps(-0.0f);
+  const __m128 one = _mm_set1_ps(1.0f);
+  const __m128 g = _mm_set1_ps(gain);
+  __m128 m = _mm_add_ps(_mm_set1_ps(mix), _mm_mul_ps(_mm_set1_ps(mix_step), _mm_setr_ps(0, 1, 2, 3)));
+  const __m128 inc = _mm_set1_ps(4.0f * mix_step);
+  __m128 pk = _mm_setzero_ps();
+  int i = 0;
+  for (; i + 4 <= frames; i += 4) {
+    const __m128 wl = _mm_loadu_ps(wet_l + i);
+    const __m128 wr = _mm_loadu_ps(wet_r + i);
+    pk = _mm_max_ps(pk, _mm_max_ps(_mm_andnot_ps(sign, wl), _mm_andnot_ps(sign, wr)));
+    const __m128 dry = _mm_sub_ps(one, m);
+    const __m128 wet = _mm_mul_ps(m, g);
+    const __m128 yl = _mm_mul_ps(wl, wet);
+    const __m128 yr = _mm_mul_ps(wr, wet);
+    float* p = buf + i * 2;
+    _mm_storeu_ps(p, _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(p), _mm_unpacklo_ps(dry, dry)), _mm_unpacklo_ps(yl, yr)));
+    _mm_storeu_ps(p + 4,
+                  _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(p + 4), _mm_unpackhi_ps(dry, dry)), _mm_unpackhi_ps(yl, yr)));
+    m = _mm_add_ps(m, inc);
+  }
+  float p = hmax(pk);
+  for (; i < frames; ++i) {
+    const float mi = mix + mix_step * static_cast<float>(i);
+    const float dry = 1.0f - mi;
+    const float wet = mi * gain;
+    buf[i * 2] = buf[i * 2] * dry + wet_l[i] * wet;
+    buf[i * 2 + 1] = buf[i * 2 + 1] * dry + wet_r[i] * wet;
+    const float a = std::fabs(wet_l[i]) > std::fabs(wet_r[i]) ? std::fabs(wet_l[i]) : std::fabs(wet_r[i]);
+    if (a > p) p = a;
+  }
+  return p;
+}
+
+const DspKernels kKernels = {"sse2", &s16_to_f32, &ramp_stereo, &matrix_stereo, &limit_to_s16,
+                             &deinterleave, &comb_pair, &allpass, &wet_mix};
+
+}  // namespace
+
+const DspKernels* sse2_dsp_kernels() { return &kKernels; }
+
+}  // namespace tsbot::voice
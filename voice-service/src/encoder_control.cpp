@@ -0,0 +1,100 @@
+#include "encoder_control.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "env.h"
+
+namespace tsbot::voice {
+
+namespace {
+
+// ~1 s exponential average at one update per 20 ms frame.
+constexpr double kAvgWeight = 1.0 / 50.0;
+
+// Send-thread load, as averaged wakeup lateness and encode time, that counts as pressure and as
+// headroom again. A 20 ms frame leaves little slack once either passes 2 ms.
+constexpr double kPressureLateUs = 2000.0;
+constexpr double kPressureEncodeUs = 2000.0;
+constexpr double kRelaxedLateUs = 500.0;
+constexpr double kRelaxedEncodeUs = 1000.0;
+// Frames between complexity steps: down after ~1 s of pressure, up after ~5 s of headroom.
+constexpr uint32_t kStepDownFrames = 50;
+constexpr uint32_t kStepUpFrames = 250;
+
+// Loss at which FEC is worth its bits, and at which the bitrate reaches the policy minimum.
+constexpr int kFecMinLossPerc = 1;
+constexpr int kFullLossPerc = 10;
+// libopus gains little from planning for more loss than this.
+constexpr int kMaxExpectedLossPerc = 25;
+// Ping above which the link is treated as congested, adding this much loss per 100 ms beyond.
+constexpr uint32_t kCongestedPingMs = 250;
+constexpr int kPingLossPercPer100Ms = 2;
+
+}  // namespace
+
+EncoderPolicy EncoderPolicy::clamped() const {
+  EncoderPolicy p = *this;
+  p.max_bitrate_kbps = std::clamp(p.max_bitrate_kbps, 6, 510);
+  p.min_bitrate_kbps = std::clamp(p.min_bitrate_kbps, 6, p.max_bitrate_kbps);
+  p.max_complexity = std::clamp(p.max_complexity, 0, 10);
+  p.min_complexity = std::clamp(p.min_complexity, 0, p.max_complexity);
+  return p;
+}
+
+EncoderPolicy EncoderPolicy::from_env() {
+  EncoderPolicy p;
+  if (auto v = env_int("TSBOT_VOICE_OPUS_ADAPTIVE")) p.adaptive = *v != 0;
+  if (auto v = env_int("TSBOT_VOICE_OPUS_BITRATE_KBPS")) p.max_bitrate_kbps = static_cast<int>(*v);
+  if (auto v = env_int("TSBOT_VOICE_OPUS_MIN_BITRATE_KBPS")) p.min_bitrate_kbps = static_cast<int>(*v);
+  if (auto v = env_int("TSBOT_VOICE_OPUS_COMPLEXITY")) p.max_complexity = static_cast<int>(*v);
+  if (auto v = env_int("TSBOT_VOICE_OPUS_MIN_COMPLEXITY")) p.min_complexity = static_cast<int>(*v);
+  if (auto v = env_int("TSBOT_VOICE_OPUS_FEC")) p.fec = *v != 0;
+  return p.clamped();
+}
+
+const OpusEncoderSettings& EncoderController::update(const EncoderPolicy& policy, const LinkQuality* link,
+                                                     uint64_t encode_us, int64_t late_us) {
+  late_avg_us_ += (static_cast<double>(std::max<int64_t>(late_us, 0)) - late_avg_us_) * kAvgWeight;
+  encode_avg_us_ += (static_cast<double>(encode_us) - encode_avg_us_) * kAvgWeight;
+
+  if (!policy.adaptive) {
+    complexity_ = policy.max_complexity;
+    out_ = OpusEncoderSettings{policy.max_bitrate_kbps * 1000, policy.max_complexity, false, 0};
+    return out_;
+  }
+
+  int loss_perc = 0;
+  int congestion_perc = 0;
+  if (link) {
+    loss_perc = std::clamp(static_cast<int>(std::lround(link->packet_loss * 100.0)), 0, 100);
+    if (link->ping_ms > kCongestedPingMs) {
+      congestion_perc = static_cast<int>((link->ping_ms - kCongestedPingMs) / 100 + 1) * kPingLossPercPer100Ms;
+    }
+  }
+
+  const int degrade_perc = std::min(loss_perc + congestion_perc, kFullLossPerc);
+  const int span = policy.max_bitrate_kbps - policy.min_bitrate_kbps;
+  out_.bitrate_bps = (policy.max_bitrate_kbps - span * degrade_perc / kFullLossPerc) * 1000;
+  out_.inband_fec = policy.fec && loss_perc >= kFecMinLossPerc;
+  out_.packet_loss_perc = out_.inband_fec ? std::min(loss_perc, kMaxExpectedLossPerc) : 0;
+
+  if (complexity_ < 0) complexity_ = policy.max_complexity;
+  complexity_ = std::clamp(complexity_, policy.min_complexity, policy.max_complexity);
+  // Consecutive frames under pressure, or with headroom; in between, neither counts.
+  const bool pressure = late_avg_us_ > kPressureLateUs || encode_avg_us_ > kPressureEncodeUs;
+  const bool relaxed = late_avg_us_ < kRelaxedLateUs && encode_avg_us_ < kRelaxedEncodeUs;
+  pressure_frames_ = pressure ? pressure_frames_ + 1 : 0;
+  relaxed_frames_ = relaxed ? relaxed_frames_ + 1 : 0;
+  if (pressure_frames_ >= kStepDownFrames && complexity_ > policy.min_complexity) {
+    --complexity_;
+    pressure_frames_ = 0;
+  } else if (relaxed_frames_ >= kStepUpFrames && complexity_ < policy.max_complexity) {
+    ++complexity_;
+    relaxed_frames_ = 0;
+  }
+  out_.complexity = complexity_;
+  return out_;
+}
+
+}  // namespace tsbot::voice
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstdint>
+
+#include "opus_encoder.h"
+#include "voice_sink.h"
+
+namespace tsbot::voice {
+
+// Bounds for the engine's Opus encoder, set through SetEncoder. With `adaptive` the encoder runs
+// at the maximum on a clean link with CPU to spare and gives way within the bounds otherwise;
+// without it the maximums are used as fixed settings.
+struct EncoderPolicy {
+  bool adaptive = true;
+  int max_bitrate_kbps = 128;
+  int min_bitrate_kbps = 48;
+  int max_complexity = 10;
+  int min_complexity = 4;
+  // In-band FEC, turned on only while the link reports packet loss.
+  bool fec = true;
+
+  // Clamps to what libopus accepts and orders each min/max pair.
+  EncoderPolicy clamped() const;
+  bool operator==(const EncoderPolicy&) const = default;
+
+  // TSBOT_VOICE_OPUS_ADAPTIVE, _BITRATE_KBPS, _MIN_BITRATE_KBPS, _COMPLEXITY, _MIN_COMPLEXITY, _FEC.
+  static EncoderPolicy from_env();
+};
+
+// What GetEncoder reports: the settings in use and the link measurement they were derived from.
+struct EncoderStatus {
+  bool encoding = false;  // the sink takes Opus from the engine
+  bool link_known = false;
+  float packet_loss = 0.0f;
+  uint32_t ping_ms = 0;
+  OpusEncoderSettings settings;
+};
+
+// Derives encoder settings, frame by frame, from the link quality the sink reports and from CPU
+// pressure on the send thread. Loss turns on FEC, tells the encoder how much to expect and trades
+// bitrate for robustness; a rising ping counts as mild loss. CPU pressure shows up as late send
+// clock wakeups and slow encodes, averaged over about a second; it lowers complexity one step at
+// a time and lets it climb back slowly once the host has recovered, so one busy host with many
+// bots degrades gradually instead of dropping frames. Send thread only.
+class EncoderController {
+ public:
+  // `link` is null when the sink has no measurement. `encode_us` is the previous frame's encode
+  // time (0 if none) and `late_us` this tick's wakeup lateness.
+  const OpusEncoderSettings& update(const EncoderPolicy& policy, const LinkQuality* link, uint64_t encode_us,
+                                    int64_t late_us);
+
+ private:
+  double late_avg_us_ = 0.0;
+  double encode_avg_us_ = 0.0;
+  int complexity_ = -1;  // current step; -1 until the first update
+  uint32_t pressure_frames_ = 0;
+  uint32_t relaxed_frames_ = 0;
+  OpusEncoderSettings out_;
+};
+
+}  // namespace tsbot::voice
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstdlib>
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace tsbot::voice {
+
+inline std::string get_env(std::string_view key, std::string_view def = "") {
+  if (const char* v = std::getenv(std::string(key).c_str()); v && *v) return std::string(v);
+  return std::string(def);
+}
+
+inline std::optional<long long> env_int(std::string_view key) {
+  const std::string v = get_env(key);
+  if (v.empty()) return std::nullopt;
+  try {
+    return std::stoll(v);
+  } catch (...) {
+    return std::nullopt;
+  }
+}
+
+inline bool env_flag(std::string_view key) {
+  const std::string v = get_env(key);
+  return v == "1" || v == "true" || v == "yes" || v == "on";
+}
+
+}  // namespace tsbot::voice
@@ -0,0 +1,152 @@
+#include "event_bus.h"
+
+#include <algorithm>
+#include <chrono>
+
+#include "log.h"
+
+namespace tsbot::voice {
+
+namespace {
+
+int64_t unix_ms_now() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+std::atomic<std::shared_ptr<const std::vector<EventBus*>>> g_log_buses;
+
+void log_to_bus(LogLevel level, std::string_view message) {
+  const auto buses = g_log_buses.load(std::memory_order_acquire);
+  if (!buses) return;
+  v1::LogEvent::Level l = v1::LogEvent::LEVEL_INFO;
+  switch (level) {
+    case LogLevel::kDebug:
+      l = v1::LogEvent::LEVEL_DEBUG;
+      break;
+    case LogLevel::kWarn:
+      l = v1::LogEvent::LEVEL_WARN;
+      break;
+    case LogLevel::kError:
+      l = v1::LogEvent::LEVEL_ERROR;
+      break;
+    case LogLevel::kInfo:
+      break;
+  }
+  for (EventBus* bus : *buses) {
+    if (bus->wants(kEventLog)) bus->publish_log(l, std::string(message));
+  }
+}
+
+}  // namespace
+
+bool EventBus::Subscription::pop(grpc::ByteBuffer* out) {
+  std::lock_guard<std::mutex> lk(mu_);
+  if (queue_.empty()) return false;
+  *out = std::move(queue_.front());
+  queue_.pop_front();
+  return true;
+}
+
+bool EventBus::Subscription::push(const grpc::ByteBuffer& ev) {
+  std::lock_guard<std::mutex> lk(mu_);
+  if (queue_.size() >= capacity_) {
+    queue_.pop_front();
+    dropped_.fetch_add(1, std::memory_order_relaxed);
+  }
+  const bool was_empty = queue_.empty();
+  queue_.push_back(ev);  // copies share the serialized slices
+  return was_empty;
+}
+
+std::shared_ptr<EventBus::Subscription> EventBus::subscribe(uint32_t kinds, std::function<void()> notify,
+                                                            std::size_t capacity) {
+  std::shared_ptr<Subscription> sub(new Subscription(kinds, std::max<std::size_t>(capacity, 1), std::move(notify)));
+  std::lock_guard<std::mutex> lk(mu_);
+  subs_.push_back(sub);
+  recompute_kinds_locked();
+  return sub;
+}
+
+void EventBus::unsubscribe(const std::shared_ptr<Subscription>& sub) {
+  std::lock_guard<std::mutex> lk(mu_);
+  subs_.erase(std::remove(subs_.begin(), subs_.end(), sub), subs_.end());
+  recompute_kinds_locked();
+}
+
+void EventBus::recompute_kinds_locked() {
+  uint32_t k = 0;
+  for (const auto& s : subs_) k |= s->kinds_;
+  kinds_.store(k, std::memory_order_release);
+}
+
+void EventBus::publish(EventKind kind, const v1::Event& ev) {
+  if (!wants(kind)) return;
+
+  const std::string bytes = ev.SerializeAsString();
+  grpc::Slice slice(bytes);
+  const grpc::ByteBuffer buf(&slice, 1);
+
+  // Notifies run under mu_ so unsubscribe() is a barrier for them; they only post a CQ alarm.
+  std::lock_guard<std::mutex> lk(mu_);
+  for (const auto& s : subs_) {
+    if ((s->kinds_ & kind) == 0) continue;
+    s->push(buf);
+    if (s->notify_) s->notify_();
+  }
+}
+
+void EventBus::publish_chat(v1::ChatEvent chat) {
+  if (!wants(kEventChat)) return;
+  v1::Event ev;
+  ev.set_unix_ms(unix_ms_now());
+  *ev.mutable_chat() = std::move(chat);
+  publish(kEventChat, ev);
+}
+
+void EventBus::publish_playback(v1::PlaybackEvent::Type type, const std::string& title, const std::string& source_url,
+                                const std::string& detail) {
+  if (!wants(kEventPlayback)) return;
+  v1::Event ev;
+  ev.set_unix_ms(unix_ms_now());
+  auto* pb = ev.mutable_playback();
+  pb->set_type(type);
+  pb->set_title(title);
+  pb->set_source_url(source_url);
+  pb->set_detail(detail);
+  publish(kEventPlayback, ev);
+}
+
+void EventBus::publish_log(v1::LogEvent::Level level, const std::string& message) {
+  if (!wants(kEventLog)) return;
+  v1::Event ev;
+  ev.set_unix_ms(unix_ms_now());
+  auto* log = ev.mutable_log();
+  log->set_level(level);
+  log->set_message(message);
+  publish(kEventLog, ev);
+}
+
+void EventBus::publish_talk(uint32_t client_id, const std::string& nickname, bool talking, float level_dbfs) {
+  if (!wants(kEventTalk)) return;
+  v1::Event ev;
+  ev.set_unix_ms(unix_ms_now());
+  auto* talk = ev.mutable_talk();
+  talk->set_client_id(client_id);
+  talk->set_nickname(nickname);
+  talk->set_talking(talking);
+  talk->set_level_dbfs(level_dbfs);
+  publish(kEventTalk, ev);
+}
+
+void attach_log_events(std::vector<EventBus*> buses) {
+  if (buses.empty()) {
+    g_log_hook.store(nullptr, std::memory_order_release);
+    g_log_buses.store(nullptr, std::memory_order_release);
+    return;
+  }
+  g_log_buses.store(std::make_shared<const std::vector<EventBus*>>(std::move(buses)), std::memory_order_release);
+  g_log_hook.store(&log_to_bus, std::memory_order_release);
+}
+
+}  // namespace tsbot::voice
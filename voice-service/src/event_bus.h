@@ -0,0 +1,94 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <grpcpp/support/byte_buffer.h>
+
+#include "voice.pb.h"
+
+namespace tsbot::voice {
+
+// Event classes a subscriber can ask for (SubscribeRequest.include_*).
+enum EventKind : uint32_t {
+  kEventChat = 1u << 0,
+  kEventPlayback = 1u << 1,
+  kEventLog = 1u << 2,
+  kEventTalk = 1u << 3,
+};
+
+inline constexpr std::size_t kDefaultSubscriberQueue = 256;
+
+// Fan-out of service events to SubscribeEvents streams.
+//
+// publish() serializes an event once into a ref-counted grpc::ByteBuffer and hands the same
+// buffer to every interested subscriber. Each subscriber has its own bounded queue that drops
+// its oldest entry when full, so a slow stream loses events instead of back-pressuring the
+// publisher (the TS3 SDK callback thread, the engine, the logger). With no interested
+// subscriber, publish() returns before building anything.
+class EventBus {
+ public:
+  class Subscription {
+   public:
+    // Next serialized v1::Event, or false if the queue is empty.
+    bool pop(grpc::ByteBuffer* out);
+    uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+   private:
+    friend class EventBus;
+    Subscription(uint32_t kinds, std::size_t capacity, std::function<void()> notify)
+        : kinds_(kinds), capacity_(capacity), notify_(std::move(notify)) {}
+    // Returns true if the queue went from empty to non-empty.
+    bool push(const grpc::ByteBuffer& ev);
+
+    const uint32_t kinds_;
+    const std::size_t capacity_;
+    // Invoked by the publisher after a push; must be cheap and non-blocking.
+    const std::function<void()> notify_;
+
+    std::mutex mu_;
+    std::deque<grpc::ByteBuffer> queue_;
+    std::atomic<uint64_t> dropped_{0};
+  };
+
+  EventBus() = default;
+  EventBus(const EventBus&) = delete;
+  EventBus& operator=(const EventBus&) = delete;
+
+  std::shared_ptr<Subscription> subscribe(uint32_t kinds, std::function<void()> notify,
+                                          std::size_t capacity = kDefaultSubscriberQueue);
+  // After this returns the subscription's notify callback is never invoked again.
+  void unsubscribe(const std::shared_ptr<Subscription>& sub);
+
+  bool wants(EventKind kind) const { return (kinds_.load(std::memory_order_acquire) & kind) != 0; }
+
+  void publish(EventKind kind, const v1::Event& ev);
+
+  void publish_chat(v1::ChatEvent chat);
+  void publish_playback(v1::PlaybackEvent::Type type, const std::string& title, const std::string& source_url,
+                        const std::string& detail = {});
+  void publish_log(v1::LogEvent::Level level, const std::string& message);
+  void publish_talk(uint32_t client_id, const std::string& nickname, bool talking, float level_dbfs);
+
+ private:
+  void recompute_kinds_locked();
+
+  mutable std::mutex mu_;
+  std::vector<std::shared_ptr<Subscription>> subs_;
+  // Union of every subscriber's kinds, for the no-listener fast path.
+  std::atomic<uint32_t> kinds_{0};
+};
+
+// Routes log_print output into every bus in `buses` as LogEvents (level from the WARN/ERROR
+// prefix), or stops doing so when `buses` is empty. Logging is process-wide, so in multi-bot mode
+// each bot's stream carries all lines. The buses must outlive the registration.
+void attach_log_events(std::vector<EventBus*> buses);
+
+}  // namespace tsbot::voice
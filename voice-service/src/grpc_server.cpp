@@ -0,0 +1,352 @@
+#include "grpc_server.h"
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <mutex>
+
+#include <grpcpp/alarm.h>
+#include <grpcpp/support/async_stream.h>
+#include <grpcpp/support/async_unary_call.h>
+
+#include "env.h"
+#include "log.h"
+#include "send_clock.h"
+
+namespace tsbot::voice {
+
+namespace {
+
+using AsyncService = v1::VoiceService::AsyncService;
+
+constexpr auto kShutdownGrace = std::chrono::seconds(1);
+
+// One in-flight RPC. The CQ tag is the call object itself.
+class Call {
+ public:
+  virtual ~Call() = default;
+  // `ok` is the completion-queue event status for the step this call was waiting on.
+  virtual void proceed(bool ok) = 0;
+};
+
+// Unary RPC: wait for a request, re-arm a fresh call for the next one, run the selected bot's
+// handler inline on this CQ thread, finish, delete.
+template <typename Req, typename Resp>
+class UnaryCall final : public Call {
+ public:
+  using RequestFn = void (AsyncService::*)(grpc::ServerContext*, Req*, grpc::ServerAsyncResponseWriter<Resp>*,
+                                           grpc::CompletionQueue*, grpc::ServerCompletionQueue*, void*);
+  using HandlerFn = grpc::Status (VoiceServiceImpl::*)(const Req&, Resp*);
+
+  static void arm(AsyncService* svc, grpc::ServerCompletionQueue* cq, const BotRegistry* bots, RequestFn request,
+                  HandlerFn handler) {
+    new UnaryCall(svc, cq, bots, request, handler);
+  }
+
+  void proceed(bool ok) override {
+    if (!ok || finishing_) {
+      delete this;
+      return;
+    }
+    arm(svc_, cq_, bots_, request_, handler_);
+    const Bot* bot = bots_->resolve(ctx_);
+    const grpc::Status st =
+        bot ? (bot->service.get()->*handler_)(req_, &resp_) : grpc::Status(grpc::StatusCode::NOT_FOUND, "unknown bot");
+    finishing_ = true;
+    responder_.Finish(resp_, st, this);
+  }
+
+ private:
+  UnaryCall(AsyncService* svc, grpc::ServerCompletionQueue* cq, const BotRegistry* bots, RequestFn request,
+            HandlerFn handler)
+      : svc_(svc), cq_(cq), bots_(bots), request_(request), handler_(handler), responder_(&ctx_) {
+    (svc_->*request_)(&ctx_, &req_, &responder_, cq_, cq_, this);
+  }
+
+  AsyncService* svc_;
+  grpc::ServerCompletionQueue* cq_;
+  const BotRegistry* bots_;
+  RequestFn request_;
+  HandlerFn handler_;
+
+  grpc::ServerContext ctx_;
+  Req req_;
+  Resp resp_;
+  grpc::ServerAsyncResponseWriter<Resp> responder_;
+  bool finishing_ = false;
+};
+
+// Server-streaming SubscribeEvents. The method is registered raw, so events already serialized
+// once by the EventBus go out as shared ByteBuffers without re-encoding per subscriber.
+//
+// Several CQ threads may run this call's steps concurrently, so every step takes mu_. Publishers
+// never touch the stream: they only post a zero-delay Alarm on this call's queue, and the write is
+// issued from a CQ thread. The object deletes itself once no operation is outstanding.
+class SubscribeEventsCall final {
+ public:
+  static void arm(StreamingService* svc, grpc::ServerCompletionQueue* cq, const BotRegistry* bots) {
+    new SubscribeEventsCall(svc, cq, bots);
+  }
+
+ private:
+  struct Tag final : Call {
+    Tag(SubscribeEventsCall* c, void (SubscribeEventsCall::*f)(bool)) : call(c), fn(f) {}
+    void proceed(bool ok) override { (call->*fn)(ok); }
+    SubscribeEventsCall* call;
+    void (SubscribeEventsCall::*fn)(bool);
+  };
+
+  SubscribeEventsCall(StreamingService* svc, grpc::ServerCompletionQueue* cq, const BotRegistry* bots)
+      : svc_(svc), cq_(cq), bots_(bots), writer_(&ctx_) {
+    ctx_.AsyncNotifyWhenDone(&done_tag_);
+    svc_->RequestSubscribeEvents(&ctx_, &request_buf_, &writer_, cq_, cq_, &request_tag_);
+  }
+
+  void on_request(bool ok) {
+    if (!ok) {
+      // Never matched (server shutting down), so the done tag is not delivered either.
+      delete this;
+      return;
+    }
+    arm(svc_, cq_, bots_);
+
+    v1::SubscribeRequest req;
+    grpc::Status parsed = grpc::SerializationTraits<v1::SubscribeRequest>::Deserialize(&request_buf_, &req);
+    if (Bot* bot = bots_->resolve(ctx_)) {
+      bus_ = &bot->events;
+    } else if (parsed.ok()) {
+      parsed = grpc::Status(grpc::StatusCode::NOT_FOUND, "unknown bot");
+    }
+    uint32_t kinds = 0;
+    if (req.include_chat()) kinds |= kEventChat;
+    if (req.include_playback()) kinds |= kEventPlayback;
+    if (req.include_log()) kinds |= kEventLog;
+    if (req.include_talk()) kinds |= kEventTalk;
+
+    // Subscribe before taking mu_: the bus calls wake() under its own lock, which takes mu_.
+    std::shared_ptr<EventBus::Subscription> sub;
+    if (parsed.ok()) sub = bus_->subscribe(kinds, [this] { wake(); });
+
+    std::unique_lock<std::mutex> lk(mu_);
+    --pending_;
+    if (!parsed.ok()) {
+      final_status_ = parsed;
+      finish_locked();
+    } else {
+      sub_ = std::move(sub);
+      write_next_locked();
+    }
+    release(lk);
+  }
+
+  // Publisher thread, under the bus lock.
+  void wake() {
+    std::lock_guard<std::mutex> lk(mu_);
+    if (alarm_armed_ || writing_ || closing_) return;
+    alarm_armed_ = true;
+    ++pending_;
+    alarm_.Set(cq_, gpr_now(GPR_CLOCK_MONOTONIC), &alarm_tag_);
+  }
+
+  void on_alarm(bool) {
+    std::unique_lock<std::mutex> lk(mu_);
+    alarm_armed_ = false;
+    --pending_;
+    write_next_locked();
+    release(lk);
+  }
+
+  void on_write(bool ok) {
+    std::unique_lock<std::mutex> lk(mu_);
+    writing_ = false;
+    --pending_;
+    if (!ok) closing_ = true;  // client went away
+    if (closing_) {
+      finish_locked();
+    } else {
+      write_next_locked();
+    }
+    release(lk);
+  }
+
+  void on_done(bool) {
+    std::unique_lock<std::mutex> lk(mu_);
+    --pending_;
+    closing_ = true;
+    finish_locked();
+    release(lk);
+  }
+
+  void on_finish(bool) {
+    std::unique_lock<std::mutex> lk(mu_);
+    --pending_;
+    release(lk);
+  }
+
+  void write_next_locked() {
+    if (writing_ || closing_ || !sub_) return;
+    if (!sub_->pop(&out_)) return;
+    writing_ = true;
+    ++pending_;
+    writer_.Write(out_, &write_tag_);
+  }
+
+  // Starts Finish once no write is in flight. Unsubscribing needs the bus lock, which publishers
+  // hold while calling wake(); it is done in release(), outside mu_.
+  void finish_locked() {
+    closing_ = true;
+    if (writing_ || finish_started_) return;
+    finish_started_ = true;
+    ++pending_;
+    writer_.Finish(final_status_, &finish_tag_);
+  }
+
+  // Drops the subscription after the stream closes and deletes the call when nothing is pending.
+  void release(std::unique_lock<std::mutex>& lk) {
+    std::shared_ptr<EventBus::Subscription> sub;
+    if (closing_) sub = std::move(sub_);
+    const bool last = finish_started_ && pending_ == 0;
+    lk.unlock();
+    if (sub) bus_->unsubscribe(sub);
+    if (last) delete this;
+  }
+
+  StreamingService* svc_;
+  grpc::ServerCompletionQueue* cq_;
+  const BotRegistry* bots_;
+  EventBus* bus_ = nullptr;  // the selected bot's, set once the request arrives
+
+  grpc::ServerContext ctx_;
+  grpc::ByteBuffer request_buf_;
+  grpc::ServerAsyncWriter<grpc::ByteBuffer> writer_;
+  grpc::Alarm alarm_;
+  grpc::ByteBuffer out_;
+
+  Tag request_tag_{this, &SubscribeEventsCall::on_request};
+  Tag write_tag_{this, &SubscribeEventsCall::on_write};
+  Tag alarm_tag_{this, &SubscribeEventsCall::on_alarm};
+  Tag done_tag_{this, &SubscribeEventsCall::on_done};
+  Tag finish_tag_{this, &SubscribeEventsCall::on_finish};
+
+  std::mutex mu_;
+  std::shared_ptr<EventBus::Subscription> sub_;
+  grpc::Status final_status_ = grpc::Status::OK;
+  int pending_ = 2;  // the request step and the done tag
+  bool writing_ = false;
+  bool alarm_armed_ = false;
+  bool closing_ = false;
+  bool finish_started_ = false;
+};
+
+template <typename Req, typename Resp>
+void arm_unary(AsyncService* svc, grpc::ServerCompletionQueue* cq, const BotRegistry* bots,
+               typename UnaryCall<Req, Resp>::RequestFn request, typename UnaryCall<Req, Resp>::HandlerFn handler) {
+  UnaryCall<Req, Resp>::arm(svc, cq, bots, request, handler);
+}
+
+}  // namespace
+
+GrpcServerConfig GrpcServerConfig::from_env() {
+  GrpcServerConfig c;
+  if (auto v = env_int("TSBOT_VOICE_GRPC_CQS"); v && *v > 0) c.cq_count = static_cast<int>(std::min<long long>(*v, 16));
+  if (auto v = env_int("TSBOT_VOICE_GRPC_THREADS_PER_CQ"); v && *v > 0) {
+    c.threads_per_cq = static_cast<int>(std::min<long long>(*v, 16));
+  }
+  c.unix_socket = get_env("TSBOT_VOICE_GRPC_UNIX");
+  return c;
+}
+
+GrpcServer::GrpcServer(const BotRegistry& bots, GrpcServerConfig cfg) : bots_(bots), cfg_(cfg) {}
+
+GrpcServer::~GrpcServer() { shutdown(); }
+
+bool GrpcServer::start(const std::string& addr) {
+  grpc::ServerBuilder builder;
+  std::vector<std::string> addrs{addr};
+  if (!cfg_.unix_socket.empty()) addrs.push_back("unix:" + cfg_.unix_socket);
+  for (const auto& a : addrs) {
+    // gRPC replaces a stale socket file itself, but not a missing directory.
+    if (a.rfind("unix:", 0) == 0) {
+      const std::filesystem::path dir = std::filesystem::path(a.substr(5)).parent_path();
+      std::error_code ec;
+      if (!dir.empty()) std::filesystem::create_directories(dir, ec);
+    }
+    builder.AddListeningPort(a, grpc::InsecureServerCredentials());
+  }
+  builder.RegisterService(&service_);
+  for (int i = 0; i < cfg_.cq_count; ++i) cqs_.push_back(builder.AddCompletionQueue());
+
+  server_ = builder.BuildAndStart();
+  if (!server_) return false;
+
+  for (auto& cq : cqs_) {
+    arm_calls(cq.get());
+    for (int t = 0; t < cfg_.threads_per_cq; ++t) {
+      threads_.emplace_back([this, q = cq.get()] { poll_loop(q); });
+    }
+  }
+  log_print("grpc server: ", cfg_.cq_count, " completion queue(s) x ", cfg_.threads_per_cq, " thread(s)");
+  if (!cfg_.unix_socket.empty()) log_print("grpc server: also on unix:", cfg_.unix_socket);
+  return true;
+}
+
+void GrpcServer::wait() {
+  if (server_) server_->Wait();
+}
+
+void GrpcServer::shutdown() {
+  if (shut_down_ || !server_) return;
+  shut_down_ = true;
+  // Event streams never end on their own; the deadline cancels them.
+  server_->Shutdown(std::chrono::system_clock::now() + kShutdownGrace);
+  for (auto& cq : cqs_) cq->Shutdown();
+  for (auto& t : threads_) {
+    if (t.joinable()) t.join();
+  }
+}
+
+// One pending call per method per queue; each accepted call re-arms its replacement.
+void GrpcServer::arm_calls(grpc::ServerCompletionQueue* cq) {
+  AsyncService* s = &service_;
+  const BotRegistry* h = &bots_;
+  arm_unary<v1::Empty, v1::PingResponse>(s, cq, h, &AsyncService::RequestPing, &VoiceServiceImpl::Ping);
+  arm_unary<v1::PlayRequest, v1::CommandResponse>(s, cq, h, &AsyncService::RequestPlay, &VoiceServiceImpl::Play);
+  arm_unary<v1::PlayNextRequest, v1::CommandResponse>(s, cq, h, &AsyncService::RequestPlayNext,
+                                                      &VoiceServiceImpl::PlayNext);
+  arm_unary<v1::Empty, v1::CommandResponse>(s, cq, h, &AsyncService::RequestPause, &VoiceServiceImpl::Pause);
+  arm_unary<v1::Empty, v1::CommandResponse>(s, cq, h, &AsyncService::RequestResume, &VoiceServiceImpl::Resume);
+  arm_unary<v1::Empty, v1::CommandResponse>(s, cq, h, &AsyncService::RequestStop, &VoiceServiceImpl::Stop);
+  arm_unary<v1::Empty, v1::CommandResponse>(s, cq, h, &AsyncService::RequestSkip, &VoiceServiceImpl::Skip);
+  arm_unary<v1::SeekRequest, v1::CommandResponse>(s, cq, h, &AsyncService::RequestSeek, &VoiceServiceImpl::Seek);
+  arm_unary<v1::NoticeRequest, v1::CommandResponse>(s, cq, h, &AsyncService::RequestSendNotice,
+                                                    &VoiceServiceImpl::SendNotice);
+  arm_unary<v1::SetClientDescriptionRequest, v1::CommandResponse>(s, cq, h, &AsyncService::RequestSetClientDescription,
+                                                                  &VoiceServiceImpl::SetClientDescription);
+  arm_unary<v1::SetVolumeRequest, v1::CommandResponse>(s, cq, h, &AsyncService::RequestSetVolume,
+                                                       &VoiceServiceImpl::SetVolume);
+  arm_unary<v1::Empty, v1::StatusResponse>(s, cq, h, &AsyncService::RequestGetStatus, &VoiceServiceImpl::GetStatus);
+  arm_unary<v1::Empty, v1::StatsResponse>(s, cq, h, &AsyncService::RequestGetStats, &VoiceServiceImpl::GetStats);
+  arm_unary<v1::SetAudioFxRequest, v1::CommandResponse>(s, cq, h, &AsyncService::RequestSetAudioFx,
+                                                        &VoiceServiceImpl::SetAudioFx);
+  arm_unary<v1::Empty, v1::AudioFxResponse>(s, cq, h, &AsyncService::RequestGetAudioFx, &VoiceServiceImpl::GetAudioFx);
+  arm_unary<v1::SetEncoderRequest, v1::CommandResponse>(s, cq, h, &AsyncService::RequestSetEncoder,
+                                                        &VoiceServiceImpl::SetEncoder);
+  arm_unary<v1::Empty, v1::EncoderResponse>(s, cq, h, &AsyncService::RequestGetEncoder, &VoiceServiceImpl::GetEncoder);
+  arm_unary<v1::SnapshotRequest, v1::SnapshotResponse>(s, cq, h, &AsyncService::RequestGetSnapshot,
+                                                       &VoiceServiceImpl::GetSnapshot);
+  arm_unary<v1::BatchRequest, v1::BatchResponse>(s, cq, h, &AsyncService::RequestBatch, &VoiceServiceImpl::Batch);
+  arm_unary<v1::StartRecordingRequest, v1::RecordingResponse>(s, cq, h, &AsyncService::RequestStartRecording,
+                                                             &VoiceServiceImpl::StartRecording);
+  arm_unary<v1::Empty, v1::RecordingResponse>(s, cq, h, &AsyncService::RequestStopRecording,
+                                              &VoiceServiceImpl::StopRecording);
+  SubscribeEventsCall::arm(&service_, cq, &bots_);
+}
+
+void GrpcServer::poll_loop(grpc::ServerCompletionQueue* cq) {
+  keep_off_audio_cpu("tsbot-grpc", cfg_.audio_cpu);
+  void* tag = nullptr;
+  bool ok = false;
+  while (cq->Next(&tag, &ok)) static_cast<Call*>(tag)->proceed(ok);
+}
+
+}  // namespace tsbot::voice
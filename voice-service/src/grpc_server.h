@@ -0,0 +1,65 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <grpcpp/grpcpp.h>
+
+#include "bot_registry.h"
+#include "voice.grpc.pb.h"
+
+namespace tsbot::voice {
+
+// Sizing of the gRPC completion-queue pool.
+struct GrpcServerConfig {
+  // Completion queues (TSBOT_VOICE_GRPC_CQS).
+  int cq_count = 1;
+  // Threads polling each queue (TSBOT_VOICE_GRPC_THREADS_PER_CQ).
+  int threads_per_cq = 2;
+  // CPU the send thread is pinned to; pool threads are kept off it. -1 = no restriction.
+  int audio_cpu = -1;
+  // Unix socket served as well as the main address (TSBOT_VOICE_GRPC_UNIX), for a backend on the
+  // same host: no loopback TCP stack in the path. Empty = none.
+  std::string unix_socket;
+
+  static GrpcServerConfig from_env();
+};
+
+// AsyncService with SubscribeEvents switched to raw ByteBuffer writes.
+class StreamingService final
+    : public v1::VoiceService::WithRawMethod_SubscribeEvents<v1::VoiceService::AsyncService> {};
+
+// VoiceService on the async CompletionQueue API. A fixed pool of cq_count * threads_per_cq
+// threads runs every handler, so a chatty client can queue calls but never grow the thread
+// count; the sync server's one-thread-per-call model is not used.
+//
+// Every call is dispatched to the bot named by its x-tsbot-bot metadata (BotRegistry::resolve).
+class GrpcServer {
+ public:
+  GrpcServer(const BotRegistry& bots, GrpcServerConfig cfg);
+  ~GrpcServer();
+  GrpcServer(const GrpcServer&) = delete;
+  GrpcServer& operator=(const GrpcServer&) = delete;
+
+  // `addr` is "host:port" or "unix:<path>". Parent directories of socket paths are created.
+  bool start(const std::string& addr);
+  // Blocks until shutdown() is called from another thread.
+  void wait();
+  void shutdown();
+
+ private:
+  void arm_calls(grpc::ServerCompletionQueue* cq);
+  void poll_loop(grpc::ServerCompletionQueue* cq);
+
+  const BotRegistry& bots_;
+  const GrpcServerConfig cfg_;
+  StreamingService service_;
+  std::unique_ptr<grpc::Server> server_;
+  std::vector<std::unique_ptr<grpc::ServerCompletionQueue>> cqs_;
+  std::vector<std::thread> threads_;
+  bool shut_down_ = false;
+};
+
+}  // namespace tsbot::voice
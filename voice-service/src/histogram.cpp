@@ -0,0 +1,31 @@
+#include "histogram.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace tsbot::voice {
+
+Histogram::Snapshot Histogram::snapshot() const {
+  Snapshot s;
+  for (std::size_t i = 0; i < kBuckets; ++i) {
+    s.buckets[i] = buckets_[i].load(std::memory_order_relaxed);
+    s.count += s.buckets[i];
+  }
+  // The count comes from the buckets themselves so percentiles stay consistent with it.
+  s.sum = sum_.load(std::memory_order_relaxed);
+  s.max = max_.load(std::memory_order_relaxed);
+  return s;
+}
+
+uint64_t Histogram::Snapshot::percentile(double q) const {
+  if (count == 0) return 0;
+  const auto rank = static_cast<uint64_t>(std::ceil(std::clamp(q, 0.0, 1.0) * static_cast<double>(count)));
+  uint64_t seen = 0;
+  for (std::size_t i = 0; i < kBuckets; ++i) {
+    seen += buckets[i];
+    if (seen >= std::max<uint64_t>(rank, 1)) return std::min(bucket_upper(i), max);
+  }
+  return max;
+}
+
+}  // namespace tsbot::voice
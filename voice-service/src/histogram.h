@@ -0,0 +1,67 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace tsbot::voice {
+
+// Fixed-size log-linear histogram in the style of HdrHistogram: values below 16 get exact
+// buckets, above that every power of two is split into 16 sub-buckets, so any reported value is
+// within ~6% of the real one. Covers 0 .. 2^27 (about 134 s in microseconds); larger values land in
+// the top bucket.
+//
+// record() is a handful of relaxed atomic adds and never allocates or locks, so it is safe on the
+// send thread and from several threads at once. snapshot() may run concurrently with writers; it
+// is not an atomic cut, but every recorded value shows up in exactly one later snapshot.
+class Histogram {
+ public:
+  static constexpr int kSubBits = 4;
+  static constexpr uint64_t kSubCount = uint64_t{1} << kSubBits;
+  static constexpr int kMaxBits = 27;
+  static constexpr std::size_t kBuckets = (kMaxBits - kSubBits + 1) * kSubCount;
+
+  struct Snapshot {
+    uint64_t count = 0;
+    uint64_t sum = 0;
+    uint64_t max = 0;
+    std::array<uint64_t, kBuckets> buckets{};
+
+    // Highest value equivalent to the q-quantile's bucket, clamped to max. 0 when empty.
+    uint64_t percentile(double q) const;
+  };
+
+  void record(uint64_t v) {
+    buckets_[bucket_of(v)].fetch_add(1, std::memory_order_relaxed);
+    sum_.fetch_add(v, std::memory_order_relaxed);
+    uint64_t seen = max_.load(std::memory_order_relaxed);
+    while (v > seen && !max_.compare_exchange_weak(seen, v, std::memory_order_relaxed)) {
+    }
+  }
+
+  Snapshot snapshot() const;
+
+  static std::size_t bucket_of(uint64_t v) {
+    if (v < kSubCount) return static_cast<std::size_t>(v);
+    const int msb = 63 - __builtin_clzll(v);
+    if (msb >= kMaxBits) return kBuckets - 1;
+    const int shift = msb - kSubBits;
+    return static_cast<std::size_t>((shift + 1) * kSubCount + ((v >> shift) & (kSubCount - 1)));
+  }
+
+  // Largest value that maps to bucket `i`.
+  static uint64_t bucket_upper(std::size_t i) {
+    if (i < kSubCount) return i;
+    const int shift = static_cast<int>(i / kSubCount) - 1;
+    const uint64_t lower = (kSubCount + i % kSubCount) << shift;
+    return lower + (uint64_t{1} << shift) - 1;
+  }
+
+ private:
+  std::array<std::atomic<uint64_t>, kBuckets> buckets_{};
+  std::atomic<uint64_t> sum_{0};
+  std::atomic<uint64_t> max_{0};
+};
+
+}  // namespace tsbot::voice
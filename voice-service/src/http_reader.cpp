@@ -0,0 +1,454 @@
+#include "http_reader.h"
+
+#include <curl/curl.h>
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iterator>
+
+#include "env.h"
+#include "log.h"
+
+namespace tsbot::voice {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Consumer and fetch threads re-check interruption and shutdown this often while they wait.
+constexpr auto kPollInterval = std::chrono::milliseconds(50);
+// A demuxer wait this long is a stall worth reporting, the threshold the Rust engine logs
+// "ffmpeg pcm read stalled" at.
+constexpr int64_t kReadStallReportMs = 200;
+// Bytes kept behind the read position so the demuxer's short backward seeks stay in the window.
+constexpr std::size_t kMaxKeepBehind = 256 * 1024;
+constexpr auto kMaxBackoff = std::chrono::milliseconds(1600);
+// Idle easy handles the session keeps, and with them their open connections (up to curl's
+// default of 5 each). Beyond this the oldest is closed.
+constexpr std::size_t kMaxIdleHandles = 32;
+
+int64_t now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+}
+
+int64_t ms_between(int64_t a_ns, int64_t b_ns) { return (b_ns - a_ns) / 1000000; }
+
+// Client errors that another attempt will not fix.
+bool is_fatal_status(long code) { return code >= 400 && code < 500 && code != 408 && code != 429; }
+
+// "host[:port]" of an http(s) URL, lowercased; empty if there is none.
+std::string url_host(const char* url) {
+  if (!url) return {};
+  const char* p = std::strstr(url, "://");
+  if (!p) return {};
+  p += 3;
+  const char* end = p + std::strcspn(p, "/?#");
+  // Drop any userinfo.
+  for (const char* q = end; q > p; --q) {
+    if (q[-1] == '@') {
+      p = q;
+      break;
+    }
+  }
+  std::string host(p, end);
+  for (char& ch : host) ch = static_cast<char>(std::tolower(static_cast<unsigned char>(ch)));
+  return host;
+}
+
+}  // namespace
+
+HttpReaderConfig HttpReaderConfig::from_env() {
+  HttpReaderConfig c;
+  if (auto v = env_int("TSBOT_VOICE_HTTP_READER")) c.enabled = *v != 0;
+  if (auto v = env_int("TSBOT_VOICE_HTTP_READAHEAD_KB"); v && *v >= 64) c.read_ahead_bytes = static_cast<std::size_t>(*v) << 10;
+  if (auto v = env_int("TSBOT_VOICE_HTTP_CONNECT_MS"); v && *v > 0) c.connect_timeout_ms = static_cast<int>(*v);
+  if (auto v = env_int("TSBOT_VOICE_HTTP_STALL_MS"); v && *v >= 500) c.stall_timeout_ms = static_cast<int>(*v);
+  if (auto v = env_int("TSBOT_VOICE_HTTP_RETRIES"); v && *v >= 0) c.max_retries = static_cast<int>(*v);
+  return c;
+}
+
+HttpStream::HttpStream(HttpSession* session, std::string url, const std::atomic<bool>* interrupted)
+    : session_(session),
+      url_(std::move(url)),
+      interrupted_(interrupted),
+      window_(session->config().read_ahead_bytes) {
+  thread_ = std::thread([this] { fetch_loop(); });
+}
+
+HttpStream::~HttpStream() {
+  {
+    std::lock_guard<std::mutex> lk(mu_);
+    stop_ = true;
+  }
+  abort_.store(true, std::memory_order_relaxed);
+  cv_.notify_all();
+  if (thread_.joinable()) thread_.join();
+}
+
+bool HttpStream::stopping() const {
+  return stop_ || (interrupted_ && interrupted_->load(std::memory_order_relaxed));
+}
+
+int HttpStream::read(uint8_t* buf, int len) {
+  std::unique_lock<std::mutex> lk(mu_);
+  const int64_t t0 = now_ns();
+  bool waited = false;
+  while (read_pos_ >= write_pos_ && !eof_ && !failed_) {
+    if (stopping()) return -1;
+    waited = true;
+    cv_.wait_for(lk, kPollInterval);
+  }
+  if (waited) {
+    if (const int64_t ms = ms_between(t0, now_ns()); ms >= kReadStallReportMs) {
+      session_->stats_.read_stall_ms.record(static_cast<uint64_t>(ms));
+      log_print("WARN http read stalled source_url=", url_, " offset=", read_pos_, " waited_ms=", ms);
+    }
+  }
+  if (read_pos_ < write_pos_) {
+    const std::size_t cap = window_.size();
+    const std::size_t n = static_cast<std::size_t>(std::min<int64_t>(len, write_pos_ - read_pos_));
+    const std::size_t at = static_cast<std::size_t>(read_pos_ % static_cast<int64_t>(cap));
+    const std::size_t first = std::min(n, cap - at);
+    std::memcpy(buf, window_.data() + at, first);
+    std::memcpy(buf + first, window_.data(), n - first);
+    read_pos_ += static_cast<int64_t>(n);
+    const int64_t keep = static_cast<int64_t>(std::min(kMaxKeepBehind, cap / 8));
+    tail_ = std::max(tail_, read_pos_ - keep);
+    cv_.notify_all();
+    return static_cast<int>(n);
+  }
+  return failed_ ? -1 : 0;
+}
+
+int64_t HttpStream::seek(int64_t offset) {
+  std::lock_guard<std::mutex> lk(mu_);
+  if (offset < 0 || (size_ >= 0 && offset > size_)) return -1;
+  if (offset >= tail_ && offset <= write_pos_) {
+    read_pos_ = offset;
+    return offset;
+  }
+  // Outside the window: drop it and fetch again from `offset`.
+  ++gen_;
+  tail_ = read_pos_ = write_pos_ = offset;
+  eof_ = false;
+  failed_ = false;
+  error_.clear();
+  abort_.store(true, std::memory_order_relaxed);
+  cv_.notify_all();
+  return offset;
+}
+
+bool HttpStream::readable(std::size_t n) {
+  std::lock_guard<std::mutex> lk(mu_);
+  return write_pos_ - read_pos_ >= static_cast<int64_t>(n) || eof_ || failed_;
+}
+
+int64_t HttpStream::size() {
+  std::unique_lock<std::mutex> lk(mu_);
+  while (!headers_ && !failed_ && !stopping()) cv_.wait_for(lk, kPollInterval);
+  return size_;
+}
+
+std::string HttpStream::error() {
+  std::lock_guard<std::mutex> lk(mu_);
+  return error_;
+}
+
+void HttpStream::fetch_loop() {
+  const HttpReaderConfig& cfg = session_->config();
+  CURL* c = static_cast<CURL*>(session_->acquire_handle(url_));
+  curl_ = c;
+  if (!c) {
+    std::lock_guard<std::mutex> lk(mu_);
+    failed_ = true;
+    headers_ = true;
+    error_ = "http: curl_easy_init failed";
+    cv_.notify_all();
+    return;
+  }
+  char errbuf[CURL_ERROR_SIZE] = {};
+  curl_easy_setopt(c, CURLOPT_URL, url_.c_str());
+  curl_easy_setopt(c, CURLOPT_NOSIGNAL, 1L);
+  curl_easy_setopt(c, CURLOPT_FOLLOWLOCATION, 1L);
+  curl_easy_setopt(c, CURLOPT_MAXREDIRS, 5L);
+  curl_easy_setopt(c, CURLOPT_FAILONERROR, 1L);
+  curl_easy_setopt(c, CURLOPT_TCP_KEEPALIVE, 1L);
+  curl_easy_setopt(c, CURLOPT_CONNECTTIMEOUT_MS, static_cast<long>(cfg.connect_timeout_ms));
+  curl_easy_setopt(c, CURLOPT_USERAGENT, "tsbot-voice");
+  curl_easy_setopt(c, CURLOPT_ERRORBUFFER, errbuf);
+  curl_easy_setopt(c, CURLOPT_SHARE, session_->share_);
+  curl_easy_setopt(c, CURLOPT_WRITEFUNCTION, &HttpStream::on_data);
+  curl_easy_setopt(c, CURLOPT_WRITEDATA, this);
+  curl_easy_setopt(c, CURLOPT_XFERINFOFUNCTION, &HttpStream::on_progress);
+  curl_easy_setopt(c, CURLOPT_XFERINFODATA, this);
+  curl_easy_setopt(c, CURLOPT_NOPROGRESS, 0L);
+
+  HttpStats& stats = session_->stats_;
+  int failures = 0;
+  for (;;) {
+    int64_t offset = 0;
+    uint64_t gen = 0;
+    {
+      std::unique_lock<std::mutex> lk(mu_);
+      // Idle once the resource is complete (or given up) until a seek asks for more.
+      cv_.wait(lk, [&] { return stop_ || (!eof_ && !failed_); });
+      if (stop_) break;
+      offset = write_pos_;
+      gen = gen_;
+      abort_.store(false, std::memory_order_relaxed);
+    }
+
+    errbuf[0] = '\0';
+    bool progressed = false;
+    const CURLcode res = perform(offset, gen, &progressed) ? CURLE_OK : static_cast<CURLcode>(curl_code_);
+    long status = 0;
+    curl_easy_getinfo(c, CURLINFO_RESPONSE_CODE, &status);
+
+    std::unique_lock<std::mutex> lk(mu_);
+    headers_ = true;
+    cv_.notify_all();
+    if (stop_) break;
+    if (gen_ != gen) {
+      failures = 0;
+      continue;
+    }
+    if (res == CURLE_OK) {
+      // A live stream ends when the server closes it; a sized resource must be complete.
+      if (size_ < 0 || write_pos_ >= size_) {
+        eof_ = true;
+        cv_.notify_all();
+        continue;
+      }
+    } else if (status == 416 && size_ >= 0 && write_pos_ >= size_) {
+      eof_ = true;
+      cv_.notify_all();
+      continue;
+    }
+
+    std::string why;
+    if (res == CURLE_OK) {
+      why = "connection closed at " + std::to_string(write_pos_) + " of " + std::to_string(size_) + " bytes";
+    } else if (stalled_) {
+      why = "no data for " + std::to_string(cfg.stall_timeout_ms) + " ms";
+      stats.stall_reconnects.fetch_add(1, std::memory_order_relaxed);
+    } else {
+      why = errbuf[0] ? errbuf : curl_easy_strerror(res);
+    }
+    if (progressed) failures = 0;
+    if (is_fatal_status(status) || ++failures > cfg.max_retries) {
+      failed_ = true;
+      error_ = "http: " + why + (is_fatal_status(status) ? "" : " (gave up after " + std::to_string(cfg.max_retries) + " retries)");
+      stats.failures.fetch_add(1, std::memory_order_relaxed);
+      cv_.notify_all();
+      continue;
+    }
+    stats.resumes.fetch_add(1, std::memory_order_relaxed);
+    log_print("WARN http resume source_url=", url_, " offset=", write_pos_, " attempt=", failures, ": ", why);
+    const auto backoff = std::min(std::chrono::milliseconds(100 << std::min(failures - 1, 4)), kMaxBackoff);
+    cv_.wait_for(lk, backoff, [&] { return stop_ || gen_ != gen; });
+  }
+  curl_ = nullptr;
+  session_->release_handle(c, url_);
+}
+
+// One request from `offset` to the end of the resource (or until aborted). False on failure, with
+// the curl result in curl_code_.
+bool HttpStream::perform(int64_t offset, uint64_t gen, bool* progressed) {
+  CURL* c = static_cast<CURL*>(curl_);
+  char range[32];
+  // Without a known length the resource is a live stream: reconnect at the live edge.
+  bool ranged = false;
+  {
+    std::lock_guard<std::mutex> lk(mu_);
+    ranged = offset > 0 && size_ >= 0;
+  }
+  if (ranged) std::snprintf(range, sizeof(range), "%lld-", static_cast<long long>(offset));
+  curl_easy_setopt(c, CURLOPT_RANGE, ranged ? range : nullptr);
+
+  req_gen_ = gen;
+  req_offset_ = ranged ? offset : 0;
+  req_skip_ = 0;
+  req_bytes_ = 0;
+  req_started_ = false;
+  stalled_ = false;
+  waited_room_ = false;
+  req_start_ns_ = last_data_ns_ = now_ns();
+  curl_code_ = curl_easy_perform(c);
+
+  HttpStats& stats = session_->stats_;
+  stats.requests.fetch_add(1, std::memory_order_relaxed);
+  long connects = 0;
+  if (req_started_ && curl_easy_getinfo(c, CURLINFO_NUM_CONNECTS, &connects) == CURLE_OK && connects == 0) {
+    stats.reused_connections.fetch_add(1, std::memory_order_relaxed);
+  }
+  // Throughput only means something for transfers that never waited on a full window.
+  const int64_t elapsed_ms = ms_between(req_start_ns_, now_ns());
+  if (req_bytes_ > 0 && !waited_room_ && elapsed_ms > 0) {
+    stats.throughput_kbps.record(req_bytes_ * 8 / static_cast<uint64_t>(elapsed_ms));
+  }
+  *progressed = req_bytes_ > 0;
+  return curl_code_ == CURLE_OK;
+}
+
+// Caller holds mu_. First body bytes of a response: learn the length, and where the data starts.
+bool HttpStream::begin_body_locked() {
+  CURL* c = static_cast<CURL*>(curl_);
+  long status = 0;
+  curl_off_t len = -1;
+  curl_easy_getinfo(c, CURLINFO_RESPONSE_CODE, &status);
+  curl_easy_getinfo(c, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &len);
+  req_started_ = true;
+  session_->stats_.first_byte_ms.record(static_cast<uint64_t>(ms_between(req_start_ns_, now_ns())));
+  if (status == 206) {
+    if (len >= 0) size_ = req_offset_ + len;
+  } else {
+    if (len >= 0) size_ = len;
+    // The server ignored the Range header and starts over.
+    if (req_offset_ > 0) req_skip_ = req_offset_;
+    // A live stream reconnected at its live edge continues where the window ends.
+    if (req_offset_ == 0 && write_pos_ > 0 && size_ >= 0) req_skip_ = write_pos_;
+  }
+  if (!headers_) {
+    headers_ = true;
+    cv_.notify_all();
+  }
+  return true;
+}
+
+std::size_t HttpStream::on_data(char* data, std::size_t size, std::size_t n, void* opaque) {
+  auto* self = static_cast<HttpStream*>(opaque);
+  const std::size_t total = size * n;
+  const uint8_t* p = reinterpret_cast<const uint8_t*>(data);
+  std::size_t left = total;
+
+  std::unique_lock<std::mutex> lk(self->mu_);
+  if (self->stop_ || self->gen_ != self->req_gen_) return 0;
+  if (!self->req_started_ && !self->begin_body_locked()) return 0;
+  if (self->req_skip_ > 0) {
+    const std::size_t drop = static_cast<std::size_t>(std::min<int64_t>(self->req_skip_, static_cast<int64_t>(left)));
+    p += drop;
+    left -= drop;
+    self->req_skip_ -= static_cast<int64_t>(drop);
+  }
+  const std::size_t cap = self->window_.size();
+  while (left > 0) {
+    const std::size_t room = cap - static_cast<std::size_t>(self->write_pos_ - self->tail_);
+    if (room == 0) {
+      // Window full: hold the transfer here until the demuxer reads. A connection the server
+      // drops meanwhile is resumed at write_pos_.
+      self->waited_room_ = true;
+      self->cv_.wait_for(lk, kPollInterval);
+      if (self->stop_ || self->gen_ != self->req_gen_) return 0;
+      continue;
+    }
+    const std::size_t k = std::min(room, left);
+    const std::size_t at = static_cast<std::size_t>(self->write_pos_ % static_cast<int64_t>(cap));
+    const std::size_t first = std::min(k, cap - at);
+    std::memcpy(self->window_.data() + at, p, first);
+    std::memcpy(self->window_.data(), p + first, k - first);
+    self->write_pos_ += static_cast<int64_t>(k);
+    self->req_bytes_ += k;
+    p += k;
+    left -= k;
+    self->cv_.notify_all();
+  }
+  self->last_data_ns_ = now_ns();
+  self->session_->stats_.bytes.fetch_add(total, std::memory_order_relaxed);
+  return total;
+}
+
+int HttpStream::on_progress(void* opaque, int64_t, int64_t, int64_t, int64_t) {
+  auto* self = static_cast<HttpStream*>(opaque);
+  if (self->abort_.load(std::memory_order_relaxed)) return 1;
+  if (self->interrupted_ && self->interrupted_->load(std::memory_order_relaxed)) return 1;
+  // Runs on the fetch thread between deliveries, never while on_data waits for room.
+  if (ms_between(self->last_data_ns_, now_ns()) >= self->session_->config().stall_timeout_ms) {
+    self->stalled_ = true;
+    return 1;
+  }
+  return 0;
+}
+
+HttpSession::HttpSession(HttpReaderConfig cfg) : cfg_(std::move(cfg)) {
+  if (!cfg_.enabled) return;
+  // Not thread-safe; this runs once at startup before any stream exists.
+  curl_global_init(CURL_GLOBAL_DEFAULT);
+  CURLSH* sh = curl_share_init();
+  if (!sh) return;
+  curl_share_setopt(sh, CURLSHOPT_LOCKFUNC, &HttpSession::lock_cb);
+  curl_share_setopt(sh, CURLSHOPT_UNLOCKFUNC, &HttpSession::unlock_cb);
+  curl_share_setopt(sh, CURLSHOPT_USERDATA, this);
+  // No CURL_LOCK_DATA_CONNECT: the streams perform on threads of their own, and a connection
+  // cache shared between concurrent transfers is unsupported. See acquire_handle().
+  curl_share_setopt(sh, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+  curl_share_setopt(sh, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+  share_ = sh;
+}
+
+HttpSession::~HttpSession() {
+  // Handles still attached to the share would keep it from being cleaned up.
+  for (const IdleHandle& h : idle_) curl_easy_cleanup(static_cast<CURL*>(h.curl));
+  idle_.clear();
+  if (share_) curl_share_cleanup(static_cast<CURLSH*>(share_));
+  if (cfg_.enabled) curl_global_cleanup();
+}
+
+bool HttpSession::handles(const std::string& url) {
+  return url.rfind("http://", 0) == 0 || url.rfind("https://", 0) == 0;
+}
+
+std::unique_ptr<HttpStream> HttpSession::open(const std::string& url, const std::atomic<bool>* interrupted) {
+  return std::unique_ptr<HttpStream>(new HttpStream(this, url, interrupted));
+}
+
+void* HttpSession::acquire_handle(const std::string& url) {
+  const std::string host = url_host(url.c_str());
+  {
+    std::lock_guard<std::mutex> lk(pool_mu_);
+    if (!idle_.empty()) {
+      auto it = std::find_if(idle_.rbegin(), idle_.rend(), [&](const IdleHandle& h) { return h.host == host; });
+      // A handle kept for another host still has the DNS cache and TLS sessions of the share.
+      const auto pick = it != idle_.rend() ? std::prev(it.base()) : std::prev(idle_.end());
+      void* curl = pick->curl;
+      idle_.erase(pick);
+      return curl;
+    }
+  }
+  return curl_easy_init();
+}
+
+void HttpSession::release_handle(void* curl, const std::string& url) {
+  CURL* c = static_cast<CURL*>(curl);
+  if (!c) return;
+  // Filed under the host asked for: after a redirect the handle holds connections to both ends.
+  std::string host = url_host(url.c_str());
+  // Back to default options (the stream's callbacks and error buffer are gone with it); the
+  // connection cache survives a reset.
+  curl_easy_reset(c);
+  CURL* evicted = nullptr;
+  {
+    std::lock_guard<std::mutex> lk(pool_mu_);
+    if (idle_.size() >= kMaxIdleHandles) {
+      evicted = static_cast<CURL*>(idle_.front().curl);
+      idle_.erase(idle_.begin());
+    }
+    idle_.push_back({c, std::move(host)});
+  }
+  // Closing its connections can take a moment; not under the lock.
+  if (evicted) curl_easy_cleanup(evicted);
+}
+
+void HttpSession::lock_cb(void*, int data, int, void* opaque) {
+  auto* self = static_cast<HttpSession*>(opaque);
+  self->locks_[static_cast<std::size_t>(data) % std::size(self->locks_)].lock();
+}
+
+void HttpSession::unlock_cb(void*, int data, void* opaque) {
+  auto* self = static_cast<HttpSession*>(opaque);
+  self->locks_[static_cast<std::size_t>(data) % std::size(self->locks_)].unlock();
+}
+
+}  // namespace tsbot::voice
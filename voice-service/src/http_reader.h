@@ -0,0 +1,187 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "histogram.h"
+
+namespace tsbot::voice {
+
+struct HttpReaderConfig {
+  // TSBOT_VOICE_HTTP_READER: fetch http(s) sources with HttpStream instead of libavformat's own
+  // protocol handler.
+  bool enabled = true;
+  // TSBOT_VOICE_HTTP_READAHEAD_KB: bytes fetched ahead of the demuxer (about 1 min of 256 kb/s).
+  std::size_t read_ahead_bytes = std::size_t{2} << 20;
+  // TSBOT_VOICE_HTTP_CONNECT_MS.
+  int connect_timeout_ms = 5000;
+  // TSBOT_VOICE_HTTP_STALL_MS: a transfer that delivers nothing for this long while there is room
+  // for more is dropped and resumed on a fresh connection.
+  int stall_timeout_ms = 3000;
+  // TSBOT_VOICE_HTTP_RETRIES: reconnects in a row without a single byte before the source fails.
+  int max_retries = 5;
+
+  static HttpReaderConfig from_env();
+};
+
+// Process-wide reader measurements since startup. Lock-free; read by GetStats and /metrics.
+struct HttpStats {
+  Histogram first_byte_ms;     // request sent to first body byte
+  Histogram throughput_kbps;   // per finished request, while the window had room
+  Histogram read_stall_ms;     // demuxer waits of 200 ms or more on an empty window
+
+  std::atomic<uint64_t> requests{0};
+  std::atomic<uint64_t> reused_connections{0};  // requests sent on a connection a pooled handle kept
+  std::atomic<uint64_t> resumes{0};             // reconnects that continued at the byte offset
+  std::atomic<uint64_t> stall_reconnects{0};    // transfers dropped by the stall timeout
+  std::atomic<uint64_t> failures{0};            // sources given up after max_retries
+  std::atomic<uint64_t> bytes{0};
+
+  template <typename F>
+  void for_each_histogram(F&& f) const {
+    f("http_first_byte", "ms", first_byte_ms);
+    f("http_throughput", "kbps", throughput_kbps);
+    f("http_read_stall", "ms", read_stall_ms);
+  }
+  template <typename F>
+  void for_each_counter(F&& f) const {
+    f("http_requests", requests.load(std::memory_order_relaxed));
+    f("http_reused_connections", reused_connections.load(std::memory_order_relaxed));
+    f("http_resumes", resumes.load(std::memory_order_relaxed));
+    f("http_stall_reconnects", stall_reconnects.load(std::memory_order_relaxed));
+    f("http_failures", failures.load(std::memory_order_relaxed));
+    f("http_bytes", bytes.load(std::memory_order_relaxed));
+  }
+};
+
+class HttpSession;
+
+// The bytes of one http(s) resource, fetched on a thread of its own into a read-ahead window the
+// demuxer reads from (see PcmDecoder). The first request goes out on construction, so the
+// response is on its way while the caller sets up the demuxer. A dropped or stalled connection
+// resumes with a Range request at the exact byte the window ends at; resources without a known
+// length (live streams) reconnect at the live edge instead. Seeks inside the window are free,
+// seeks outside it restart the fetch at the new offset.
+//
+// read(), seek(), readable() and size() are for the consumer, one thread at a time; the destructor
+// stops the fetch.
+class HttpStream {
+ public:
+  ~HttpStream();
+  HttpStream(const HttpStream&) = delete;
+  HttpStream& operator=(const HttpStream&) = delete;
+
+  // Blocks until at least one byte is there. Returns the bytes copied, 0 at the end of the
+  // resource, -1 on failure (see error()) or when `interrupted` was set.
+  int read(uint8_t* buf, int len);
+  // Absolute offset; returns it, or -1 if it lies past the known end.
+  int64_t seek(int64_t offset);
+  int64_t position() const { return read_pos_; }
+  // True when read() would not block for want of `n` bytes: they are in the window, or the
+  // resource is complete or has failed.
+  bool readable(std::size_t n);
+  // Length of the resource, -1 until the response says or if it never does. Waits for the first
+  // response header.
+  int64_t size();
+  std::string error();
+
+ private:
+  friend class HttpSession;
+  HttpStream(HttpSession* session, std::string url, const std::atomic<bool>* interrupted);
+
+  void fetch_loop();
+  bool perform(int64_t offset, uint64_t gen, bool* progressed);
+  static std::size_t on_data(char* data, std::size_t size, std::size_t n, void* opaque);
+  static int on_progress(void* opaque, int64_t, int64_t, int64_t, int64_t);
+  bool begin_body_locked();
+  bool stopping() const;
+
+  HttpSession* const session_;
+  const std::string url_;
+  const std::atomic<bool>* const interrupted_;
+  void* curl_ = nullptr;  // CURL*, fetch thread only
+
+  std::mutex mu_;
+  std::condition_variable cv_;
+  std::vector<uint8_t> window_;  // ring indexed by absolute offset % size
+  int64_t tail_ = 0;             // oldest byte still held (kept a little behind read_pos_)
+  int64_t read_pos_ = 0;
+  int64_t write_pos_ = 0;        // next byte the fetch delivers
+  int64_t size_ = -1;
+  uint64_t gen_ = 0;             // bumped by a seek that restarts the fetch
+  bool headers_ = false;         // first response seen (size_ is final)
+  bool eof_ = false;
+  bool failed_ = false;
+  bool stop_ = false;
+  std::string error_;
+
+  // Fetch thread only, for the request in flight.
+  uint64_t req_gen_ = 0;
+  int64_t req_offset_ = 0;
+  int64_t req_skip_ = 0;  // body bytes to drop when the server ignored the Range header
+  uint64_t req_bytes_ = 0;
+  bool req_started_ = false;
+  int64_t req_start_ns_ = 0;
+  int64_t last_data_ns_ = 0;
+  bool waited_room_ = false;  // the window filled up during the request
+  bool stalled_ = false;      // aborted by the stall timeout
+  int curl_code_ = 0;         // CURLcode of the last request
+  std::atomic<bool> abort_{false};
+
+  std::thread thread_;
+};
+
+// The DNS cache and TLS sessions shared by every HttpStream, and a pool of curl easy handles the
+// streams borrow one at a time. libcurl does not support sharing a connection cache between
+// transfers running on different threads, so keep-alive goes with the handle instead: a returned
+// handle keeps its connections open, and the next stream for the same host gets it back, so
+// consecutive tracks from a CDN host skip the TCP and TLS handshakes. Thread-safe; outlives its
+// streams.
+class HttpSession {
+ public:
+  explicit HttpSession(HttpReaderConfig cfg);
+  ~HttpSession();
+  HttpSession(const HttpSession&) = delete;
+  HttpSession& operator=(const HttpSession&) = delete;
+
+  bool enabled() const { return cfg_.enabled; }
+  // True for the URLs HttpStream handles.
+  static bool handles(const std::string& url);
+  // `interrupted` (may be null) aborts blocking reads when it becomes true.
+  std::unique_ptr<HttpStream> open(const std::string& url, const std::atomic<bool>* interrupted);
+
+  const HttpReaderConfig& config() const { return cfg_; }
+  HttpStats& stats() { return stats_; }
+  const HttpStats& stats() const { return stats_; }
+
+ private:
+  friend class HttpStream;
+  struct IdleHandle {
+    void* curl;        // CURL*, options reset, connections still open
+    std::string host;  // of the last URL it was given
+  };
+
+  // A handle for `url`: an idle one whose last fetch went to the same host if there is one, the
+  // most recently returned one otherwise, else a new one. Null if curl cannot make one.
+  void* acquire_handle(const std::string& url);
+  // Returns a handle acquire_handle() gave out for `url`, keeping it for the next one.
+  void release_handle(void* curl, const std::string& url);
+  static void lock_cb(void*, int data, int, void* opaque);
+  static void unlock_cb(void*, int data, void* opaque);
+
+  const HttpReaderConfig cfg_;
+  void* share_ = nullptr;  // CURLSH*, DNS and TLS sessions only
+  std::mutex locks_[8];    // one per curl_lock_data
+  std::mutex pool_mu_;
+  std::vector<IdleHandle> idle_;  // oldest first
+  HttpStats stats_;
+};
+
+}  // namespace tsbot::voice
@@ -0,0 +1,324 @@
+#include "log.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <ctime>
+#include <memory>
+#include <vector>
+
+#if defined(__linux__)
+#include <pthread.h>
+#endif
+
+#include "env.h"
+#include "spsc_ring.h"
+
+namespace tsbot::voice {
+
+namespace {
+
+constexpr std::size_t kRingRecords = 256;  // per thread
+constexpr auto kDrainInterval = std::chrono::milliseconds(20);
+constexpr std::string_view kTruncatedMark = " [...]";
+
+struct Record {
+  uint64_t seq;
+  int64_t unix_ms;
+  LogLevel level;
+  uint16_t len;
+  bool truncated;
+  char text[log_detail::kMaxMessage];
+};
+
+// One thread's lines on their way to the writer. Owned jointly by the thread and the registry, so
+// the writer can still drain it after the thread has exited.
+struct ThreadRing {
+  SpscRing<Record> ring{kRingRecords};
+  std::atomic<uint64_t> dropped{0};
+  std::atomic<bool> exited{false};
+};
+
+struct Registry {
+  std::mutex mu;
+  std::vector<std::shared_ptr<ThreadRing>> rings;
+};
+
+Registry& registry() {
+  static Registry r;
+  return r;
+}
+
+const LogConfig& config() {
+  static const LogConfig c = LogConfig::from_env();
+  return c;
+}
+
+std::atomic<uint64_t> g_seq{0};
+std::atomic<bool> g_async{false};
+
+struct ThreadHandle {
+  ~ThreadHandle() {
+    if (ring) ring->exited.store(true, std::memory_order_release);
+  }
+  std::shared_ptr<ThreadRing> ring;
+};
+
+ThreadRing& thread_ring() {
+  thread_local ThreadHandle handle;
+  if (!handle.ring) {
+    handle.ring = std::make_shared<ThreadRing>();
+    Registry& r = registry();
+    std::lock_guard<std::mutex> lk(r.mu);
+    r.rings.push_back(handle.ring);
+  }
+  return *handle.ring;
+}
+
+int64_t unix_ms_now() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+const char* level_name(LogLevel l) {
+  switch (l) {
+    case LogLevel::kDebug:
+      return "DEBUG";
+    case LogLevel::kWarn:
+      return "WARN";
+    case LogLevel::kError:
+      return "ERROR";
+    case LogLevel::kInfo:
+      break;
+  }
+  return "INFO";
+}
+
+std::string_view split_level(std::string_view msg, LogLevel* level) {
+  static constexpr struct {
+    std::string_view prefix;
+    LogLevel level;
+  } kPrefixes[] = {
+      {"WARNING:", LogLevel::kWarn}, {"WARN", LogLevel::kWarn},   {"ERROR:", LogLevel::kError},
+      {"ERROR", LogLevel::kError},   {"DEBUG", LogLevel::kDebug},
+  };
+  *level = LogLevel::kInfo;
+  for (const auto& p : kPrefixes) {
+    if (msg.substr(0, p.prefix.size()) != p.prefix) continue;
+    const std::string_view rest = msg.substr(p.prefix.size());
+    // "WARN x" and "WARN: x", but not "WARNED".
+    if (!rest.empty() && rest[0] != ' ' && rest[0] != ':') continue;
+    *level = p.level;
+    const std::size_t start = rest.find_first_not_of(" :");
+    return start == std::string_view::npos ? std::string_view() : rest.substr(start);
+  }
+  return msg;
+}
+
+void append_json_string(std::string& out, std::string_view s) {
+  out.push_back('"');
+  for (const char ch : s) {
+    const auto c = static_cast<unsigned char>(ch);
+    if (c == '"' || c == '\\') {
+      out.push_back('\\');
+      out.push_back(ch);
+    } else if (c < 0x20) {
+      char esc[8];
+      std::snprintf(esc, sizeof(esc), "\\u%04x", c);
+      out += esc;
+    } else {
+      out.push_back(ch);
+    }
+  }
+  out.push_back('"');
+}
+
+// One output line, newline included, in the configured format.
+void format_line(std::string& out, int64_t unix_ms, LogLevel level, std::string_view msg, bool truncated) {
+  const std::time_t secs = static_cast<std::time_t>(unix_ms / 1000);
+  std::tm tm{};
+  localtime_r(&secs, &tm);
+  char when[32];
+  std::strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", &tm);
+
+  if (config().json) {
+    out += "{\"time\":\"";
+    out += when;
+    out += "\",\"unix_ms\":";
+    out += std::to_string(unix_ms);
+    out += ",\"level\":\"";
+    out += level_name(level);
+    out += "\",\"component\":\"voice\",\"message\":";
+    std::string text(msg);
+    if (truncated) text += kTruncatedMark;
+    append_json_string(out, text);
+    out += "}\n";
+    return;
+  }
+  out += '[';
+  out += when;
+  out += "] [";
+  out += level_name(level);
+  out += "] [voice] ";
+  out += msg;
+  if (truncated) out += kTruncatedMark;
+  out += '\n';
+}
+
+void write_out(const std::string& out) {
+  std::fwrite(out.data(), 1, out.size(), stdout);
+  std::fflush(stdout);
+}
+
+void call_hook(LogLevel level, std::string_view msg) {
+  if (const LogHook hook = g_log_hook.load(std::memory_order_acquire)) hook(level, msg);
+}
+
+}  // namespace
+
+LogConfig LogConfig::from_env() {
+  LogConfig c;
+  std::string level = get_env("TSBOT_LOG_LEVEL", "INFO");
+  for (char& ch : level) ch = static_cast<char>(std::toupper(static_cast<unsigned char>(ch)));
+  if (level == "DEBUG" || level == "TRACE") {
+    c.min_level = LogLevel::kDebug;
+  } else if (level == "WARN" || level == "WARNING") {
+    c.min_level = LogLevel::kWarn;
+  } else if (level == "ERROR") {
+    c.min_level = LogLevel::kError;
+  }
+  c.json = get_env("TSBOT_LOG_FORMAT") == "json";
+  return c;
+}
+
+namespace log_detail {
+
+void submit(const LineBuilder& line) {
+  LogLevel level;
+  const std::string_view msg = split_level(line.view(), &level);
+  if (level < config().min_level) return;
+  const int64_t now = unix_ms_now();
+
+  if (!g_async.load(std::memory_order_acquire)) {
+    static std::mutex mu;
+    std::string out;
+    format_line(out, now, level, msg, line.truncated());
+    {
+      std::lock_guard<std::mutex> lk(mu);
+      write_out(out);
+    }
+    call_hook(level, msg);
+    return;
+  }
+
+  ThreadRing& t = thread_ring();
+  Record* r = t.ring.begin_write();
+  if (!r) {
+    t.dropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  r->seq = g_seq.fetch_add(1, std::memory_order_relaxed);
+  r->unix_ms = now;
+  r->level = level;
+  r->len = static_cast<uint16_t>(msg.size());
+  r->truncated = line.truncated();
+  std::memcpy(r->text, msg.data(), msg.size());
+  t.ring.commit_write();
+}
+
+}  // namespace log_detail
+
+void prepare_thread_log() { thread_ring(); }
+
+AsyncLogger::AsyncLogger() {
+  g_async.store(true, std::memory_order_release);
+  thread_ = std::thread([this] { run(); });
+}
+
+AsyncLogger::~AsyncLogger() {
+  {
+    std::lock_guard<std::mutex> lk(mu_);
+    quit_ = true;
+  }
+  cv_.notify_all();
+  thread_.join();
+  // From here on lines are written directly; a last drain picks up any queued meanwhile.
+  g_async.store(false, std::memory_order_release);
+  drain();
+}
+
+void AsyncLogger::flush() {
+  std::unique_lock<std::mutex> lk(mu_);
+  // A drain already under way may have passed some rings; wait for the one after it.
+  const uint64_t target = drains_ + 2;
+  flush_requested_ = true;
+  cv_.notify_all();
+  cv_.wait(lk, [&] { return drains_ >= target || quit_; });
+}
+
+void AsyncLogger::run() {
+#if defined(__linux__)
+  pthread_setname_np(pthread_self(), "tsbot-log");
+#endif
+  std::unique_lock<std::mutex> lk(mu_);
+  while (!quit_) {
+    cv_.wait_for(lk, kDrainInterval, [this] { return quit_ || flush_requested_; });
+    flush_requested_ = false;
+    lk.unlock();
+    drain();
+    lk.lock();
+    ++drains_;
+    cv_.notify_all();
+  }
+}
+
+// Writer thread (or the destructor, once it has stopped).
+void AsyncLogger::drain() {
+  struct Line {
+    uint64_t seq;
+    int64_t unix_ms;
+    LogLevel level;
+    bool truncated;
+    std::string text;
+  };
+  std::vector<Line> lines;
+  uint64_t dropped = 0;
+
+  std::vector<std::shared_ptr<ThreadRing>> rings;
+  {
+    Registry& r = registry();
+    std::lock_guard<std::mutex> lk(r.mu);
+    rings = r.rings;
+  }
+  for (const auto& t : rings) {
+    // Read before draining, so a ring that says it exited is empty once drained.
+    const bool exited = t->exited.load(std::memory_order_acquire);
+    while (const Record* rec = t->ring.begin_read()) {
+      lines.push_back({rec->seq, rec->unix_ms, rec->level, rec->truncated, std::string(rec->text, rec->len)});
+      t->ring.commit_read();
+    }
+    dropped += t->dropped.exchange(0, std::memory_order_relaxed);
+    if (exited) {
+      Registry& r = registry();
+      std::lock_guard<std::mutex> lk(r.mu);
+      r.rings.erase(std::remove(r.rings.begin(), r.rings.end(), t), r.rings.end());
+    }
+  }
+  if (lines.empty() && dropped == 0) return;
+
+  // Each ring is in order already; this interleaves the threads.
+  std::sort(lines.begin(), lines.end(), [](const Line& a, const Line& b) { return a.seq < b.seq; });
+  std::string out;
+  for (const Line& l : lines) format_line(out, l.unix_ms, l.level, l.text, l.truncated);
+  std::string dropped_msg;
+  if (dropped > 0) {
+    dropped_msg = "log: " + std::to_string(dropped) + " line(s) dropped, a thread logged faster than they were written";
+    format_line(out, unix_ms_now(), LogLevel::kWarn, dropped_msg, false);
+  }
+  write_out(out);
+
+  for (const Line& l : lines) call_hook(l.level, l.text);
+  if (dropped > 0) call_hook(LogLevel::kWarn, dropped_msg);
+}
+
+}  // namespace tsbot::voice
@@ -0,0 +1,165 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+namespace tsbot::voice {
+
+enum class LogLevel : uint8_t { kDebug, kInfo, kWarn, kError };
+
+// Output of every line, from the environment: TSBOT_LOG_LEVEL (DEBUG, INFO, WARN, ERROR; default
+// INFO) and TSBOT_LOG_FORMAT ("text", the unified `[YYYY-MM-DD HH:MM:SS] [LEVEL] [voice] message`
+// of LOGGING.md, or "json" for one object per line with the same fields).
+struct LogConfig {
+  LogLevel min_level = LogLevel::kInfo;
+  bool json = false;
+
+  static LogConfig from_env();
+};
+
+// Optional second destination for every line (the SubscribeEvents log stream). Runs on the log
+// writer thread, or on the logging thread while no AsyncLogger runs; it must not log itself.
+using LogHook = void (*)(LogLevel level, std::string_view message);
+inline std::atomic<LogHook> g_log_hook{nullptr};
+
+namespace log_detail {
+
+// Longest message kept; the rest of a line is cut and marked.
+inline constexpr std::size_t kMaxMessage = 440;
+
+// Formats a line into a fixed buffer on the caller's stack, so logging allocates nothing for the
+// common argument types. Anything else goes through an ostringstream.
+class LineBuilder {
+ public:
+  void append(std::string_view s) {
+    const std::size_t n = std::min(s.size(), kMaxMessage - len_);
+    std::memcpy(buf_ + len_, s.data(), n);
+    len_ += n;
+    truncated_ |= n < s.size();
+  }
+  void append(const char* s) { append(std::string_view(s ? s : "(null)")); }
+  void append(const std::string& s) { append(std::string_view(s)); }
+  void append(char c) { append(std::string_view(&c, 1)); }
+  void append(bool b) { append(b ? '1' : '0'); }
+
+  template <typename T>
+  void append(const T& v) {
+    if constexpr (std::is_integral_v<T> || std::is_floating_point_v<T>) {
+      char tmp[32];
+      std::to_chars_result r;
+      if constexpr (std::is_floating_point_v<T>) {
+        // Same as the default ostream precision.
+        r = std::to_chars(tmp, tmp + sizeof(tmp), v, std::chars_format::general, 6);
+      } else {
+        r = std::to_chars(tmp, tmp + sizeof(tmp), v);
+      }
+      append(std::string_view(tmp, static_cast<std::size_t>(r.ptr - tmp)));
+    } else if constexpr (std::is_enum_v<T>) {
+      append(static_cast<std::underlying_type_t<T>>(v));
+    } else {
+      std::ostringstream os;
+      os << v;
+      append(os.str());
+    }
+  }
+
+  std::string_view view() const { return {buf_, len_}; }
+  bool truncated() const { return truncated_; }
+
+ private:
+  char buf_[kMaxMessage];
+  std::size_t len_ = 0;
+  bool truncated_ = false;
+};
+
+// Level from the message's prefix ("DEBUG", "WARN", "WARNING:", "ERROR"), which is then dropped,
+// so existing call sites keep working.
+void submit(const LineBuilder& line);
+
+}  // namespace log_detail
+
+// Logs one line built from `args`. With an AsyncLogger running this never blocks and makes no
+// syscall: the line goes into the calling thread's lock-free ring and the writer thread prints it.
+// A full ring drops the line and counts it.
+template <typename... Args>
+void log_print(Args&&... args) {
+  log_detail::LineBuilder line;
+  (line.append(std::forward<Args>(args)), ...);
+  log_detail::submit(line);
+}
+
+// Sets up the calling thread's ring ahead of its first line, which would otherwise allocate it.
+// Called by threads that must not allocate once running (the send thread).
+void prepare_thread_log();
+
+// A log site that logs at most once per `interval`; the lines it held back are counted into the
+// next one. For hot paths, e.g. `static RateLimitedLog limit(std::chrono::seconds(1));`.
+class RateLimitedLog {
+ public:
+  explicit constexpr RateLimitedLog(std::chrono::milliseconds interval) : interval_ns_(interval.count() * 1000000) {}
+
+  template <typename... Args>
+  void operator()(Args&&... args) {
+    const int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                            std::chrono::steady_clock::now().time_since_epoch())
+                            .count();
+    int64_t next = next_ns_.load(std::memory_order_relaxed);
+    if (now < next || !next_ns_.compare_exchange_strong(next, now + interval_ns_, std::memory_order_relaxed)) {
+      suppressed_.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    const uint64_t held = suppressed_.exchange(0, std::memory_order_relaxed);
+    if (held == 0) {
+      log_print(std::forward<Args>(args)...);
+    } else {
+      log_print(std::forward<Args>(args)..., " (", held, " similar suppressed)");
+    }
+  }
+
+ private:
+  const int64_t interval_ns_;
+  std::atomic<int64_t> next_ns_{0};
+  std::atomic<uint64_t> suppressed_{0};
+};
+
+// The process's log writer. While one exists, log_print() only queues into per-thread rings and
+// this thread drains them every few milliseconds: lines of all threads in order, one buffered
+// write per batch, then the hook. Without one (tools, tests), lines are written synchronously.
+// Construct once, early in main() and after keep_off_audio_cpu(), whose mask the writer thread
+// inherits; the destructor prints whatever is still queued.
+class AsyncLogger {
+ public:
+  AsyncLogger();
+  ~AsyncLogger();
+  AsyncLogger(const AsyncLogger&) = delete;
+  AsyncLogger& operator=(const AsyncLogger&) = delete;
+
+  // Returns once every line queued before the call has been written and passed to the hook.
+  void flush();
+
+ private:
+  void run();
+  void drain();
+
+  std::mutex mu_;
+  std::condition_variable cv_;
+  bool quit_ = false;
+  uint64_t drains_ = 0;         // completed drains, under mu_
+  bool flush_requested_ = false;
+  std::thread thread_;
+};
+
+}  // namespace tsbot::voice
@@ -0,0 +1,110 @@
+#include "loudness.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "audio_format.h"
+#include "env.h"
+
+namespace tsbot::voice {
+
+namespace {
+
+// BS.1770 K-weighting at 48 kHz: a high shelf for the head, then the RLB high-pass.
+constexpr double kShelfB0 = 1.53512485958697;
+constexpr double kShelfB1 = -2.69169618940638;
+constexpr double kShelfB2 = 1.19839281085285;
+constexpr double kShelfA1 = -1.69065929318241;
+constexpr double kShelfA2 = 0.73248077421585;
+constexpr double kHighPassA1 = -1.99004745483398;
+constexpr double kHighPassA2 = 0.99007225036621;
+
+constexpr int kBlockFrames = 20;  // 400 ms
+constexpr double kBlockSamplesPerChannel = double{kFrameSamplesPerChannel} * kBlockFrames;
+constexpr double kRelativeGateLu = 10.0;
+constexpr float kDeadbandDb = 0.5f;
+
+double lufs_of(double mean_square) { return -0.691 + 10.0 * std::log10(mean_square); }
+
+}  // namespace
+
+float LoudnessConfig::gain_for(float lufs) const {
+  const float db = std::clamp(target_lufs - lufs, -max_cut_db, max_boost_db);
+  if (std::fabs(db) < kDeadbandDb) return 1.0f;
+  return std::pow(10.0f, db / 20.0f);
+}
+
+LoudnessConfig LoudnessConfig::from_env() {
+  LoudnessConfig c;
+  if (auto v = env_int("TSBOT_VOICE_LOUDNORM")) c.enabled = *v != 0;
+  if (auto v = env_int("TSBOT_VOICE_LOUDNORM_TARGET"); v && *v >= -40 && *v <= -5) c.target_lufs = static_cast<float>(*v);
+  if (auto v = env_int("TSBOT_VOICE_LOUDNORM_MAX_BOOST_DB"); v && *v >= 0 && *v <= 24) {
+    c.max_boost_db = static_cast<float>(*v);
+  }
+  return c;
+}
+
+bool LoudnessMeter::add(const int16_t* frame) {
+  constexpr double kScale = 1.0 / 32768.0;
+  // Both channels in one pass: their recurrences are independent, so the CPU overlaps them.
+  Filter& l = k_[0];
+  Filter& r = k_[1];
+  double sum = 0.0;
+  for (int i = 0; i < kFrameSamplesPerChannel; ++i) {
+    const double xl = frame[i * 2] * kScale;
+    const double xr = frame[i * 2 + 1] * kScale;
+    const double yl = kShelfB0 * xl + l.s1[0];
+    const double yr = kShelfB0 * xr + r.s1[0];
+    l.s1[0] = kShelfB1 * xl - kShelfA1 * yl + l.s1[1];
+    r.s1[0] = kShelfB1 * xr - kShelfA1 * yr + r.s1[1];
+    l.s1[1] = kShelfB2 * xl - kShelfA2 * yl;
+    r.s1[1] = kShelfB2 * xr - kShelfA2 * yr;
+    // The high-pass numerator is 1, -2, 1.
+    const double zl = yl + l.s2[0];
+    const double zr = yr + r.s2[0];
+    l.s2[0] = -2.0 * yl - kHighPassA1 * zl + l.s2[1];
+    r.s2[0] = -2.0 * yr - kHighPassA1 * zr + r.s2[1];
+    l.s2[1] = yl - kHighPassA2 * zl;
+    r.s2[1] = yr - kHighPassA2 * zr;
+    sum += zl * zl + zr * zr;
+  }
+  block_sum_ += sum;
+  if (++block_frames_ < kBlockFrames) return false;
+
+  const double mean_square = block_sum_ / kBlockSamplesPerChannel;
+  block_sum_ = 0.0;
+  block_frames_ = 0;
+  ++blocks_;
+  const double lufs = mean_square > 0.0 ? lufs_of(mean_square) : kMinLufs;
+  if (lufs > kMinLufs) {
+    const int bin = std::min(kBins - 1, static_cast<int>((lufs - kMinLufs) / kBinLu));
+    ++bin_blocks_[bin];
+    bin_energy_[bin] += mean_square;
+  }
+  return true;
+}
+
+float LoudnessMeter::integrated_lufs() const {
+  double energy = 0.0;
+  uint64_t blocks = 0;
+  for (int b = 0; b < kBins; ++b) {
+    energy += bin_energy_[b];
+    blocks += bin_blocks_[b];
+  }
+  if (blocks == 0) return std::numeric_limits<float>::quiet_NaN();
+
+  // Bins whose centre is at or above the relative gate count whole.
+  const double gate = lufs_of(energy / static_cast<double>(blocks)) - kRelativeGateLu;
+  const int first = std::max(0, static_cast<int>(std::ceil((gate - kMinLufs) / kBinLu - 0.5)));
+  double gated_energy = 0.0;
+  uint64_t gated_blocks = 0;
+  for (int b = first; b < kBins; ++b) {
+    gated_energy += bin_energy_[b];
+    gated_blocks += bin_blocks_[b];
+  }
+  if (gated_blocks == 0) return static_cast<float>(lufs_of(energy / static_cast<double>(blocks)));
+  return static_cast<float>(lufs_of(gated_energy / static_cast<double>(gated_blocks)));
+}
+
+}  // namespace tsbot::voice
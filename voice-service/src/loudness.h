@@ -0,0 +1,60 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+namespace tsbot::voice {
+
+// Loudness normalization of the engine's output (see PlaybackEngine).
+struct LoudnessConfig {
+  // TSBOT_VOICE_LOUDNORM, default on.
+  bool enabled = true;
+  // TSBOT_VOICE_LOUDNORM_TARGET: integrated loudness every track is brought to, in LUFS.
+  float target_lufs = -16.0f;
+  // TSBOT_VOICE_LOUDNORM_MAX_BOOST_DB: quiet tracks are raised at most this much; the output
+  // limiter takes care of the peaks that pushes over full scale.
+  float max_boost_db = 9.0f;
+  // Loud tracks are lowered at most this much.
+  float max_cut_db = 20.0f;
+
+  // Linear gain that brings a track measured at `lufs` to the target. Exactly 1 within half a dB
+  // of it, where the difference is not worth giving up the engine's transparent path.
+  float gain_for(float lufs) const;
+
+  static LoudnessConfig from_env();
+};
+
+// Integrated loudness after ITU-R BS.1770 / EBU R128, cheap enough to run on every decoded frame:
+// K-weighting, non-overlapping 400 ms blocks (20 engine frames), the -70 LUFS absolute and -10 LU
+// relative gates. Block energies are binned by level in 0.25 LU steps instead of kept in a list,
+// so memory is fixed and nothing allocates; the relative gate is resolved to the nearest bin.
+// Without the standard's 75% block overlap, a track's estimate can differ slightly from a full R128
+// meter's, which is plenty for normalization.
+class LoudnessMeter {
+ public:
+  // One engine frame (kFrameSamples interleaved s16). True when it completed a block.
+  bool add(const int16_t* frame);
+  // NaN until a block has passed the absolute gate.
+  float integrated_lufs() const;
+  // Blocks completed so far, gated or not.
+  uint32_t blocks() const { return blocks_; }
+
+ private:
+  static constexpr double kMinLufs = -70.0;
+  static constexpr double kBinLu = 0.25;
+  static constexpr int kBins = 320;  // up to +10 LUFS, past anything s16 stereo can reach
+
+  // Transposed direct form II state of the two K-weighting stages, per channel.
+  struct Filter {
+    double s1[2] = {};
+    double s2[2] = {};
+  };
+  Filter k_[2];
+  double block_sum_ = 0.0;  // K-weighted squares of both channels in the current block
+  int block_frames_ = 0;
+  uint32_t blocks_ = 0;
+  std::array<uint32_t, kBins> bin_blocks_{};
+  std::array<double, kBins> bin_energy_{};  // sum of the mean squares of the blocks in each bin
+};
+
+}  // namespace tsbot::voice
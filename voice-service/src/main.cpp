@@ -1,19 +1,27 @@
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <cctype>
 #include <chrono>
+#include <condition_variable>
 #include <cstdint>
 #include <cstdlib>
+#include <deque>
 #include <filesystem>
 #include <fstream>
-#include <iostream>
 #include <memory>
 #include <mutex>
 #include <optional>
+#include <random>
+#include <shared_mutex>
 #include <string>
 #include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
 #include <grpcpp/grpcpp.h>
-#include <google/protobuf/empty.pb.h>
 
 #if defined(TSBOT_HAS_TS3_SDK)
 #include <teamlog/logtypes.h>
@@ -21,24 +29,35 @@
 #include <teamspeak/public_definitions.h>
 #endif
 
-#include "voice.grpc.pb.h"
-
-namespace voicev1 = tsbot::voice::v1;
+#include "audio_cache.h"
+#include "audio_format.h"
+#include "bot_registry.h"
+#include "client_commands.h"
+#include "decode_pool.h"
+#include "env.h"
+#include "event_bus.h"
+#include "grpc_server.h"
+#include "http_reader.h"
+#include "log.h"
+#include "metrics_http.h"
+#include "playback_engine.h"
+#include "send_clock.h"
+#include "serverquery.h"
+#include "status_page.h"
+#include "voice_activity.h"
+#include "voice_service.h"
+#include "voice_sink.h"
+
+namespace voice = tsbot::voice;
 
 #if defined(TSBOT_HAS_TS3_SDK)
 namespace {
 
-std::string get_env(std::string_view key, std::string_view def = "") {
-  if (const char* v = std::getenv(std::string(key).c_str()); v && *v) return std::string(v);
-  return std::string(def);
-}
-
-std::mutex g_print_mu;
+using voice::get_env;
 
 template <typename... Args>
 void ts3_print(Args&&... args) {
-  std::lock_guard<std::mutex> lk(g_print_mu);
-  (std::cout << ... << std::forward<Args>(args)) << std::endl;
+  voice::log_print(std::forward<Args>(args)...);
 }
 
 std::optional<uint64> parse_u64(std::string_view s) {
@@ -93,40 +112,182 @@ struct Ts3Config {
   std::string channel_password;
   std::vector<std::string> channel_path;
   std::optional<uint64> channel_id;
-  std::string resources_folder;
-  std::string log_folder;
+  // Playback on the custom device instead of a sound card.
+  bool headless = true;
 };
 
-class Ts3Client {
- public:
-  Ts3Client() = default;
+// Name under which the engine's output is registered with the SDK as a capture device. In
+// multi-bot mode each connection gets its own, suffixed with the bot id.
+constexpr const char* kCaptureDeviceId = "tsbot_engine";
+
+// TSBOT_TS3_<KEY> for `bot`: TSBOT_TS3_<BOT>_<KEY> wins if set. Keys that must differ between
+// connections (nickname, identity) are not inherited from the plain key in multi-bot mode.
+std::string bot_env(const std::string& bot, bool multi, const std::string& key, const std::string& def = "",
+                    bool inherit = true) {
+  std::string prefix;
+  for (const char ch : bot) {
+    prefix.push_back(std::isalnum(static_cast<unsigned char>(ch)) ? static_cast<char>(std::toupper(ch)) : '_');
+  }
+  if (multi) {
+    if (std::string v = get_env("TSBOT_TS3_" + prefix + "_" + key); !v.empty()) return v;
+    if (!inherit) return def;
+  }
+  return get_env("TSBOT_TS3_" + key, def);
+}
 
-  bool start() {
-    cfg_ = load_config();
+// Replaces `path` by way of a temporary file, so a crash never leaves it half written. `tag` keeps
+// the temporary files of connections starting at once apart.
+void write_file_atomic(const std::string& path, const std::string& content, const std::string& tag) {
+  const std::string tmp = path + ".tmp-" + tag;
+  {
+    std::ofstream out(tmp, std::ios::trunc);
+    if (!out.good()) return;
+    out << content;
+    if (!out.flush()) return;
+  }
+  std::error_code ec;
+  std::filesystem::rename(tmp, path, ec);
+  if (ec) {
+    ts3_print("WARN cannot write ", path, ": ", ec.message());
+    std::filesystem::remove(tmp, ec);
+  }
+}
 
-    std::error_code ec;
-    if (!cfg_.log_folder.empty()) {
-      std::filesystem::create_directories(std::filesystem::path(cfg_.log_folder), ec);
+// Notices and description updates waiting for the command thread; beyond this they are dropped.
+constexpr std::size_t kMaxPendingCommands = 50;
+// How often the command thread samples the connection's packet loss and ping.
+constexpr auto kLinkPollInterval = std::chrono::seconds(2);
+// Redial delays after a drop double from the first to the last, each with jitter; a connection that
+// stayed up this long resets them.
+constexpr auto kFirstRedialDelay = std::chrono::milliseconds(250);
+constexpr auto kMaxRedialDelay = std::chrono::milliseconds(30000);
+constexpr auto kStableConnection = std::chrono::seconds(30);
+
+struct Ts3Command {
+  enum class Kind { kNotice, kDescription };
+  Kind kind = Kind::kNotice;
+  int target_mode = 2;
+  std::string text;
+};
+
+// One TS3 server connection. The client library itself is process-wide (init_library() /
+// shutdown_library()); SDK callbacks are dispatched to the connection owning their
+// serverConnectionHandlerID.
+class Ts3Client final : public voice::VoiceSink, public voice::ClientCommands {
+ public:
+  // `multi` selects per-bot configuration (see bot_env). Incoming text messages are published to
+  // `events` as ChatEvents. With `ducking` enabled the other clients' voice is watched for talk,
+  // which channel_talking() reports to the engine and `events` gets as TalkEvents.
+  Ts3Client(std::string bot_id, bool multi, voice::EventBus* events, const voice::DuckingConfig& ducking,
+            int audio_cpu)
+      : bot_id_(std::move(bot_id)),
+        multi_(multi),
+        capture_device_id_(multi_ ? std::string(kCaptureDeviceId) + "_" + bot_id_ : kCaptureDeviceId),
+        events_(events) {
+    if (ducking.enabled) {
+      vad_ = std::make_unique<voice::VoiceActivity>(
+          ducking, audio_cpu,
+          [this](uint16_t client, bool talking, float level_dbfs) { on_talk(client, talking, level_dbfs); },
+          [this] { pull_playback(); });
     }
+  }
+  // stop() is idempotent; this covers a client destroyed without one.
+  ~Ts3Client() override { stop(); }
 
-    if (!cfg_.identity_file.empty()) {
-      std::filesystem::create_directories(std::filesystem::path(cfg_.identity_file).parent_path(), ec);
+  // The custom capture device takes PCM; the SDK encodes it with the channel's codec.
+  bool wants_opus() const override { return false; }
+
+  void send_frame(const voice::OutFrame& frame) override {
+    if (!connected_.load(std::memory_order_acquire)) return;
+    ts3client_processCustomCaptureData(capture_device_id_.c_str(), frame.pcm, voice::kFrameSamplesPerChannel);
+  }
+
+  void end_of_stream() override {}
+
+  // Offline from the first connect on; without the client library (development runs) there is
+  // nothing to wait for.
+  bool online() const override {
+    return connected_.load(std::memory_order_acquire) || !supervised_.load(std::memory_order_acquire);
+  }
+
+  bool link_quality(voice::LinkQuality* out) const override {
+    const uint32_t loss = loss_permille_.load(std::memory_order_relaxed);
+    if (loss == kLinkUnknown) return false;
+    out->packet_loss = loss / 1000.0;
+    out->ping_ms = ping_ms_.load(std::memory_order_relaxed);
+    return true;
+  }
+
+  bool channel_talking() const override { return vad_ && vad_->anyone_talking(); }
+
+  bool send_notice(int target_mode, std::string text) override {
+    return enqueue(Ts3Command{Ts3Command::Kind::kNotice, target_mode == 3 ? 3 : 2, std::move(text)});
+  }
+
+  bool set_description(std::string description) override {
+    return enqueue(Ts3Command{Ts3Command::Kind::kDescription, 0, std::move(description)});
+  }
+
+  // Once per process, before any start(). `voice_activity` registers for the other clients' voice,
+  // which is only looked at for ducking.
+  static void init_library(bool voice_activity) {
+    const std::string log_folder = get_env("TSBOT_TS3_LOG", "./logs");
+    const std::string resources_folder = get_env("TSBOT_TS3_RESOURCES", "./ts3sdk/bin/linux/amd64");
+    std::error_code ec;
+    if (!log_folder.empty()) {
+      std::filesystem::create_directories(std::filesystem::path(log_folder), ec);
     }
 
     ui_.onConnectStatusChangeEvent = &Ts3Client::onConnectStatusChangeEvent;
     ui_.onTextMessageEvent = &Ts3Client::onTextMessageEvent;
     ui_.onServerErrorEvent = &Ts3Client::onServerErrorEvent;
+    if (voice_activity) {
+      ui_.onTalkStatusChangeEvent = &Ts3Client::onTalkStatusChangeEvent;
+      ui_.onEditPlaybackVoiceDataEvent = &Ts3Client::onEditPlaybackVoiceDataEvent;
+    }
 
     const int log_types = LogType_CONSOLE | LogType_FILE;
-    unsigned int err = ts3client_initClientLib(&ui_, nullptr, log_types, cfg_.log_folder.c_str(), cfg_.resources_folder.c_str());
+    unsigned int err = ts3client_initClientLib(&ui_, nullptr, log_types, log_folder.c_str(), resources_folder.c_str());
     if (err != 0) {
-      std::cerr << "ts3client_initClientLib failed: " << err << " (" << ts3_err(err) << ")" << std::endl;
+      ts3_print("ERROR ts3client_initClientLib failed: ", err, " (", ts3_err(err), ")");
       ts3_print("WARNING: TS3 SDK initialization failed, continuing without TS3 connection");
-      return true; // Continue without TS3 connection for development
+      return;  // Continue without TS3 connection for development
+    }
+    lib_initialized_ = true;
+    if (!log_folder.empty()) device_cache_file_ = log_folder + "/playback_device.txt";
+  }
+
+  // After every connection has been stopped.
+  static void shutdown_library() {
+    if (lib_initialized_) ts3client_destroyClientLib();
+    lib_initialized_ = false;
+  }
+
+  // Runs start() on a thread of its own, so gRPC and other connections need not wait for it.
+  void start_async() {
+    start_thread_ = std::thread([this] { start(); });
+  }
+
+  bool start() {
+    const auto started = std::chrono::steady_clock::now();
+    cfg_ = load_config(bot_id_, multi_);
+    sq_cfg_ = voice::ServerQueryConfig::from_env();
+    {
+      // enqueue() may already be running on a gRPC thread.
+      std::lock_guard<std::mutex> lk(cmd_mu_);
+      cmd_thread_ = std::thread([this] { command_loop(); });
+    }
+
+    std::error_code ec;
+    if (!cfg_.identity_file.empty()) {
+      std::filesystem::create_directories(std::filesystem::path(cfg_.identity_file).parent_path(), ec);
     }
 
+    if (!lib_initialized_) return true;
     initialized_ = true;
+    supervised_.store(true, std::memory_order_release);
 
+    unsigned int err = 0;
     if (cfg_.identity.empty()) {
       if (!cfg_.identity_file.empty() && std::filesystem::exists(std::filesystem::path(cfg_.identity_file))) {
         std::ifstream in(cfg_.identity_file);
@@ -141,161 +302,316 @@ class Ts3Client {
       char* ident = nullptr;
       err = ts3client_createIdentity(&ident);
       if (err != 0) {
-        std::cerr << "ts3client_createIdentity failed: " << err << " (" << ts3_err(err) << ")" << std::endl;
+        ts3_print("ERROR ts3client_createIdentity failed: ", err, " (", ts3_err(err), ")");
         return false;
       }
       cfg_.identity = ident;
       ts3client_freeMemory(ident);
       ts3_print("TS3_IDENTITY=", cfg_.identity);
 
-      if (!cfg_.identity_file.empty()) {
-        std::ofstream out(cfg_.identity_file, std::ios::trunc);
-        if (out.good()) {
-          out << cfg_.identity;
-        }
-      }
+      // Cached for the next start; createIdentity is the slowest step of a first run.
+      if (!cfg_.identity_file.empty()) write_file_atomic(cfg_.identity_file, cfg_.identity, bot_id_);
     }
 
     uint64 sch_id = 0;
     err = ts3client_spawnNewServerConnectionHandler(0, &sch_id);
     if (err != 0) {
-      std::cerr << "ts3client_spawnNewServerConnectionHandler failed: " << err << " (" << ts3_err(err) << ")" << std::endl;
+      ts3_print("ERROR ts3client_spawnNewServerConnectionHandler failed: ", err, " (", ts3_err(err), ")");
       return false;
     }
     sch_id_ = sch_id;
 
     {
-      std::lock_guard<std::mutex> lk(mu_);
-      active_instance_ = this;
+      std::unique_lock<std::shared_mutex> lk(registry_mu_);
+      by_handler_[sch_id_] = this;
+    }
+
+    open_devices();
+    if (vad_) vad_->start();
+
+    if (!connect()) {
+      ts3_print("WARNING: TS3[", bot_id_, "] connection failed, will keep retrying");
+      connection_lost();
+      return true;
+    }
+
+    ts3_print("TS3[", bot_id_, "] connecting to ", cfg_.host, ":", cfg_.port, " as ", cfg_.nickname, " (setup ",
+              std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started).count(),
+              " ms)");
+    return true;
+  }
+
+  void stop() {
+    if (start_thread_.joinable()) start_thread_.join();
+    stop_command_thread();
+    connected_.store(false, std::memory_order_release);
+    if (initialized_ && sch_id_) {
+      {
+        // Waits out any callback still dispatching to this connection.
+        std::unique_lock<std::shared_mutex> lk(registry_mu_);
+        by_handler_.erase(sch_id_);
+      }
+      if (vad_) vad_->stop();
+      ts3client_closeCaptureDevice(sch_id_);
+      ts3client_closePlaybackDevice(sch_id_);
+      ts3client_stopConnection(sch_id_, "");
+      ts3client_destroyServerConnectionHandler(sch_id_);
+      ts3client_unregisterCustomDevice(capture_device_id_.c_str());
+    }
+    initialized_ = false;
+  }
+
+ private:
+  // Joins the server, or rejoins it after a drop: the default channel path goes along with the
+  // connect, and a configured channel id is moved to once the connection is up. False if the SDK
+  // refused to start the attempt.
+  bool connect() {
+    std::vector<const char*> chan_ptrs;
+    if (!cfg_.channel_path.empty()) {
+      chan_ptrs.reserve(cfg_.channel_path.size() + 1);
+      for (auto& p : cfg_.channel_path) chan_ptrs.push_back(p.c_str());
+      chan_ptrs.push_back(nullptr);
+    }
+    const char** default_channel_array = chan_ptrs.empty() ? nullptr : chan_ptrs.data();
+    const unsigned int err = ts3client_startConnection(sch_id_, cfg_.identity.c_str(), cfg_.host.c_str(), cfg_.port,
+                                                       cfg_.nickname.c_str(), default_channel_array,
+                                                       cfg_.channel_password.c_str(), cfg_.server_password.c_str());
+    if (err != 0) {
+      ts3_print("WARN ts3client_startConnection failed: ", err, " (", ts3_err(err), ")");
+      return false;
     }
+    return true;
+  }
 
-    // Many TS3 SDK setups require opening playback/capture devices before connecting.
-    // We try to open explicit default mode/device first for better compatibility.
+  // The connection dropped or an attempt failed: the command thread redials after a jittered,
+  // exponentially growing delay. The SDK is not re-entered from its own callback. Meanwhile the
+  // engine holds the track (see online()), so playback picks up where it stopped.
+  void connection_lost() {
+    // Whoever talked is gone with the connection, without a status change.
+    if (vad_) vad_->reset();
+    std::chrono::milliseconds delay{};
+    uint32_t attempt = 0;
     {
-      Ts3Str pb_mode;
-      unsigned int e = ts3client_getDefaultPlayBackMode(&pb_mode.p);
-      if (e != 0) ts3_print("ts3client_getDefaultPlayBackMode failed: ", e, " (", ts3_err(e), ")");
-      pb_mode_ = (pb_mode.p && *pb_mode.p) ? pb_mode.p : "";
-      const char* pb_mode_id = pb_mode_.c_str();
-      ts3_print("TS3 playback mode=", pb_mode_id);
-
-      Ts3StrArray pb_dev;
-      e = ts3client_getDefaultPlaybackDevice(pb_mode_id, &pb_dev.p);
-      if (e != 0) ts3_print("ts3client_getDefaultPlaybackDevice failed: ", e, " (", ts3_err(e), ")");
-
-      pb_device_id_ = (pb_dev.p && pb_dev.p[1]) ? pb_dev.p[1] : "";
-      pb_device_name_ = (pb_dev.p && pb_dev.p[0]) ? pb_dev.p[0] : "";
-      const char* pb_try1 = pb_device_id_.c_str();
-      const char* pb_try2 = pb_device_name_.c_str();
-      ts3_print("TS3 playback device(name)=", pb_try2, " id=", pb_try1);
-
-      e = ts3client_openPlaybackDevice(sch_id_, pb_mode_id, pb_try1);
+      std::lock_guard<std::mutex> lk(cmd_mu_);
+      if (cmd_quit_) return;
+      const auto now = std::chrono::steady_clock::now();
+      // A connection that held for a while starts over at the shortest delay; a flapping one
+      // keeps backing off.
+      if (up_since_ && now - *up_since_ >= kStableConnection) redial_attempts_ = 0;
+      up_since_.reset();
+      attempt = ++redial_attempts_;
+      const auto cap = std::min(kMaxRedialDelay, kFirstRedialDelay * (1 << std::min<uint32_t>(attempt - 1, 10)));
+      // Half the step plus a random share of the other half, so bots dropped together do not
+      // redial in lockstep.
+      delay = cap / 2 + std::chrono::milliseconds(std::uniform_int_distribution<int64_t>(0, cap.count() / 2)(rng_));
+      redial_at_ = now + delay;
+    }
+    cmd_cv_.notify_one();
+    ts3_print("TS3[", bot_id_, "] disconnected, redialing in ", delay.count(), " ms (attempt ", attempt, ")");
+  }
+
+  void connection_up() {
+    std::lock_guard<std::mutex> lk(cmd_mu_);
+    up_since_ = std::chrono::steady_clock::now();
+    redial_at_.reset();
+  }
+
+  // Headless, playback goes to the custom device as well: a bot has nothing to play out, and no
+  // sound card needs probing. Otherwise the device that worked last time is tried first, then the
+  // default device by id, by name and the SDK's own fallback.
+  void open_devices() {
+    // Capture goes through a custom device fed by the playback engine instead of a sound card.
+    unsigned int e = ts3client_registerCustomDevice(capture_device_id_.c_str(), "tsbot engine", voice::kSampleRate,
+                                                    voice::kChannels, voice::kSampleRate, voice::kChannels);
+    if (e != 0) ts3_print("ts3client_registerCustomDevice failed: ", e, " (", ts3_err(e), ")");
+
+    if (cfg_.headless) {
+      e = ts3client_openPlaybackDevice(sch_id_, "custom", capture_device_id_.c_str());
       if (e == 0) {
-        ts3_print("ts3client_openPlaybackDevice (id) ok");
+        ts3_print("TS3[", bot_id_, "] headless, playback on custom device");
       } else {
-        ts3_print("ts3client_openPlaybackDevice (id) failed: ", e, " (", ts3_err(e), ")");
-        e = ts3client_openPlaybackDevice(sch_id_, pb_mode_id, pb_try2);
-        if (e == 0) {
-          ts3_print("ts3client_openPlaybackDevice (name) ok");
-        } else {
-          ts3_print("ts3client_openPlaybackDevice (name) failed: ", e, " (", ts3_err(e), ")");
-          e = ts3client_openPlaybackDevice(sch_id_, "", "");
-          if (e == 0) {
-            ts3_print("ts3client_openPlaybackDevice (fallback empty) ok");
-          } else {
-            ts3_print("ts3client_openPlaybackDevice (fallback empty) failed: ", e, " (", ts3_err(e), ")");
+        ts3_print("ts3client_openPlaybackDevice (custom) failed: ", e, " (", ts3_err(e), ")");
+      }
+    } else {
+      open_playback_device();
+    }
+
+    e = ts3client_openCaptureDevice(sch_id_, "custom", capture_device_id_.c_str());
+    if (e != 0) ts3_print("ts3client_openCaptureDevice (custom) failed: ", e, " (", ts3_err(e), ")");
+
+    // Music, not speech: the preprocessor must not gate, level or denoise the stream.
+    ts3client_setPreProcessorConfigValue(sch_id_, "vad", "false");
+    ts3client_setPreProcessorConfigValue(sch_id_, "agc", "false");
+    ts3client_setPreProcessorConfigValue(sch_id_, "denoise", "false");
+  }
+
+  void open_playback_device() {
+    // "mode\tdevice" of the last device that opened.
+    if (!device_cache_file_.empty()) {
+      std::ifstream in(device_cache_file_);
+      std::string line;
+      if (in.good() && std::getline(in, line)) {
+        if (const auto tab = line.find('\t'); tab != std::string::npos) {
+          const std::string mode = line.substr(0, tab);
+          const std::string device = line.substr(tab + 1);
+          if (ts3client_openPlaybackDevice(sch_id_, mode.c_str(), device.c_str()) == 0) {
+            ts3_print("TS3[", bot_id_, "] playback mode=", mode, " device=", device, " (cached)");
+            return;
           }
         }
       }
+    }
 
-      Ts3Str cap_mode;
-      e = ts3client_getDefaultCaptureMode(&cap_mode.p);
-      if (e != 0) ts3_print("ts3client_getDefaultCaptureMode failed: ", e, " (", ts3_err(e), ")");
-      cap_mode_ = (cap_mode.p && *cap_mode.p) ? cap_mode.p : "";
-      const char* cap_mode_id = cap_mode_.c_str();
-      ts3_print("TS3 capture mode=", cap_mode_id);
-
-      Ts3StrArray cap_dev;
-      e = ts3client_getDefaultCaptureDevice(cap_mode_id, &cap_dev.p);
-      if (e != 0) ts3_print("ts3client_getDefaultCaptureDevice failed: ", e, " (", ts3_err(e), ")");
+    Ts3Str pb_mode;
+    unsigned int e = ts3client_getDefaultPlayBackMode(&pb_mode.p);
+    if (e != 0) ts3_print("ts3client_getDefaultPlayBackMode failed: ", e, " (", ts3_err(e), ")");
+    const std::string mode = (pb_mode.p && *pb_mode.p) ? pb_mode.p : "";
 
-      cap_device_id_ = (cap_dev.p && cap_dev.p[1]) ? cap_dev.p[1] : "";
-      cap_device_name_ = (cap_dev.p && cap_dev.p[0]) ? cap_dev.p[0] : "";
-      const char* cap_try1 = cap_device_id_.c_str();
-      const char* cap_try2 = cap_device_name_.c_str();
-      ts3_print("TS3 capture device(name)=", cap_try2, " id=", cap_try1);
+    Ts3StrArray pb_dev;
+    e = ts3client_getDefaultPlaybackDevice(mode.c_str(), &pb_dev.p);
+    if (e != 0) ts3_print("ts3client_getDefaultPlaybackDevice failed: ", e, " (", ts3_err(e), ")");
+    const std::string id = (pb_dev.p && pb_dev.p[1]) ? pb_dev.p[1] : "";
+    const std::string name = (pb_dev.p && pb_dev.p[0]) ? pb_dev.p[0] : "";
 
-      e = ts3client_openCaptureDevice(sch_id_, cap_mode_id, cap_try1);
+    const std::pair<std::string, std::string> tries[] = {{mode, id}, {mode, name}, {"", ""}};
+    for (const auto& [m, d] : tries) {
+      e = ts3client_openPlaybackDevice(sch_id_, m.c_str(), d.c_str());
       if (e == 0) {
-        ts3_print("ts3client_openCaptureDevice (id) ok");
-      } else {
-        ts3_print("ts3client_openCaptureDevice (id) failed: ", e, " (", ts3_err(e), ")");
-        e = ts3client_openCaptureDevice(sch_id_, cap_mode_id, cap_try2);
-        if (e == 0) {
-          ts3_print("ts3client_openCaptureDevice (name) ok");
-        } else {
-          ts3_print("ts3client_openCaptureDevice (name) failed: ", e, " (", ts3_err(e), ")");
-          e = ts3client_openCaptureDevice(sch_id_, "", "");
-          if (e == 0) {
-            ts3_print("ts3client_openCaptureDevice (fallback empty) ok");
-          } else {
-            ts3_print("ts3client_openCaptureDevice (fallback empty) failed: ", e, " (", ts3_err(e), ")");
-          }
-        }
+        ts3_print("TS3[", bot_id_, "] playback mode=", m, " device=", d);
+        if (!device_cache_file_.empty()) write_file_atomic(device_cache_file_, m + "\t" + d, bot_id_);
+        return;
       }
     }
+    ts3_print("ts3client_openPlaybackDevice failed for mode=", mode, " device=", id, " name=", name, ": ", e, " (",
+              ts3_err(e), ")");
+  }
 
-    std::vector<const char*> chan_ptrs;
-    if (!cfg_.channel_path.empty()) {
-      chan_ptrs.reserve(cfg_.channel_path.size() + 1);
-      for (auto& p : cfg_.channel_path) chan_ptrs.push_back(p.c_str());
-      chan_ptrs.push_back(nullptr);
+  bool enqueue(Ts3Command cmd) {
+    {
+      std::lock_guard<std::mutex> lk(cmd_mu_);
+      if (!cmd_thread_.joinable() || cmd_quit_ || cmd_queue_.size() >= kMaxPendingCommands) return false;
+      cmd_queue_.push_back(std::move(cmd));
+    }
+    cmd_cv_.notify_one();
+    return true;
+  }
+
+  void stop_command_thread() {
+    {
+      std::lock_guard<std::mutex> lk(cmd_mu_);
+      cmd_quit_ = true;
     }
+    cmd_cv_.notify_all();
+    if (cmd_thread_.joinable()) cmd_thread_.join();
+  }
 
-    const char** default_channel_array = chan_ptrs.empty() ? nullptr : chan_ptrs.data();
-    err = ts3client_startConnection(
-        sch_id_,
-        cfg_.identity.c_str(),
-        cfg_.host.c_str(),
-        cfg_.port,
-        cfg_.nickname.c_str(),
-        default_channel_array,
-        cfg_.channel_password.c_str(),
-        cfg_.server_password.c_str());
+  // Runs SDK text commands and ServerQuery round-trips off the gRPC and audio threads, and
+  // samples the link for link_quality() in between.
+  void command_loop() {
+    auto next_poll = std::chrono::steady_clock::now();
+    for (;;) {
+      Ts3Command cmd;
+      {
+        std::unique_lock<std::mutex> lk(cmd_mu_);
+        const auto scheduled = redial_at_;
+        const auto wake = scheduled ? std::min(next_poll, *scheduled) : next_poll;
+        cmd_cv_.wait_until(lk, wake, [&] { return cmd_quit_ || !cmd_queue_.empty() || redial_at_ != scheduled; });
+        if (cmd_quit_) return;
+        const auto now = std::chrono::steady_clock::now();
+        if (redial_at_ && *redial_at_ <= now) {
+          redial_at_.reset();
+          lk.unlock();
+          ts3_print("TS3[", bot_id_, "] redialing ", cfg_.host, ":", cfg_.port);
+          if (!connect()) connection_lost();
+          continue;
+        }
+        if (cmd_queue_.empty()) {
+          // Woken early by a redial being scheduled or called off.
+          if (now < next_poll) continue;
+          lk.unlock();
+          poll_link();
+          next_poll = std::chrono::steady_clock::now() + kLinkPollInterval;
+          continue;
+        }
+        cmd = std::move(cmd_queue_.front());
+        cmd_queue_.pop_front();
+      }
+      if (cmd.kind == Ts3Command::Kind::kNotice) {
+        run_notice(cmd.target_mode, cmd.text);
+      } else {
+        run_set_description(cmd.text);
+      }
+    }
+  }
+
+  // The SDK keeps the own client's connection statistics current, so no request round-trip.
+  void poll_link() {
+    if (!connected_.load(std::memory_order_acquire)) {
+      loss_permille_.store(kLinkUnknown, std::memory_order_relaxed);
+      return;
+    }
+    anyID my_id = 0;
+    double loss = 0.0;
+    uint64 ping = 0;
+    unsigned int err = ts3client_getClientID(sch_id_, &my_id);
+    if (err == 0) err = ts3client_getConnectionVariableAsDouble(sch_id_, my_id, CONNECTION_CLIENT2SERVER_PACKETLOSS_TOTAL, &loss);
+    if (err == 0) err = ts3client_getConnectionVariableAsUInt64(sch_id_, my_id, CONNECTION_PING, &ping);
     if (err != 0) {
-      std::cerr << "ts3client_startConnection failed: " << err << " (" << ts3_err(err) << ")" << std::endl;
-      ts3_print("WARNING: TS3 connection failed, continuing without TS3 connection");
-      return true; // Continue without TS3 connection for development
+      loss_permille_.store(kLinkUnknown, std::memory_order_relaxed);
+      return;
     }
+    ping_ms_.store(static_cast<uint32_t>(std::min<uint64>(ping, UINT32_MAX)), std::memory_order_relaxed);
+    loss_permille_.store(static_cast<uint32_t>(std::clamp(loss, 0.0, 1.0) * 1000.0 + 0.5), std::memory_order_relaxed);
+  }
 
-    ts3_print("TS3 connecting to ", cfg_.host, ":", cfg_.port, " as ", cfg_.nickname);
-    return true;
+  void run_notice(int target_mode, const std::string& text) {
+    if (!connected_.load(std::memory_order_acquire)) {
+      ts3_print("WARN notice dropped: not connected");
+      return;
+    }
+    unsigned int err = 0;
+    if (target_mode == 3) {
+      err = ts3client_requestSendServerTextMsg(sch_id_, text.c_str(), nullptr);
+    } else {
+      anyID my_id = 0;
+      uint64 channel_id = 0;
+      err = ts3client_getClientID(sch_id_, &my_id);
+      if (err == 0) err = ts3client_getChannelOfClient(sch_id_, my_id, &channel_id);
+      if (err == 0) err = ts3client_requestSendChannelTextMsg(sch_id_, text.c_str(), channel_id, nullptr);
+    }
+    if (err != 0) ts3_print("WARN send notice failed: ", err, " (", ts3_err(err), ")");
   }
 
-  void stop() {
-    if (initialized_ && sch_id_) {
-      ts3client_closeCaptureDevice(sch_id_);
-      ts3client_closePlaybackDevice(sch_id_);
-      ts3client_stopConnection(sch_id_, "");
-      ts3client_destroyServerConnectionHandler(sch_id_);
+  // With ServerQuery configured the description is edited through the query port (works without
+  // extra client permissions); otherwise a direct clientupdate is sent only when explicitly allowed.
+  void run_set_description(const std::string& description) {
+    if (sq_cfg_) {
+      std::string err;
+      if (!voice::serverquery_set_client_description(*sq_cfg_, cfg_.nickname, voice::ts3_escape_value(description), &err)) {
+        ts3_print("WARN serverquery set description failed: ", err);
+      }
+      return;
     }
-    if (initialized_) {
-      ts3client_destroyClientLib();
+
+    if (!voice::env_flag("TSBOT_TS3_ALLOW_DIRECT_CLIENTUPDATE_DESCRIPTION")) {
+      if (!direct_description_warned_) {
+        direct_description_warned_ = true;
+        ts3_print("WARN client_description sync skipped: configure ServerQuery or set "
+                  "TSBOT_TS3_ALLOW_DIRECT_CLIENTUPDATE_DESCRIPTION=1");
+      }
+      return;
     }
-    initialized_ = false;
+
+    if (!connected_.load(std::memory_order_acquire)) return;
+    unsigned int err = ts3client_setClientSelfVariableAsString(sch_id_, CLIENT_DESCRIPTION, description.c_str());
+    if (err == 0) err = ts3client_flushClientSelfUpdates(sch_id_, nullptr);
+    if (err != 0) ts3_print("WARN set client description failed: ", err, " (", ts3_err(err), ")");
   }
 
- private:
-  ClientUIFunctions ui_{};
-  std::string pb_mode_;
-  std::string pb_device_name_;
-  std::string pb_device_id_;
-  std::string cap_mode_;
-  std::string cap_device_name_;
-  std::string cap_device_id_;
-  static Ts3Client* instance() {
-    std::lock_guard<std::mutex> lk(mu_);
-    return active_instance_;
+  // Caller holds registry_mu_ (shared) while using the result.
+  static Ts3Client* lookup(uint64 sch_id) {
+    const auto it = by_handler_.find(sch_id);
+    return it == by_handler_.end() ? nullptr : it->second;
   }
 
   static void onConnectStatusChangeEvent(uint64 serverConnectionHandlerID, int newStatus, unsigned int errorNumber) {
@@ -305,21 +621,30 @@ class Ts3Client {
       ts3_print("TS3 status(", serverConnectionHandlerID, "): ", newStatus);
     }
 
-    auto* self = instance();
+    std::shared_lock<std::shared_mutex> lk(registry_mu_);
+    auto* self = lookup(serverConnectionHandlerID);
     if (!self) return;
-    if (self->sch_id_ != serverConnectionHandlerID) return;
+
+    self->connected_.store(newStatus == STATUS_CONNECTION_ESTABLISHED, std::memory_order_release);
+    if (newStatus == STATUS_DISCONNECTED) self->connection_lost();
+    if (newStatus == STATUS_CONNECTION_ESTABLISHED) self->connection_up();
+
+    if (newStatus == STATUS_CONNECTION_ESTABLISHED) {
+      ts3client_setClientSelfVariableAsInt(serverConnectionHandlerID, CLIENT_INPUT_DEACTIVATED, INPUT_ACTIVE);
+      ts3client_flushClientSelfUpdates(serverConnectionHandlerID, nullptr);
+    }
 
     if (newStatus == STATUS_CONNECTION_ESTABLISHED && self->cfg_.channel_id.has_value()) {
       anyID my_id = 0;
       unsigned int err = ts3client_getClientID(serverConnectionHandlerID, &my_id);
       if (err != 0) {
-        std::cerr << "ts3client_getClientID failed: " << err << " (" << ts3_err(err) << ")" << std::endl;
+        ts3_print("ERROR ts3client_getClientID failed: ", err, " (", ts3_err(err), ")");
         return;
       }
       const anyID ids[2] = {my_id, 0};
       err = ts3client_requestClientMove(serverConnectionHandlerID, ids, self->cfg_.channel_id.value(), self->cfg_.channel_password.c_str(), "");
       if (err != 0) {
-        std::cerr << "ts3client_requestClientMove failed: " << err << " (" << ts3_err(err) << ")" << std::endl;
+        ts3_print("ERROR ts3client_requestClientMove failed: ", err, " (", ts3_err(err), ")");
       }
     }
   }
@@ -327,7 +652,6 @@ class Ts3Client {
   static void onTextMessageEvent(uint64 serverConnectionHandlerID, anyID targetMode, anyID toID, anyID fromID,
                                  const char* fromName, const char* fromUniqueIdentifier, const char* message) {
     (void)toID;
-    (void)fromID;
     ts3_print(
         "TS3 msg(",
         serverConnectionHandlerID,
@@ -339,6 +663,74 @@ class Ts3Client {
         (fromUniqueIdentifier ? fromUniqueIdentifier : ""),
         ": ",
         (message ? message : ""));
+
+    std::shared_lock<std::shared_mutex> lk(registry_mu_);
+    auto* self = lookup(serverConnectionHandlerID);
+    if (!self || !self->events_ || !self->events_->wants(voice::kEventChat)) return;
+
+    voice::v1::ChatEvent chat;
+    // TextMessageTarget_CLIENT/CHANNEL/SERVER share the proto's 1/2/3 numbering.
+    if (targetMode >= TextMessageTarget_CLIENT && targetMode <= TextMessageTarget_SERVER) {
+      chat.set_target_mode(static_cast<voice::v1::ChatEvent::TargetMode>(targetMode));
+    }
+    chat.set_invoker_unique_id(fromUniqueIdentifier ? fromUniqueIdentifier : "");
+    chat.set_invoker_name(fromName ? fromName : "");
+    chat.set_message(message ? message : "");
+    // Only known for clients the SDK currently has in view; left empty otherwise.
+    Ts3Str avatar;
+    if (ts3client_getClientVariableAsString(serverConnectionHandlerID, fromID, CLIENT_FLAG_AVATAR, &avatar.p) == 0 &&
+        avatar.p) {
+      chat.set_invoker_avatar_hash(avatar.p);
+    }
+    Ts3Str description;
+    if (ts3client_getClientVariableAsString(serverConnectionHandlerID, fromID, CLIENT_DESCRIPTION, &description.p) ==
+            0 &&
+        description.p) {
+      chat.set_invoker_description(description.p);
+    }
+    self->events_->publish_chat(std::move(chat));
+  }
+
+  // Whispers reach the bot alone and do not duck it; only channel talk counts.
+  static void onTalkStatusChangeEvent(uint64 serverConnectionHandlerID, int status, int isReceivedWhisper,
+                                      anyID clientID) {
+    if (isReceivedWhisper) return;
+    std::shared_lock<std::shared_mutex> lk(registry_mu_);
+    auto* self = lookup(serverConnectionHandlerID);
+    if (!self || !self->vad_) return;
+    // The bot's own sending is reported as talk as well.
+    anyID my_id = 0;
+    if (ts3client_getClientID(serverConnectionHandlerID, &my_id) == 0 && my_id == clientID) return;
+    self->vad_->talk_status(clientID, status == STATUS_TALKING);
+  }
+
+  // On the SDK's playback thread, for every client it mixes; the samples are left as they are.
+  static void onEditPlaybackVoiceDataEvent(uint64 serverConnectionHandlerID, anyID clientID, short* samples,
+                                           int sampleCount, int channels) {
+    std::shared_lock<std::shared_mutex> lk(registry_mu_);
+    auto* self = lookup(serverConnectionHandlerID);
+    if (self && self->vad_) self->vad_->voice_data(clientID, samples, sampleCount, channels);
+  }
+
+  // VAD thread, on each talk transition.
+  void on_talk(uint16_t client, bool talking, float level_dbfs) {
+    std::string nickname;
+    Ts3Str nick;
+    if (ts3client_getClientVariableAsString(sch_id_, client, CLIENT_NICKNAME, &nick.p) == 0 && nick.p) {
+      nickname = nick.p;
+    }
+    ts3_print("DEBUG TS3[", bot_id_, "] client ", client, " (", nickname, ")",
+              talking ? " talking" : " stopped talking", ", ", level_dbfs, " dBFS");
+    if (events_) events_->publish_talk(client, nickname, talking, level_dbfs);
+  }
+
+  // VAD thread, every tick. Headless, the SDK decodes incoming voice (and calls
+  // onEditPlaybackVoiceDataEvent) only as the custom playback device is read, so it is read here
+  // in real time and what it returns dropped. Nothing to read while nobody talks is not an error.
+  void pull_playback() {
+    if (!cfg_.headless || !connected_.load(std::memory_order_acquire)) return;
+    ts3client_acquireCustomPlaybackData(capture_device_id_.c_str(), playback_scratch_.data(),
+                                        voice::kFrameSamplesPerChannel);
   }
 
   static void onServerErrorEvent(uint64 serverConnectionHandlerID, const char* errorMessage, unsigned int error,
@@ -358,25 +750,29 @@ class Ts3Client {
         (extraMessage ? extraMessage : ""));
   }
 
-  static Ts3Config load_config() {
+  static Ts3Config load_config(const std::string& bot, bool multi) {
+    const auto env = [&](const std::string& key, const std::string& def = "") { return bot_env(bot, multi, key, def); };
+    const auto own = [&](const std::string& key, const std::string& def) {
+      return bot_env(bot, multi, key, def, /*inherit=*/false);
+    };
     Ts3Config c;
-    c.host = get_env("TSBOT_TS3_HOST", "127.0.0.1");
-    c.nickname = get_env("TSBOT_TS3_NICKNAME", "tsbot");
-    c.identity = get_env("TSBOT_TS3_IDENTITY");
-    c.identity_file = get_env("TSBOT_TS3_IDENTITY_FILE", "./logs/identity.txt");
-    c.server_password = get_env("TSBOT_TS3_SERVER_PASSWORD");
-    c.channel_password = get_env("TSBOT_TS3_CHANNEL_PASSWORD");
-    c.resources_folder = get_env("TSBOT_TS3_RESOURCES", "./ts3sdk/bin/linux/amd64");
-    c.log_folder = get_env("TSBOT_TS3_LOG", "./logs");
-
-    if (auto port = parse_u64(get_env("TSBOT_TS3_PORT", "9987")); port.has_value()) {
+    c.host = env("HOST", "127.0.0.1");
+    c.nickname = own("NICKNAME", multi ? "tsbot-" + bot : get_env("TSBOT_TS3_NICKNAME", "tsbot"));
+    c.identity = own("IDENTITY", multi ? "" : get_env("TSBOT_TS3_IDENTITY"));
+    c.identity_file = own("IDENTITY_FILE", multi ? "./logs/identity_" + bot + ".txt"
+                                                 : get_env("TSBOT_TS3_IDENTITY_FILE", "./logs/identity.txt"));
+    c.headless = env("HEADLESS", "1") != "0";
+    c.server_password = env("SERVER_PASSWORD");
+    c.channel_password = env("CHANNEL_PASSWORD");
+
+    if (auto port = parse_u64(env("PORT", "9987")); port.has_value()) {
       c.port = static_cast<unsigned int>(port.value());
     }
 
-    const auto ch_id = parse_u64(get_env("TSBOT_TS3_CHANNEL_ID"));
+    const auto ch_id = parse_u64(env("CHANNEL_ID"));
     if (ch_id.has_value()) c.channel_id = ch_id;
 
-    const std::string ch_path = get_env("TSBOT_TS3_CHANNEL_PATH");
+    const std::string ch_path = env("CHANNEL_PATH");
     if (!ch_path.empty()) {
       std::string cur;
       for (char ch : ch_path) {
@@ -394,117 +790,162 @@ class Ts3Client {
     return c;
   }
 
+  const std::string bot_id_;
+  const bool multi_;
+  const std::string capture_device_id_;
+  voice::EventBus* events_;
   Ts3Config cfg_;
+  std::optional<voice::ServerQueryConfig> sq_cfg_;
   uint64 sch_id_ = 0;
   bool initialized_ = false;
-
-  static inline std::mutex mu_;
-  static inline Ts3Client* active_instance_ = nullptr;
+  std::atomic<bool> connected_{false};
+  std::atomic<bool> supervised_{false};  // online() follows connected_
+  // Written by the command thread, read by the send thread.
+  static constexpr uint32_t kLinkUnknown = UINT32_MAX;
+  std::atomic<uint32_t> loss_permille_{kLinkUnknown};
+  std::atomic<uint32_t> ping_ms_{0};
+
+  std::mutex cmd_mu_;
+  std::condition_variable cmd_cv_;
+  std::deque<Ts3Command> cmd_queue_;
+  bool cmd_quit_ = false;
+  std::thread cmd_thread_;
+  bool direct_description_warned_ = false;  // command thread only
+  // Reconnect supervisor, guarded by cmd_mu_ (see connection_lost()).
+  std::optional<std::chrono::steady_clock::time_point> redial_at_;
+  std::optional<std::chrono::steady_clock::time_point> up_since_;
+  uint32_t redial_attempts_ = 0;
+  std::mt19937 rng_{std::random_device{}()};
+  std::thread start_thread_;
+  std::array<short, voice::kFrameSamples> playback_scratch_{};  // VAD thread only
+  // Declared last: its thread calls back into the members above until it is stopped.
+  std::unique_ptr<voice::VoiceActivity> vad_;
+
+  static inline ClientUIFunctions ui_{};
+  static inline bool lib_initialized_ = false;
+  static inline std::string device_cache_file_;  // last playback device that opened; empty: none
+  // Connections by serverConnectionHandlerID. Callbacks hold it shared for the whole dispatch.
+  static inline std::shared_mutex registry_mu_;
+  static inline std::unordered_map<uint64, Ts3Client*> by_handler_;
 };
 
 }  // namespace
 #endif
 
-class VoiceServiceImpl final : public voicev1::VoiceService::Service {
- public:
-  grpc::Status Ping(grpc::ServerContext*, const google::protobuf::Empty*, voicev1::PingResponse* out) override {
-    out->set_version("0.1.0");
-    return grpc::Status::OK;
-  }
-
-  grpc::Status Play(grpc::ServerContext*, const voicev1::PlayRequest* req, voicev1::CommandResponse* out) override {
-    now_playing_title_ = req->title();
-    now_playing_url_ = req->source_url();
-    state_ = voicev1::StatusResponse::STATE_PLAYING;
-    out->set_ok(true);
-    out->set_message("accepted");
-    return grpc::Status::OK;
-  }
-
-  grpc::Status Pause(grpc::ServerContext*, const google::protobuf::Empty*, voicev1::CommandResponse* out) override {
-    if (state_ == voicev1::StatusResponse::STATE_PLAYING) state_ = voicev1::StatusResponse::STATE_PAUSED;
-    out->set_ok(true);
-    out->set_message("ok");
-    return grpc::Status::OK;
-  }
+int main(int argc, char** argv) {
+  std::string addr = "127.0.0.1:50051";
+  if (argc >= 2) addr = argv[1];
 
-  grpc::Status Resume(grpc::ServerContext*, const google::protobuf::Empty*, voicev1::CommandResponse* out) override {
-    if (state_ == voicev1::StatusResponse::STATE_PAUSED) state_ = voicev1::StatusResponse::STATE_PLAYING;
-    out->set_ok(true);
-    out->set_message("ok");
-    return grpc::Status::OK;
-  }
+  const voice::EngineConfig engine_cfg = voice::EngineConfig::from_env();
+  // Every thread spawned from here on (SDK, gRPC internals, decoders) inherits a mask without the
+  // audio core; only the send thread pins itself onto it.
+  voice::keep_off_audio_cpu(nullptr, engine_cfg.send_thread.cpu);
+  // From here on log lines are queued and printed by the logger's own thread.
+  voice::AsyncLogger logger;
+
+  // Bots playing the same track share its decoder; see SourceRegistry.
+  voice::AudioCache audio_cache(voice::AudioCacheConfig::from_env());
+  // Keep-alive connections to the CDN survive from one track to the next; see HttpSession.
+  voice::HttpSession http(voice::HttpReaderConfig::from_env());
+  // Decoders of every bot share one pool of threads, sized to the host rather than the bot count.
+  voice::DecodePoolConfig pool_cfg = voice::DecodePoolConfig::from_env();
+  pool_cfg.audio_cpu = engine_cfg.send_thread.cpu;
+  voice::DecodePool decode_pool(pool_cfg);
+  voice::SourceRegistry sources(engine_cfg.pcm_ring_capacity, engine_cfg.prebuffer_target, &audio_cache, &http,
+                                &decode_pool);
+
+  const std::vector<std::string> bot_ids = voice::bot_ids_from_env();
+  [[maybe_unused]] const bool multi = bot_ids.size() > 1;
+  voice::BotRegistry bots;
+  std::vector<voice::EventBus*> buses;
+  for (const auto& id : bot_ids) buses.push_back(&bots.add(id).events);
+  voice::attach_log_events(buses);
+  // However main() is left, the log hook lets go of the buses before `bots` destroys them, and
+  // what is still queued is written while they exist.
+  struct LogEventsDetach {
+    voice::AsyncLogger& logger;
+    ~LogEventsDetach() {
+      voice::attach_log_events({});
+      logger.flush();
+    }
+  } log_events_detach{logger};
 
-  grpc::Status Stop(grpc::ServerContext*, const google::protobuf::Empty*, voicev1::CommandResponse* out) override {
-    state_ = voicev1::StatusResponse::STATE_IDLE;
-    now_playing_title_.clear();
-    now_playing_url_.clear();
-    out->set_ok(true);
-    out->set_message("ok");
-    return grpc::Status::OK;
-  }
+  // One engine and service per bot; `sink`/`commands` is that bot's TS3 connection.
+  const auto wire = [&](voice::Bot& bot, voice::VoiceSink* sink, voice::ClientCommands* commands) {
+    voice::EngineConfig cfg = engine_cfg;
+    cfg.recorder.name = bot.id;
+    bot.engine = std::make_unique<voice::PlaybackEngine>(sink, &bot.events, std::move(cfg), &sources);
+    bot.service = std::make_unique<voice::VoiceServiceImpl>(*bot.engine, *commands, bot_ids, &http.stats());
+  };
 
-  grpc::Status Skip(grpc::ServerContext*, const google::protobuf::Empty*, voicev1::CommandResponse* out) override {
-    state_ = voicev1::StatusResponse::STATE_IDLE;
-    now_playing_title_.clear();
-    now_playing_url_.clear();
-    out->set_ok(true);
-    out->set_message("ok");
-    return grpc::Status::OK;
+#if defined(TSBOT_HAS_TS3_SDK)
+  // The TS3 side comes up in the background, every connection at once: gRPC serves from the start,
+  // and a track played before its bot has connected waits for the connection (VoiceSink::online).
+  std::vector<std::unique_ptr<Ts3Client>> connections;
+  for (const auto& bot : bots.bots()) {
+    auto ts3 =
+        std::make_unique<Ts3Client>(bot->id, multi, &bot->events, engine_cfg.ducking, engine_cfg.send_thread.cpu);
+    wire(*bot, ts3.get(), ts3.get());
+    connections.push_back(std::move(ts3));
   }
+  std::thread ts3_startup([&connections, &engine_cfg] {
+    Ts3Client::init_library(engine_cfg.ducking.enabled);
+    for (auto& ts3 : connections) ts3->start_async();
+  });
+#else
+  voice::NullSink null_sink;
+  voice::NullClientCommands null_commands;
+  for (const auto& bot : bots.bots()) wire(*bot, &null_sink, &null_commands);
+#endif
 
-  grpc::Status SetVolume(grpc::ServerContext*, const voicev1::SetVolumeRequest* req, voicev1::CommandResponse* out) override {
-    volume_percent_ = std::clamp(req->volume_percent(), 0, 200);
-    out->set_ok(true);
-    out->set_message("ok");
-    return grpc::Status::OK;
+  std::vector<voice::MetricsSource> metric_sources;
+  for (const auto& bot : bots.bots()) metric_sources.push_back({bot->id, &bot->engine->stats()});
+  voice::MetricsHttpServer metrics(std::move(metric_sources), engine_cfg.send_thread.cpu, &http.stats());
+  if (const std::string metrics_addr = voice::get_env("TSBOT_VOICE_METRICS_ADDR"); !metrics_addr.empty()) {
+    std::string err;
+    if (metrics.start(metrics_addr, &err)) {
+      voice::log_print("metrics on http://", metrics_addr, "/metrics");
+    } else {
+      voice::log_print("ERROR metrics endpoint disabled (", metrics_addr, "): ", err);
+    }
   }
 
-  grpc::Status GetStatus(grpc::ServerContext*, const google::protobuf::Empty*, voicev1::StatusResponse* out) override {
-    out->set_state(state_);
-    out->set_now_playing_title(now_playing_title_);
-    out->set_now_playing_source_url(now_playing_url_);
-    out->set_volume_percent(volume_percent_);
-    return grpc::Status::OK;
+  std::vector<voice::StatusPageSource> page_sources;
+  for (const auto& bot : bots.bots()) page_sources.push_back({bot->id, bot->engine.get()});
+  voice::StatusPage status_page(std::move(page_sources), engine_cfg.send_thread.cpu);
+  if (const std::string page_path = voice::get_env("TSBOT_VOICE_STATUS_PAGE"); !page_path.empty()) {
+    std::string err;
+    if (status_page.start(page_path, &err)) {
+      voice::log_print("status page at ", page_path);
+    } else {
+      voice::log_print("ERROR status page disabled (", page_path, "): ", err);
+    }
   }
 
-  grpc::Status SubscribeEvents(grpc::ServerContext*, const voicev1::SubscribeRequest*, grpc::ServerWriter<voicev1::Event>*) override {
-    return grpc::Status(grpc::StatusCode::UNIMPLEMENTED, "event stream not implemented");
+  voice::GrpcServerConfig grpc_cfg = voice::GrpcServerConfig::from_env();
+  grpc_cfg.audio_cpu = engine_cfg.send_thread.cpu;
+  voice::GrpcServer server(bots, grpc_cfg);
+  const bool serving = server.start(addr);
+  if (serving) {
+    voice::log_print("voice-service listening on ", addr, " (", bot_ids.size(), " bot(s))");
+    server.wait();
+    server.shutdown();
+  } else {
+    voice::log_print("ERROR failed to start grpc server");
   }
 
- private:
-  voicev1::StatusResponse::State state_ = voicev1::StatusResponse::STATE_IDLE;
-  std::string now_playing_title_;
-  std::string now_playing_url_;
-  int volume_percent_ = 100;
-};
-
-int main(int argc, char** argv) {
-  std::string addr = "127.0.0.1:50051";
-  if (argc >= 2) addr = argv[1];
-
-#if defined(TSBOT_HAS_TS3_SDK)
-  Ts3Client ts3;
-  ts3.start();
-#endif
-
-  VoiceServiceImpl service;
-
-  grpc::ServerBuilder builder;
-  builder.AddListeningPort(addr, grpc::InsecureServerCredentials());
-  builder.RegisterService(&service);
-
-  std::unique_ptr<grpc::Server> server(builder.BuildAndStart());
-  if (!server) {
-    std::cerr << "failed to start grpc server" << std::endl;
-    return 1;
+  // Engines feed the TS3 sinks, so they have to go first; the same on the way out after a failed
+  // start, while the connections may already be up.
+  metrics.stop();
+  status_page.stop();
+  for (const auto& bot : bots.bots()) {
+    bot->service.reset();
+    bot->engine.reset();
   }
-
-  std::cout << "voice-service listening on " << addr << std::endl;
-  server->Wait();
-
 #if defined(TSBOT_HAS_TS3_SDK)
-  ts3.stop();
+  ts3_startup.join();
+  for (auto& ts3 : connections) ts3->stop();
+  Ts3Client::shutdown_library();
 #endif
-  return 0;
+  return serving ? 0 : 1;
 }
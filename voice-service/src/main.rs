@@ -284,6 +284,7 @@ impl VoiceService for VoiceServiceImpl {
     ) -> std::result::Result<Response<voicev1::PingResponse>, Status> {
         Ok(Response::new(voicev1::PingResponse {
             version: "0.1.0".to_string(),
+            bots: Vec::new(),
         }))
     }
 
@@ -497,6 +498,28 @@ impl VoiceService for VoiceServiceImpl {
         }))
     }
 
+    async fn play_next(
+        &self,
+        _req: Request<voicev1::PlayNextRequest>,
+    ) -> std::result::Result<Response<voicev1::CommandResponse>, Status> {
+        // No gapless queue here; callers fall back to Play when the current track finishes.
+        Err(Status::unimplemented("PlayNext is not supported by this voice service"))
+    }
+
+    async fn seek(
+        &self,
+        _req: Request<voicev1::SeekRequest>,
+    ) -> std::result::Result<Response<voicev1::CommandResponse>, Status> {
+        Err(Status::unimplemented("Seek is not supported by this voice service"))
+    }
+
+    async fn get_stats(
+        &self,
+        _req: Request<voicev1::Empty>,
+    ) -> std::result::Result<Response<voicev1::StatsResponse>, Status> {
+        Err(Status::unimplemented("GetStats is not supported by this voice service"))
+    }
+
     async fn skip(
         &self,
         _req: Request<voicev1::Empty>,
@@ -547,6 +570,8 @@ impl VoiceService for VoiceServiceImpl {
             now_playing_title: st.now_playing_title.clone(),
             now_playing_source_url: st.now_playing_source_url.clone(),
             volume_percent: st.volume_percent,
+            position_ms: 0,
+            duration_ms: 0,
         }))
     }
 
@@ -599,6 +624,48 @@ impl VoiceService for VoiceServiceImpl {
         }))
     }
 
+    async fn set_encoder(
+        &self,
+        _req: Request<voicev1::SetEncoderRequest>,
+    ) -> std::result::Result<Response<voicev1::CommandResponse>, Status> {
+        Err(Status::unimplemented("SetEncoder is not supported by this voice service"))
+    }
+
+    async fn get_encoder(
+        &self,
+        _req: Request<voicev1::Empty>,
+    ) -> std::result::Result<Response<voicev1::EncoderResponse>, Status> {
+        Err(Status::unimplemented("GetEncoder is not supported by this voice service"))
+    }
+
+    async fn get_snapshot(
+        &self,
+        _req: Request<voicev1::SnapshotRequest>,
+    ) -> std::result::Result<Response<voicev1::SnapshotResponse>, Status> {
+        Err(Status::unimplemented("GetSnapshot is not supported by this voice service"))
+    }
+
+    async fn batch(
+        &self,
+        _req: Request<voicev1::BatchRequest>,
+    ) -> std::result::Result<Response<voicev1::BatchResponse>, Status> {
+        Err(Status::unimplemented("Batch is not supported by this voice service"))
+    }
+
+    async fn start_recording(
+        &self,
+        _req: Request<voicev1::StartRecordingRequest>,
+    ) -> std::result::Result<Response<voicev1::RecordingResponse>, Status> {
+        Err(Status::unimplemented("StartRecording is not supported by this voice service"))
+    }
+
+    async fn stop_recording(
+        &self,
+        _req: Request<voicev1::Empty>,
+    ) -> std::result::Result<Response<voicev1::RecordingResponse>, Status> {
+        Err(Status::unimplemented("StopRecording is not supported by this voice service"))
+    }
+
     async fn subscribe_events(
         &self,
         req: Request<voicev1::SubscribeRequest>,
@@ -609,6 +676,7 @@ impl VoiceService for VoiceServiceImpl {
             let include_chat = cfg.include_chat;
             let include_playback = cfg.include_playback;
             let include_log = cfg.include_log;
+            let include_talk = cfg.include_talk;
             async move {
                 match r {
                     Ok(ev) => {
@@ -616,6 +684,7 @@ impl VoiceService for VoiceServiceImpl {
                             Some(voicev1::event::Payload::Chat(_)) => include_chat,
                             Some(voicev1::event::Payload::Playback(_)) => include_playback,
                             Some(voicev1::event::Payload::Log(_)) => include_log,
+                            Some(voicev1::event::Payload::Talk(_)) => include_talk,
                             None => false,
                         };
                         if ok { Some(Ok(ev)) } else { None }
@@ -0,0 +1,193 @@
+#include "metrics_http.h"
+
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+
+#include "log.h"
+#include "send_clock.h"
+
+namespace tsbot::voice {
+
+namespace {
+
+constexpr int kRequestTimeoutMs = 2000;
+constexpr std::size_t kMaxRequestBytes = 4096;
+
+void send_all(int fd, const std::string& data) {
+  std::size_t off = 0;
+  while (off < data.size()) {
+    const ssize_t n = ::send(fd, data.data() + off, data.size() - off, MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return;
+    }
+    off += static_cast<std::size_t>(n);
+  }
+}
+
+std::string http_response(const char* status, const char* content_type, const std::string& body) {
+  std::string out = std::string("HTTP/1.1 ") + status + "\r\nContent-Type: " + content_type +
+                    "\r\nContent-Length: " + std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n";
+  out += body;
+  return out;
+}
+
+}  // namespace
+
+std::string render_prometheus(const std::vector<MetricsSource>& sources, const HttpStats* http) {
+  if (sources.empty()) return {};
+  // Metric families must be contiguous, so walk the names once and emit every bot under each.
+  std::vector<std::pair<std::string, std::string>> histograms;  // metric, name
+  sources.front().stats->for_each_histogram([&](const char* name, const char* unit, const Histogram&) {
+    histograms.emplace_back(std::string("tsbot_voice_") + name + "_" + unit, name);
+  });
+  std::vector<std::string> counters;
+  sources.front().stats->for_each_counter([&](const char* name, uint64_t) { counters.emplace_back(name); });
+
+  std::ostringstream os;
+  for (const auto& [metric, name] : histograms) {
+    std::ostringstream max;
+    os << "# TYPE " << metric << " summary\n";
+    for (const auto& src : sources) {
+      src.stats->for_each_histogram([&](const char* n, const char*, const Histogram& h) {
+        if (name != n) return;
+        const Histogram::Snapshot snap = h.snapshot();
+        const std::string bot = "bot=\"" + src.bot + "\"";
+        for (const double q : {0.5, 0.9, 0.99, 0.999}) {
+          os << metric << "{" << bot << ",quantile=\"" << q << "\"} " << snap.percentile(q) << "\n";
+        }
+        os << metric << "_sum{" << bot << "} " << snap.sum << "\n";
+        os << metric << "_count{" << bot << "} " << snap.count << "\n";
+        max << metric << "_max{" << bot << "} " << snap.max << "\n";
+      });
+    }
+    os << "# TYPE " << metric << "_max gauge\n" << max.str();
+  }
+  for (const auto& name : counters) {
+    const std::string metric = "tsbot_voice_" + name + "_total";
+    os << "# TYPE " << metric << " counter\n";
+    for (const auto& src : sources) {
+      src.stats->for_each_counter([&](const char* n, uint64_t v) {
+        if (name == n) os << metric << "{bot=\"" << src.bot << "\"} " << v << "\n";
+      });
+    }
+  }
+  if (http) {
+    http->for_each_histogram([&](const char* name, const char* unit, const Histogram& h) {
+      const std::string metric = std::string("tsbot_voice_") + name + "_" + unit;
+      const Histogram::Snapshot snap = h.snapshot();
+      os << "# TYPE " << metric << " summary\n";
+      for (const double q : {0.5, 0.9, 0.99, 0.999}) {
+        os << metric << "{quantile=\"" << q << "\"} " << snap.percentile(q) << "\n";
+      }
+      os << metric << "_sum " << snap.sum << "\n";
+      os << metric << "_count " << snap.count << "\n";
+      os << "# TYPE " << metric << "_max gauge\n" << metric << "_max " << snap.max << "\n";
+    });
+    http->for_each_counter([&](const char* name, uint64_t v) {
+      const std::string metric = std::string("tsbot_voice_") + name + "_total";
+      os << "# TYPE " << metric << " counter\n" << metric << " " << v << "\n";
+    });
+  }
+  return os.str();
+}
+
+bool MetricsHttpServer::start(const std::string& addr, std::string* err) {
+  const auto colon = addr.rfind(':');
+  if (colon == std::string::npos) {
+    *err = "expected host:port";
+    return false;
+  }
+  const std::string host = addr.substr(0, colon);
+  const std::string port = addr.substr(colon + 1);
+
+  addrinfo hints{};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_PASSIVE;
+  addrinfo* res = nullptr;
+  if (const int rc = ::getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &res); rc != 0) {
+    *err = std::string("resolve failed: ") + ::gai_strerror(rc);
+    return false;
+  }
+  *err = "bind failed";
+  for (addrinfo* ai = res; ai; ai = ai->ai_next) {
+    const int fd = ::socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+    if (fd < 0) continue;
+    const int one = 1;
+    ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (::bind(fd, ai->ai_addr, ai->ai_addrlen) == 0 && ::listen(fd, 8) == 0) {
+      listen_fd_ = fd;
+      break;
+    }
+    *err = std::strerror(errno);
+    ::close(fd);
+  }
+  ::freeaddrinfo(res);
+  if (listen_fd_ < 0) return false;
+
+  if (::pipe2(wake_fds_, O_CLOEXEC) != 0) {
+    *err = std::strerror(errno);
+    ::close(listen_fd_);
+    listen_fd_ = -1;
+    return false;
+  }
+  thread_ = std::thread([this] { serve_loop(); });
+  return true;
+}
+
+void MetricsHttpServer::stop() {
+  if (!thread_.joinable()) return;
+  const char byte = 0;
+  (void)!::write(wake_fds_[1], &byte, 1);
+  thread_.join();
+  ::close(listen_fd_);
+  ::close(wake_fds_[0]);
+  ::close(wake_fds_[1]);
+  listen_fd_ = -1;
+  wake_fds_[0] = wake_fds_[1] = -1;
+}
+
+void MetricsHttpServer::serve_loop() {
+  keep_off_audio_cpu("tsbot-metrics", audio_cpu_);
+  for (;;) {
+    pollfd fds[2] = {{listen_fd_, POLLIN, 0}, {wake_fds_[0], POLLIN, 0}};
+    if (::poll(fds, 2, -1) < 0) {
+      if (errno == EINTR) continue;
+      log_print("WARN metrics endpoint poll failed: ", std::strerror(errno));
+      return;
+    }
+    if (fds[1].revents) return;
+    if (!(fds[0].revents & POLLIN)) continue;
+    const int fd = ::accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+    if (fd < 0) continue;
+    serve_one(fd);
+    ::close(fd);
+  }
+}
+
+void MetricsHttpServer::serve_one(int fd) {
+  std::string req;
+  while (req.find("\r\n\r\n") == std::string::npos && req.size() < kMaxRequestBytes) {
+    pollfd p{fd, POLLIN, 0};
+    if (::poll(&p, 1, kRequestTimeoutMs) <= 0) return;
+    char chunk[1024];
+    const ssize_t n = ::recv(fd, chunk, sizeof(chunk), 0);
+    if (n <= 0) return;
+    req.append(chunk, static_cast<std::size_t>(n));
+  }
+  if (req.rfind("GET /metrics ", 0) == 0 || req.rfind("GET /metrics?", 0) == 0) {
+    send_all(fd, http_response("200 OK", "text/plain; version=0.0.4", render_prometheus(sources_, http_)));
+  } else {
+    send_all(fd, http_response("404 Not Found", "text/plain", "not found\n"));
+  }
+}
+
+}  // namespace tsbot::voice
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "http_reader.h"
+#include "playback_engine.h"
+
+namespace tsbot::voice {
+
+// One engine's stats, labelled bot="<bot>" in the export.
+struct MetricsSource {
+  std::string bot;
+  const EngineStats* stats = nullptr;
+};
+
+// EngineStats in the Prometheus text exposition format: histograms as summaries
+// (p50/p90/p99/p999, _sum, _count), counters as *_total. The process-wide `http` reader stats (may
+// be null) follow without a bot label.
+std::string render_prometheus(const std::vector<MetricsSource>& sources, const HttpStats* http = nullptr);
+
+// Optional scrape endpoint (TSBOT_VOICE_METRICS_ADDR, e.g. "127.0.0.1:9464"). Answers
+// GET /metrics and 404s everything else, one connection at a time on its own thread, which is kept
+// off the audio CPU. Reading stats never blocks the engine.
+class MetricsHttpServer {
+ public:
+  MetricsHttpServer(std::vector<MetricsSource> sources, int audio_cpu, const HttpStats* http = nullptr)
+      : sources_(std::move(sources)), audio_cpu_(audio_cpu), http_(http) {}
+  ~MetricsHttpServer() { stop(); }
+  MetricsHttpServer(const MetricsHttpServer&) = delete;
+  MetricsHttpServer& operator=(const MetricsHttpServer&) = delete;
+
+  // `addr` is "host:port"; an empty host listens on all interfaces.
+  bool start(const std::string& addr, std::string* err);
+  void stop();
+
+ private:
+  void serve_loop();
+  void serve_one(int fd);
+
+  const std::vector<MetricsSource> sources_;
+  const int audio_cpu_;
+  const HttpStats* const http_;
+  int listen_fd_ = -1;
+  int wake_fds_[2] = {-1, -1};  // self-pipe that interrupts poll() on stop()
+  std::thread thread_;
+};
+
+}  // namespace tsbot::voice
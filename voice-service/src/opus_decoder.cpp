@@ -0,0 +1,29 @@
+#include "opus_decoder.h"
+
+#include <opus.h>
+
+namespace tsbot::voice {
+
+OpusFrameDecoder::~OpusFrameDecoder() {
+  if (dec_) opus_decoder_destroy(dec_);
+}
+
+bool OpusFrameDecoder::init(std::string* err) {
+  if (dec_) return true;
+  int e = OPUS_OK;
+  dec_ = opus_decoder_create(kSampleRate, kChannels, &e);
+  if (e != OPUS_OK || !dec_) {
+    if (err) *err = std::string("opus decoder init failed: ") + opus_strerror(e);
+    dec_ = nullptr;
+    return false;
+  }
+  return true;
+}
+
+bool OpusFrameDecoder::decode(const uint8_t* packet, std::size_t len, int16_t* out) {
+  if (!dec_) return false;
+  const int n = opus_decode(dec_, packet, static_cast<opus_int32>(len), out, kFrameSamplesPerChannel, 0);
+  return n == kFrameSamplesPerChannel;
+}
+
+}  // namespace tsbot::voice
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "audio_format.h"
+
+struct OpusDecoder;
+
+namespace tsbot::voice {
+
+// Owns one libopus decoder for the engine's output format (48 kHz stereo, 20 ms packets).
+class OpusFrameDecoder {
+ public:
+  OpusFrameDecoder() = default;
+  ~OpusFrameDecoder();
+  OpusFrameDecoder(const OpusFrameDecoder&) = delete;
+  OpusFrameDecoder& operator=(const OpusFrameDecoder&) = delete;
+
+  bool init(std::string* err);
+  bool ready() const { return dec_ != nullptr; }
+
+  // Decodes one packet into kFrameSamples interleaved samples. False on a corrupt packet or one
+  // that is not exactly one frame long.
+  bool decode(const uint8_t* packet, std::size_t len, int16_t* out);
+
+ private:
+  OpusDecoder* dec_ = nullptr;
+};
+
+}  // namespace tsbot::voice
@@ -0,0 +1,59 @@
+#include "opus_encoder.h"
+
+#include <opus.h>
+
+namespace tsbot::voice {
+
+OpusFrameEncoder::~OpusFrameEncoder() {
+  if (enc_) opus_encoder_destroy(enc_);
+}
+
+bool OpusFrameEncoder::init(std::string* err) {
+  if (enc_) return true;
+  int e = OPUS_OK;
+  enc_ = opus_encoder_create(kSampleRate, kChannels, OPUS_APPLICATION_AUDIO, &e);
+  if (e != OPUS_OK || !enc_) {
+    if (err) *err = std::string("opus encoder init failed: ") + opus_strerror(e);
+    enc_ = nullptr;
+    return false;
+  }
+  opus_encoder_ctl(enc_, OPUS_SET_SIGNAL(OPUS_SIGNAL_MUSIC));
+  push(settings_, true);
+  return true;
+}
+
+void OpusFrameEncoder::reset() {
+  if (enc_) opus_encoder_ctl(enc_, OPUS_RESET_STATE);
+}
+
+void OpusFrameEncoder::apply(const OpusEncoderSettings& s) {
+  if (s == settings_) return;
+  push(s, false);
+  settings_ = s;
+}
+
+void OpusFrameEncoder::push(const OpusEncoderSettings& s, bool force) {
+  if (!enc_) return;
+  if (force || s.bitrate_bps != settings_.bitrate_bps) {
+    opus_encoder_ctl(enc_, OPUS_SET_BITRATE(s.bitrate_bps > 0 ? s.bitrate_bps : OPUS_AUTO));
+  }
+  if (force || s.complexity != settings_.complexity) opus_encoder_ctl(enc_, OPUS_SET_COMPLEXITY(s.complexity));
+  if (force || s.inband_fec != settings_.inband_fec) opus_encoder_ctl(enc_, OPUS_SET_INBAND_FEC(s.inband_fec ? 1 : 0));
+  if (force || s.packet_loss_perc != settings_.packet_loss_perc) {
+    opus_encoder_ctl(enc_, OPUS_SET_PACKET_LOSS_PERC(s.packet_loss_perc));
+  }
+}
+
+int OpusFrameEncoder::lookahead() const {
+  opus_int32 n = 0;
+  if (enc_) opus_encoder_ctl(enc_, OPUS_GET_LOOKAHEAD(&n));
+  return static_cast<int>(n);
+}
+
+int OpusFrameEncoder::encode(const float* pcm, uint8_t* out) {
+  if (!enc_) return -1;
+  const opus_int32 n = opus_encode_float(enc_, pcm, kFrameSamplesPerChannel, out, static_cast<opus_int32>(kMaxOpusPacket));
+  return n < 0 ? -1 : static_cast<int>(n);
+}
+
+}  // namespace tsbot::voice
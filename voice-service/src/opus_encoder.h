@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "audio_format.h"
+
+struct OpusEncoder;
+
+namespace tsbot::voice {
+
+// Encoder controls that may change while a track plays.
+struct OpusEncoderSettings {
+  int bitrate_bps = 0;  // 0: libopus picks (OPUS_AUTO)
+  int complexity = 10;  // 0 .. 10
+  bool inband_fec = false;
+  int packet_loss_perc = 0;  // expected loss the encoder plans redundancy for, 0 .. 100
+
+  bool operator==(const OpusEncoderSettings&) const = default;
+};
+
+// Owns one libopus encoder configured for the engine's output format
+// (48 kHz stereo, OPUS_APPLICATION_AUDIO, one packet per 20 ms frame).
+class OpusFrameEncoder {
+ public:
+  OpusFrameEncoder() = default;
+  ~OpusFrameEncoder();
+  OpusFrameEncoder(const OpusFrameEncoder&) = delete;
+  OpusFrameEncoder& operator=(const OpusFrameEncoder&) = delete;
+
+  bool init(std::string* err);
+  // Clears the codec state; the settings stay.
+  void reset();
+  // Takes effect from the next packet. Only the controls that differ are sent to libopus, so this
+  // is cheap to call every frame. Before init() it just records the settings.
+  void apply(const OpusEncoderSettings& s);
+  const OpusEncoderSettings& settings() const { return settings_; }
+  bool ready() const { return enc_ != nullptr; }
+  // Samples per channel the encoder delays its input by (the Ogg Opus pre-skip); 0 before init().
+  int lookahead() const;
+
+  // Encodes kFrameSamples interleaved floats into `out` (at least kMaxOpusPacket bytes).
+  // Returns the packet length, or -1 on failure.
+  int encode(const float* pcm, uint8_t* out);
+
+ private:
+  void push(const OpusEncoderSettings& s, bool force);
+
+  OpusEncoder* enc_ = nullptr;
+  OpusEncoderSettings settings_{};
+};
+
+}  // namespace tsbot::voice
@@ -0,0 +1,386 @@
+#include "pcm_decoder.h"
+
+#include <algorithm>
+#include <cstring>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavutil/channel_layout.h>
+#include <libavutil/error.h>
+#include <libswresample/swresample.h>
+}
+
+#include "http_reader.h"
+
+namespace tsbot::voice {
+
+namespace {
+
+std::string av_error_string(const char* what, int code) {
+  char buf[AV_ERROR_MAX_STRING_SIZE] = {};
+  av_strerror(code, buf, sizeof(buf));
+  return std::string(what) + ": " + buf;
+}
+
+// Enough for ~0.7 s of resampled audio; covers every common codec frame size so the
+// pending buffer never grows after open().
+constexpr std::size_t kInitialPendingPerChannel = 1 << 15;
+
+// Demuxer-side buffer between libavformat and an HttpStream.
+constexpr int kAvioBufferSize = 64 * 1024;
+// Input that counts as ready: a few hundred ms even at high bitrates, and past the first
+// keyframe and header bytes a probe needs for most formats.
+constexpr std::size_t kReadyInputBytes = 16 * 1024;
+
+}  // namespace
+
+PcmDecoder::PcmDecoder() = default;
+
+PcmDecoder::~PcmDecoder() { close(); }
+
+int PcmDecoder::interrupt_cb(void* opaque) {
+  auto* self = static_cast<PcmDecoder*>(opaque);
+  return self->interrupted_.load(std::memory_order_relaxed) ? 1 : 0;
+}
+
+int PcmDecoder::http_read_cb(void* opaque, uint8_t* buf, int len) {
+  auto* self = static_cast<PcmDecoder*>(opaque);
+  const int n = self->http_->read(buf, len);
+  if (n > 0) return n;
+  if (n == 0) return AVERROR_EOF;
+  return self->interrupted_.load(std::memory_order_relaxed) ? AVERROR_EXIT : AVERROR(EIO);
+}
+
+int64_t PcmDecoder::http_seek_cb(void* opaque, int64_t offset, int whence) {
+  HttpStream& s = *static_cast<PcmDecoder*>(opaque)->http_;
+  switch (whence & ~AVSEEK_FORCE) {
+    case AVSEEK_SIZE:
+      return s.size();
+    case SEEK_SET:
+      break;
+    case SEEK_CUR:
+      offset += s.position();
+      break;
+    case SEEK_END: {
+      const int64_t size = s.size();
+      if (size < 0) return AVERROR(ENOSYS);
+      offset += size;
+      break;
+    }
+    default:
+      return AVERROR(EINVAL);
+  }
+  const int64_t r = s.seek(offset);
+  return r < 0 ? AVERROR(EINVAL) : r;
+}
+
+void PcmDecoder::prefetch(const std::string& url, HttpSession* http) {
+  close();
+  interrupted_.store(false, std::memory_order_relaxed);
+  if (http && http->enabled() && HttpSession::handles(url)) {
+    http_ = http->open(url, &interrupted_);
+    prefetch_url_ = url;
+  }
+}
+
+bool PcmDecoder::input_ready() const { return !http_ || http_->readable(kReadyInputBytes); }
+
+bool PcmDecoder::open(const std::string& url, HttpSession* http, bool opus_packets, std::string* err) {
+  // A prefetch of this URL keeps its stream and the bytes it has already fetched.
+  std::unique_ptr<HttpStream> prefetched = prefetch_url_ == url ? std::move(http_) : nullptr;
+  close();
+  if (!prefetched) interrupted_.store(false, std::memory_order_relaxed);
+
+  auto fail = [&](std::string msg) {
+    last_error_ = std::move(msg);
+    if (err) *err = last_error_;
+    close();
+    return false;
+  };
+
+  fmt_ = avformat_alloc_context();
+  if (!fmt_) return fail("avformat_alloc_context failed");
+  fmt_->interrupt_callback.callback = &PcmDecoder::interrupt_cb;
+  fmt_->interrupt_callback.opaque = this;
+
+  AVDictionary* opts = nullptr;
+  if (http && http->enabled() && HttpSession::handles(url)) {
+    // The request is under way while the demuxer gets set up; probing then reads from the window.
+    http_ = prefetched ? std::move(prefetched) : http->open(url, &interrupted_);
+    auto* buf = static_cast<unsigned char*>(av_malloc(kAvioBufferSize));
+    if (buf) {
+      avio_ = avio_alloc_context(buf, kAvioBufferSize, 0, this, &PcmDecoder::http_read_cb, nullptr,
+                                 &PcmDecoder::http_seek_cb);
+    }
+    if (!avio_) {
+      av_free(buf);
+      return fail("avio_alloc_context failed");
+    }
+    fmt_->pb = avio_;
+    fmt_->flags |= AVFMT_FLAG_CUSTOM_IO;
+  } else {
+    // Same network behaviour the Rust engine asks of the ffmpeg CLI.
+    av_dict_set(&opts, "reconnect", "1", 0);
+    av_dict_set(&opts, "reconnect_streamed", "1", 0);
+    av_dict_set(&opts, "reconnect_delay_max", "5", 0);
+    av_dict_set(&opts, "rw_timeout", "15000000", 0);
+  }
+  int r = avformat_open_input(&fmt_, url.c_str(), nullptr, &opts);
+  av_dict_free(&opts);
+  if (r < 0) {
+    fmt_ = nullptr;  // freed by avformat_open_input on failure
+    // The reader's own error says more than libavformat's EIO.
+    if (http_ && !http_->error().empty()) return fail("avformat_open_input: " + http_->error());
+    return fail(av_error_string("avformat_open_input", r));
+  }
+
+  r = avformat_find_stream_info(fmt_, nullptr);
+  if (r < 0) return fail(av_error_string("avformat_find_stream_info", r));
+
+  const AVCodec* dec = nullptr;
+  r = av_find_best_stream(fmt_, AVMEDIA_TYPE_AUDIO, -1, -1, &dec, 0);
+  if (r < 0 || !dec) return fail(av_error_string("av_find_best_stream", r));
+  stream_index_ = r;
+
+  codec_ = avcodec_alloc_context3(dec);
+  if (!codec_) return fail("avcodec_alloc_context3 failed");
+  r = avcodec_parameters_to_context(codec_, fmt_->streams[stream_index_]->codecpar);
+  if (r < 0) return fail(av_error_string("avcodec_parameters_to_context", r));
+  opus_passthrough_ = opus_packets && codec_->codec_id == AV_CODEC_ID_OPUS && codec_->sample_rate == kSampleRate &&
+                      codec_->ch_layout.nb_channels == kChannels;
+  // Passing packets through keeps the pre-skip (6.5 ms of encoder warm-up) and the end padding in
+  // the decoded output, so every packet maps onto exactly one engine frame; a receiving Opus
+  // decoder plays that prefix anyway. For PCM readers only, libavcodec applies the skip itself
+  // (AV_FRAME_DATA_SKIP_SAMPLES) and swr never sees the warm-up.
+  if (opus_passthrough_) codec_->flags2 |= AV_CODEC_FLAG2_SKIP_MANUAL;
+  r = avcodec_open2(codec_, dec, nullptr);
+  if (r < 0) return fail(av_error_string("avcodec_open2", r));
+
+  AVChannelLayout in_layout{};
+  if (codec_->ch_layout.order == AV_CHANNEL_ORDER_UNSPEC || codec_->ch_layout.nb_channels <= 0) {
+    av_channel_layout_default(&in_layout, std::max(codec_->ch_layout.nb_channels, 1));
+  } else {
+    av_channel_layout_copy(&in_layout, &codec_->ch_layout);
+  }
+  AVChannelLayout out_layout = AV_CHANNEL_LAYOUT_STEREO;
+  r = swr_alloc_set_opts2(&swr_, &out_layout, AV_SAMPLE_FMT_S16, kSampleRate, &in_layout, codec_->sample_fmt,
+                          codec_->sample_rate, 0, nullptr);
+  av_channel_layout_uninit(&in_layout);
+  if (r < 0 || !swr_) return fail(av_error_string("swr_alloc_set_opts2", r));
+  r = swr_init(swr_);
+  if (r < 0) return fail(av_error_string("swr_init", r));
+
+  pkt_ = av_packet_alloc();
+  frame_ = av_frame_alloc();
+  if (!pkt_ || !frame_) return fail("av_packet_alloc/av_frame_alloc failed");
+  if (opus_passthrough_) {
+    sent_ = av_packet_alloc();
+    for (auto& p : packets_) p.ref = av_packet_alloc();
+    if (!sent_ || std::any_of(packets_.begin(), packets_.end(), [](const SourcePacket& p) { return !p.ref; })) {
+      return fail("av_packet_alloc failed");
+    }
+  }
+
+  pending_.assign(kInitialPendingPerChannel * kChannels, 0);
+  pending_begin_ = 0;
+  pending_end_ = 0;
+  duration_ms_ = fmt_->duration == AV_NOPTS_VALUE ? 0 : std::max<int64_t>(fmt_->duration / 1000, 0);
+  reset_packets();
+  drained_ = false;
+  failed_ = false;
+  finished_ = false;
+  last_error_.clear();
+  return true;
+}
+
+void PcmDecoder::close() {
+  if (frame_) av_frame_free(&frame_);
+  if (pkt_) av_packet_free(&pkt_);
+  if (sent_) av_packet_free(&sent_);
+  for (auto& p : packets_) {
+    if (p.ref) av_packet_free(&p.ref);
+    p.data = nullptr;
+    p.len = 0;
+  }
+  if (swr_) swr_free(&swr_);
+  if (codec_) avcodec_free_context(&codec_);
+  if (fmt_) avformat_close_input(&fmt_);
+  // Custom I/O is the caller's to free, buffer included (libavformat may have replaced it).
+  if (avio_) {
+    av_freep(&avio_->buffer);
+    avio_context_free(&avio_);
+  }
+  http_.reset();
+  prefetch_url_.clear();
+  stream_index_ = -1;
+  opus_passthrough_ = false;
+  frame_packet_ = nullptr;
+}
+
+void PcmDecoder::reset_packets() {
+  for (auto& p : packets_) {
+    if (p.ref) av_packet_unref(p.ref);
+    p.data = nullptr;
+    p.len = 0;
+  }
+  packets_written_ = 0;
+  if (sent_) av_packet_unref(sent_);
+  frame_packet_ = nullptr;
+  samples_out_ = 0;
+  samples_read_ = 0;
+}
+
+bool PcmDecoder::seek(int64_t position_ms, std::string* err) {
+  auto fail = [&](std::string msg) {
+    last_error_ = std::move(msg);
+    if (err) *err = last_error_;
+    return false;
+  };
+  if (!codec_) return fail("seek: decoder not open");
+  if (live()) return fail("seek: source is a live stream");
+
+  const int64_t ts = position_ms * (AV_TIME_BASE / 1000);
+  int r = avformat_seek_file(fmt_, -1, INT64_MIN, ts, ts, 0);
+  if (r < 0) return fail(av_error_string("avformat_seek_file", r));
+  avcodec_flush_buffers(codec_);
+  // Drop the resampler's delay line too, or the old position bleeds into the first frame.
+  swr_close(swr_);
+  r = swr_init(swr_);
+  if (r < 0) return fail(av_error_string("swr_init", r));
+
+  pending_begin_ = 0;
+  pending_end_ = 0;
+  reset_packets();
+  drained_ = false;
+  failed_ = false;
+  finished_ = false;
+  return true;
+}
+
+PcmDecoder::ReadResult PcmDecoder::read_frame(int16_t* out) {
+  frame_packet_ = nullptr;
+  if (!codec_) return ReadResult::kError;
+
+  while (pending_samples() < static_cast<std::size_t>(kFrameSamples) && !finished_) {
+    if (!decode_more()) finished_ = true;
+  }
+  if (failed_) return ReadResult::kError;
+
+  const std::size_t avail = std::min(pending_samples(), static_cast<std::size_t>(kFrameSamples));
+  if (avail == 0) return ReadResult::kEof;
+
+  std::memcpy(out, pending_.data() + pending_begin_, avail * sizeof(int16_t));
+  if (avail < static_cast<std::size_t>(kFrameSamples)) {
+    std::memset(out + avail, 0, (kFrameSamples - avail) * sizeof(int16_t));
+  } else if (opus_passthrough_) {
+    for (const SourcePacket& p : packets_) {
+      if (p.len > 0 && p.at == samples_read_) frame_packet_ = &p;
+    }
+  }
+  samples_read_ += avail;
+  pending_begin_ += avail;
+  if (pending_begin_ == pending_end_) {
+    pending_begin_ = 0;
+    pending_end_ = 0;
+  }
+  return ReadResult::kOk;
+}
+
+bool PcmDecoder::decode_more() {
+  for (;;) {
+    int r = avcodec_receive_frame(codec_, frame_);
+    if (r == 0) {
+      // The Opus decoder turns each packet into one frame, so this frame is the packet just sent.
+      const uint64_t at = samples_out_;
+      const bool whole = opus_passthrough_ && sent_->size > 0 && frame_->nb_samples == kFrameSamplesPerChannel;
+      const bool ok = convert(frame_);
+      av_frame_unref(frame_);
+      if (ok && whole && samples_out_ - at == static_cast<uint64_t>(kFrameSamples)) {
+        SourcePacket& p = packets_[packets_written_++ % kPacketSlots];
+        av_packet_unref(p.ref);
+        av_packet_move_ref(p.ref, sent_);
+        p.at = at;
+        p.data = p.ref->data;
+        p.len = static_cast<uint16_t>(p.ref->size);
+      }
+      if (sent_) av_packet_unref(sent_);
+      return ok;
+    }
+    if (r == AVERROR_EOF) {
+      if (drained_) return false;
+      // Flush the samples still held back by the resampler's filter delay.
+      drained_ = true;
+      return convert(nullptr);
+    }
+    if (r != AVERROR(EAGAIN)) {
+      last_error_ = av_error_string("avcodec_receive_frame", r);
+      failed_ = true;
+      return false;
+    }
+
+    // The decoder needs more input.
+    r = av_read_frame(fmt_, pkt_);
+    if (r < 0) {
+      if (r != AVERROR_EOF && !interrupted_.load(std::memory_order_relaxed)) {
+        last_error_ = http_ && !http_->error().empty() ? "av_read_frame: " + http_->error()
+                                                       : av_error_string("av_read_frame", r);
+        failed_ = true;
+        return false;
+      }
+      avcodec_send_packet(codec_, nullptr);
+      continue;
+    }
+
+    if (pkt_->stream_index != stream_index_) {
+      av_packet_unref(pkt_);
+      continue;
+    }
+    r = avcodec_send_packet(codec_, pkt_);
+    // The decoder took its own reference; ours moves on to the frame it decodes to.
+    if (opus_passthrough_) av_packet_unref(sent_);
+    if (opus_passthrough_ && pkt_->size > 0 && static_cast<std::size_t>(pkt_->size) <= kMaxOpusPacket) {
+      av_packet_move_ref(sent_, pkt_);
+    } else {
+      av_packet_unref(pkt_);
+    }
+    // A corrupt packet in the middle of a CDN stream is not worth aborting the track for.
+    if (r < 0 && r != AVERROR(EAGAIN) && r != AVERROR_INVALIDDATA) {
+      last_error_ = av_error_string("avcodec_send_packet", r);
+      failed_ = true;
+      return false;
+    }
+  }
+}
+
+bool PcmDecoder::convert(const AVFrame* frame) {
+  const int in_samples = frame ? frame->nb_samples : 0;
+  const int max_out = swr_get_out_samples(swr_, in_samples);
+  if (max_out <= 0) return true;
+
+  reserve_pending(static_cast<std::size_t>(max_out));
+  uint8_t* out[1] = {reinterpret_cast<uint8_t*>(pending_.data() + pending_end_)};
+  const uint8_t** in = frame ? const_cast<const uint8_t**>(frame->extended_data) : nullptr;
+  const int got = swr_convert(swr_, out, max_out, in, in_samples);
+  if (got < 0) {
+    last_error_ = av_error_string("swr_convert", got);
+    failed_ = true;
+    return false;
+  }
+  pending_end_ += static_cast<std::size_t>(got) * kChannels;
+  samples_out_ += static_cast<uint64_t>(got) * kChannels;
+  return true;
+}
+
+void PcmDecoder::reserve_pending(std::size_t samples_per_channel) {
+  if (pending_begin_ > 0) {
+    const std::size_t n = pending_samples();
+    std::memmove(pending_.data(), pending_.data() + pending_begin_, n * sizeof(int16_t));
+    pending_begin_ = 0;
+    pending_end_ = n;
+  }
+  const std::size_t need = pending_end_ + samples_per_channel * kChannels;
+  if (need > pending_.size()) pending_.resize(need);
+}
+
+}  // namespace tsbot::voice
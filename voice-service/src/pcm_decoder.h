@@ -0,0 +1,135 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "audio_format.h"
+
+struct AVCodecContext;
+struct AVFormatContext;
+struct AVFrame;
+struct AVIOContext;
+struct AVPacket;
+struct SwrContext;
+
+namespace tsbot::voice {
+
+class HttpSession;
+class HttpStream;
+
+// In-process replacement for the `ffmpeg ... -f s16le -ar 48000 -ac 2 pipe:1` child the Rust
+// engine spawns: demuxes and decodes any libavformat source and resamples it to the engine's
+// fixed output format.
+//
+// A source that is already 48 kHz stereo Opus can also hand out its packets, when opened for an
+// Opus reader: each 20 ms packet decodes to exactly one engine frame, so an Opus sink can send it
+// as is instead of re-encoding.
+class PcmDecoder {
+ public:
+  enum class ReadResult { kOk, kEof, kError };
+
+  PcmDecoder();
+  ~PcmDecoder();
+  PcmDecoder(const PcmDecoder&) = delete;
+  PcmDecoder& operator=(const PcmDecoder&) = delete;
+
+  // With an enabled `http` session (may be null), http(s) sources are fetched through an HttpStream
+  // of it rather than libavformat's own protocol handler. `opus_packets`: a reader sends Opus, so
+  // an Opus source should hand out its packets (see opus_passthrough()).
+  bool open(const std::string& url, HttpSession* http, bool opus_packets, std::string* err);
+  // Starts fetching an http(s) `url` ahead of open() with the same arguments, which then demuxes
+  // from what has arrived. No-op for other sources.
+  void prefetch(const std::string& url, HttpSession* http);
+  void close();
+
+  // Repositions an open, non-live source; the next read_frame() starts at (or just before, on
+  // a keyframe boundary) `position_ms`.
+  bool seek(int64_t position_ms, std::string* err);
+
+  // Fills exactly kFrameSamples interleaved samples. On kEof the tail of the last frame is
+  // zero-padded and returned as kOk first, so no decoded audio is dropped.
+  ReadResult read_frame(int16_t* out);
+
+  // The source's own Opus packet for the frame the last read_frame() returned, or nullptr when
+  // the frame is not exactly one source packet (other codecs, other packet durations, the padded
+  // last frame). Valid until the next read_frame().
+  const uint8_t* opus_packet(std::size_t* len) const {
+    *len = frame_packet_ ? frame_packet_->len : 0;
+    return frame_packet_ ? frame_packet_->data : nullptr;
+  }
+  // True after open() with `opus_packets` when the source is Opus the engine can pass through.
+  bool opus_passthrough() const { return opus_passthrough_; }
+
+  // False while the next open() or read_frame() would wait on the network: the in-process HTTP
+  // reader has less than a few frames' worth of input buffered. Other sources always count as
+  // ready.
+  bool input_ready() const;
+
+  // Safe to call from any thread; aborts blocking network I/O inside libavformat.
+  void interrupt() { interrupted_.store(true, std::memory_order_relaxed); }
+
+  const std::string& last_error() const { return last_error_; }
+
+  // True after open() when the container reports no duration: a radio or other live stream.
+  bool live() const { return duration_ms_ <= 0; }
+  // Container duration after open(); 0 for live streams.
+  int64_t duration_ms() const { return duration_ms_; }
+
+ private:
+  static int interrupt_cb(void* opaque);
+  static int http_read_cb(void* opaque, uint8_t* buf, int len);
+  static int64_t http_seek_cb(void* opaque, int64_t offset, int whence);
+
+  bool decode_more();
+  bool convert(const AVFrame* frame);
+  void reserve_pending(std::size_t samples_per_channel);
+  std::size_t pending_samples() const { return pending_end_ - pending_begin_; }
+  void reset_packets();
+
+  AVFormatContext* fmt_ = nullptr;
+  std::unique_ptr<HttpStream> http_;
+  std::string prefetch_url_;  // what http_ fetches before open()
+  AVIOContext* avio_ = nullptr;  // custom I/O over http_
+  AVCodecContext* codec_ = nullptr;
+  SwrContext* swr_ = nullptr;
+  AVPacket* pkt_ = nullptr;
+  AVFrame* frame_ = nullptr;
+  int stream_index_ = -1;
+
+  // Resampled output not yet handed out; indices count interleaved samples.
+  std::vector<int16_t> pending_;
+  std::size_t pending_begin_ = 0;
+  std::size_t pending_end_ = 0;
+
+  // Opus passthrough: source packets that decoded to one whole frame, tagged with the position
+  // (interleaved samples since open or seek) where that frame starts in the pending stream. A
+  // few packets of look-ahead are all the pending buffer ever holds for 20 ms packets. Each slot
+  // holds a reference to the demuxer's own packet buffer, moved in rather than copied.
+  struct SourcePacket {
+    uint64_t at = 0;
+    AVPacket* ref = nullptr;
+    const uint8_t* data = nullptr;  // ref's payload, or null while the slot is empty
+    uint16_t len = 0;
+  };
+  static constexpr std::size_t kPacketSlots = 4;
+  bool opus_passthrough_ = false;
+  std::array<SourcePacket, kPacketSlots> packets_;
+  std::size_t packets_written_ = 0;
+  AVPacket* sent_ = nullptr;  // the last packet given to the decoder; empty if it cannot pass through
+  const SourcePacket* frame_packet_ = nullptr;
+  uint64_t samples_out_ = 0;   // appended to pending_
+  uint64_t samples_read_ = 0;  // handed out by read_frame()
+
+  int64_t duration_ms_ = 0;
+  bool drained_ = false;
+  bool failed_ = false;
+  bool finished_ = false;
+  std::atomic<bool> interrupted_{false};
+  std::string last_error_;
+};
+
+}  // namespace tsbot::voice
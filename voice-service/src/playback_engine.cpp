@@ -0,0 +1,786 @@
+#include "playback_engine.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+#include "alloc_counter.h"
+#include "dsp.h"
+#include "env.h"
+#include "log.h"
+#include "opus_encoder.h"
+#include "send_clock.h"
+
+namespace tsbot::voice {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr int64_t kFrameNs = int64_t{kFrameMs} * 1000000;
+
+constexpr auto kFirstPcmTimeout = std::chrono::seconds(5);
+constexpr uint64_t kMaxConsecutiveUnderruns = 150;
+constexpr auto kDiagInterval = std::chrono::seconds(5);
+// How often a held track checks whether its sink is back online.
+constexpr auto kOfflinePollInterval = std::chrono::milliseconds(10);
+// Normalization moves at most this factor per frame once a track is playing (0.1 dB, 5 dB/s).
+constexpr float kNormSlewPerFrame = 1.011579f;
+
+int64_t ms_since(Clock::time_point t) {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - t).count();
+}
+
+uint64_t us_between(Clock::time_point a, Clock::time_point b) {
+  return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(b - a).count());
+}
+
+// Equal-power crossfade of two s16 frames into `dst`. `t0`/`t1` are the fade position (0 = all
+// `from`, 1 = all `to`) at the start and end of the frame; gains are interpolated per sample.
+void crossfade_frame(const int16_t* from, const int16_t* to, int16_t* dst, float t0, float t1) {
+  constexpr float kHalfPi = 1.57079633f;
+  const float a0 = std::cos(t0 * kHalfPi), a1 = std::cos(t1 * kHalfPi);
+  const float b0 = std::sin(t0 * kHalfPi), b1 = std::sin(t1 * kHalfPi);
+  constexpr float kStep = 1.0f / kFrameSamplesPerChannel;
+  for (int i = 0; i < kFrameSamplesPerChannel; ++i) {
+    const float f = static_cast<float>(i) * kStep;
+    const float ga = a0 + (a1 - a0) * f;
+    const float gb = b0 + (b1 - b0) * f;
+    for (int c = 0; c < kChannels; ++c) {
+      const int k = i * kChannels + c;
+      const float v = static_cast<float>(from[k]) * ga + static_cast<float>(to[k]) * gb;
+      dst[k] = static_cast<int16_t>(std::clamp(v, -32768.0f, 32767.0f));
+    }
+  }
+}
+
+}  // namespace
+
+EngineConfig EngineConfig::from_env() {
+  EngineConfig c;
+  if (auto v = env_int("TSBOT_VOICE_PCM_CAPACITY"); v && *v > 0) c.pcm_ring_capacity = static_cast<std::size_t>(*v);
+  if (auto v = env_int("TSBOT_VOICE_PREBUFFER_FRAMES"); v && *v >= 0) c.prebuffer_target = static_cast<std::size_t>(*v);
+  c.prebuffer_target = std::min(c.prebuffer_target, c.pcm_ring_capacity);
+  if (auto v = env_int("TSBOT_VOICE_SHARED_DECODE")) c.shared_decode = *v != 0;
+  c.send_thread = SendThreadConfig::from_env();
+  c.encoder = EncoderPolicy::from_env();
+  c.loudness = LoudnessConfig::from_env();
+  c.recorder = RecorderConfig::from_env();
+  c.ducking = DuckingConfig::from_env();
+  return c;
+}
+
+struct PlaybackEngine::Session {
+  Session(TrackInfo t, std::unique_ptr<SourceReader> r) : track(std::move(t)), src(std::move(r)) {}
+
+  // Leaving the source stops its decoder if this was the last reader.
+  void cancel() { cancelled.store(true, std::memory_order_release); }
+
+  TrackInfo track;
+  // Consumed by the send thread only; released with the session.
+  std::unique_ptr<SourceReader> src;
+
+  std::atomic<bool> cancelled{false};
+  std::atomic<bool> paused{false};
+
+  // Frames of overlap with the previous track when this one is started by play_next().
+  std::size_t crossfade_frames = 0;
+
+  // Track frame the source starts at (non-zero after a seek), and frames played since: sent, or
+  // skipped on a resume behind a shared decoder. The latter is touched by the send thread only.
+  uint64_t start_frame = 0;
+  uint64_t frames_played = 0;
+
+  // Guarded by PlaybackEngine::mu_. Also set while the send thread mixes this session in as the
+  // incoming side of a crossfade.
+  bool sending = false;
+  bool send_finished = false;
+};
+
+// Send-thread state that outlives a single session, so a gapless switch keeps the clock, the DSP
+// filter state and the encoder running across the track boundary.
+struct PlaybackEngine::SendPath {
+  FrameClock clock{kFrameNs};
+  DspChain dsp;
+  uint32_t fx_version = 0;
+  // Loudness normalization: the estimate last seen, the gain it asks for and the gain applied.
+  float norm_lufs = std::numeric_limits<float>::quiet_NaN();
+  float norm_target = 1.0f;
+  float norm_gain = 1.0f;
+  // Ducking gain, 1 unless someone talks. The chain gets norm_gain * duck_gain.
+  float duck_gain = 1.0f;
+  bool encode = false;
+  OpusFrameEncoder encoder;
+  EncoderController control;
+  EncoderPolicy policy;
+  uint32_t policy_version = 0;
+  uint64_t last_encode_us = 0;
+  uint32_t status_countdown = 0;
+  // The source's packets stand in for our own only while this bot would encode at full quality.
+  bool shared_packets_ok = true;
+
+  PcmFrame pcm{};  // silence / output staging; real frames are read from the source in place
+  PcmFrame mix{};  // crossfade output
+  std::array<float, kFrameSamples> float_buf{};
+  std::array<uint8_t, kMaxOpusPacket> opus_out{};
+};
+
+PlaybackEngine::PlaybackEngine(VoiceSink* sink, EventBus* events, EngineConfig cfg, SourceRegistry* sources)
+    : sink_(sink),
+      events_(events),
+      cfg_(cfg),
+      own_sources_(sources ? nullptr : std::make_unique<SourceRegistry>(cfg.pcm_ring_capacity, cfg.prebuffer_target)),
+      sources_(sources ? sources : own_sources_.get()),
+      encoder_policy_(cfg.encoder.clamped()),
+      recorder_(cfg.recorder, cfg.send_thread.cpu) {
+  now_playing_.store(std::make_shared<const NowPlaying>());
+  send_thread_ = std::thread([this] { send_loop(); });
+}
+
+PlaybackEngine::~PlaybackEngine() {
+  {
+    std::unique_lock<std::mutex> lk(mu_);
+    quit_ = true;
+    if (current_) current_->cancel();
+    if (next_) next_->cancel();
+  }
+  cv_.notify_all();
+  if (send_thread_.joinable()) send_thread_.join();
+  next_.reset();
+  current_.reset();
+  retired_.clear();
+}
+
+std::unique_ptr<PlaybackEngine::Session> PlaybackEngine::start_session(TrackInfo track, bool shareable,
+                                                                      uint64_t start_frame) {
+  auto reader = sources_->open(track.source_url, track.cache_key, shareable && cfg_.shared_decode, sink_->wants_opus(),
+                               start_frame);
+  if (reader->shared()) stats_.tracks_shared.fetch_add(1, std::memory_order_relaxed);
+  auto s = std::make_unique<Session>(std::move(track), std::move(reader));
+  s->start_frame = start_frame;
+  return s;
+}
+
+void PlaybackEngine::play(TrackInfo track) {
+  std::lock_guard<std::recursive_mutex> control(control_mu_);
+  auto info = std::make_shared<const TrackInfo>(track);
+  auto s = start_session(std::move(track), true);
+  {
+    std::unique_lock<std::mutex> lk(mu_);
+    retire(next_, lk);
+    retire(current_, lk);
+    current_ = std::move(s);
+    active_.store(true, std::memory_order_release);
+    publish_now_playing(info, false);
+    reset_position(0, 0);
+  }
+  cv_.notify_all();
+  if (events_) events_->publish_playback(v1::PlaybackEvent::TYPE_STARTED, info->title, info->source_url);
+}
+
+bool PlaybackEngine::play_next(TrackInfo track, int crossfade_ms) {
+  std::lock_guard<std::recursive_mutex> control(control_mu_);
+  // A queued track holds its decoder back from the moment it is prebuffered, so it never joins
+  // (and stalls) a decoder another bot is playing from.
+  auto s = start_session(std::move(track), false);
+  s->crossfade_frames = std::min(static_cast<std::size_t>(std::max(crossfade_ms, 0) / kFrameMs), s->src->capacity());
+  std::shared_ptr<const TrackInfo> started;
+  {
+    std::unique_lock<std::mutex> lk(mu_);
+    retire(next_, lk);
+    // Decided under mu_, where the send thread also makes its switch, so a track that ends right
+    // now either sees next_ or leaves current_ finished for us to replace.
+    if (current_ && !current_->send_finished) {
+      next_ = std::move(s);
+      return true;
+    }
+    retire(current_, lk);
+    started = std::make_shared<const TrackInfo>(s->track);
+    current_ = std::move(s);
+    active_.store(true, std::memory_order_release);
+    publish_now_playing(started, false);
+    reset_position(0, 0);
+  }
+  cv_.notify_all();
+  if (events_) events_->publish_playback(v1::PlaybackEvent::TYPE_STARTED, started->title, started->source_url);
+  return false;
+}
+
+void PlaybackEngine::pause() {
+  std::lock_guard<std::recursive_mutex> control(control_mu_);
+  std::lock_guard<std::mutex> lk(mu_);
+  if (!current_) return;
+  current_->paused.store(true, std::memory_order_release);
+  publish_now_playing(now_playing_.load()->track, true);
+}
+
+void PlaybackEngine::resume() {
+  std::lock_guard<std::recursive_mutex> control(control_mu_);
+  {
+    std::lock_guard<std::mutex> lk(mu_);
+    if (!current_) return;
+    current_->paused.store(false, std::memory_order_release);
+    publish_now_playing(now_playing_.load()->track, false);
+  }
+  cv_.notify_all();
+}
+
+void PlaybackEngine::skip() {
+  std::lock_guard<std::recursive_mutex> control(control_mu_);
+  std::shared_ptr<const TrackInfo> started;
+  {
+    std::unique_lock<std::mutex> lk(mu_);
+    retire(current_, lk);
+    if (next_) {
+      current_ = std::move(next_);
+      started = std::make_shared<const TrackInfo>(current_->track);
+    }
+    active_.store(current_ != nullptr, std::memory_order_release);
+    publish_now_playing(started, false);
+    reset_position(0, 0);
+  }
+  if (!started) return;
+  cv_.notify_all();
+  if (events_) events_->publish_playback(v1::PlaybackEvent::TYPE_STARTED, started->title, started->source_url);
+}
+
+void PlaybackEngine::stop() {
+  std::lock_guard<std::recursive_mutex> control(control_mu_);
+  std::unique_lock<std::mutex> lk(mu_);
+  retire(next_, lk);
+  retire(current_, lk);
+  active_.store(false, std::memory_order_release);
+  publish_now_playing(nullptr, false);
+  reset_position(0, 0);
+}
+
+bool PlaybackEngine::seek(int64_t position_ms, std::string* err) {
+  std::lock_guard<std::recursive_mutex> control(control_mu_);
+  const Session* seen = nullptr;
+  TrackInfo track;
+  bool paused = false;
+  int64_t duration_ms = 0;
+  {
+    std::lock_guard<std::mutex> lk(mu_);
+    if (!current_ || current_->send_finished) {
+      *err = "nothing playing";
+      return false;
+    }
+    seen = current_.get();
+    track = current_->track;
+    paused = current_->paused.load(std::memory_order_acquire);
+    // Known once the decoder has opened the track.
+    duration_ms = current_->src->duration_ms();
+  }
+  if (duration_ms <= 0) {
+    *err = "track is not seekable";
+    return false;
+  }
+  const int64_t target_ms = std::clamp<int64_t>(position_ms, 0, duration_ms - 1);
+  const uint64_t frame = static_cast<uint64_t>(target_ms / kFrameMs);
+  const std::string url = track.source_url;
+
+  // The new source opens and prebuffers while the old position keeps playing.
+  auto s = start_session(std::move(track), false, frame);
+  s->paused.store(paused, std::memory_order_relaxed);
+  {
+    std::unique_lock<std::mutex> lk(mu_);
+    if (current_.get() != seen || current_->send_finished) {
+      *err = "track changed while seeking";
+      return false;
+    }
+    retire(current_, lk);
+    current_ = std::move(s);
+    active_.store(true, std::memory_order_release);
+    reset_position(static_cast<int64_t>(frame) * kFrameMs, duration_ms);
+  }
+  cv_.notify_all();
+  log_print("playback seek source_url=", url, " position_ms=", target_ms);
+  return true;
+}
+
+void PlaybackEngine::set_volume_percent(int v) {
+  update_fx([v](FxSettings& fx) { fx.volume_percent = v; });
+}
+
+void PlaybackEngine::set_fx(const FxSettings& fx) {
+  std::lock_guard<std::recursive_mutex> control(control_mu_);
+  fx_.store(fx.clamped());
+}
+
+void PlaybackEngine::update_fx(const std::function<void(FxSettings&)>& edit) {
+  std::lock_guard<std::recursive_mutex> control(control_mu_);
+  FxSettings fx = fx_.load();
+  edit(fx);
+  fx_.store(fx.clamped());
+}
+
+void PlaybackEngine::set_encoder_policy(const EncoderPolicy& policy) {
+  std::lock_guard<std::recursive_mutex> control(control_mu_);
+  encoder_policy_.store(policy.clamped());
+}
+
+void PlaybackEngine::update_encoder_policy(const std::function<void(EncoderPolicy&)>& edit) {
+  std::lock_guard<std::recursive_mutex> control(control_mu_);
+  EncoderPolicy policy = encoder_policy_.load();
+  edit(policy);
+  encoder_policy_.store(policy.clamped());
+}
+
+void PlaybackEngine::batch(const std::function<void()>& commands) {
+  std::lock_guard<std::recursive_mutex> control(control_mu_);
+  commands();
+}
+
+PlaybackStatus PlaybackEngine::status() const {
+  const std::shared_ptr<const NowPlaying> np = now_playing_.load();
+  PlaybackStatus st;
+  if (np->track) st.track = *np->track;
+  // The engine ends a track on its own (EOF or decode failure); that reads as idle.
+  if (np->track && active()) st.state = np->paused ? PlaybackState::kPaused : PlaybackState::kPlaying;
+  st.fx = fx_.load();
+  if (st.state != PlaybackState::kIdle) {
+    st.position_ms = position_ms_.load(std::memory_order_acquire);
+    st.duration_ms = duration_ms_.load(std::memory_order_acquire);
+  }
+  return st;
+}
+
+// Caller holds mu_.
+void PlaybackEngine::publish_now_playing(std::shared_ptr<const TrackInfo> track, bool paused) {
+  auto np = std::make_shared<NowPlaying>();
+  np->track = std::move(track);
+  np->paused = paused;
+  now_playing_.store(std::move(np));
+}
+
+// Caller holds mu_, with the send thread off the previous session.
+void PlaybackEngine::reset_position(int64_t position_ms, int64_t duration_ms) {
+  position_ms_.store(position_ms, std::memory_order_release);
+  duration_ms_.store(duration_ms, std::memory_order_release);
+}
+
+// Cancels the session in `slot` and waits until the send thread has let go of it, so a session
+// (and its reader, which may stop a decoder) is always torn down on a control thread. Sessions the send thread
+// parked in retired_ are freed on the way.
+void PlaybackEngine::retire(std::unique_ptr<Session>& slot, std::unique_lock<std::mutex>& lk) {
+  std::unique_ptr<Session> old = std::move(slot);
+  std::vector<std::unique_ptr<Session>> parked;
+  parked.swap(retired_);
+  if (old) {
+    old->cancel();
+    cv_.notify_all();
+    cv_.wait(lk, [&] { return !old->sending; });
+  }
+  if (!old && parked.empty()) return;
+  lk.unlock();
+  old.reset();
+  parked.clear();
+  lk.lock();
+}
+
+void PlaybackEngine::send_loop() {
+  apply_send_thread_config(cfg_.send_thread);
+  prepare_thread_log();
+
+  SendPath path;
+  path.encode = sink_->wants_opus();
+  path.policy_version = encoder_policy_.version();
+  path.policy = encoder_policy_.load();
+  bool continued = false;
+
+  for (;;) {
+    Session* s = nullptr;
+    {
+      std::unique_lock<std::mutex> lk(mu_);
+      cv_.wait(lk, [&] { return quit_ || (current_ && !current_->send_finished); });
+      if (quit_) return;
+      s = current_.get();
+      s->sending = true;
+    }
+
+    // A fresh start gets a new schedule, a fade-in and a clean encoder; a gapless switch keeps
+    // all three running.
+    if (!continued) {
+      path.clock.reset();
+      path.dsp.reset();
+      path.fx_version = fx_.version();
+      path.dsp.set_settings(fx_.load());
+      path.encoder.reset();
+    }
+
+    const bool finished = run_session(*s, path);
+
+    std::shared_ptr<const TrackInfo> started;
+    {
+      std::lock_guard<std::mutex> lk(mu_);
+      s->sending = false;
+      s->send_finished = true;
+      continued = false;
+      if (current_.get() == s) {
+        if (finished && next_ && !quit_) {
+          retired_.push_back(std::move(current_));
+          current_ = std::move(next_);
+          started = std::make_shared<const TrackInfo>(current_->track);
+          publish_now_playing(started, false);
+          // Its crossfade frames, if any, already count.
+          reset_position(static_cast<int64_t>(current_->frames_played) * kFrameMs,
+                         current_->src->duration_ms());
+          continued = true;
+        } else {
+          active_.store(false, std::memory_order_release);
+        }
+      }
+    }
+    cv_.notify_all();
+
+    if (!continued) sink_->end_of_stream();
+    if (started && events_) {
+      events_->publish_playback(v1::PlaybackEvent::TYPE_STARTED, started->title, started->source_url);
+    }
+  }
+}
+
+// Borrows next_ as the incoming side of a crossfade once the current track's decoder has finished
+// and no more than next_'s crossfade length is left in the ring.
+bool PlaybackEngine::begin_crossfade(Session& s, Session** next) {
+  std::lock_guard<std::mutex> lk(mu_);
+  if (!next_ || next_->crossfade_frames == 0 || next_->cancelled.load(std::memory_order_acquire)) return false;
+  if (s.src->size() > next_->crossfade_frames || next_->src->empty()) return false;
+  next_->sending = true;
+  *next = next_.get();
+  return true;
+}
+
+void PlaybackEngine::end_crossfade(Session** next) {
+  {
+    std::lock_guard<std::mutex> lk(mu_);
+    (*next)->sending = false;
+  }
+  cv_.notify_all();
+  *next = nullptr;
+}
+
+// Once per tick with normalization on. A track's first frame gets the gain its estimate asks for
+// outright (that frame is a fade-in or a track change anyway); after that the gain slews, so the
+// estimate settling over the track's first seconds is not heard as steps. Until a track has an
+// estimate it keeps the previous track's gain.
+void PlaybackEngine::update_normalization(Session& s, SendPath& path) {
+  const float lufs = s.src->loudness_lufs();
+  if (!std::isnan(lufs) && lufs != path.norm_lufs) {
+    path.norm_lufs = lufs;
+    path.norm_target = cfg_.loudness.gain_for(lufs);
+  }
+  float g = path.norm_target;
+  if (s.frames_played > 0) g = std::clamp(g, path.norm_gain / kNormSlewPerFrame, path.norm_gain * kNormSlewPerFrame);
+  path.norm_gain = g;
+}
+
+// Once per tick with ducking on: while the sink hears someone talk the gain falls toward the
+// configured depth at the attack rate, and afterwards climbs back to unity at the release rate.
+// The steps are per frame in dB, and the chain ramps each across its frame.
+void PlaybackEngine::update_ducking(SendPath& path) {
+  if (sink_->channel_talking()) {
+    path.duck_gain = std::max(cfg_.ducking.duck_gain(), path.duck_gain * cfg_.ducking.attack_step());
+  } else if (path.duck_gain < 1.0f) {
+    path.duck_gain = std::min(1.0f, path.duck_gain * cfg_.ducking.release_step());
+  }
+  if (path.duck_gain < 1.0f) stats_.ducked_frames.fetch_add(1, std::memory_order_relaxed);
+}
+
+// Once per tick while the sink takes Opus: picks up a new SetEncoder policy, feeds the controller
+// and applies its settings before this frame is encoded.
+void PlaybackEngine::tune_encoder(SendPath& path, int64_t late_us) {
+  if (const uint32_t v = encoder_policy_.version(); v != path.policy_version) {
+    path.policy_version = v;
+    path.policy = encoder_policy_.load();
+  }
+  LinkQuality link;
+  const bool link_known = sink_->link_quality(&link);
+  const OpusEncoderSettings& want =
+      path.control.update(path.policy, link_known ? &link : nullptr, path.last_encode_us, late_us);
+  if (!(want == path.encoder.settings())) {
+    const OpusEncoderSettings& was = path.encoder.settings();
+    log_print("opus encoder retuned bitrate_bps=", was.bitrate_bps, "->", want.bitrate_bps,
+              " complexity=", was.complexity, "->", want.complexity, " fec=", want.inband_fec,
+              " expected_loss_perc=", want.packet_loss_perc);
+    path.encoder.apply(want);
+    stats_.encoder_changes.fetch_add(1, std::memory_order_relaxed);
+  }
+  path.shared_packets_ok =
+      path.policy.adaptive && !want.inband_fec && want.bitrate_bps == path.policy.max_bitrate_kbps * 1000;
+  if (path.status_countdown-- == 0) {
+    path.status_countdown = 1000 / kFrameMs;
+    EncoderStatus st;
+    st.encoding = true;
+    st.link_known = link_known;
+    st.packet_loss = static_cast<float>(link.packet_loss);
+    st.ping_ms = link.ping_ms;
+    st.settings = path.encoder.settings();
+    encoder_status_.store(st);
+  }
+}
+
+bool PlaybackEngine::run_session(Session& s, SendPath& path) {
+  const auto started = Clock::now();
+  const std::string& src = s.track.source_url;
+  log_print("playback starting source_url=", src);
+  stats_.tracks_started.fetch_add(1, std::memory_order_relaxed);
+
+  if (path.encode && !path.encoder.ready()) {
+    std::string err;
+    if (!path.encoder.init(&err)) {
+      log_print("playback failed source_url=", src, ": ", err);
+      stats_.tracks_failed.fetch_add(1, std::memory_order_relaxed);
+      if (events_) events_->publish_playback(v1::PlaybackEvent::TYPE_ERROR, s.track.title, src, err);
+      return false;
+    }
+  }
+
+  // Gapless or not, this track's estimate takes over from the last one's once it has one.
+  path.norm_lufs = std::numeric_limits<float>::quiet_NaN();
+  bool prebuffering = true;
+  bool got_first_pcm = false;
+  uint64_t underruns_total = 0;
+  RateLimitedLog underrun_log(std::chrono::seconds(1));
+  uint64_t underruns_window = 0;
+  uint64_t underruns_consecutive = 0;
+  uint64_t limited_window = 0;
+  float max_abs_sample = 0.0f;
+  int64_t tick_late_max_us = 0;
+  uint64_t allocs_window = 0;
+  std::string error;
+
+  // Incoming track while crossfading into it; owned by next_, pinned by its `sending` flag.
+  Session* next = nullptr;
+  std::size_t xfade_pos = 0;
+  std::size_t xfade_len = 0;
+
+  auto diag_next = Clock::now() + kDiagInterval;
+
+  while (!s.cancelled.load(std::memory_order_acquire)) {
+    if (s.paused.load(std::memory_order_acquire) || !sink_->online()) {
+      // Other bots on the same decoder keep playing; this one rejoins wherever the ring still is.
+      // A private decoder simply fills the ring and waits, so the track resumes where it stopped.
+      s.src->park(true);
+      const auto held_since = Clock::now();
+      const bool offline = !sink_->online();
+      if (offline) log_print("playback held while the sink is offline source_url=", src);
+      {
+        // A borrowed incoming track may be replaced while paused; its retire() waits on us.
+        std::unique_lock<std::mutex> lk(mu_);
+        const auto interrupted = [&] { return quit_ || s.cancelled.load() || (next && next->cancelled.load()); };
+        while (!interrupted() && (s.paused.load() || !sink_->online())) {
+          if (s.paused.load()) {
+            cv_.wait(lk, [&] { return interrupted() || !s.paused.load(); });
+          } else {
+            // Nothing signals the sink coming back; it is polled.
+            cv_.wait_for(lk, kOfflinePollInterval, [&] { return interrupted() || s.paused.load(); });
+          }
+        }
+      }
+      if (next && next->cancelled.load(std::memory_order_acquire)) end_crossfade(&next);
+      if (const std::size_t skipped = s.src->park(false)) {
+        // The other readers played those frames meanwhile; the position moves on with them.
+        s.frames_played += skipped;
+        const int64_t position_ms = static_cast<int64_t>(s.start_frame + s.frames_played) * kFrameMs;
+        position_ms_.store(position_ms, std::memory_order_release);
+        log_print("playback resumed behind shared decoder source_url=", src, " skipped_frames=", skipped,
+                  " position_ms=", position_ms);
+      }
+      if (offline && sink_->online()) {
+        log_print("playback resumed after sink came back source_url=", src, " held_ms=", ms_since(held_since));
+      }
+      path.clock.reset();
+      continue;
+    }
+
+    const int64_t late_us = path.clock.wait_next() / 1000;
+    tick_late_max_us = std::max(tick_late_max_us, late_us);
+    stats_.tick_late_us.record(static_cast<uint64_t>(std::max<int64_t>(late_us, 0)));
+    const auto now = Clock::now();
+    stats_.ring_frames.record(s.src->size());
+
+    if (!got_first_pcm) {
+      if (!s.src->empty()) {
+        got_first_pcm = true;
+        const int64_t first_ms = ms_since(started);
+        stats_.first_pcm_ms.record(static_cast<uint64_t>(first_ms));
+        log_print("first pcm frame received source_url=", src, " first_pcm_ms=", first_ms);
+      } else if (s.src->drained()) {
+        error = s.src->decode_error().empty() ? "decoder produced no audio" : s.src->decode_error();
+        break;
+      } else if (Clock::now() - started >= kFirstPcmTimeout) {
+        error = "no pcm received from decoder";
+        break;
+      }
+    }
+
+    if (prebuffering) {
+      prebuffering = s.src->size() < cfg_.prebuffer_target && !s.src->decoder_done();
+    }
+    // Counted from here to the hand-off, past the once-per-track first-frame log line.
+    const uint64_t allocs_at_tick = thread_allocations();
+
+    // Prefer a real frame; fall back to silence to keep the cadence stable. The tick is never
+    // delayed waiting for the decoder: a late frame simply goes out on the next tick.
+    const SourceFrame* frame = prebuffering ? nullptr : s.src->begin_read();
+    if (!prebuffering && !frame && s.src->drained()) {
+      error = s.src->decode_error();
+      break;
+    }
+    const bool got_real_frame = frame != nullptr;
+    const PcmFrame* in = nullptr;
+
+    if (got_real_frame) {
+      in = &frame->pcm;
+      underruns_consecutive = 0;
+      stats_.decode_us.record(frame->decode_us);
+      if (frame->decode_allocs) stats_.decode_allocations.fetch_add(frame->decode_allocs, std::memory_order_relaxed);
+    } else {
+      path.pcm.fill(0);
+      in = &path.pcm;
+      ++underruns_total;
+      ++underruns_window;
+      ++underruns_consecutive;
+      stats_.underrun_frames.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Sustained silence is treated as a failure so the backend skips the track.
+    if (got_first_pcm && underruns_consecutive >= kMaxConsecutiveUnderruns) {
+      error = "sustained pcm underrun (" + std::to_string(underruns_consecutive) + " frames, " +
+              std::to_string(underruns_consecutive * kFrameMs) + " ms)";
+      break;
+    }
+    if (!got_real_frame) {
+      underrun_log("playback underrun underruns_total=", underruns_total, " (sending silence frames to keep cadence)");
+    }
+
+    // Once the decoder is done the ring holds exactly what is left, so the fade length is known.
+    if (!next && got_real_frame && s.src->decoder_done() && begin_crossfade(s, &next)) {
+      xfade_pos = 0;
+      xfade_len = s.src->size();
+    }
+    const auto dsp_start = Clock::now();
+    const PcmFrame* src_frame = in;
+    if (next && next->cancelled.load(std::memory_order_acquire)) end_crossfade(&next);
+    if (next) {
+      if (const SourceFrame* incoming = next->src->begin_read()) {
+        const float t0 = static_cast<float>(xfade_pos) / static_cast<float>(xfade_len);
+        const float t1 = std::min(1.0f, static_cast<float>(xfade_pos + 1) / static_cast<float>(xfade_len));
+        crossfade_frame(in->data(), incoming->pcm.data(), path.mix.data(), t0, t1);
+        next->src->commit_read();
+        ++next->frames_played;
+        src_frame = &path.mix;
+        ++xfade_pos;
+      }
+    }
+
+    if (const uint32_t v = fx_.version(); v != path.fx_version) {
+      path.fx_version = v;
+      path.dsp.set_settings(fx_.load());
+    }
+    if (cfg_.loudness.enabled) update_normalization(s, path);
+    if (cfg_.ducking.enabled) update_ducking(path);
+    path.dsp.set_normalization(path.norm_gain * path.duck_gain);
+    if (path.encode) tune_encoder(path, late_us);
+
+    // A transparent chain sends the decoded frame as is, with the decoder's own packet for Opus
+    // sinks, so bots sharing a decoder also share its encode.
+    const bool bypass = got_real_frame && src_frame == in && path.dsp.transparent() &&
+                        (!path.encode || (frame->opus_len > 0 && path.shared_packets_ok));
+    OutFrame out;
+    if (bypass) {
+      out.pcm = in->data();
+      if (path.encode) {
+        out.opus = frame->opus.data();
+        out.opus_len = frame->opus_len;
+        stats_.shared_opus_frames.fetch_add(1, std::memory_order_relaxed);
+      }
+      stats_.dsp_bypass_frames.fetch_add(1, std::memory_order_relaxed);
+    } else {
+      path.dsp.process(src_frame->data(), path.pcm.data(), path.encode ? path.float_buf.data() : nullptr,
+                       got_real_frame);
+      out.pcm = path.pcm.data();
+    }
+    auto t = Clock::now();
+    stats_.dsp_us.record(us_between(dsp_start, t));
+
+    if (!bypass) {
+      uint64_t limited = 0;
+      float peak = 0.0f;
+      path.dsp.take_limit_stats(&limited, &peak);
+      limited_window += limited;
+      max_abs_sample = std::max(max_abs_sample, peak);
+      if (limited) stats_.limited_samples.fetch_add(limited, std::memory_order_relaxed);
+    }
+
+    if (path.encode && !bypass) {
+      const int len = path.encoder.encode(path.float_buf.data(), path.opus_out.data());
+      if (len < 0) {
+        error = "opus encode failed";
+        break;
+      }
+      out.opus = path.opus_out.data();
+      out.opus_len = static_cast<std::size_t>(len);
+      const auto encoded = Clock::now();
+      path.last_encode_us = us_between(t, encoded);
+      stats_.encode_us.record(path.last_encode_us);
+      t = encoded;
+    } else {
+      path.last_encode_us = 0;
+    }
+    sink_->send_frame(out);
+    stats_.sink_us.record(us_between(t, Clock::now()));
+    recorder_.tap(out);
+    stats_.frames_sent.fetch_add(1, std::memory_order_relaxed);
+    // Released only now: a bypassed frame went to the sink straight from the ring slot.
+    if (got_real_frame) {
+      s.src->commit_read();
+      ++s.frames_played;
+    }
+    position_ms_.store(static_cast<int64_t>(s.start_frame + s.frames_played) * kFrameMs, std::memory_order_release);
+    duration_ms_.store(s.src->duration_ms(), std::memory_order_release);
+    // Zero in steady state; anything here is an error or a bug on the audio path.
+    if (const uint64_t allocs = thread_allocations() - allocs_at_tick) {
+      allocs_window += allocs;
+      stats_.send_allocations.fetch_add(allocs, std::memory_order_relaxed);
+    }
+
+    if (now >= diag_next) {
+      diag_next = now + kDiagInterval;
+      log_print(underruns_window > 0 || tick_late_max_us > 5000 ? "WARN " : "",
+                "audio_encode_diag source_url=", src, " underruns_total=", underruns_total,
+                " underruns_window=", underruns_window, " tick_late_max_us=", tick_late_max_us,
+                " limited_samples=", limited_window, " max_abs_sample=", max_abs_sample,
+                " send_allocs=", allocs_window);
+      tick_late_max_us = 0;
+      allocs_window = 0;
+      underruns_window = 0;
+      limited_window = 0;
+      max_abs_sample = 0.0f;
+    }
+  }
+
+  if (next) end_crossfade(&next);
+
+  if (s.cancelled.load(std::memory_order_acquire)) {
+    log_print("playback stopped source_url=", src);
+    return false;
+  }
+  if (!error.empty()) {
+    log_print("playback failed source_url=", src, ": ", error);
+    stats_.tracks_failed.fetch_add(1, std::memory_order_relaxed);
+    if (events_) events_->publish_playback(v1::PlaybackEvent::TYPE_ERROR, s.track.title, src, error);
+    return false;
+  }
+  log_print("playback finished source_url=", src, " elapsed_ms=", ms_since(started));
+  stats_.tracks_finished.fetch_add(1, std::memory_order_relaxed);
+  if (events_) events_->publish_playback(v1::PlaybackEvent::TYPE_FINISHED, s.track.title, src);
+  return true;
+}
+
+}  // namespace tsbot::voice
@@ -0,0 +1,275 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "audio_format.h"
+#include "dsp.h"
+#include "encoder_control.h"
+#include "event_bus.h"
+#include "histogram.h"
+#include "loudness.h"
+#include "recorder.h"
+#include "send_clock.h"
+#include "seqlock.h"
+#include "shared_source.h"
+#include "voice_activity.h"
+#include "voice_sink.h"
+
+namespace tsbot::voice {
+
+// Same defaults as the Rust engine's pcm_channel_capacity / prebuffer_target.
+#if defined(_WIN32)
+inline constexpr std::size_t kDefaultPcmRingCapacity = 200;
+inline constexpr std::size_t kDefaultPrebufferTarget = 15;
+#else
+inline constexpr std::size_t kDefaultPcmRingCapacity = 50;
+inline constexpr std::size_t kDefaultPrebufferTarget = 5;
+#endif
+
+struct EngineConfig {
+  // Frames buffered between the decoder and the send clock (TSBOT_VOICE_PCM_CAPACITY).
+  // Rounded up to a power of two.
+  std::size_t pcm_ring_capacity = kDefaultPcmRingCapacity;
+  // Frames that must be queued before sending starts (TSBOT_VOICE_PREBUFFER_FRAMES).
+  std::size_t prebuffer_target = kDefaultPrebufferTarget;
+  // Lets a track join a decoder another bot is already running for the same URL
+  // (TSBOT_VOICE_SHARED_DECODE, default on).
+  bool shared_decode = true;
+  SendThreadConfig send_thread;
+  // Initial SetEncoder policy, for sinks that take Opus.
+  EncoderPolicy encoder;
+  // Per-track loudness normalization from the source's estimate.
+  LoudnessConfig loudness;
+  // Where StartRecording writes to.
+  RecorderConfig recorder;
+  // Lowering the bot while the sink hears someone talk (VoiceSink::channel_talking).
+  DuckingConfig ducking;
+
+  static EngineConfig from_env();
+};
+
+struct TrackInfo {
+  std::string source_url;
+  std::string title;
+  // Stable id of the track for the audio cache and decoder sharing; empty if there is none.
+  std::string cache_key;
+};
+
+enum class PlaybackState { kIdle, kPlaying, kPaused };
+
+// What GetStatus reports. Built from an immutable snapshot, so it is always self-consistent.
+struct PlaybackStatus {
+  PlaybackState state = PlaybackState::kIdle;
+  TrackInfo track;
+  FxSettings fx;
+  // Playback position in the current track, and its length (0 for live streams or until the
+  // decoder has opened the track).
+  int64_t position_ms = 0;
+  int64_t duration_ms = 0;
+};
+
+// Hot-path measurements, lifetime totals since the engine started. Written lock-free by the send
+// and decoder threads; read by GetStats and the metrics endpoint.
+struct EngineStats {
+  Histogram decode_us;     // one PcmDecoder::read_frame, for each frame this engine played
+  Histogram dsp_us;        // DspChain::process, crossfade mix included
+  Histogram encode_us;     // Opus encode, when the sink takes Opus
+  Histogram sink_us;       // VoiceSink::send_frame (the TS3 SDK hand-off)
+  Histogram tick_late_us;  // send-clock wakeup lateness
+  Histogram ring_frames;   // PCM ring occupancy, sampled every tick
+  Histogram first_pcm_ms;  // session start to first decoded frame
+
+  std::atomic<uint64_t> frames_sent{0};
+  std::atomic<uint64_t> underrun_frames{0};
+  std::atomic<uint64_t> limited_samples{0};     // output samples the soft limiter bent
+  std::atomic<uint64_t> tracks_started{0};
+  std::atomic<uint64_t> tracks_finished{0};
+  std::atomic<uint64_t> tracks_failed{0};
+  std::atomic<uint64_t> tracks_shared{0};       // joined a decoder another track had started
+  std::atomic<uint64_t> dsp_bypass_frames{0};   // sent as decoded, FX chain transparent
+  std::atomic<uint64_t> shared_opus_frames{0};  // Opus packet taken from the shared decoder
+  std::atomic<uint64_t> encoder_changes{0};     // adaptive encoder settings switched
+  std::atomic<uint64_t> ducked_frames{0};       // sent below unity for someone talking
+  // operator new calls on the send thread during a tick, and in the decoder for the frames this
+  // engine played (see alloc_counter.h). Both stay at zero once a track is playing.
+  std::atomic<uint64_t> send_allocations{0};
+  std::atomic<uint64_t> decode_allocations{0};
+
+  // Stable names for GetStats and the Prometheus export.
+  template <typename F>
+  void for_each_histogram(F&& f) const {
+    f("decode", "us", decode_us);
+    f("dsp", "us", dsp_us);
+    f("encode", "us", encode_us);
+    f("sink", "us", sink_us);
+    f("tick_late", "us", tick_late_us);
+    f("ring_occupancy", "frames", ring_frames);
+    f("first_pcm", "ms", first_pcm_ms);
+  }
+  template <typename F>
+  void for_each_counter(F&& f) const {
+    f("frames_sent", frames_sent.load(std::memory_order_relaxed));
+    f("underrun_frames", underrun_frames.load(std::memory_order_relaxed));
+    f("limited_samples", limited_samples.load(std::memory_order_relaxed));
+    f("tracks_started", tracks_started.load(std::memory_order_relaxed));
+    f("tracks_finished", tracks_finished.load(std::memory_order_relaxed));
+    f("tracks_failed", tracks_failed.load(std::memory_order_relaxed));
+    f("tracks_shared", tracks_shared.load(std::memory_order_relaxed));
+    f("dsp_bypass_frames", dsp_bypass_frames.load(std::memory_order_relaxed));
+    f("shared_opus_frames", shared_opus_frames.load(std::memory_order_relaxed));
+    f("encoder_changes", encoder_changes.load(std::memory_order_relaxed));
+    f("ducked_frames", ducked_frames.load(std::memory_order_relaxed));
+    f("send_allocations", send_allocations.load(std::memory_order_relaxed));
+    f("decode_allocations", decode_allocations.load(std::memory_order_relaxed));
+  }
+};
+
+// Decodes one track at a time and feeds it to a VoiceSink on a steady 20 ms cadence.
+//
+// Threads: sources are decoded in short steps on a DecodePool shared by every bot (see
+// SourceRegistry), straight into the slots of a broadcast ring; one long-lived send thread reads
+// them in place, runs the DSP chain and hands frames to the sink. Engines given the same registry
+// share one decoder when they play the same URL, and while the FX chain is transparent a frame goes
+// out as decoded, its Opus packet (for Opus sinks) encoded once by the source for every bot, or
+// taken unchanged from a source that is already 48 kHz Opus.
+//
+// The send thread belongs to the engine alone: it runs on an absolute-deadline FrameClock, may be
+// pinned and given SCHED_FIFO priority, and never executes gRPC handlers or TS3 SDK callbacks.
+// Control methods are called from gRPC handlers and never run on either of those threads.
+//
+// Control state is published as immutable snapshots: FX parameters through a SeqLock the send
+// thread reads once per tick without locking, the current track through an atomically swapped
+// shared_ptr. Nothing on the audio path waits for a gRPC handler.
+//
+// play_next() opens, probes and prebuffers a second track while the current one plays. When the
+// current track ends the send thread switches to it on the next frame boundary, keeping its clock,
+// DSP state and encoder running, so there is no gap; optionally the two overlap in a crossfade.
+//
+// For Opus sinks an EncoderController retunes the engine's encoder every frame from the sink's
+// link quality and the send thread's load, within the bounds of the SetEncoder policy. The shared
+// decoder's packets are sent only while that would mean full quality anyway (adaptive, clean
+// link); a bot that needs FEC or a lower bitrate, or has fixed settings, encodes its own.
+//
+// Playback events (STARTED when a track begins sending or on play(), FINISHED on a natural end,
+// ERROR with the failure as detail) go to `events` if non-null; a stopped, skipped or replaced
+// track reports nothing.
+class PlaybackEngine {
+ public:
+  // `sources` may be shared between engines and must outlive them; null gives the engine its own.
+  PlaybackEngine(VoiceSink* sink, EventBus* events, EngineConfig cfg, SourceRegistry* sources = nullptr);
+  ~PlaybackEngine();
+  PlaybackEngine(const PlaybackEngine&) = delete;
+  PlaybackEngine& operator=(const PlaybackEngine&) = delete;
+
+  // Stops whatever is playing, drops any queued next track and starts `track`.
+  void play(TrackInfo track);
+  // Queues `track` to follow the current one, replacing any earlier queued track, and starts
+  // decoding it right away. The last `crossfade_ms` of the current track (capped by the PCM ring
+  // size) are mixed with its start. Returns false if nothing was playing, in which case `track`
+  // simply starts now.
+  bool play_next(TrackInfo track, int crossfade_ms);
+  void pause();
+  void resume();
+  // Cuts straight to the queued next track, already prebuffered, or stops if there is none.
+  void skip();
+  void stop();
+  // Restarts the current track at `position_ms` (clamped to its length), paused if it was. A cached
+  // track starts there from its frame index, others reopen the source and seek the demuxer. Fails
+  // on live streams and when nothing is playing. Publishes no event.
+  bool seek(int64_t position_ms, std::string* err);
+  void set_volume_percent(int v);
+  // Replaces every FX parameter, volume included. Values are clamped.
+  void set_fx(const FxSettings& fx);
+  // Read-modify-write of the FX parameters, atomic with respect to other control calls.
+  void update_fx(const std::function<void(FxSettings&)>& edit);
+  FxSettings fx() const { return fx_.load(); }
+  // Bounds for the adaptive Opus encoder; clamped. Takes effect on the next frame.
+  void set_encoder_policy(const EncoderPolicy& policy);
+  void update_encoder_policy(const std::function<void(EncoderPolicy&)>& edit);
+  EncoderPolicy encoder_policy() const { return encoder_policy_.load(); }
+  // Published by the send thread about once a second while encoding.
+  EncoderStatus encoder_status() const { return encoder_status_.load(); }
+
+  // Runs `commands`, which call this engine's control methods, with the control lock held
+  // throughout: they take effect in order and no other control call lands between them. The send
+  // thread sees each as it is made, so FX set before a play() apply from the track's first frame.
+  void batch(const std::function<void()>& commands);
+
+  // The sink's own cached view of its connection; see VoiceSink.
+  bool sink_online() const { return sink_->online(); }
+  bool link_quality(LinkQuality* out) const { return sink_->link_quality(out); }
+
+  // Records every frame this engine sends, while started; see Recorder.
+  Recorder& recorder() { return recorder_; }
+
+  // True from play() until the track ends, fails or is stopped.
+  bool active() const { return active_.load(std::memory_order_acquire); }
+  PlaybackStatus status() const;
+  const EngineStats& stats() const { return stats_; }
+
+ private:
+  struct Session;
+  struct SendPath;
+
+  std::unique_ptr<Session> start_session(TrackInfo track, bool shareable, uint64_t start_frame = 0);
+  void send_loop();
+  // Returns true if the track played to its natural end.
+  bool run_session(Session& s, SendPath& path);
+  void tune_encoder(SendPath& path, int64_t late_us);
+  void update_normalization(Session& s, SendPath& path);
+  void update_ducking(SendPath& path);
+  bool begin_crossfade(Session& s, Session** next);
+  void end_crossfade(Session** next);
+  void retire(std::unique_ptr<Session>& slot, std::unique_lock<std::mutex>& lk);
+  void publish_now_playing(std::shared_ptr<const TrackInfo> track, bool paused);
+  void reset_position(int64_t position_ms, int64_t duration_ms);
+
+  VoiceSink* sink_;
+  EventBus* events_;
+  const EngineConfig cfg_;
+  std::unique_ptr<SourceRegistry> own_sources_;
+  SourceRegistry* sources_;
+
+  // Serializes control methods so two gRPC workers cannot interleave a session swap or a snapshot
+  // publish. Recursive for batch(). Never taken by the send or decoder threads.
+  std::recursive_mutex control_mu_;
+  std::mutex mu_;
+  std::condition_variable cv_;
+  std::unique_ptr<Session> current_;
+  std::unique_ptr<Session> next_;
+  // Sessions the send thread moved past in a gapless switch; destroyed by the next retire().
+  std::vector<std::unique_ptr<Session>> retired_;
+  bool quit_ = false;
+
+  // Written under control_mu_ and read lock-free, once per tick, by the send thread.
+  SeqLock<FxSettings> fx_;
+  SeqLock<EncoderPolicy> encoder_policy_;
+  // Written by the send thread only.
+  SeqLock<EncoderStatus> encoder_status_;
+
+  struct NowPlaying {
+    std::shared_ptr<const TrackInfo> track;  // null when stopped
+    bool paused = false;
+  };
+  // Written under mu_ (control methods and the send thread's gapless switch); read by status().
+  std::atomic<std::shared_ptr<const NowPlaying>> now_playing_;
+  std::atomic<bool> active_{false};
+  // Stored by the send thread every tick, and reset under mu_ when a new session takes over.
+  std::atomic<int64_t> position_ms_{0};
+  std::atomic<int64_t> duration_ms_{0};
+
+  EngineStats stats_;
+  // Tapped by the send thread after every frame.
+  Recorder recorder_;
+  std::thread send_thread_;
+};
+
+}  // namespace tsbot::voice
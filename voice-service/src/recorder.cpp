@@ -0,0 +1,400 @@
+#include "recorder.h"
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+#include <random>
+#include <vector>
+
+#include "env.h"
+#include "log.h"
+#include "opus_encoder.h"
+#include "send_clock.h"
+
+namespace tsbot::voice {
+
+namespace {
+
+constexpr std::size_t kRingFrames = 128;  // 2.5 s of audio the writer may fall behind by
+constexpr auto kDrainInterval = std::chrono::milliseconds(250);
+constexpr int64_t kFramesPerSecond = 1000 / kFrameMs;
+// Sending paused for longer than a few ticks is written as silence, up to kMaxFilledGapMs.
+constexpr int64_t kMinGapMs = 10 * kFrameMs;
+constexpr int64_t kMaxFilledGapMs = 60 * 1000;
+// A 20 ms CELT frame with the silence flag set.
+constexpr uint8_t kSilencePacket[] = {0xF8, 0xFF, 0xFE};
+constexpr std::size_t kMaxNameLen = 64;
+
+int64_t unix_ms_now() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+bool valid_name_char(char c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '-' || c == '_';
+}
+
+// CRC-32 of an Ogg page: polynomial 0x04c11db7, not reflected, zero initial value.
+constexpr std::array<uint32_t, 256> make_ogg_crc_table() {
+  std::array<uint32_t, 256> t{};
+  for (uint32_t i = 0; i < 256; ++i) {
+    uint32_t r = i << 24;
+    for (int b = 0; b < 8; ++b) r = (r & 0x80000000u) ? (r << 1) ^ 0x04c11db7u : r << 1;
+    t[i] = r;
+  }
+  return t;
+}
+constexpr std::array<uint32_t, 256> kOggCrc = make_ogg_crc_table();
+
+void put_le(std::vector<uint8_t>& out, uint64_t v, int bytes) {
+  for (int i = 0; i < bytes; ++i) out.push_back(static_cast<uint8_t>(v >> (8 * i)));
+}
+
+// One Ogg Opus stream in one file (RFC 7845): the two header pages, then audio pages of whole
+// 20 ms packets.
+class OggOpusFile {
+ public:
+  ~OggOpusFile() { close(); }
+
+  // Fails with EEXIST rather than overwrite a file.
+  bool open(const std::string& path, int pre_skip, const std::vector<std::string>& comments, std::string* err) {
+    f_ = std::fopen(path.c_str(), "wbx");
+    if (!f_) {
+      open_errno_ = errno;
+      *err = path + ": " + std::strerror(open_errno_);
+      return false;
+    }
+    open_errno_ = 0;
+    serial_ = std::random_device{}();
+    seq_ = 0;
+    packets_ = 0;
+
+    std::vector<uint8_t> head = {'O', 'p', 'u', 's', 'H', 'e', 'a', 'd', 1, kChannels};
+    put_le(head, static_cast<uint64_t>(pre_skip), 2);
+    put_le(head, kSampleRate, 4);
+    put_le(head, 0, 2);  // output gain
+    head.push_back(0);   // channel mapping family: mono or stereo
+    std::vector<uint8_t> tags = {'O', 'p', 'u', 's', 'T', 'a', 'g', 's'};
+    const std::string vendor = "tsbot voice-service";
+    put_le(tags, vendor.size(), 4);
+    tags.insert(tags.end(), vendor.begin(), vendor.end());
+    put_le(tags, comments.size(), 4);
+    for (const std::string& c : comments) {
+      put_le(tags, c.size(), 4);
+      tags.insert(tags.end(), c.begin(), c.end());
+    }
+    if (!add(head.data(), head.size()) || !write_page(kBos) || !add(tags.data(), tags.size()) || !write_page(0) ||
+        std::fflush(f_) != 0) {
+      *err = path + ": " + std::strerror(errno);
+      close();
+      return false;
+    }
+    return true;
+  }
+
+  // errno of the last failed open(), e.g. EEXIST.
+  int open_errno() const { return open_errno_; }
+
+  bool is_open() const { return f_ != nullptr; }
+  // Audio packets so far, each one engine frame.
+  uint64_t packets() const { return packets_; }
+
+  bool add_audio(const uint8_t* packet, std::size_t len) {
+    if (!add(packet, len)) return false;
+    ++packets_;
+    return true;
+  }
+
+  // Ends the current page and hands the file's buffer to the OS.
+  bool flush() {
+    if (!f_) return false;
+    if (!lacing_.empty() && !write_page(0)) return false;
+    return std::fflush(f_) == 0;
+  }
+
+  bool close() {
+    if (!f_) return true;
+    bool ok = write_page(kEos);
+    if (!f_) return false;
+    ok = std::fflush(f_) == 0 && ok;
+    ok = std::fclose(f_) == 0 && ok;
+    f_ = nullptr;
+    lacing_.clear();
+    body_.clear();
+    return ok;
+  }
+
+ private:
+  static constexpr uint8_t kBos = 0x02;
+  static constexpr uint8_t kEos = 0x04;
+
+  // Starts a new page first when the packet's lacing values would not fit on this one.
+  bool add(const uint8_t* packet, std::size_t len) {
+    const std::size_t segments = len / 255 + 1;
+    if (lacing_.size() + segments > 255 && !write_page(0)) return false;
+    for (std::size_t n = len; n >= 255; n -= 255) lacing_.push_back(255);
+    lacing_.push_back(static_cast<uint8_t>(len % 255));
+    body_.insert(body_.end(), packet, packet + len);
+    return true;
+  }
+
+  bool write_page(uint8_t flags) {
+    std::vector<uint8_t> page = {'O', 'g', 'g', 'S', 0, flags};
+    // Samples decoded by the end of the page's last packet, pre-skip included.
+    put_le(page, packets_ * kFrameSamplesPerChannel, 8);
+    put_le(page, serial_, 4);
+    put_le(page, seq_++, 4);
+    put_le(page, 0, 4);  // CRC, filled in below
+    page.push_back(static_cast<uint8_t>(lacing_.size()));
+    page.insert(page.end(), lacing_.begin(), lacing_.end());
+    page.insert(page.end(), body_.begin(), body_.end());
+    uint32_t crc = 0;
+    for (const uint8_t b : page) crc = (crc << 8) ^ kOggCrc[((crc >> 24) ^ b) & 0xFF];
+    for (int i = 0; i < 4; ++i) page[22 + i] = static_cast<uint8_t>(crc >> (8 * i));
+    lacing_.clear();
+    body_.clear();
+    if (std::fwrite(page.data(), 1, page.size(), f_) != page.size()) {
+      std::fclose(f_);
+      f_ = nullptr;
+      return false;
+    }
+    return true;
+  }
+
+  std::FILE* f_ = nullptr;
+  int open_errno_ = 0;
+  uint32_t serial_ = 0;
+  uint32_t seq_ = 0;
+  uint64_t packets_ = 0;
+  std::vector<uint8_t> lacing_;
+  std::vector<uint8_t> body_;
+};
+
+// Turns tapped frames into files: rotation, gap filling and, for PCM taps, the encode.
+class RecordingWriter {
+ public:
+  RecordingWriter(const RecorderConfig& cfg, std::string name)
+      : cfg_(cfg), name_(std::move(name)), rotate_frames_(std::max(cfg.rotate_s, 1) * kFramesPerSecond) {}
+
+  // `opus` is null for a PCM frame. On false, `error()` says why and the writer is done.
+  bool write(int64_t unix_ms, const uint8_t* opus, std::size_t opus_len, const int16_t* pcm, std::string* opened) {
+    if (file_.is_open()) {
+      const int64_t gap_ms = unix_ms - last_ms_;
+      if (gap_ms > kMaxFilledGapMs || file_.packets() >= static_cast<uint64_t>(rotate_frames_)) {
+        if (!file_.close()) return fail("closing " + path_ + " failed");
+      } else if (gap_ms > kMinGapMs) {
+        for (int64_t i = gap_ms / kFrameMs - 1; i > 0 && file_.packets() < static_cast<uint64_t>(rotate_frames_); --i) {
+          if (!file_.add_audio(kSilencePacket, sizeof(kSilencePacket))) return fail(path_ + ": write failed");
+        }
+      }
+    }
+    if (!file_.is_open()) {
+      if (!open_file(unix_ms, opus == nullptr)) return false;
+      *opened = path_;
+    }
+
+    if (!opus) {
+      for (int i = 0; i < kFrameSamples; ++i) float_buf_[i] = pcm[i] / 32768.0f;
+      const int len = encoder_.encode(float_buf_.data(), packet_.data());
+      if (len < 0) return fail("opus encode failed");
+      opus = packet_.data();
+      opus_len = static_cast<std::size_t>(len);
+    }
+    if (!file_.add_audio(opus, opus_len)) return fail(path_ + ": write failed");
+    last_ms_ = unix_ms;
+    return true;
+  }
+
+  bool flush() { return !file_.is_open() || file_.flush() || fail(path_ + ": write failed"); }
+  bool close() { return file_.close() || fail("closing " + path_ + " failed"); }
+  const std::string& error() const { return error_; }
+
+ private:
+  bool open_file(int64_t unix_ms, bool encode) {
+    int pre_skip = 0;  // tapped packets join the engine's stream midway; there is no start to skip
+    if (encode) {
+      if (!encoder_.ready() && !encoder_.init(&error_)) return false;
+      encoder_.reset();
+      pre_skip = encoder_.lookahead();
+    }
+    const std::time_t secs = static_cast<std::time_t>(unix_ms / 1000);
+    std::tm tm{};
+    localtime_r(&secs, &tm);
+    char when[32];
+    std::strftime(when, sizeof(when), "%Y%m%d-%H%M%S", &tm);
+    const std::vector<std::string> comments = {
+        "TSBOT_NAME=" + name_,
+        "TSBOT_START_UNIX_MS=" + std::to_string(unix_ms),
+        std::string("TSBOT_SOURCE=") + (encode ? "pcm" : "opus"),
+    };
+    const std::string base = (std::filesystem::path(cfg_.dir) / (name_ + "-" + when)).string();
+    for (int n = 1;; ++n) {
+      path_ = n == 1 ? base + ".opus" : base + "-" + std::to_string(n) + ".opus";
+      if (file_.open(path_, pre_skip, comments, &error_)) return true;
+      if (file_.open_errno() != EEXIST || n == 9) return false;
+    }
+  }
+
+  bool fail(std::string e) {
+    error_ = std::move(e);
+    return false;
+  }
+
+  const RecorderConfig& cfg_;
+  const std::string name_;
+  const int64_t rotate_frames_;
+  OggOpusFile file_;
+  std::string path_;
+  int64_t last_ms_ = 0;
+  OpusFrameEncoder encoder_;
+  std::array<float, kFrameSamples> float_buf_{};
+  std::array<uint8_t, kMaxOpusPacket> packet_{};
+  std::string error_;
+};
+
+}  // namespace
+
+RecorderConfig RecorderConfig::from_env() {
+  RecorderConfig c;
+  c.dir = get_env("TSBOT_VOICE_RECORD_DIR", c.dir);
+  if (auto v = env_int("TSBOT_VOICE_RECORD_ROTATE_S"); v && *v > 0) c.rotate_s = static_cast<int>(*v);
+  return c;
+}
+
+bool Recorder::start(const std::string& name, std::string* err) {
+  std::string prefix = name;
+  if (prefix.empty()) {
+    // The configured default is a bot id; keep the file name tame whatever it is.
+    prefix = cfg_.name.substr(0, kMaxNameLen);
+    std::replace_if(prefix.begin(), prefix.end(), [](char c) { return !valid_name_char(c); }, '_');
+  } else if (prefix.size() > kMaxNameLen || !std::all_of(prefix.begin(), prefix.end(), valid_name_char)) {
+    *err = "recording name must be up to 64 letters, digits, '-' or '_'";
+    return false;
+  }
+
+  std::lock_guard<std::mutex> control(control_mu_);
+  if (session_.load(std::memory_order_relaxed) != 0) {
+    *err = "already recording";
+    return false;
+  }
+  std::error_code ec;
+  std::filesystem::create_directories(cfg_.dir, ec);
+  if (ec) {
+    *err = cfg_.dir + ": " + ec.message();
+    return false;
+  }
+  // A writer that gave up on an error is still to be joined.
+  if (thread_.joinable()) {
+    {
+      std::lock_guard<std::mutex> lk(mu_);
+      quit_ = true;
+    }
+    cv_.notify_all();
+    thread_.join();
+  }
+  if (!ring_) ring_ = std::make_unique<SpscRing<Frame>>(kRingFrames);
+
+  {
+    std::lock_guard<std::mutex> lk(mu_);
+    quit_ = false;
+    path_.clear();
+    error_.clear();
+    files_ = 0;
+  }
+  frames_written_.store(0, std::memory_order_relaxed);
+  frames_dropped_.store(0, std::memory_order_relaxed);
+  const uint64_t session = ++last_session_;
+  thread_ = std::thread([this, session, prefix] { write_loop(session, prefix); });
+  session_.store(session, std::memory_order_release);
+  return true;
+}
+
+void Recorder::stop() {
+  std::lock_guard<std::mutex> control(control_mu_);
+  if (!thread_.joinable()) return;
+  session_.store(0, std::memory_order_release);
+  {
+    std::lock_guard<std::mutex> lk(mu_);
+    quit_ = true;
+  }
+  cv_.notify_all();
+  thread_.join();
+}
+
+RecordingStatus Recorder::status() const {
+  RecordingStatus st;
+  st.recording = session_.load(std::memory_order_acquire) != 0;
+  st.frames_written = frames_written_.load(std::memory_order_relaxed);
+  st.frames_dropped = frames_dropped_.load(std::memory_order_relaxed);
+  std::lock_guard<std::mutex> lk(mu_);
+  st.path = path_;
+  st.files = files_;
+  st.error = error_;
+  return st;
+}
+
+void Recorder::tap_slow(uint64_t session, const OutFrame& frame) {
+  Frame* f = ring_->begin_write();
+  if (!f) {
+    frames_dropped_.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  f->session = session;
+  f->unix_ms = unix_ms_now();
+  if (frame.opus && frame.opus_len > 0 && frame.opus_len <= kMaxOpusPacket) {
+    f->opus_len = static_cast<uint16_t>(frame.opus_len);
+    std::memcpy(f->opus, frame.opus, frame.opus_len);
+  } else {
+    f->opus_len = 0;
+    std::memcpy(f->pcm.data(), frame.pcm, kFrameBytes);
+  }
+  ring_->commit_write();
+}
+
+void Recorder::write_loop(uint64_t session, std::string name) {
+  keep_off_audio_cpu("tsbot-record", audio_cpu_);
+  RecordingWriter writer(cfg_, name);
+  bool ok = true;
+
+  std::unique_lock<std::mutex> lk(mu_);
+  for (bool quit = false; !quit && ok;) {
+    quit = cv_.wait_for(lk, kDrainInterval, [this] { return quit_; });
+    lk.unlock();
+    // Frames of an earlier recording, queued after it stopped, are only taken out of the way.
+    while (const Frame* f = ring_->begin_read()) {
+      if (ok && f->session == session) {
+        std::string opened;
+        ok = writer.write(f->unix_ms, f->opus_len ? f->opus : nullptr, f->opus_len, f->pcm.data(), &opened);
+        if (ok) frames_written_.fetch_add(1, std::memory_order_relaxed);
+        if (!opened.empty()) {
+          log_print("recording ", name, " to ", opened);
+          std::lock_guard<std::mutex> files(mu_);
+          path_ = opened;
+          ++files_;
+        }
+      }
+      ring_->commit_read();
+    }
+    ok = ok && writer.flush();
+    lk.lock();
+  }
+  lk.unlock();
+
+  ok = writer.close() && ok;
+  if (!ok) {
+    session_.store(0, std::memory_order_release);
+    log_print("WARN recording ", name, " stopped: ", writer.error());
+    lk.lock();
+    error_ = writer.error();
+    return;
+  }
+  log_print("recording ", name, " stopped after ", frames_written_.load(std::memory_order_relaxed), " frames (",
+            frames_dropped_.load(std::memory_order_relaxed), " dropped)");
+}
+
+}  // namespace tsbot::voice
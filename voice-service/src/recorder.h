@@ -0,0 +1,111 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+
+#include "audio_format.h"
+#include "spsc_ring.h"
+#include "voice_sink.h"
+
+namespace tsbot::voice {
+
+struct RecorderConfig {
+  // Directory the recordings go to, created on demand (TSBOT_VOICE_RECORD_DIR).
+  std::string dir = "recordings";
+  // A file is closed and the next one begun after this many seconds (TSBOT_VOICE_RECORD_ROTATE_S).
+  int rotate_s = 3600;
+  // File name prefix when StartRecording gives none; main() sets the bot id.
+  std::string name = "tsbot";
+
+  static RecorderConfig from_env();
+};
+
+struct RecordingStatus {
+  bool recording = false;
+  // File being written, or the last one once stopped.
+  std::string path;
+  // This recording, every file of it: frames written, and frames lost because the writer fell
+  // behind. Gaps in sending (pause, between tracks) are written as silence and not counted.
+  uint64_t frames_written = 0;
+  uint64_t frames_dropped = 0;
+  uint32_t files = 0;
+  // Why the writer gave up, if it did.
+  std::string error;
+};
+
+// Optional tap on an engine's output: every frame handed to the sink is also written to Ogg Opus
+// files, on a thread of its own and off the audio CPU.
+//
+// tap() runs on the send thread. It copies the frame into a slot of a preallocated ring and
+// returns; a full ring drops the frame and counts it, so a slow disk never holds up the send
+// clock. Opus sinks get their packets recorded byte for byte; for PCM sinks (the TS3 SDK, which
+// encodes itself) the writer thread encodes the PCM it was given.
+//
+// Files are named `<name>-YYYYmmdd-HHMMSS.opus` after the local time of their first frame, which
+// is also in the OpusTags (TSBOT_START_UNIX_MS). Gaps of up to a minute are filled with silence so
+// a file's timeline is wall-clock time; a longer gap, or reaching rotate_s, begins a new file.
+class Recorder {
+ public:
+  Recorder(RecorderConfig cfg, int audio_cpu) : cfg_(std::move(cfg)), audio_cpu_(audio_cpu) {}
+  ~Recorder() { stop(); }
+  Recorder(const Recorder&) = delete;
+  Recorder& operator=(const Recorder&) = delete;
+
+  // Starts recording with file names prefixed `name` (letters, digits, '-', '_'; the configured
+  // name if empty). False with `err` set if the name is invalid or a recording is running.
+  bool start(const std::string& name, std::string* err);
+  // Writes out what is queued, closes the file and returns. No-op when not recording.
+  void stop();
+  RecordingStatus status() const;
+
+  // Send thread only.
+  void tap(const OutFrame& frame) {
+    const uint64_t session = session_.load(std::memory_order_acquire);
+    if (session == 0) return;
+    tap_slow(session, frame);
+  }
+
+ private:
+  struct Frame {
+    uint64_t session;
+    int64_t unix_ms;
+    uint16_t opus_len;  // 0: the writer encodes `pcm`
+    uint8_t opus[kMaxOpusPacket];
+    PcmFrame pcm;
+  };
+
+  void tap_slow(uint64_t session, const OutFrame& frame);
+  void write_loop(uint64_t session, std::string name);
+
+  const RecorderConfig cfg_;
+  const int audio_cpu_;
+
+  // Recording in progress, or 0. Stale frames a stopped recording left in the ring carry its
+  // number and are skipped by the next one.
+  std::atomic<uint64_t> session_{0};
+  // Created by the first start() and kept; the send thread only reaches it through session_.
+  std::unique_ptr<SpscRing<Frame>> ring_;
+  std::atomic<uint64_t> frames_written_{0};
+  std::atomic<uint64_t> frames_dropped_{0};
+
+  // Serializes start() and stop(); owns thread_ and last_session_.
+  std::mutex control_mu_;
+  uint64_t last_session_ = 0;
+  std::thread thread_;
+
+  // Shared with the writer thread.
+  mutable std::mutex mu_;
+  std::condition_variable cv_;
+  bool quit_ = false;
+  std::string path_;
+  std::string error_;
+  uint32_t files_ = 0;
+};
+
+}  // namespace tsbot::voice
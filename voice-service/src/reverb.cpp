@@ -0,0 +1,104 @@
+#include "reverb.h"
+
+#include <algorithm>
+
+namespace tsbot::voice {
+
+namespace {
+
+constexpr float kCombFeedback = 0.78f;
+constexpr float kAllpassFeedback = 0.5f;
+constexpr float kWetGain = 0.28f;
+
+constexpr std::size_t kCombL[2] = {1487, 1601};
+constexpr std::size_t kCombR[2] = {1559, 1699};
+constexpr std::size_t kAllpassL = 556;
+constexpr std::size_t kAllpassR = 579;
+
+// -90 dBFS. Below this a tail is inaudible even at full volume.
+constexpr float kSilence = 3.1623e-5f;
+// Quiet needed before the lines count as empty: what is in a comb comes back out within its
+// delay, and the allpass holds what the combs fed it a little longer.
+constexpr int kQuietFrames = static_cast<int>(std::max(kCombL[1], kCombR[1]) + std::max(kAllpassL, kAllpassR));
+
+std::size_t ring_size(std::size_t n) {
+  std::size_t p = 1;
+  while (p < n) p <<= 1;
+  return p;
+}
+
+}  // namespace
+
+SimpleReverb::DelayLine::DelayLine(std::size_t d) : delay(d), buf(ring_size(d + kBlock), 0.0f), mask(buf.size() - 1) {}
+
+SimpleReverb::Channel::Channel(std::size_t comb0, std::size_t comb1, std::size_t ap)
+    : combs{DelayLine(comb0), DelayLine(comb1)}, allpass(ap) {}
+
+void SimpleReverb::Channel::clear() {
+  for (auto& c : combs) std::fill(c.buf.begin(), c.buf.end(), 0.0f);
+  std::fill(allpass.buf.begin(), allpass.buf.end(), 0.0f);
+}
+
+SimpleReverb::SimpleReverb(const DspKernels& k)
+    : k_(k), l_(kCombL[0], kCombL[1], kAllpassL), r_(kCombR[0], kCombR[1], kAllpassR) {}
+
+void SimpleReverb::reset() {
+  if (!idle_) {
+    l_.clear();
+    r_.clear();
+  }
+  pos_ = 0;
+  idle_ = true;
+  quiet_frames_ = 0;
+}
+
+// `n` samples of one channel from `in` into `wet`. Each kernel call covers a span where none of
+// its ring positions wrap; there are at most a few of those per block.
+void SimpleReverb::run_channel(Channel& c, const float* in, float* wet, int n) {
+  DelayLine& c0 = c.combs[0];
+  DelayLine& c1 = c.combs[1];
+  for (int i = 0; i < n;) {
+    const std::size_t w = pos_ + static_cast<std::size_t>(i);
+    const std::size_t len = std::min({static_cast<std::size_t>(n - i), c0.room(w - c0.delay), c0.room(w),
+                                      c1.room(w - c1.delay), c1.room(w)});
+    k_.comb_pair(in + i, c0.at(w - c0.delay), c0.at(w), c1.at(w - c1.delay), c1.at(w), wet + i, static_cast<int>(len),
+                 kCombFeedback);
+    i += static_cast<int>(len);
+  }
+  DelayLine& ap = c.allpass;
+  for (int i = 0; i < n;) {
+    const std::size_t w = pos_ + static_cast<std::size_t>(i);
+    const std::size_t len = std::min({static_cast<std::size_t>(n - i), ap.room(w - ap.delay), ap.room(w)});
+    k_.allpass(wet + i, ap.at(w - ap.delay), ap.at(w), static_cast<int>(len), kAllpassFeedback);
+    i += static_cast<int>(len);
+  }
+}
+
+void SimpleReverb::process(float* buf, int frames, float mix, float mix_step) {
+  for (int done = 0; done < frames; done += kBlock) {
+    const int n = std::min(kBlock, frames - done);
+    float* b = buf + done * 2;
+    const float in_peak = k_.deinterleave(b, in_l_, in_r_, n);
+    if (idle_) {
+      // Nothing in the lines and nothing coming in: the block passes through as it is.
+      if (in_peak < kSilence) continue;
+      idle_ = false;
+    }
+    run_channel(l_, in_l_, wet_l_, n);
+    run_channel(r_, in_r_, wet_r_, n);
+    pos_ += static_cast<std::size_t>(n);
+    const float m = mix + mix_step * static_cast<float>(done);
+    const float tail = k_.wet_mix(b, wet_l_, wet_r_, n, m, mix_step, kWetGain);
+
+    quiet_frames_ = in_peak < kSilence && tail < kSilence ? quiet_frames_ + n : 0;
+    if (quiet_frames_ >= kQuietFrames) {
+      // Whatever is left in the lines is below -90 dB; drop it rather than keep working it down.
+      l_.clear();
+      r_.clear();
+      idle_ = true;
+      quiet_frames_ = 0;
+    }
+  }
+}
+
+}  // namespace tsbot::voice
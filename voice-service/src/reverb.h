@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include "dsp_kernels.h"
+
+namespace tsbot::voice {
+
+// Port of the Rust engine's SimpleReverb: per channel, two feedback combs into one allpass.
+//
+// Runs a block at a time rather than sample by sample. Every delay is longer than a block, so
+// within one block no sample depends on another of the same block. Each comb and allpass then
+// becomes a straight vector loop over the block (DspKernels). The delay lines are power-of-two
+// rings indexed with a mask.
+//
+// Once the input has been silent long enough for the tail to decay below -90 dB, the lines are
+// cleared and silent blocks pass through after one peak scan, until sound comes in again.
+class SimpleReverb {
+ public:
+  explicit SimpleReverb(const DspKernels& k);
+
+  void reset();
+  // In place on interleaved stereo; `mix` in (0, 1]. A non-zero `mix_step` moves the mix by that
+  // much per L/R pair, for parameter ramps.
+  void process(float* buf, int frames, float mix, float mix_step = 0.0f);
+  // True while the tail has died away and silent input passes through untouched.
+  bool idle() const { return idle_; }
+
+ private:
+  // Frames per pass; shorter than the shortest delay.
+  static constexpr int kBlock = 512;
+
+  struct DelayLine {
+    explicit DelayLine(std::size_t delay);
+    // Write position `pos`; the tap of the same sample is at(pos - delay).
+    float* at(std::size_t pos) { return buf.data() + (pos & mask); }
+    // Samples from `pos` to the end of the ring.
+    std::size_t room(std::size_t pos) const { return buf.size() - (pos & mask); }
+
+    std::size_t delay;
+    std::vector<float> buf;  // power of two, at least delay + kBlock
+    std::size_t mask;
+  };
+  struct Channel {
+    Channel(std::size_t comb0, std::size_t comb1, std::size_t allpass);
+    void clear();
+
+    DelayLine combs[2];
+    DelayLine allpass;
+  };
+
+  void run_channel(Channel& c, const float* in, float* wet, int n);
+
+  const DspKernels& k_;
+  Channel l_;
+  Channel r_;
+  std::size_t pos_ = 0;  // samples written to every line so far
+  bool idle_ = true;
+  int quiet_frames_ = 0;  // silent input and a tail below -90 dB, in a row
+
+  alignas(32) float in_l_[kBlock];
+  alignas(32) float in_r_[kBlock];
+  alignas(32) float wet_l_[kBlock];
+  alignas(32) float wet_r_[kBlock];
+};
+
+}  // namespace tsbot::voice
@@ -0,0 +1,102 @@
+#include "send_clock.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <thread>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#endif
+
+#include "env.h"
+#include "log.h"
+
+namespace tsbot::voice {
+
+int64_t FrameClock::now_ns() {
+#if defined(__linux__)
+  timespec ts{};
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+#else
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+#endif
+}
+
+void FrameClock::reset() { next_ns_ = now_ns(); }
+
+int64_t FrameClock::wait_next() {
+  next_ns_ += period_ns_;
+
+#if defined(__linux__)
+  timespec ts{};
+  ts.tv_sec = static_cast<time_t>(next_ns_ / 1000000000);
+  ts.tv_nsec = static_cast<long>(next_ns_ % 1000000000);
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR) {
+  }
+#else
+  std::this_thread::sleep_until(std::chrono::steady_clock::time_point(std::chrono::nanoseconds(next_ns_)));
+#endif
+
+  const int64_t late = now_ns() - next_ns_;
+  if (late > kMaxCatchUpTicks * period_ns_) next_ns_ = now_ns();
+  return std::max<int64_t>(late, 0);
+}
+
+SendThreadConfig SendThreadConfig::from_env() {
+  SendThreadConfig c;
+  if (auto v = env_int("TSBOT_VOICE_SEND_CPU"); v && *v >= 0) c.cpu = static_cast<int>(*v);
+  if (auto v = env_int("TSBOT_VOICE_SEND_RT_PRIORITY"); v) c.rt_priority = std::clamp(static_cast<int>(*v), 0, 99);
+  return c;
+}
+
+void apply_send_thread_config(const SendThreadConfig& cfg) {
+#if defined(__linux__)
+  pthread_setname_np(pthread_self(), "tsbot-send");
+
+  if (cfg.cpu >= 0) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cfg.cpu, &set);
+    if (const int e = pthread_setaffinity_np(pthread_self(), sizeof(set), &set); e != 0) {
+      log_print("WARN send thread: pin to cpu ", cfg.cpu, " failed: ", std::strerror(e));
+    }
+  }
+
+  if (cfg.rt_priority > 0) {
+    sched_param sp{};
+    sp.sched_priority = cfg.rt_priority;
+    if (const int e = pthread_setschedparam(pthread_self(), SCHED_FIFO, &sp); e != 0) {
+      log_print("WARN send thread: SCHED_FIFO priority ", cfg.rt_priority, " failed: ", std::strerror(e));
+    }
+  }
+#else
+  (void)cfg;
+#endif
+}
+
+void keep_off_audio_cpu(const char* thread_name, int audio_cpu) {
+#if defined(__linux__)
+  if (thread_name) pthread_setname_np(pthread_self(), thread_name);
+  if (audio_cpu < 0) return;
+
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (pthread_getaffinity_np(pthread_self(), sizeof(set), &set) != 0) return;
+  if (!CPU_ISSET(audio_cpu, &set) || CPU_COUNT(&set) <= 1) return;
+  CPU_CLR(audio_cpu, &set);
+  if (const int e = pthread_setaffinity_np(pthread_self(), sizeof(set), &set); e != 0) {
+    log_print("WARN ", thread_name ? thread_name : "thread", ": moving off cpu ", audio_cpu, " failed: ", std::strerror(e));
+  }
+#else
+  (void)thread_name;
+  (void)audio_cpu;
+#endif
+}
+
+}  // namespace tsbot::voice
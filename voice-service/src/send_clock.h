@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+
+namespace tsbot::voice {
+
+// Drift-free 20 ms frame clock. Deadlines are absolute (start + n * frame), so time spent
+// encoding and sending a frame never pushes later ticks back, and sleeping uses
+// clock_nanosleep(TIMER_ABSTIME) on CLOCK_MONOTONIC where available.
+class FrameClock {
+ public:
+  explicit FrameClock(int64_t period_ns) : period_ns_(period_ns) {}
+
+  // Anchors tick 0 at now; call on start and after a pause.
+  void reset();
+
+  // Sleeps until the next deadline and returns how late the wakeup was, in nanoseconds.
+  // If the thread fell more than kMaxCatchUpTicks behind (suspend, long stall), the schedule is
+  // re-anchored instead of bursting the backlog out.
+  int64_t wait_next();
+
+  static int64_t now_ns();
+
+ private:
+  static constexpr int64_t kMaxCatchUpTicks = 5;
+
+  const int64_t period_ns_;
+  int64_t next_ns_ = 0;
+};
+
+// Scheduling knobs for the send thread.
+struct SendThreadConfig {
+  // CPU the send thread pins itself to, or -1 to leave affinity alone (TSBOT_VOICE_SEND_CPU).
+  int cpu = -1;
+  // SCHED_FIFO priority (1..99), or 0 to stay SCHED_OTHER (TSBOT_VOICE_SEND_RT_PRIORITY).
+  // Needs CAP_SYS_NICE or an rtprio rlimit; failure is logged and playback continues.
+  int rt_priority = 0;
+
+  static SendThreadConfig from_env();
+};
+
+// Applies `cfg` (and a thread name) to the calling thread.
+void apply_send_thread_config(const SendThreadConfig& cfg);
+
+// For control-plane threads: sets the thread name (if non-null) and removes `audio_cpu` from the
+// calling thread's affinity mask so it never competes with a pinned send thread. Threads created
+// afterwards inherit the mask. No-op for audio_cpu < 0.
+void keep_off_audio_cpu(const char* thread_name, int audio_cpu);
+
+}  // namespace tsbot::voice
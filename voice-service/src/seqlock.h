@@ -0,0 +1,64 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+namespace tsbot::voice {
+
+// Single-writer sequence lock for a small trivially copyable value.
+//
+// store() publishes a new immutable copy; load() never blocks the writer and never takes a lock,
+// it just retries if it raced with a store. The payload is kept in relaxed atomic words so the
+// concurrent copy is not a data race. Writers must be serialized by the caller.
+template <typename T>
+class SeqLock {
+  static_assert(std::is_trivially_copyable_v<T>, "SeqLock payload must be trivially copyable");
+
+ public:
+  explicit SeqLock(const T& initial = T{}) { write_words(initial); }
+
+  SeqLock(const SeqLock&) = delete;
+  SeqLock& operator=(const SeqLock&) = delete;
+
+  void store(const T& v) {
+    const uint32_t seq = seq_.load(std::memory_order_relaxed);
+    seq_.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    write_words(v);
+    seq_.store(seq + 2, std::memory_order_release);
+  }
+
+  T load() const {
+    uint64_t buf[kWords];
+    for (;;) {
+      const uint32_t before = seq_.load(std::memory_order_acquire);
+      if (before & 1) continue;
+      for (std::size_t i = 0; i < kWords; ++i) buf[i] = words_[i].load(std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (seq_.load(std::memory_order_relaxed) == before) break;
+    }
+    T out;
+    std::memcpy(&out, buf, sizeof(T));
+    return out;
+  }
+
+  // Even, and bumped by every store(). Lets a reader skip load() when nothing changed.
+  uint32_t version() const { return seq_.load(std::memory_order_acquire) & ~uint32_t{1}; }
+
+ private:
+  static constexpr std::size_t kWords = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+  void write_words(const T& v) {
+    uint64_t buf[kWords] = {};
+    std::memcpy(buf, &v, sizeof(T));
+    for (std::size_t i = 0; i < kWords; ++i) words_[i].store(buf[i], std::memory_order_relaxed);
+  }
+
+  std::atomic<uint32_t> seq_{0};
+  std::atomic<uint64_t> words_[kWords];
+};
+
+}  // namespace tsbot::voice
@@ -0,0 +1,268 @@
+#include "serverquery.h"
+
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <vector>
+
+#include "env.h"
+
+namespace tsbot::voice {
+
+namespace {
+
+constexpr int kConnectTimeoutMs = 5000;
+constexpr int kReadTimeoutMs = 5000;
+constexpr int kGreetingTimeoutMs = 2000;
+
+std::string trim_colon(std::string s) {
+  while (!s.empty() && s.front() == ':') s.erase(s.begin());
+  return s;
+}
+
+class QueryConnection {
+ public:
+  QueryConnection() = default;
+  ~QueryConnection() {
+    if (fd_ >= 0) ::close(fd_);
+  }
+  QueryConnection(const QueryConnection&) = delete;
+  QueryConnection& operator=(const QueryConnection&) = delete;
+
+  bool connect(const std::string& host, const std::string& port, std::string* err) {
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* res = nullptr;
+    if (const int rc = ::getaddrinfo(host.c_str(), port.c_str(), &hints, &res); rc != 0) {
+      *err = std::string("resolve failed: ") + ::gai_strerror(rc);
+      return false;
+    }
+    *err = "connect failed";
+    for (addrinfo* ai = res; ai; ai = ai->ai_next) {
+      const int fd = ::socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+      if (fd < 0) continue;
+      if (connect_with_timeout(fd, ai, err)) {
+        fd_ = fd;
+        break;
+      }
+      ::close(fd);
+    }
+    ::freeaddrinfo(res);
+    return fd_ >= 0;
+  }
+
+  // Reads one line without the trailing CR/LF. False on timeout, EOF or error.
+  bool read_line(std::string* line, int timeout_ms, std::string* err) {
+    for (;;) {
+      if (const auto nl = buf_.find('\n'); nl != std::string::npos) {
+        *line = buf_.substr(0, nl);
+        buf_.erase(0, nl + 1);
+        while (!line->empty() && (line->back() == '\r' || line->back() == '\n')) line->pop_back();
+        return true;
+      }
+      pollfd p{fd_, POLLIN, 0};
+      const int rc = ::poll(&p, 1, timeout_ms);
+      if (rc == 0) {
+        *err = "read timeout";
+        return false;
+      }
+      if (rc < 0) {
+        if (errno == EINTR) continue;
+        *err = std::strerror(errno);
+        return false;
+      }
+      char chunk[1024];
+      const ssize_t n = ::recv(fd_, chunk, sizeof(chunk), 0);
+      if (n == 0) {
+        *err = "server closed connection";
+        return false;
+      }
+      if (n < 0) {
+        if (errno == EINTR || errno == EAGAIN) continue;
+        *err = std::strerror(errno);
+        return false;
+      }
+      buf_.append(chunk, static_cast<std::size_t>(n));
+    }
+  }
+
+  // Sends `cmd` and collects response lines up to the terminating "error id=..." line.
+  bool exec(const std::string& cmd, std::vector<std::string>* out, std::string* err) {
+    const std::string wire = cmd + "\n";
+    std::size_t off = 0;
+    while (off < wire.size()) {
+      const ssize_t n = ::send(fd_, wire.data() + off, wire.size() - off, MSG_NOSIGNAL);
+      if (n < 0) {
+        if (errno == EINTR) continue;
+        *err = std::strerror(errno);
+        return false;
+      }
+      off += static_cast<std::size_t>(n);
+    }
+
+    std::string line;
+    for (;;) {
+      if (!read_line(&line, kReadTimeoutMs, err)) return false;
+      if (line.empty()) continue;
+      if (line.rfind("error", 0) == 0) {
+        long id = -1;
+        std::string msg;
+        parse_error_line(line, &id, &msg);
+        if (id == 0) return true;
+        *err = "error id=" + std::to_string(id) + " msg=" + msg;
+        return false;
+      }
+      if (out) out->push_back(line);
+    }
+  }
+
+ private:
+  static bool connect_with_timeout(int fd, const addrinfo* ai, std::string* err) {
+    const int flags = ::fcntl(fd, F_GETFL, 0);
+    ::fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+    int rc = ::connect(fd, ai->ai_addr, ai->ai_addrlen);
+    if (rc < 0 && errno == EINPROGRESS) {
+      pollfd p{fd, POLLOUT, 0};
+      rc = ::poll(&p, 1, kConnectTimeoutMs);
+      if (rc == 0) {
+        *err = "connect timeout";
+        return false;
+      }
+      int so_err = 0;
+      socklen_t len = sizeof(so_err);
+      ::getsockopt(fd, SOL_SOCKET, SO_ERROR, &so_err, &len);
+      if (rc < 0 || so_err != 0) {
+        *err = std::strerror(rc < 0 ? errno : so_err);
+        return false;
+      }
+    } else if (rc < 0) {
+      *err = std::strerror(errno);
+      return false;
+    }
+    ::fcntl(fd, F_SETFL, flags);
+    return true;
+  }
+
+  static void parse_error_line(const std::string& line, long* id, std::string* msg) {
+    std::size_t pos = 0;
+    while (pos < line.size()) {
+      const std::size_t end = std::min(line.find(' ', pos), line.size());
+      const std::string token = line.substr(pos, end - pos);
+      if (const auto eq = token.find('='); eq != std::string::npos) {
+        const std::string key = token.substr(0, eq);
+        const std::string val = token.substr(eq + 1);
+        if (key == "id") {
+          try {
+            *id = std::stol(val);
+          } catch (...) {
+          }
+        } else if (key == "msg") {
+          *msg = val;
+        }
+      }
+      pos = end + 1;
+    }
+  }
+
+  int fd_ = -1;
+  std::string buf_;
+};
+
+std::optional<unsigned long long> first_clid(const std::vector<std::string>& lines) {
+  for (const auto& line : lines) {
+    std::size_t pos = line.find("clid=");
+    while (pos != std::string::npos) {
+      // Only a token start counts, so "cid=" inside another key cannot match.
+      if (pos == 0 || line[pos - 1] == ' ' || line[pos - 1] == '|') {
+        try {
+          return std::stoull(line.substr(pos + 5));
+        } catch (...) {
+        }
+      }
+      pos = line.find("clid=", pos + 1);
+    }
+  }
+  return std::nullopt;
+}
+
+}  // namespace
+
+std::optional<ServerQueryConfig> ServerQueryConfig::from_env() {
+  ServerQueryConfig c;
+  c.user = get_env("TSBOT_TS3_SERVERQUERY_USER");
+  c.password = get_env("TSBOT_TS3_SERVERQUERY_PASSWORD");
+  if (c.user.empty() || c.password.empty()) return std::nullopt;
+
+  c.host = get_env("TSBOT_TS3_SERVERQUERY_HOST", get_env("TSBOT_TS3_HOST", "127.0.0.1"));
+  c.port = trim_colon(get_env("TSBOT_TS3_SERVERQUERY_PORT", "10011"));
+  c.sid = get_env("TSBOT_TS3_SERVERQUERY_SID");
+  std::string use_port = get_env("TSBOT_TS3_SERVERQUERY_USE_PORT");
+  if (use_port.empty()) use_port = get_env("TSBOT_TS3_PORT", "9987");
+  c.use_port = trim_colon(use_port);
+  return c;
+}
+
+std::string ts3_escape_value(const std::string& s) {
+  std::string out;
+  out.reserve(s.size());
+  for (const char ch : s) {
+    switch (ch) {
+      case '\\': out += "\\\\"; break;
+      case ' ': out += "\\s"; break;
+      case '|': out += "\\p"; break;
+      case '/': out += "\\/"; break;
+      case '\n': out += "\\n"; break;
+      case '\r': out += "\\r"; break;
+      case '\t': out += "\\t"; break;
+      default: out += ch; break;
+    }
+  }
+  return out;
+}
+
+bool serverquery_set_client_description(const ServerQueryConfig& cfg, const std::string& nickname,
+                                        const std::string& encoded_desc, std::string* err) {
+  QueryConnection q;
+  if (!q.connect(cfg.host, cfg.port, err)) return false;
+
+  // Greeting banner; its content does not matter.
+  std::string line;
+  std::string ignored;
+  for (int i = 0; i < 3; ++i) {
+    if (!q.read_line(&line, kGreetingTimeoutMs, &ignored)) break;
+  }
+
+  if (!q.exec("login client_login_name=" + ts3_escape_value(cfg.user) +
+                  " client_login_password=" + ts3_escape_value(cfg.password),
+              nullptr, err)) {
+    return false;
+  }
+
+  const std::string use_cmd =
+      !cfg.sid.empty() ? "use sid=" + ts3_escape_value(cfg.sid) : "use port=" + ts3_escape_value(cfg.use_port);
+  if (!q.exec(use_cmd, nullptr, err)) return false;
+
+  std::vector<std::string> lines;
+  if (!q.exec("clientfind pattern=" + ts3_escape_value(nickname), &lines, err)) return false;
+  const auto clid = first_clid(lines);
+  if (!clid) {
+    *err = "clientfind returned no clid";
+    return false;
+  }
+
+  if (!q.exec("clientedit clid=" + std::to_string(*clid) + " client_description=" + encoded_desc, nullptr, err)) {
+    return false;
+  }
+
+  q.exec("quit", nullptr, &ignored);
+  return true;
+}
+
+}  // namespace tsbot::voice
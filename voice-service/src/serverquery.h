@@ -0,0 +1,30 @@
+#pragma once
+
+#include <optional>
+#include <string>
+
+namespace tsbot::voice {
+
+// ServerQuery login used to edit the bot's own description (TSBOT_TS3_SERVERQUERY_*).
+struct ServerQueryConfig {
+  std::string host;
+  std::string port;
+  std::string user;
+  std::string password;
+  std::string sid;
+  std::string use_port;
+
+  // Nullopt unless both user and password are set.
+  static std::optional<ServerQueryConfig> from_env();
+};
+
+// TS3 query-protocol escaping for one argument value.
+std::string ts3_escape_value(const std::string& s);
+
+// Connects, logs in, selects the virtual server, finds the client named `nickname` and sets its
+// description. Blocking, with 5 s connect/read timeouts; call it from a background thread.
+// `encoded_desc` must already be escaped. Returns false and sets `err` on failure.
+bool serverquery_set_client_description(const ServerQueryConfig& cfg, const std::string& nickname,
+                                        const std::string& encoded_desc, std::string* err);
+
+}  // namespace tsbot::voice
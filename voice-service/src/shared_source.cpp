@@ -0,0 +1,496 @@
+#include "shared_source.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+#include "alloc_counter.h"
+#include "audio_cache.h"
+#include "decode_pool.h"
+#include "log.h"
+#include "loudness.h"
+#include "opus_decoder.h"
+#include "opus_encoder.h"
+#include "pcm_decoder.h"
+
+namespace tsbot::voice {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// A pool step decodes up to this many frames, and stops early once it has used up its time: a
+// source that decodes slowly must not keep a worker from the others for long.
+constexpr int kStepFrames = 8;
+constexpr auto kStepBudget = std::chrono::milliseconds(4);
+
+// Spare rings kept for upcoming tracks, a few hundred KB each at the default capacity.
+constexpr std::size_t kMaxSpareRings = 8;
+// Recording reserves this much per frame of a track's length up front (about 128 kb/s).
+constexpr std::size_t kRecordReserveBytesPerFrame = 320;
+// The published loudness estimate settles over this many 400 ms blocks (6 s) and then stays put;
+// a recorded track is measured to its end for the cache.
+constexpr uint32_t kEstimateBlocks = 15;
+
+std::size_t round_up_pow2(std::size_t n) {
+  std::size_t c = 1;
+  while (c < n) c <<= 1;
+  return c;
+}
+
+}  // namespace
+
+// Broadcast rings of finished tracks, kept for the next ones. Every source of a registry needs a
+// ring of the same size, so once a few tracks have played, starting one allocates no frame storage
+// and a long-running process does not fragment its heap with a large block per track.
+class FrameRingPool {
+ public:
+  explicit FrameRingPool(std::size_t capacity) : capacity_(capacity) { spare_.reserve(kMaxSpareRings); }
+
+  std::size_t capacity() const { return capacity_; }
+
+  std::unique_ptr<SourceFrame[]> take() {
+    {
+      std::lock_guard<std::mutex> lk(mu_);
+      if (!spare_.empty()) {
+        std::unique_ptr<SourceFrame[]> ring = std::move(spare_.back());
+        spare_.pop_back();
+        return ring;
+      }
+    }
+    return std::unique_ptr<SourceFrame[]>(new SourceFrame[capacity_]);
+  }
+
+  // Stale frames are harmless: a slot is always written before readers can reach it.
+  void give(std::unique_ptr<SourceFrame[]> ring) {
+    std::lock_guard<std::mutex> lk(mu_);
+    if (spare_.size() < kMaxSpareRings) spare_.push_back(std::move(ring));
+  }
+
+ private:
+  const std::size_t capacity_;
+  std::mutex mu_;
+  std::vector<std::unique_ptr<SourceFrame[]>> spare_;
+};
+
+// One decoder and the broadcast ring it fills, run in steps on the DecodePool. Owned jointly by its
+// readers and, while it is running, the pool.
+class SharedSource : public DecodeTask {
+ public:
+  SharedSource(std::string url, std::string cache_key, AudioCache* cache, HttpSession* http, uint64_t start_frame,
+               std::shared_ptr<FrameRingPool> rings)
+      : url_(std::move(url)),
+        cache_key_(std::move(cache_key)),
+        cache_(cache && cache->enabled() && !cache_key_.empty() ? cache : nullptr),
+        http_(http),
+        start_frame_(start_frame),
+        rings_(std::move(rings)),
+        capacity_(rings_->capacity()),
+        mask_(capacity_ - 1),
+        slots_(rings_->take()) {}
+
+  ~SharedSource() override { rings_->give(std::move(slots_)); }
+
+  SharedSource(const SharedSource&) = delete;
+  SharedSource& operator=(const SharedSource&) = delete;
+
+  // Caller holds mu_. Where a new reader would start, or false if it should not join.
+  bool join_position(std::size_t live_join_frames, uint64_t* start) const {
+    if (stop_.load(std::memory_order_acquire)) return false;
+    if (done_.load(std::memory_order_acquire) && !error_.empty()) return false;
+    const uint64_t written = write_seq_.load(std::memory_order_acquire);
+    uint64_t furthest = 0;
+    for (const SourceReader* r : readers_) furthest = std::max(furthest, r->cursor_.load(std::memory_order_acquire));
+    // Frame 0 survives until slot 0 is reused, and joining that far back must leave the readers
+    // ahead enough ring to stay buffered.
+    if (written < capacity_ && furthest <= capacity_ / 2) {
+      *start = 0;
+      return true;
+    }
+    if (!live_.load(std::memory_order_acquire)) return false;
+    *start = std::max(written - std::min<uint64_t>(written, live_join_frames), oldest_readable(written));
+    return true;
+  }
+
+  // Caller holds mu_.
+  void add_reader(SourceReader* r) { readers_.push_back(r); }
+
+  void remove_reader(SourceReader* r) {
+    std::lock_guard<std::mutex> lk(mu_);
+    readers_.erase(std::remove(readers_.begin(), readers_.end(), r), readers_.end());
+    // With its last reader gone the task ends on its next step; a read blocked on the network
+    // returns now.
+    if (readers_.empty()) {
+      stop_.store(true, std::memory_order_release);
+      decoder_.interrupt();
+    }
+  }
+
+  std::size_t readers() const { return readers_.size(); }
+
+  std::size_t park(SourceReader* r, bool parked) {
+    std::lock_guard<std::mutex> lk(mu_);
+    r->parked_ = parked;
+    if (parked) return 0;
+    // The decoder may be filling the slot after the last published one, which reuses the oldest.
+    const uint64_t oldest = oldest_readable(write_seq_.load(std::memory_order_acquire));
+    const uint64_t cursor = r->cursor_.load(std::memory_order_relaxed);
+    if (cursor >= oldest) return 0;
+    r->cursor_.store(oldest, std::memory_order_release);
+    return static_cast<std::size_t>(oldest - cursor);
+  }
+
+  void want_opus() { want_opus_.store(true, std::memory_order_relaxed); }
+
+  std::mutex& mutex() { return mu_; }
+  std::size_t capacity() const { return capacity_; }
+  uint64_t written() const { return write_seq_.load(std::memory_order_acquire); }
+  const SourceFrame& slot(uint64_t seq) const { return slots_[seq & mask_]; }
+  bool done() const { return done_.load(std::memory_order_acquire); }
+  const std::string& error() const { return error_; }
+  int64_t duration_ms() const { return duration_ms_.load(std::memory_order_acquire); }
+  float loudness_lufs() const { return loudness_lufs_.load(std::memory_order_acquire); }
+
+ private:
+  uint64_t oldest_readable(uint64_t written) const { return written + 1 > capacity_ ? written + 1 - capacity_ : 0; }
+
+  // Frames decoded ahead of the reader holding the decoder back. Parked readers only count when
+  // nobody else is reading, so one paused bot cannot stall the rest.
+  uint64_t lead(uint64_t seq) const {
+    std::lock_guard<std::mutex> lk(mu_);
+    uint64_t slowest = UINT64_MAX;
+    uint64_t slowest_parked = UINT64_MAX;
+    for (const SourceReader* r : readers_) {
+      const uint64_t c = r->cursor_.load(std::memory_order_acquire);
+      if (r->parked_) {
+        slowest_parked = std::min(slowest_parked, c);
+      } else {
+        slowest = std::min(slowest, c);
+      }
+    }
+    if (slowest == UINT64_MAX) slowest = slowest_parked;
+    return slowest == UINT64_MAX ? capacity_ : seq - std::min(seq, slowest);
+  }
+
+  // True once every reader holding the decoder back is past the slot `seq` reuses.
+  bool has_room(uint64_t seq) const { return seq < capacity_ || lead(seq) < capacity_; }
+
+  // A full ring is topped up a quarter at a time rather than frame by frame as readers move on.
+  bool below_refill_mark() const { return lead(seq_) <= capacity_ - capacity_ / 4; }
+
+  Step step() override {
+    if (stop_.load(std::memory_order_acquire)) return finish(false);
+    switch (state_) {
+      case State::kStart:
+        return start_step();
+      case State::kOpening:
+        return open_step();
+      case State::kDecoding:
+        return decode_step();
+      case State::kCached:
+        return cached_step();
+    }
+    return finish(false);
+  }
+
+  bool ready() override {
+    if (stop_.load(std::memory_order_acquire)) return true;
+    if (state_ == State::kOpening) return decoder_.input_ready();
+    return below_refill_mark() && (state_ != State::kDecoding || decoder_.input_ready());
+  }
+
+  Step start_step() {
+    if (cache_) {
+      if (auto cached = cache_->open(cache_key_)) {
+        duration_ms_.store(int64_t{cached->frames()} * kFrameMs, std::memory_order_release);
+        if (!opus_.init(&error_)) return finish(false);
+        if (const float lufs = cached->loudness_lufs(); !std::isnan(lufs)) {
+          loudness_lufs_.store(lufs, std::memory_order_release);
+          metering_ = false;
+        }
+        log_print("playback from audio cache source_url=", url_, " key=", cache_key_, " frames=", cached->frames(),
+                  " start_frame=", start_frame_);
+        cached_ = std::move(cached);
+        state_ = State::kCached;
+        return Step::kAgain;
+      }
+    }
+    // The request goes out now, and the task holds no worker until the first bytes are in.
+    decoder_.prefetch(url_, http_);
+    state_ = State::kOpening;
+    return decoder_.input_ready() ? Step::kAgain : Step::kWait;
+  }
+
+  Step open_step() {
+    std::string err;
+    // Only an Opus reader makes the packets worth keeping: passthrough leaves the pre-skip in the PCM.
+    if (!decoder_.open(url_, http_, want_opus_.load(std::memory_order_relaxed), &err)) {
+      error_ = err;
+      return finish(false);
+    }
+    live_.store(decoder_.live(), std::memory_order_release);
+    duration_ms_.store(decoder_.duration_ms(), std::memory_order_release);
+    if (decoder_.opus_passthrough()) log_print("opus source packets pass through source_url=", url_);
+    if (start_frame_ > 0 && !decoder_.seek(static_cast<int64_t>(start_frame_) * kFrameMs, &err)) {
+      error_ = err;
+      return finish(false);
+    }
+    // Recording needs a packet for every frame from the first one on.
+    recording_ = cache_ && !decoder_.live() && start_frame_ == 0;
+    if (recording_) {
+      want_opus_.store(true, std::memory_order_relaxed);
+      // Sized from the track length once, instead of growing packet by packet while it plays.
+      const auto frames = static_cast<std::size_t>(decoder_.duration_ms() / kFrameMs) + 1;
+      log_.data.reserve(std::min<uint64_t>(frames * kRecordReserveBytesPerFrame, cache_->max_track_bytes()));
+      log_.ends.reserve(frames);
+    }
+    state_ = State::kDecoding;
+    return Step::kAgain;
+  }
+
+  Step decode_step() {
+    const auto deadline = Clock::now() + kStepBudget;
+    for (int n = 0; n < kStepFrames && Clock::now() < deadline; ++n) {
+      // Ring full, or the next frame would wait on the network: give the worker back.
+      if (!has_room(seq_) || !decoder_.input_ready()) return Step::kWait;
+      SourceFrame& slot = slots_[seq_ & mask_];
+      const uint64_t allocs = thread_allocations();
+      const auto t0 = Clock::now();
+      const auto r = decoder_.read_frame(slot.pcm.data());
+      slot.decode_us =
+          static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - t0).count());
+      if (r != PcmDecoder::ReadResult::kOk) {
+        if (r == PcmDecoder::ReadResult::kError) error_ = decoder_.last_error();
+        return finish(r == PcmDecoder::ReadResult::kEof);
+      }
+      measure(slot.pcm.data());
+      slot.opus_len = 0;
+      if (want_opus_.load(std::memory_order_relaxed)) {
+        // An Opus source's own packet is the frame already encoded; only the rest is re-encoded.
+        std::size_t len = 0;
+        if (const uint8_t* packet = decoder_.opus_packet(&len)) {
+          std::memcpy(slot.opus.data(), packet, len);
+          slot.opus_len = static_cast<uint16_t>(len);
+          ++passthrough_frames_;
+        } else {
+          encode(slot);
+        }
+      }
+      slot.decode_allocs = static_cast<uint32_t>(thread_allocations() - allocs);
+      if (recording_) {
+        if (slot.opus_len == 0 || log_.data.size() + slot.opus_len > cache_->max_track_bytes()) {
+          recording_ = false;
+          log_ = PacketLog{};
+        } else {
+          log_.add(slot.opus.data(), slot.opus_len);
+        }
+      }
+      write_seq_.store(++seq_, std::memory_order_release);
+    }
+    return Step::kAgain;
+  }
+
+  // Feeds the ring from a cached track: no network and no demux or resample. Packets are decoded
+  // to PCM for the FX chain and PCM sinks and passed on as they are for Opus sinks.
+  Step cached_step() {
+    // The frame index makes a seek a lookup: ring frame `seq` is track frame start_frame_ + seq.
+    const uint64_t frames = cached_->frames() > start_frame_ ? cached_->frames() - start_frame_ : 0;
+    const auto deadline = Clock::now() + kStepBudget;
+    for (int n = 0; n < kStepFrames && Clock::now() < deadline; ++n) {
+      if (seq_ >= frames) return finish(true);
+      if (!has_room(seq_)) return Step::kWait;
+      SourceFrame& slot = slots_[seq_ & mask_];
+      std::size_t len = 0;
+      const uint8_t* packet = cached_->packet(static_cast<uint32_t>(start_frame_ + seq_), &len);
+      const auto t0 = Clock::now();
+      if (len == 0 || len > kMaxOpusPacket || !opus_.decode(packet, len, slot.pcm.data())) {
+        error_ = "corrupt audio cache entry at frame " + std::to_string(start_frame_ + seq_);
+        return finish(false);
+      }
+      slot.decode_us =
+          static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - t0).count());
+      measure(slot.pcm.data());
+      std::memcpy(slot.opus.data(), packet, len);
+      slot.opus_len = static_cast<uint16_t>(len);
+      slot.decode_allocs = 0;
+      write_seq_.store(++seq_, std::memory_order_release);
+    }
+    return Step::kAgain;
+  }
+
+  // Publishes the end of the track. Only a track decoded to its end goes into the cache; a stopped
+  // or failed one would replay cut.
+  Step finish(bool eof) {
+    if (passthrough_frames_ > 0) {
+      log_print("opus passthrough source_url=", url_, " frames=", passthrough_frames_, " of ", seq_);
+    }
+    if (recording_ && eof) {
+      log_.loudness_lufs = meter_.integrated_lufs();
+      cache_->store(cache_key_, log_);
+    }
+    recording_ = false;
+    log_ = PacketLog{};
+    decoder_.close();
+    cached_.reset();
+    done_.store(true, std::memory_order_release);
+    return Step::kDone;
+  }
+
+  // Feeds the loudness meter a decoded frame, publishing the estimate while it settles.
+  void measure(const int16_t* pcm) {
+    if (!metering_ || !meter_.add(pcm)) return;
+    if (meter_.blocks() <= kEstimateBlocks) {
+      loudness_lufs_.store(meter_.integrated_lufs(), std::memory_order_release);
+    } else if (!recording_) {
+      metering_ = false;
+    }
+  }
+
+  void encode(SourceFrame& slot) {
+    if (!encoder_.ready()) {
+      std::string err;
+      if (!encoder_.init(&err)) {
+        log_print("WARN shared opus encoder disabled source_url=", url_, ": ", err);
+        want_opus_.store(false, std::memory_order_relaxed);
+        return;
+      }
+    }
+    constexpr float kScale = 1.0f / 32768.0f;
+    for (int i = 0; i < kFrameSamples; ++i) f32_[i] = static_cast<float>(slot.pcm[i]) * kScale;
+    const int len = encoder_.encode(f32_.data(), slot.opus.data());
+    slot.opus_len = len > 0 ? static_cast<uint16_t>(len) : 0;
+  }
+
+  const std::string url_;
+  const std::string cache_key_;
+  AudioCache* const cache_;  // null when this track is not cached
+  HttpSession* const http_;
+  const uint64_t start_frame_;
+  const std::shared_ptr<FrameRingPool> rings_;
+  const std::size_t capacity_;
+  const std::size_t mask_;
+  std::unique_ptr<SourceFrame[]> slots_;
+
+  // Decoder state, touched only by the step that is running.
+  enum class State { kStart, kOpening, kDecoding, kCached };
+  State state_ = State::kStart;
+  PcmDecoder decoder_;
+  OpusFrameEncoder encoder_;
+  std::array<float, kFrameSamples> f32_{};
+  std::shared_ptr<const CachedTrack> cached_;
+  OpusFrameDecoder opus_;  // for cached_
+  uint64_t seq_ = 0;
+  uint64_t passthrough_frames_ = 0;
+  bool recording_ = false;
+  PacketLog log_;
+  bool metering_ = true;
+  LoudnessMeter meter_;
+
+  // Frames published so far; slot `seq & mask_` holds frame `seq`.
+  std::atomic<uint64_t> write_seq_{0};
+  // Written by the decoder step before done_ is released.
+  std::string error_;
+  std::atomic<bool> done_{false};
+  std::atomic<bool> live_{false};
+  std::atomic<int64_t> duration_ms_{0};
+  std::atomic<float> loudness_lufs_{std::numeric_limits<float>::quiet_NaN()};
+  std::atomic<bool> want_opus_{false};
+  std::atomic<bool> stop_{false};
+
+  mutable std::mutex mu_;
+  std::vector<SourceReader*> readers_;
+};
+
+SourceReader::SourceReader(std::shared_ptr<SharedSource> src, uint64_t start, bool shared)
+    : src_(std::move(src)), cursor_(start), shared_(shared) {}
+
+SourceReader::~SourceReader() { src_->remove_reader(this); }
+
+std::size_t SourceReader::capacity() const { return src_->capacity(); }
+
+std::size_t SourceReader::size() const {
+  const uint64_t written = src_->written();
+  const uint64_t cursor = cursor_.load(std::memory_order_relaxed);
+  return written > cursor ? static_cast<std::size_t>(written - cursor) : 0;
+}
+
+const SourceFrame* SourceReader::begin_read() {
+  const uint64_t cursor = cursor_.load(std::memory_order_relaxed);
+  if (cursor >= src_->written()) return nullptr;
+  return &src_->slot(cursor);
+}
+
+void SourceReader::commit_read() {
+  cursor_.store(cursor_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+bool SourceReader::decoder_done() const { return src_->done(); }
+
+const std::string& SourceReader::decode_error() const { return src_->error(); }
+
+int64_t SourceReader::duration_ms() const { return src_->duration_ms(); }
+
+float SourceReader::loudness_lufs() const { return src_->loudness_lufs(); }
+
+std::size_t SourceReader::park(bool parked) {
+  if (parked == parked_) return 0;
+  return src_->park(this, parked);
+}
+
+SourceRegistry::SourceRegistry(std::size_t ring_capacity, std::size_t live_join_frames, AudioCache* cache,
+                               HttpSession* http, DecodePool* pool)
+    : ring_capacity_(ring_capacity),
+      live_join_frames_(live_join_frames),
+      rings_(std::make_shared<FrameRingPool>(round_up_pow2(ring_capacity))),
+      cache_(cache),
+      http_(http),
+      own_pool_(pool ? nullptr : std::make_unique<DecodePool>(DecodePoolConfig{})),
+      pool_(pool ? pool : own_pool_.get()) {}
+
+SourceRegistry::~SourceRegistry() = default;
+
+std::unique_ptr<SourceReader> SourceRegistry::open(const std::string& url, const std::string& cache_key,
+                                                   bool shareable, bool want_opus, uint64_t start_frame) {
+  // The cache key names the track even when its signed URL differs between requests.
+  const std::string& key = cache_key.empty() ? url : cache_key;
+  // Others could only join a seeked decoder mid-track.
+  if (start_frame > 0) shareable = false;
+  std::lock_guard<std::mutex> lk(mu_);
+  for (auto it = by_key_.begin(); it != by_key_.end();) {
+    it = it->second.expired() ? by_key_.erase(it) : std::next(it);
+  }
+
+  if (shareable) {
+    if (auto it = by_key_.find(key); it != by_key_.end()) {
+      if (std::shared_ptr<SharedSource> src = it->second.lock()) {
+        std::unique_lock<std::mutex> src_lk(src->mutex());
+        uint64_t start = 0;
+        if (src->join_position(live_join_frames_, &start)) {
+          std::unique_ptr<SourceReader> r(new SourceReader(src, start, true));
+          src->add_reader(r.get());
+          const std::size_t readers = src->readers();
+          src_lk.unlock();
+          if (want_opus) src->want_opus();
+          log_print("playback sharing decoder source_url=", url, " readers=", readers, " start_frame=", start);
+          return r;
+        }
+      }
+    }
+  }
+
+  auto src = std::make_shared<SharedSource>(url, cache_key, cache_, http_, start_frame, rings_);
+  std::unique_ptr<SourceReader> r(new SourceReader(src, 0, false));
+  {
+    std::lock_guard<std::mutex> src_lk(src->mutex());
+    src->add_reader(r.get());
+  }
+  if (want_opus) src->want_opus();
+  pool_->submit(src);
+  if (shareable) by_key_[key] = src;
+  return r;
+}
+
+}  // namespace tsbot::voice
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "audio_format.h"
+
+namespace tsbot::voice {
+
+// One decoded 20 ms frame in a source's broadcast ring.
+struct SourceFrame {
+  PcmFrame pcm;
+  uint32_t decode_us = 0;      // time the decoder spent producing it
+  uint32_t decode_allocs = 0;  // operator new calls while producing it (see alloc_counter.h)
+  // `pcm` encoded by the source's own Opus encoder, for readers whose FX chain is transparent.
+  // 0 for frames decoded before any reader asked for packets.
+  uint16_t opus_len = 0;
+  std::array<uint8_t, kMaxOpusPacket> opus;
+};
+
+class AudioCache;
+class DecodePool;
+class FrameRingPool;
+class HttpSession;
+class SharedSource;
+
+// One consumer's position in a SharedSource: a broadcast ring the source's decoder fills and every
+// reader walks at its own offset. The decoder overwrites a slot only once every reader that
+// holds it back has moved past, so frames are read in place without copying.
+//
+// Everything except the destructor is for the thread that consumes the frames (the send thread).
+class SourceReader {
+ public:
+  ~SourceReader();
+  SourceReader(const SourceReader&) = delete;
+  SourceReader& operator=(const SourceReader&) = delete;
+
+  std::size_t capacity() const;
+  // Frames decoded but not yet read by this reader.
+  std::size_t size() const;
+  bool empty() const { return size() == 0; }
+  // Oldest unread frame, or nullptr when this reader has caught up with the decoder.
+  const SourceFrame* begin_read();
+  void commit_read();
+
+  bool decoder_done() const;
+  // No frame left and the decoder will not produce another.
+  bool drained() const { return decoder_done() && empty(); }
+  // Why the decoder stopped early; empty on a clean EOF. Valid once decoder_done().
+  const std::string& decode_error() const;
+  // Length of the whole track once the source is open; 0 for live streams and until then. Safe
+  // from any thread.
+  int64_t duration_ms() const;
+  // Integrated loudness of the track in LUFS: from the audio cache, else estimated from what the
+  // decoder has produced and refined every 400 ms over the first seconds (see LoudnessMeter). NaN
+  // until there is one. Safe from any thread.
+  float loudness_lufs() const;
+
+  // A parked reader (a paused track) stops holding the decoder back while other readers are still
+  // playing; on unpark it skips ahead if the ring has moved past it. Returns the frames skipped.
+  std::size_t park(bool parked);
+
+  // True when this reader joined a decoder another track had already started.
+  bool shared() const { return shared_; }
+
+ private:
+  friend class SharedSource;
+  friend class SourceRegistry;
+
+  SourceReader(std::shared_ptr<SharedSource> src, uint64_t start, bool shared);
+
+  std::shared_ptr<SharedSource> src_;
+  // Send thread writes; the decoder reads it to find the slowest reader.
+  std::atomic<uint64_t> cursor_;
+  bool shared_;
+  bool parked_ = false;  // guarded by the source's mutex
+};
+
+// Decoders by track (cache key, else source URL), so several engines (bots) playing the same
+// track or stream decode it once. A new reader joins a running decoder while the track's first
+// frame is still in the ring and no reader is more than half a ring past it, so it hears the track
+// from the start; or anywhere in a live stream, starting `live_join_frames` behind the newest
+// frame. Otherwise it gets a decoder of its own. A decoder stops when its last reader goes away.
+//
+// With an AudioCache, a track that has a cache key is streamed from its cached Opus packets when
+// present, and otherwise recorded into the cache as it is decoded.
+//
+// http(s) sources are fetched through `http` when it is given and enabled (see HttpStream).
+//
+// Decoders run on `pool`, shared by every registry given it; null gives the registry its own.
+//
+// Thread-safe; open() and reader destruction run on control threads.
+class SourceRegistry {
+ public:
+  // `cache`, `http` and `pool` may be null; they must outlive every reader, and `cache` and `http`
+  // the pool too.
+  SourceRegistry(std::size_t ring_capacity, std::size_t live_join_frames, AudioCache* cache = nullptr,
+                 HttpSession* http = nullptr, DecodePool* pool = nullptr);
+  ~SourceRegistry();
+  SourceRegistry(const SourceRegistry&) = delete;
+  SourceRegistry& operator=(const SourceRegistry&) = delete;
+
+  // `cache_key` is a stable id for the track behind `url` (empty: none). `shareable` false always
+  // starts a private decoder that nobody else can join. `want_opus` asks the decoder to also encode
+  // every frame (see SourceFrame::opus). A non-zero `start_frame` starts a private decoder at that
+  // frame of the track: an index lookup for a cached track, a decoder seek otherwise.
+  std::unique_ptr<SourceReader> open(const std::string& url, const std::string& cache_key, bool shareable,
+                                     bool want_opus, uint64_t start_frame = 0);
+
+ private:
+  const std::size_t ring_capacity_;
+  const std::size_t live_join_frames_;
+  // Shared with the sources, which may outlive the registry on the pool.
+  const std::shared_ptr<FrameRingPool> rings_;
+  AudioCache* const cache_;
+  HttpSession* const http_;
+  std::unique_ptr<DecodePool> own_pool_;
+  DecodePool* const pool_;
+  std::mutex mu_;
+  std::unordered_map<std::string, std::weak_ptr<SharedSource>> by_key_;
+};
+
+}  // namespace tsbot::voice
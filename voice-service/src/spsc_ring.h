@@ -0,0 +1,84 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+namespace tsbot::voice {
+
+inline constexpr std::size_t kCacheLine = 64;
+
+// Fixed-capacity single-producer/single-consumer ring of preallocated slots.
+//
+// The producer fills a slot in place between begin_write() and commit_write(); the consumer reads
+// it in place between begin_read() and commit_read(). No locks, no allocation after construction.
+// Producer and consumer indices (and each side's cached copy of the other's) live on separate
+// cache lines so the two threads never false-share.
+template <typename T>
+class SpscRing {
+ public:
+  // Capacity is rounded up to a power of two so slot lookup is a mask.
+  explicit SpscRing(std::size_t min_capacity)
+      : capacity_(round_up_pow2(min_capacity)), mask_(capacity_ - 1), slots_(new Slot[capacity_]) {}
+
+  SpscRing(const SpscRing&) = delete;
+  SpscRing& operator=(const SpscRing&) = delete;
+
+  std::size_t capacity() const { return capacity_; }
+
+  // Approximate when called from a third thread; exact from either endpoint for its own view.
+  std::size_t size() const {
+    return tail_.load(std::memory_order_acquire) - head_.load(std::memory_order_acquire);
+  }
+  bool empty() const { return size() == 0; }
+
+  // Producer: next free slot, or nullptr when the ring is full.
+  T* begin_write() {
+    const std::size_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail - cached_head_ >= capacity_) {
+      cached_head_ = head_.load(std::memory_order_acquire);
+      if (tail - cached_head_ >= capacity_) return nullptr;
+    }
+    return &slots_[tail & mask_].value;
+  }
+
+  // Producer: publishes the slot returned by begin_write().
+  void commit_write() { tail_.store(tail_.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+  // Consumer: oldest filled slot, or nullptr when the ring is empty.
+  const T* begin_read() {
+    const std::size_t head = head_.load(std::memory_order_relaxed);
+    if (head == cached_tail_) {
+      cached_tail_ = tail_.load(std::memory_order_acquire);
+      if (head == cached_tail_) return nullptr;
+    }
+    return &slots_[head & mask_].value;
+  }
+
+  // Consumer: hands the slot returned by begin_read() back to the producer.
+  void commit_read() { head_.store(head_.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+ private:
+  struct alignas(kCacheLine) Slot {
+    T value;
+  };
+
+  static std::size_t round_up_pow2(std::size_t n) {
+    std::size_t c = 1;
+    while (c < n) c <<= 1;
+    return c;
+  }
+
+  const std::size_t capacity_;
+  const std::size_t mask_;
+  std::unique_ptr<Slot[]> slots_;
+
+  // Consumer-owned.
+  alignas(kCacheLine) std::atomic<std::size_t> head_{0};
+  std::size_t cached_tail_ = 0;
+  // Producer-owned.
+  alignas(kCacheLine) std::atomic<std::size_t> tail_{0};
+  std::size_t cached_head_ = 0;
+};
+
+}  // namespace tsbot::voice
@@ -0,0 +1,159 @@
+#include "status_page.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <new>
+
+#include "send_clock.h"
+
+namespace tsbot::voice {
+
+namespace {
+
+constexpr auto kRefreshInterval = std::chrono::milliseconds(50);
+constexpr char kMagic[8] = {'T', 'S', 'B', 'S', 'T', 'A', 'T', '1'};
+
+static_assert(sizeof(SeqLock<StatusPageEntry>) == 8 + sizeof(StatusPageEntry), "slot layout is part of the format");
+
+int64_t unix_ms_now() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+uint32_t to_page_state(PlaybackState s) {
+  switch (s) {
+    case PlaybackState::kPlaying:
+      return 2;
+    case PlaybackState::kPaused:
+      return 3;
+    case PlaybackState::kIdle:
+      break;
+  }
+  return 1;
+}
+
+// Copies at most `cap - 1` bytes of `s`, backing off so no UTF-8 sequence is cut, and NUL-pads.
+void copy_utf8(char* dst, std::size_t cap, const std::string& s) {
+  std::size_t n = std::min(s.size(), cap - 1);
+  if (n < s.size()) {
+    while (n > 0 && (static_cast<unsigned char>(s[n]) & 0xC0) == 0x80) --n;
+  }
+  std::memset(dst, 0, cap);
+  std::memcpy(dst, s.data(), n);
+}
+
+}  // namespace
+
+bool StatusPage::start(const std::string& path, std::string* err) {
+  if (sources_.empty()) {
+    *err = "no bots";
+    return false;
+  }
+  const std::size_t header_bytes = (sizeof(StatusPageHeader) + alignof(Slot) - 1) / alignof(Slot) * alignof(Slot);
+  map_bytes_ = header_bytes + sizeof(Slot) * sources_.size();
+
+  const std::string tmp = path + ".tmp";
+  const int fd = ::open(tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    *err = tmp + ": " + std::strerror(errno);
+    return false;
+  }
+  if (::ftruncate(fd, static_cast<off_t>(map_bytes_)) != 0) {
+    *err = std::strerror(errno);
+    ::close(fd);
+    ::unlink(tmp.c_str());
+    return false;
+  }
+  void* map = ::mmap(nullptr, map_bytes_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (map == MAP_FAILED) {
+    *err = std::strerror(errno);
+    ::unlink(tmp.c_str());
+    return false;
+  }
+  map_ = map;
+
+  auto* header = static_cast<StatusPageHeader*>(map_);
+  std::memcpy(header->magic, kMagic, sizeof(kMagic));
+  header->bots = static_cast<uint32_t>(sources_.size());
+  header->slot_bytes = static_cast<uint32_t>(sizeof(Slot));
+  header->header_bytes = static_cast<uint32_t>(header_bytes);
+  header->reserved = 0;
+  slots_ = reinterpret_cast<Slot*>(static_cast<char*>(map_) + header_bytes);
+  tracked_.assign(sources_.size(), {});
+  for (std::size_t i = 0; i < sources_.size(); ++i) {
+    new (&slots_[i]) Slot();
+    refresh(i);
+  }
+
+  if (std::rename(tmp.c_str(), path.c_str()) != 0) {
+    *err = path + ": " + std::strerror(errno);
+    ::munmap(map_, map_bytes_);
+    map_ = nullptr;
+    slots_ = nullptr;
+    ::unlink(tmp.c_str());
+    return false;
+  }
+  thread_ = std::thread([this] { refresh_loop(); });
+  return true;
+}
+
+void StatusPage::stop() {
+  if (thread_.joinable()) {
+    {
+      std::lock_guard<std::mutex> lk(mu_);
+      quit_ = true;
+    }
+    cv_.notify_all();
+    thread_.join();
+  }
+  if (map_) {
+    ::munmap(map_, map_bytes_);
+    map_ = nullptr;
+    slots_ = nullptr;
+  }
+}
+
+void StatusPage::refresh_loop() {
+  keep_off_audio_cpu("tsbot-status", audio_cpu_);
+  auto next = std::chrono::steady_clock::now();
+  std::unique_lock<std::mutex> lk(mu_);
+  while (!quit_) {
+    next += kRefreshInterval;
+    if (cv_.wait_until(lk, next, [this] { return quit_; })) break;
+    lk.unlock();
+    for (std::size_t i = 0; i < sources_.size(); ++i) refresh(i);
+    lk.lock();
+  }
+}
+
+void StatusPage::refresh(std::size_t i) {
+  const PlaybackStatus st = sources_[i].engine->status();
+  Tracked& t = tracked_[i];
+  if (st.track.title != t.title || st.track.source_url != t.source_url) {
+    t.title = st.track.title;
+    t.source_url = st.track.source_url;
+    ++t.changes;
+  }
+
+  StatusPageEntry e{};
+  copy_utf8(e.bot, sizeof(e.bot), sources_[i].bot);
+  e.updated_unix_ms = unix_ms_now();
+  e.state = to_page_state(st.state);
+  e.volume_percent = st.fx.volume_percent;
+  e.position_ms = static_cast<uint32_t>(st.position_ms);
+  e.duration_ms = static_cast<uint32_t>(st.duration_ms);
+  e.online = sources_[i].engine->sink_online() ? 1 : 0;
+  e.track_changes = t.changes;
+  copy_utf8(e.title, sizeof(e.title), st.track.title);
+  slots_[i].store(e);
+}
+
+}  // namespace tsbot::voice
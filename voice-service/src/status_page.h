@@ -0,0 +1,91 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "playback_engine.h"
+#include "seqlock.h"
+
+namespace tsbot::voice {
+
+// One bot's entry on the status page. Fixed layout, little endian, read by other processes.
+struct StatusPageEntry {
+  char bot[32];             // bot id, NUL-padded (truncated if longer)
+  int64_t updated_unix_ms;  // last refresh; a reader treats an entry older than a second or two as dead
+  uint32_t state;           // StatusResponse.State: 1 idle, 2 playing, 3 paused
+  int32_t volume_percent;
+  uint32_t position_ms;
+  uint32_t duration_ms;
+  uint32_t online;         // 1 while the bot's connection can deliver audio
+  uint32_t track_changes;  // bumped whenever the current track changes
+  char title[128];         // UTF-8, NUL-padded, cut at a character boundary
+};
+static_assert(sizeof(StatusPageEntry) == 192);
+
+// Header of the status page file, followed by `bots` slots of `slot_bytes` each. A slot is a
+// SeqLock<StatusPageEntry>: a u32 sequence at offset 0, the entry from offset 8. A reader copies
+// the entry while the sequence is even and unchanged around the copy, and retries otherwise.
+struct StatusPageHeader {
+  char magic[8];  // "TSBSTAT1"
+  uint32_t bots;
+  uint32_t slot_bytes;
+  uint32_t header_bytes;
+  uint32_t reserved;
+};
+static_assert(sizeof(StatusPageHeader) == 24);
+
+struct StatusPageSource {
+  std::string bot;
+  const PlaybackEngine* engine = nullptr;
+};
+
+// Optional shared-memory status page (TSBOT_VOICE_STATUS_PAGE, a file path, best under /dev/shm):
+// state, position and volume of every bot, for a co-located backend to poll without an RPC. A
+// thread of its own, kept off the audio CPU, copies each engine's status() into its slot every
+// 50 ms; nothing on the audio path touches the page.
+//
+// The file is built next to `path` and renamed over it, so a reader mapping an older file sees its
+// entries go stale rather than change layout under it.
+class StatusPage {
+ public:
+  StatusPage(std::vector<StatusPageSource> sources, int audio_cpu)
+      : sources_(std::move(sources)), audio_cpu_(audio_cpu) {}
+  ~StatusPage() { stop(); }
+  StatusPage(const StatusPage&) = delete;
+  StatusPage& operator=(const StatusPage&) = delete;
+
+  bool start(const std::string& path, std::string* err);
+  // Stops refreshing and unmaps the page; the file stays, with entries readers will see as stale.
+  void stop();
+
+ private:
+  using Slot = SeqLock<StatusPageEntry>;
+
+  struct Tracked {
+    std::string title;
+    std::string source_url;
+    uint32_t changes = 0;
+  };
+
+  void refresh_loop();
+  void refresh(std::size_t i);
+
+  const std::vector<StatusPageSource> sources_;
+  const int audio_cpu_;
+  void* map_ = nullptr;
+  std::size_t map_bytes_ = 0;
+  Slot* slots_ = nullptr;
+  std::vector<Tracked> tracked_;  // refresh thread only
+
+  std::mutex mu_;
+  std::condition_variable cv_;
+  bool quit_ = false;
+  std::thread thread_;
+};
+
+}  // namespace tsbot::voice
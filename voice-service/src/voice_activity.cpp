@@ -0,0 +1,207 @@
+#include "voice_activity.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <utility>
+
+#include "audio_format.h"
+#include "env.h"
+#include "send_clock.h"
+
+namespace tsbot::voice {
+
+namespace {
+
+constexpr auto kTick = std::chrono::milliseconds(kFrameMs);
+// Speech needed before talk begins, so a cough or a keyboard click does not duck the bot.
+constexpr uint32_t kOnsetSamples = kSampleRate / 1000 * 2 * kFrameMs;
+constexpr float kSilenceDbfs = -120.0f;
+
+int64_t steady_ms_now() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+float db_to_gain(float db) { return std::pow(10.0f, db / 20.0f); }
+
+}  // namespace
+
+float DuckingConfig::duck_gain() const { return db_to_gain(-depth_db); }
+
+float DuckingConfig::attack_step() const {
+  return db_to_gain(-depth_db * static_cast<float>(kFrameMs) / static_cast<float>(std::max(attack_ms, kFrameMs)));
+}
+
+float DuckingConfig::release_step() const {
+  return db_to_gain(depth_db * static_cast<float>(kFrameMs) / static_cast<float>(std::max(release_ms, kFrameMs)));
+}
+
+DuckingConfig DuckingConfig::from_env() {
+  DuckingConfig c;
+  if (auto v = env_int("TSBOT_VOICE_DUCKING")) c.enabled = *v != 0;
+  if (auto v = env_int("TSBOT_VOICE_DUCK_DB"); v && *v > 0 && *v <= 40) c.depth_db = static_cast<float>(*v);
+  if (auto v = env_int("TSBOT_VOICE_DUCK_ATTACK_MS"); v && *v >= 0 && *v <= 5000) c.attack_ms = static_cast<int>(*v);
+  if (auto v = env_int("TSBOT_VOICE_DUCK_RELEASE_MS"); v && *v >= 0 && *v <= 10000) c.release_ms = static_cast<int>(*v);
+  if (auto v = env_int("TSBOT_VOICE_VAD_THRESHOLD_DBFS"); v && *v >= -90 && *v < 0) {
+    c.vad_threshold_dbfs = static_cast<float>(*v);
+  }
+  if (auto v = env_int("TSBOT_VOICE_VAD_HANGOVER_MS"); v && *v >= 0 && *v <= 5000) c.hangover_ms = static_cast<int>(*v);
+  return c;
+}
+
+VoiceActivity::VoiceActivity(DuckingConfig cfg, int audio_cpu, TalkCallback on_talk, TickCallback on_tick)
+    : cfg_(cfg), audio_cpu_(audio_cpu), on_talk_(std::move(on_talk)), on_tick_(std::move(on_tick)) {}
+
+void VoiceActivity::start() {
+  if (thread_.joinable()) return;
+  // Nothing consumes while the thread is down; what queued up meanwhile is stale.
+  while (ring_.begin_read()) ring_.commit_read();
+  {
+    std::lock_guard<std::mutex> lk(mu_);
+    quit_ = false;
+  }
+  thread_ = std::thread([this] { run(); });
+}
+
+void VoiceActivity::stop() {
+  if (!thread_.joinable()) return;
+  {
+    std::lock_guard<std::mutex> lk(mu_);
+    quit_ = true;
+  }
+  cv_.notify_all();
+  thread_.join();
+  for (auto& [id, c] : clients_) {
+    if (c.talking) end_talk(id, c);
+  }
+  clients_.clear();
+}
+
+void VoiceActivity::talk_status(uint16_t client, bool talking) {
+  std::atomic<uint64_t>& word = status_bits_[client >> 6];
+  const uint64_t bit = uint64_t{1} << (client & 63);
+  if (talking) {
+    word.fetch_or(bit, std::memory_order_relaxed);
+  } else {
+    word.fetch_and(~bit, std::memory_order_relaxed);
+  }
+  push({talking ? Kind::kStatusOn : Kind::kStatusOff, client, 0, 0.0});
+}
+
+void VoiceActivity::voice_data(uint16_t client, const int16_t* samples, int frames, int channels) {
+  if (frames <= 0 || channels <= 0) return;
+  const uint64_t bit = uint64_t{1} << (client & 63);
+  if ((status_bits_[client >> 6].load(std::memory_order_relaxed) & bit) == 0) return;
+  int64_t sum = 0;
+  for (int i = 0; i < frames; ++i) {
+    const int32_t s = samples[i * channels];
+    sum += s * s;
+  }
+  push({Kind::kVoice, client, static_cast<uint32_t>(frames), static_cast<double>(sum)});
+}
+
+void VoiceActivity::reset() {
+  for (auto& word : status_bits_) word.store(0, std::memory_order_relaxed);
+  push({Kind::kReset, 0, 0, 0.0});
+}
+
+void VoiceActivity::push(const Record& r) {
+  // Held for a slot copy only.
+  while (producer_busy_.test_and_set(std::memory_order_acquire)) {
+  }
+  if (Record* slot = ring_.begin_write()) {
+    *slot = r;
+    ring_.commit_write();
+  } else {
+    dropped_.fetch_add(1, std::memory_order_relaxed);
+  }
+  producer_busy_.clear(std::memory_order_release);
+}
+
+void VoiceActivity::run() {
+  keep_off_audio_cpu("tsbot-vad", audio_cpu_);
+  auto next = std::chrono::steady_clock::now();
+  std::unique_lock<std::mutex> lk(mu_);
+  while (!quit_) {
+    next += kTick;
+    if (cv_.wait_until(lk, next, [this] { return quit_; })) break;
+    lk.unlock();
+    if (on_tick_) on_tick_();
+    tick(steady_ms_now());
+    lk.lock();
+    // After a stall, carry on from now rather than catching up in a burst.
+    if (const auto now = std::chrono::steady_clock::now(); now - next > 5 * kTick) next = now;
+  }
+}
+
+void VoiceActivity::tick(int64_t now_ms) {
+  while (const Record* r = ring_.begin_read()) {
+    switch (r->kind) {
+      case Kind::kStatusOn:
+        clients_[r->client].status = true;
+        break;
+      case Kind::kStatusOff:
+        if (const auto it = clients_.find(r->client); it != clients_.end()) {
+          it->second.status = false;
+          if (it->second.talking) end_talk(it->first, it->second);
+        }
+        break;
+      case Kind::kVoice: {
+        Client& c = clients_[r->client];
+        c.sum_sq += r->sum_sq;
+        c.samples += r->samples;
+        break;
+      }
+      case Kind::kReset:
+        for (auto& [id, c] : clients_) {
+          if (c.talking) end_talk(id, c);
+        }
+        clients_.clear();
+        break;
+    }
+    ring_.commit_read();
+  }
+
+  for (auto it = clients_.begin(); it != clients_.end();) {
+    const uint16_t id = it->first;
+    Client& c = it->second;
+    if (c.samples > 0) {
+      const double mean_sq = c.sum_sq / c.samples / (32768.0 * 32768.0);
+      const float level = mean_sq > 0.0 ? static_cast<float>(10.0 * std::log10(mean_sq)) : kSilenceDbfs;
+      if (level >= cfg_.vad_threshold_dbfs) {
+        c.last_speech_ms = now_ms;
+        c.level_dbfs = std::max(c.level_dbfs, level);
+        if (!c.talking) {
+          c.onset_samples += c.samples;
+          if (c.onset_samples >= kOnsetSamples) {
+            c.talking = true;
+            talkers_.fetch_add(1, std::memory_order_relaxed);
+            if (on_talk_) on_talk_(id, true, c.level_dbfs);
+          }
+        }
+      } else if (!c.talking) {
+        c.onset_samples = 0;
+        c.level_dbfs = kSilenceDbfs;
+      }
+      c.sum_sq = 0.0;
+      c.samples = 0;
+    }
+    if (c.talking && now_ms - c.last_speech_ms > cfg_.hangover_ms) end_talk(id, c);
+    if (!c.status && !c.talking) {
+      it = clients_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+void VoiceActivity::end_talk(uint16_t id, Client& c) {
+  c.talking = false;
+  c.onset_samples = 0;
+  talkers_.fetch_sub(1, std::memory_order_relaxed);
+  if (on_talk_) on_talk_(id, false, c.level_dbfs);
+  c.level_dbfs = kSilenceDbfs;
+}
+
+}  // namespace tsbot::voice
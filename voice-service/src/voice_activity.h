@@ -0,0 +1,121 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+#include "spsc_ring.h"
+
+namespace tsbot::voice {
+
+struct DuckingConfig {
+  // Lowers the bot while someone else in its channel talks (TSBOT_VOICE_DUCKING, default off).
+  bool enabled = false;
+  // How far the bot goes down, in dB (TSBOT_VOICE_DUCK_DB).
+  float depth_db = 12.0f;
+  // Time to reach the full depth once talk is detected, and to come back up once it ends
+  // (TSBOT_VOICE_DUCK_ATTACK_MS, TSBOT_VOICE_DUCK_RELEASE_MS).
+  int attack_ms = 100;
+  int release_ms = 600;
+  // A talker's 20 ms counts as speech above this level (TSBOT_VOICE_VAD_THRESHOLD_DBFS) ...
+  float vad_threshold_dbfs = -45.0f;
+  // ... and talk ends after this long without speech (TSBOT_VOICE_VAD_HANGOVER_MS), so the
+  // pauses between words do not pump the bot's volume.
+  int hangover_ms = 400;
+
+  // Linear gain at full depth, and the factor the gain moves by per engine frame.
+  float duck_gain() const;
+  float attack_step() const;
+  float release_step() const;
+
+  static DuckingConfig from_env();
+};
+
+// Voice activity of the other clients in the bot's channel, from the voice the TS3 SDK decodes for
+// playback (onTalkStatusChangeEvent, onEditPlaybackVoiceDataEvent).
+//
+// The SDK callbacks run on its own threads, one of them the playback mixer, and only queue: the
+// voice of a client whose talk status is off is not even looked at, and for the others one pass
+// sums the squared samples into a small record for a preallocated ring. A full ring drops the
+// record. The evaluation thread drains the ring once per 20 ms tick, every talker of the tick in
+// one batch, and decides per client: talk begins after 40 ms above the threshold without a quieter
+// tick in between, and ends after the hangover. anyone_talking() is a cached flag the send thread
+// reads for ducking; each transition is reported to the callback, on the evaluation thread.
+class VoiceActivity {
+ public:
+  // `level_dbfs` is the loudest tick of the onset (talking) or of the whole stretch (not talking).
+  using TalkCallback = std::function<void(uint16_t client, bool talking, float level_dbfs)>;
+  // Run at the start of every tick, before the ring is drained; may be empty.
+  using TickCallback = std::function<void()>;
+
+  VoiceActivity(DuckingConfig cfg, int audio_cpu, TalkCallback on_talk, TickCallback on_tick = {});
+  ~VoiceActivity() { stop(); }
+  VoiceActivity(const VoiceActivity&) = delete;
+  VoiceActivity& operator=(const VoiceActivity&) = delete;
+
+  void start();
+  // Joins the evaluation thread; clients still talking are reported as done.
+  void stop();
+
+  // SDK callbacks, any thread; they never block for longer than another one's push.
+  void talk_status(uint16_t client, bool talking);
+  // `frames` samples per channel, interleaved; only the first channel is measured.
+  void voice_data(uint16_t client, const int16_t* samples, int frames, int channels);
+  // The connection dropped: every client is gone without a status change.
+  void reset();
+
+  bool anyone_talking() const { return talkers_.load(std::memory_order_relaxed) > 0; }
+  // Records lost to a full ring, since start.
+  uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+ private:
+  enum class Kind : uint8_t { kStatusOn, kStatusOff, kVoice, kReset };
+  struct Record {
+    Kind kind;
+    uint16_t client;
+    uint32_t samples;
+    double sum_sq;
+  };
+  struct Client {
+    bool status = false;
+    bool talking = false;
+    uint32_t onset_samples = 0;  // speech so far, while not talking yet
+    int64_t last_speech_ms = 0;
+    float level_dbfs = -120.0f;
+    // This tick's voice, summed over its records.
+    double sum_sq = 0.0;
+    uint32_t samples = 0;
+  };
+
+  void push(const Record& r);
+  void run();
+  void tick(int64_t now_ms);
+  void end_talk(uint16_t id, Client& c);
+
+  const DuckingConfig cfg_;
+  const int audio_cpu_;
+  const TalkCallback on_talk_;
+  const TickCallback on_tick_;
+
+  // Several SDK threads produce into the single-producer ring; the flag takes turns.
+  std::atomic_flag producer_busy_ = ATOMIC_FLAG_INIT;
+  SpscRing<Record> ring_{1024};
+  std::atomic<uint64_t> dropped_{0};
+  // Talk status per client id, so voice_data() can skip clients that are not talking.
+  std::array<std::atomic<uint64_t>, 1024> status_bits_{};
+
+  std::unordered_map<uint16_t, Client> clients_;  // evaluation thread only
+  std::atomic<int> talkers_{0};
+
+  std::mutex mu_;
+  std::condition_variable cv_;
+  bool quit_ = false;
+  std::thread thread_;
+};
+
+}  // namespace tsbot::voice
@@ -0,0 +1,313 @@
+#include "voice_service.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <utility>
+
+#include "log.h"
+
+namespace tsbot::voice {
+
+namespace {
+
+constexpr std::size_t kMaxDescriptionLen = 700;
+// Only keeps the int conversion sane; the engine caps the fade at its PCM ring length.
+constexpr uint32_t kMaxCrossfadeMs = 10000;
+
+grpc::Status reply(v1::CommandResponse* out, bool ok, const char* message) {
+  out->set_ok(ok);
+  out->set_message(message);
+  return grpc::Status::OK;
+}
+
+// CR/LF/TAB become spaces and runs of whitespace collapse to one, as the TS3 description field
+// is single-line.
+std::string compact_whitespace(const std::string& s) {
+  std::string out;
+  out.reserve(s.size());
+  bool pending_space = false;
+  for (const char ch : s) {
+    if (ch == ' ' || ch == '\r' || ch == '\n' || ch == '\t') {
+      pending_space = !out.empty();
+      continue;
+    }
+    if (pending_space) out.push_back(' ');
+    pending_space = false;
+    out.push_back(ch);
+  }
+  return out;
+}
+
+v1::StatusResponse::State to_proto(PlaybackState s) {
+  switch (s) {
+    case PlaybackState::kPlaying:
+      return v1::StatusResponse::STATE_PLAYING;
+    case PlaybackState::kPaused:
+      return v1::StatusResponse::STATE_PAUSED;
+    case PlaybackState::kIdle:
+      break;
+  }
+  return v1::StatusResponse::STATE_IDLE;
+}
+
+}  // namespace
+
+grpc::Status VoiceServiceImpl::Ping(const v1::Empty&, v1::PingResponse* out) {
+  out->set_version("0.1.0");
+  for (const auto& id : bot_ids_) out->add_bots(id);
+  return grpc::Status::OK;
+}
+
+grpc::Status VoiceServiceImpl::Play(const v1::PlayRequest& req, v1::CommandResponse* out) {
+  if (!req.notice().empty()) commands_.send_notice(2, req.notice());
+  engine_.play(TrackInfo{req.source_url(), req.title(), req.cache_key()});
+  return reply(out, true, "accepted");
+}
+
+grpc::Status VoiceServiceImpl::PlayNext(const v1::PlayNextRequest& req, v1::CommandResponse* out) {
+  const int crossfade_ms = static_cast<int>(std::min<uint32_t>(req.crossfade_ms(), kMaxCrossfadeMs));
+  const bool queued = engine_.play_next(TrackInfo{req.source_url(), req.title(), req.cache_key()}, crossfade_ms);
+  return reply(out, true, queued ? "queued" : "accepted");
+}
+
+grpc::Status VoiceServiceImpl::Pause(const v1::Empty&, v1::CommandResponse* out) {
+  engine_.pause();
+  return reply(out, true, "ok");
+}
+
+grpc::Status VoiceServiceImpl::Resume(const v1::Empty&, v1::CommandResponse* out) {
+  engine_.resume();
+  return reply(out, true, "ok");
+}
+
+grpc::Status VoiceServiceImpl::Stop(const v1::Empty&, v1::CommandResponse* out) {
+  engine_.stop();
+  return reply(out, true, "ok");
+}
+
+grpc::Status VoiceServiceImpl::Skip(const v1::Empty&, v1::CommandResponse* out) {
+  engine_.skip();
+  return reply(out, true, "ok");
+}
+
+grpc::Status VoiceServiceImpl::Seek(const v1::SeekRequest& req, v1::CommandResponse* out) {
+  std::string err;
+  if (!engine_.seek(req.position_ms(), &err)) return reply(out, false, err.c_str());
+  return reply(out, true, "ok");
+}
+
+grpc::Status VoiceServiceImpl::SendNotice(const v1::NoticeRequest& req, v1::CommandResponse* out) {
+  if (!req.message().empty() && !commands_.send_notice(req.target_mode(), req.message())) {
+    log_print("WARN notice dropped: command queue full");
+  }
+  return reply(out, true, "ok");
+}
+
+grpc::Status VoiceServiceImpl::SetClientDescription(const v1::SetClientDescriptionRequest& req,
+                                                    v1::CommandResponse* out) {
+  const std::string& desc = req.description();
+  log_print("set client_description requested (len=", desc.size(), ")");
+  if (desc.size() > kMaxDescriptionLen) return reply(out, false, "description too long");
+  if (!commands_.set_description(compact_whitespace(desc))) return reply(out, false, "command queue full");
+  // Applied asynchronously by the connection's command thread; failures are logged there.
+  return reply(out, true, "queued");
+}
+
+grpc::Status VoiceServiceImpl::SetVolume(const v1::SetVolumeRequest& req, v1::CommandResponse* out) {
+  engine_.set_volume_percent(req.volume_percent());
+  return reply(out, true, "ok");
+}
+
+grpc::Status VoiceServiceImpl::GetStatus(const v1::Empty&, v1::StatusResponse* out) {
+  const PlaybackStatus st = engine_.status();
+  out->set_state(to_proto(st.state));
+  out->set_now_playing_title(st.track.title);
+  out->set_now_playing_source_url(st.track.source_url);
+  out->set_volume_percent(st.fx.volume_percent);
+  out->set_position_ms(static_cast<uint32_t>(st.position_ms));
+  out->set_duration_ms(static_cast<uint32_t>(st.duration_ms));
+  return grpc::Status::OK;
+}
+
+grpc::Status VoiceServiceImpl::GetStats(const v1::Empty&, v1::StatsResponse* out) {
+  const auto add_histogram = [out](const char* name, const char* unit, const Histogram& h) {
+    const Histogram::Snapshot snap = h.snapshot();
+    v1::HistogramStats* hs = out->add_histograms();
+    hs->set_name(name);
+    hs->set_unit(unit);
+    hs->set_count(snap.count);
+    hs->set_sum(snap.sum);
+    hs->set_max(snap.max);
+    hs->set_p50(snap.percentile(0.5));
+    hs->set_p90(snap.percentile(0.9));
+    hs->set_p99(snap.percentile(0.99));
+    hs->set_p999(snap.percentile(0.999));
+  };
+  auto* counters = out->mutable_counters();
+  const auto add_counter = [counters](const char* name, uint64_t v) { (*counters)[name] = v; };
+  engine_.stats().for_each_histogram(add_histogram);
+  engine_.stats().for_each_counter(add_counter);
+  if (http_) {
+    http_->for_each_histogram(add_histogram);
+    http_->for_each_counter(add_counter);
+  }
+  return grpc::Status::OK;
+}
+
+grpc::Status VoiceServiceImpl::SetAudioFx(const v1::SetAudioFxRequest& req, v1::CommandResponse* out) {
+  engine_.update_fx([&req](FxSettings& fx) {
+    if (req.has_pan()) fx.pan = req.pan();
+    if (req.has_width()) fx.width = req.width();
+    if (req.has_swap_lr()) fx.swap_lr = req.swap_lr();
+    if (req.has_bass_db()) fx.bass_db = req.bass_db();
+    if (req.has_reverb_mix()) fx.reverb_mix = req.reverb_mix();
+  });
+  return reply(out, true, "ok");
+}
+
+grpc::Status VoiceServiceImpl::GetAudioFx(const v1::Empty&, v1::AudioFxResponse* out) {
+  const FxSettings fx = engine_.fx();
+  out->set_pan(fx.pan);
+  out->set_width(fx.width);
+  out->set_swap_lr(fx.swap_lr);
+  out->set_bass_db(fx.bass_db);
+  out->set_reverb_mix(fx.reverb_mix);
+  return grpc::Status::OK;
+}
+
+grpc::Status VoiceServiceImpl::SetEncoder(const v1::SetEncoderRequest& req, v1::CommandResponse* out) {
+  engine_.update_encoder_policy([&req](EncoderPolicy& p) {
+    if (req.has_adaptive()) p.adaptive = req.adaptive();
+    if (req.has_max_bitrate_kbps()) p.max_bitrate_kbps = static_cast<int>(std::min(req.max_bitrate_kbps(), 510u));
+    if (req.has_min_bitrate_kbps()) p.min_bitrate_kbps = static_cast<int>(std::min(req.min_bitrate_kbps(), 510u));
+    if (req.has_max_complexity()) p.max_complexity = static_cast<int>(std::min(req.max_complexity(), 10u));
+    if (req.has_min_complexity()) p.min_complexity = static_cast<int>(std::min(req.min_complexity(), 10u));
+    if (req.has_fec()) p.fec = req.fec();
+  });
+  return reply(out, true, "ok");
+}
+
+grpc::Status VoiceServiceImpl::GetEncoder(const v1::Empty&, v1::EncoderResponse* out) {
+  const EncoderPolicy p = engine_.encoder_policy();
+  out->set_adaptive(p.adaptive);
+  out->set_max_bitrate_kbps(static_cast<uint32_t>(p.max_bitrate_kbps));
+  out->set_min_bitrate_kbps(static_cast<uint32_t>(p.min_bitrate_kbps));
+  out->set_max_complexity(static_cast<uint32_t>(p.max_complexity));
+  out->set_min_complexity(static_cast<uint32_t>(p.min_complexity));
+  out->set_fec(p.fec);
+
+  const EncoderStatus st = engine_.encoder_status();
+  out->set_encoding(st.encoding);
+  out->set_bitrate_bps(static_cast<uint32_t>(std::max(st.settings.bitrate_bps, 0)));
+  out->set_complexity(static_cast<uint32_t>(st.settings.complexity));
+  out->set_inband_fec(st.settings.inband_fec);
+  out->set_expected_loss_percent(static_cast<uint32_t>(st.settings.packet_loss_perc));
+  out->set_link_known(st.link_known);
+  out->set_packet_loss(st.packet_loss);
+  out->set_ping_ms(st.ping_ms);
+  return grpc::Status::OK;
+}
+
+grpc::Status VoiceServiceImpl::GetSnapshot(const v1::SnapshotRequest& req, v1::SnapshotResponse* out) {
+  fill_snapshot(req, out);
+  return grpc::Status::OK;
+}
+
+grpc::Status VoiceServiceImpl::Batch(const v1::BatchRequest& req, v1::BatchResponse* out) {
+  // Every handler below only takes the engine's control lock, which batch() already holds.
+  engine_.batch([&] {
+    const v1::Empty empty;
+    for (const v1::BatchCommand& c : req.commands()) {
+      v1::CommandResponse* r = out->add_results();
+      switch (c.command_case()) {
+        case v1::BatchCommand::kPlay:
+          // The notice is a text command to the TS3 server, which stays outside batches.
+          if (!c.play().notice().empty()) {
+            reply(r, false, "notice is not allowed in a batch; use SendNotice");
+          } else {
+            Play(c.play(), r);
+          }
+          break;
+        case v1::BatchCommand::kPlayNext:
+          PlayNext(c.play_next(), r);
+          break;
+        case v1::BatchCommand::kPause:
+          Pause(empty, r);
+          break;
+        case v1::BatchCommand::kResume:
+          Resume(empty, r);
+          break;
+        case v1::BatchCommand::kStop:
+          Stop(empty, r);
+          break;
+        case v1::BatchCommand::kSkip:
+          Skip(empty, r);
+          break;
+        case v1::BatchCommand::kSeek:
+          Seek(c.seek(), r);
+          break;
+        case v1::BatchCommand::kSetVolume:
+          SetVolume(c.set_volume(), r);
+          break;
+        case v1::BatchCommand::kSetAudioFx:
+          SetAudioFx(c.set_audio_fx(), r);
+          break;
+        case v1::BatchCommand::kSetEncoder:
+          SetEncoder(c.set_encoder(), r);
+          break;
+        case v1::BatchCommand::COMMAND_NOT_SET:
+          reply(r, false, "empty command");
+          break;
+      }
+    }
+  });
+  fill_snapshot(req.snapshot(), out->mutable_snapshot());
+  return grpc::Status::OK;
+}
+
+grpc::Status VoiceServiceImpl::StartRecording(const v1::StartRecordingRequest& req, v1::RecordingResponse* out) {
+  std::string err;
+  const bool ok = engine_.recorder().start(req.name(), &err);
+  fill_recording(out);
+  out->set_ok(ok);
+  out->set_message(ok ? "ok" : err);
+  return grpc::Status::OK;
+}
+
+grpc::Status VoiceServiceImpl::StopRecording(const v1::Empty&, v1::RecordingResponse* out) {
+  engine_.recorder().stop();
+  const std::string err = fill_recording(out);
+  // Not ok if the writer had given up on a disk error before.
+  out->set_ok(err.empty());
+  out->set_message(err.empty() ? "ok" : err);
+  return grpc::Status::OK;
+}
+
+std::string VoiceServiceImpl::fill_recording(v1::RecordingResponse* out) {
+  RecordingStatus st = engine_.recorder().status();
+  out->set_recording(st.recording);
+  out->set_path(st.path);
+  out->set_frames_written(st.frames_written);
+  out->set_frames_dropped(st.frames_dropped);
+  out->set_files(st.files);
+  return std::move(st.error);
+}
+
+void VoiceServiceImpl::fill_snapshot(const v1::SnapshotRequest& req, v1::SnapshotResponse* out) {
+  const v1::Empty empty;
+  GetStatus(empty, out->mutable_status());
+  GetAudioFx(empty, out->mutable_fx());
+  GetEncoder(empty, out->mutable_encoder());
+  v1::ConnectionStatus* conn = out->mutable_connection();
+  conn->set_online(engine_.sink_online());
+  LinkQuality link;
+  if (engine_.link_quality(&link)) {
+    conn->set_link_known(true);
+    conn->set_packet_loss(static_cast<float>(link.packet_loss));
+    conn->set_ping_ms(link.ping_ms);
+  }
+  if (req.include_stats()) GetStats(empty, out->mutable_stats());
+}
+
+}  // namespace tsbot::voice
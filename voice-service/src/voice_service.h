@@ -0,0 +1,61 @@
+#pragma once
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <grpcpp/grpcpp.h>
+
+#include "client_commands.h"
+#include "http_reader.h"
+#include "playback_engine.h"
+#include "voice.pb.h"
+
+namespace tsbot::voice {
+
+// Request handlers behind the VoiceService RPCs, independent of how calls are dispatched.
+// Every handler is short and non-blocking: playback state lives in the engine's snapshots and
+// TS3 round-trips are queued on ClientCommands, so they can run on any completion-queue thread.
+class VoiceServiceImpl {
+ public:
+  // `bot_ids` is what Ping reports as the process's bots. GetStats adds the process-wide `http`
+  // reader stats (may be null) to the engine's.
+  VoiceServiceImpl(PlaybackEngine& engine, ClientCommands& commands, std::vector<std::string> bot_ids = {},
+                   const HttpStats* http = nullptr)
+      : engine_(engine), commands_(commands), bot_ids_(std::move(bot_ids)), http_(http) {}
+
+  grpc::Status Ping(const v1::Empty& req, v1::PingResponse* out);
+  grpc::Status Play(const v1::PlayRequest& req, v1::CommandResponse* out);
+  grpc::Status PlayNext(const v1::PlayNextRequest& req, v1::CommandResponse* out);
+  grpc::Status Pause(const v1::Empty& req, v1::CommandResponse* out);
+  grpc::Status Resume(const v1::Empty& req, v1::CommandResponse* out);
+  grpc::Status Stop(const v1::Empty& req, v1::CommandResponse* out);
+  grpc::Status Skip(const v1::Empty& req, v1::CommandResponse* out);
+  grpc::Status Seek(const v1::SeekRequest& req, v1::CommandResponse* out);
+  grpc::Status SendNotice(const v1::NoticeRequest& req, v1::CommandResponse* out);
+  grpc::Status SetClientDescription(const v1::SetClientDescriptionRequest& req, v1::CommandResponse* out);
+  grpc::Status SetVolume(const v1::SetVolumeRequest& req, v1::CommandResponse* out);
+  grpc::Status GetStatus(const v1::Empty& req, v1::StatusResponse* out);
+  grpc::Status GetStats(const v1::Empty& req, v1::StatsResponse* out);
+  grpc::Status SetAudioFx(const v1::SetAudioFxRequest& req, v1::CommandResponse* out);
+  grpc::Status GetAudioFx(const v1::Empty& req, v1::AudioFxResponse* out);
+  grpc::Status SetEncoder(const v1::SetEncoderRequest& req, v1::CommandResponse* out);
+  grpc::Status GetEncoder(const v1::Empty& req, v1::EncoderResponse* out);
+  grpc::Status GetSnapshot(const v1::SnapshotRequest& req, v1::SnapshotResponse* out);
+  grpc::Status Batch(const v1::BatchRequest& req, v1::BatchResponse* out);
+  // StopRecording waits for the writer to close its file, a few milliseconds.
+  grpc::Status StartRecording(const v1::StartRecordingRequest& req, v1::RecordingResponse* out);
+  grpc::Status StopRecording(const v1::Empty& req, v1::RecordingResponse* out);
+
+ private:
+  void fill_snapshot(const v1::SnapshotRequest& req, v1::SnapshotResponse* out);
+  // Returns the writer's error, if it stopped on one.
+  std::string fill_recording(v1::RecordingResponse* out);
+
+  PlaybackEngine& engine_;
+  ClientCommands& commands_;
+  const std::vector<std::string> bot_ids_;
+  const HttpStats* const http_;
+};
+
+}  // namespace tsbot::voice
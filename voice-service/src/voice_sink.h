@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace tsbot::voice {
+
+// One 20 ms frame leaving the engine. `pcm` is always set; `opus` only when the sink asked for it.
+struct OutFrame {
+  const int16_t* pcm = nullptr;  // kFrameSamples interleaved s16
+  const uint8_t* opus = nullptr;
+  std::size_t opus_len = 0;
+};
+
+// What a transport knows about its link, for the engine's encoder control.
+struct LinkQuality {
+  double packet_loss = 0.0;  // fraction of voice packets lost, 0 .. 1
+  uint32_t ping_ms = 0;
+};
+
+// Where the engine's send thread delivers audio. Implementations must not block: they run on the
+// 20 ms send clock.
+class VoiceSink {
+ public:
+  virtual ~VoiceSink() = default;
+
+  // True for transports that carry pre-encoded Opus. The TS3 client SDK's custom capture device
+  // takes PCM and encodes with the channel codec itself, so it leaves this false and the engine
+  // skips its own encoder.
+  virtual bool wants_opus() const = 0;
+  virtual void send_frame(const OutFrame& frame) = 0;
+  // Called once after the last frame of a track.
+  virtual void end_of_stream() = 0;
+  // Latest link measurement, or false if the transport has none. Called on the send thread, so it
+  // must only read cached values.
+  virtual bool link_quality(LinkQuality*) const { return false; }
+  // False while the transport cannot deliver at all, e.g. while it reconnects. The engine then
+  // holds the track where it is instead of playing it into the void. Called on the send thread,
+  // so it must only read cached values.
+  virtual bool online() const { return true; }
+  // True while someone else on the transport is talking, for ducking (see VoiceActivity). Called
+  // on the send thread, so it must only read cached values.
+  virtual bool channel_talking() const { return false; }
+};
+
+// Drops everything; used when the service runs without a TS3 connection.
+class NullSink final : public VoiceSink {
+ public:
+  bool wants_opus() const override { return false; }
+  void send_frame(const OutFrame&) override {}
+  void end_of_stream() override {}
+};
+
+}  // namespace tsbot::voice